@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////////////////
+//
+// bench.cpp: Time the transfer calculation, solve and drawing over a
+// range of scene sizes.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "clusters.h"
+#include "defines.h"
+#include "geom.h"
+#include "profile.h"
+#include "progress.h"
+#include "glut_wrap.h"
+#include "lightmap.h"
+#include "quad_buffer.h"
+#include "ray_transfers.h"
+#include "scene.h"
+#include "session.h"
+#include "shaded_scene.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+// Where the viewer puts the camera.
+static Vertex const EYE_POS(0.0, 0.0, -3.0);
+
+// Passes of iterateLighting averaged over.
+static int const LIGHTING_PASSES = 3;
+
+// Shadow rays per source edge for "-methods=ray", as in the viewer.
+static int const RAY_SAMPLES = 2;
+
+// Settings for "-methods=clusters", as in the viewer. The transfers
+// are ray cast, with RAY_SAMPLES.
+static int const CLUSTER_SIZE = 4;
+static double const CLUSTER_NEAR_RATIO = 2.0;
+
+// Settings for "-methods=adaptive", as in the viewer.
+static int const ADAPTIVE_MIN_RESOLUTION = 32;
+static double const ADAPTIVE_TOLERANCE = 0.02;
+
+struct BenchConfig
+{
+    int subdivision;
+    bool innerCube;
+    // "render", "adaptive", "ray" or "clusters".
+    std::string method;
+    // Hemicube resolution (the maximum, if adaptive), or shadow rays
+    // per edge when ray casting.
+    int resolution;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of the process so far, in kB.
+static long peakRSSKB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    // Bytes on Mac OS, kB on Linux.
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Comma-separated integers.
+static std::vector<int> parseInts(std::string const &s)
+{
+    std::vector<int> values;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+static std::vector<std::string> parseNames(std::string const &s)
+{
+    std::vector<std::string> names;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+// Milliseconds per frame, drawing "draw" from the viewer's camera
+// position. Each frame is waited on with glFinish, so this is
+// latency rather than throughput.
+template<typename DrawFn>
+static double timeFrames(int frames, DrawFn draw)
+{
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, 1.0, 1.0, 10.0);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(EYE_POS.x(), EYE_POS.y(), EYE_POS.z(),
+              0.0, 0.0, 0.0,
+              0.0, 1.0, 0.0);
+
+    // The first frame pays for the uploads, so don't count it.
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    draw();
+    glFinish();
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; ++i) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw();
+        glFinish();
+    }
+    return secondsSince(start) * 1000.0 / frames;
+}
+
+// Run a single configuration, and print its results as a line of
+// JSON.
+static void runBench(BenchConfig const &config, int frames)
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> faces;
+    std::vector<SubdivInfo> subdivs;
+    buildCubeScene(config.subdivision, config.innerCube,
+                   vertices, faces, subdivs);
+    RadiositySession session(vertices, faces);
+    lightCubeScene(session);
+
+    TransferMatrix &transfers = session.transfers();
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    // Clustering splits the transfers in two, and needs its own solver.
+    std::unique_ptr<PatchClusters> clusters;
+    TransferMatrix farField;
+    if (config.method == "clusters") {
+        clusters.reset(new PatchClusters(session.vertices(), session.quads(),
+                                         subdivs, CLUSTER_SIZE,
+                                         CLUSTER_NEAR_RATIO));
+        calcClusteredTransfers(session.vertices(), session.quads(), *clusters,
+                               config.resolution, transfers, farField,
+                               progressPrinter(std::cerr));
+    } else if (config.method == "ray") {
+        RayTransferCalculator calc(session.vertices(), session.quads(),
+                                   config.resolution);
+        calc.setProgress(progressPrinter(std::cerr));
+        calc.calcAllLights(transfers);
+    } else {
+        RenderTransferCalculator calc(session.vertices(), session.quads(),
+                                      config.resolution, READBACK_ATLAS);
+        if (config.method == "adaptive") {
+            calc.setAdaptive(ADAPTIVE_MIN_RESOLUTION, ADAPTIVE_TOLERANCE);
+        }
+        calc.setProgress(progressPrinter(std::cerr));
+        calc.calcAllLights(transfers);
+    }
+    double const transfersSeconds = secondsSince(start);
+
+    // The simple serial reference pass, on a copy so the solve
+    // below starts from the same place. With clusters, a pass of
+    // their solver instead.
+    std::vector<Quad> lighting(session.quads());
+    start = std::chrono::steady_clock::now();
+    if (clusters) {
+        ClusteredSolver solver(lighting, session.vertices(), *clusters,
+                               transfers, farField, 1);
+        for (int i = 0; i < LIGHTING_PASSES; ++i) {
+            solver.iterate();
+        }
+    } else {
+        for (int i = 0; i < LIGHTING_PASSES; ++i) {
+            iterateLighting(lighting, transfers);
+        }
+    }
+    double const iterateMS = secondsSince(start) * 1000.0 / LIGHTING_PASSES;
+
+    start = std::chrono::steady_clock::now();
+    int iterations = 0;
+    if (clusters) {
+        ClusteredSolver solver(session.quads(), session.vertices(), *clusters,
+                               transfers, farField);
+        iterations = solveLighting(solver, CONVERGENCE_TARGET);
+    } else {
+        iterations = session.resolve(CONVERGENCE_TARGET);
+    }
+    double const solveSeconds = secondsSince(start);
+
+    double frameMS = 0.0;
+    double shadedFrameMS = 0.0;
+    double lightmapFrameMS = 0.0;
+    if (frames > 0) {
+        // The SubdivInfos refer to our own copy of the faces.
+        faces = session.quads();
+        // Gouraud quads add midpoint vertices, so keep them separate.
+        std::vector<GouraudQuad> gouraudQuads;
+        std::vector<Vertex> gouraudVertices(vertices);
+        MeshBuilder().buildGouraud(subdivs, gouraudQuads, gouraudVertices);
+
+        int handle = gwTransferSetup(WIDTH);
+        QuadBuffer buffer;
+        buffer.setGouraudQuads(gouraudQuads, gouraudVertices);
+        frameMS = timeFrames(frames, [&buffer]() { buffer.draw(); });
+        buffer.clear();
+
+        ShadedScene shaded;
+        shaded.build(faces, vertices, subdivs);
+        shadedFrameMS = timeFrames(frames, [&shaded]() {
+            shaded.draw(EYE_POS);
+        });
+        shaded.clear();
+
+        LightmapScene lightmap;
+        lightmap.build(faces, vertices, subdivs);
+        lightmapFrameMS = timeFrames(frames, [&lightmap]() { lightmap.draw(); });
+        lightmap.clear();
+        gwTransferTeardown(handle);
+    }
+
+    std::cout << "{\"subdivision\": " << config.subdivision
+              << ", \"inner\": " << (config.innerCube ? "true" : "false")
+              << ", \"quads\": " << faces.size()
+              << ", \"method\": \"" << config.method << "\""
+              << ", \"resolution\": " << config.resolution
+              << ", \"non_zeros\": " << transfers.nonZeros() + farField.nonZeros()
+              << ", \"transfers_seconds\": " << transfersSeconds
+              << ", \"iterate_lighting_ms\": " << iterateMS
+              << ", \"solve_iterations\": " << iterations
+              << ", \"solve_seconds\": " << solveSeconds
+              << ", \"frame_ms\": " << frameMS
+              << ", \"shaded_frame_ms\": " << shadedFrameMS
+              << ", \"lightmap_frame_ms\": " << lightmapFrameMS
+              << ", \"peak_rss_kb\": " << peakRSSKB()
+              << "}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    try {
+        gwInit(&argc, argv);
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<int> subdivisions(1, 8);
+    std::vector<int> resolutions(1, 128);
+    std::vector<int> inner(1, 1);
+    std::vector<std::string> methods(1, "render");
+    int frames = 20;
+    std::string tracePath;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg.compare(0, 14, "-subdivisions=") == 0) {
+                subdivisions = parseInts(arg.substr(14));
+            } else if (arg.compare(0, 13, "-resolutions=") == 0) {
+                resolutions = parseInts(arg.substr(13));
+            } else if (arg.compare(0, 7, "-inner=") == 0) {
+                inner = parseInts(arg.substr(7));
+            } else if (arg.compare(0, 9, "-methods=") == 0) {
+                methods = parseNames(arg.substr(9));
+            } else if (arg.compare(0, 8, "-frames=") == 0) {
+                frames = std::stoi(arg.substr(8));
+            } else if (arg.compare(0, 7, "-trace=") == 0) {
+                tracePath = arg.substr(7);
+            } else {
+                throw std::invalid_argument(arg);
+            }
+        }
+        for (int i = 0, n = methods.size(); i < n; ++i) {
+            if (methods[i] != "render" && methods[i] != "adaptive" &&
+                methods[i] != "ray" && methods[i] != "clusters") {
+                throw std::invalid_argument(methods[i]);
+            }
+        }
+    } catch (std::logic_error const &) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-subdivisions=8,16,...] [-resolutions=128,256,...]"
+                  << " [-inner=0,1] [-methods=render,adaptive,ray,clusters]"
+                  << " [-frames=N]"
+                  << " [-trace=file.json] [-gl=glut|egl|osmesa]" << std::endl;
+        return 1;
+    }
+    profileReportAtExit(tracePath);
+
+    // One JSON object per line on stdout, progress on stderr.
+    for (int m = 0, nm = methods.size(); m < nm; ++m) {
+        // Ray casting doesn't have a resolution to vary.
+        bool const rayCast = methods[m] == "ray" || methods[m] == "clusters";
+        std::vector<int> methodResolutions = rayCast ?
+            std::vector<int>(1, RAY_SAMPLES) : resolutions;
+        for (int s = 0, ns = subdivisions.size(); s < ns; ++s) {
+            for (int r = 0, nr = methodResolutions.size(); r < nr; ++r) {
+                for (int c = 0, nc = inner.size(); c < nc; ++c) {
+                    BenchConfig config = { subdivisions[s], inner[c] != 0,
+                                           methods[m], methodResolutions[r] };
+                    std::cerr << "Running " << config.method
+                              << ", subdivision " << config.subdivision
+                              << ", resolution " << config.resolution
+                              << (config.innerCube ? ", inner cube" : "")
+                              << std::endl;
+                    try {
+                        runBench(config, frames);
+                    } catch (std::runtime_error const &e) {
+                        std::cerr << e.what() << std::endl;
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
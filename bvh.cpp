@@ -0,0 +1,195 @@
+////////////////////////////////////////////////////////////////////////
+//
+// bvh.cpp: Bounding volume hierarchy over quads, for shadow rays and
+// collisions.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bvh.h"
+#include "geom.h"
+
+// Quads per leaf.
+static int const LEAF_SIZE = 4;
+
+QuadBVH::QuadBVH(std::vector<Vertex> const &vs, std::vector<Quad> const &qs)
+    : m_vertices(vs),
+      m_quads(qs)
+{
+    int const n = qs.size();
+    std::vector<Vertex> centres;
+    centres.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        m_order.push_back(i);
+        centres.push_back(paraCentre(qs[i], vs));
+    }
+    if (n > 0) {
+        m_nodes.reserve(2 * (n / LEAF_SIZE + 1));
+        build(0, n, centres);
+    }
+}
+
+int QuadBVH::nodeCount() const
+{
+    return m_nodes.size();
+}
+
+// Build the node for m_order[begin, end), returning its index.
+int QuadBVH::build(int begin, int end, std::vector<Vertex> const &centres)
+{
+    int const index = m_nodes.size();
+    m_nodes.push_back(Node());
+    Node node;
+    for (int k = 0; k < 3; ++k) {
+        node.lo[k] = HUGE_VAL;
+        node.hi[k] = -HUGE_VAL;
+    }
+    double cLo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+    double cHi[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    for (int i = begin; i < end; ++i) {
+        Quad const &q = m_quads[m_order[i]];
+        for (int c = 0; c < 4; ++c) {
+            Vertex const &v = m_vertices[q.indices[c]];
+            for (int k = 0; k < 3; ++k) {
+                node.lo[k] = std::min<double>(node.lo[k], v.p[k]);
+                node.hi[k] = std::max<double>(node.hi[k], v.p[k]);
+            }
+        }
+        Vertex const &centre = centres[m_order[i]];
+        for (int k = 0; k < 3; ++k) {
+            cLo[k] = std::min<double>(cLo[k], centre.p[k]);
+            cHi[k] = std::max<double>(cHi[k], centre.p[k]);
+        }
+    }
+
+    node.first = begin;
+    node.count = end - begin;
+    node.second = -1;
+    if (end - begin > LEAF_SIZE) {
+        int axis = 0;
+        for (int k = 1; k < 3; ++k) {
+            if (cHi[k] - cLo[k] > cHi[axis] - cLo[axis]) {
+                axis = k;
+            }
+        }
+        int const mid = (begin + end) / 2;
+        std::nth_element(m_order.begin() + begin,
+                         m_order.begin() + mid,
+                         m_order.begin() + end,
+                         [&centres, axis](int a, int b) {
+            return centres[a].p[axis] < centres[b].p[axis];
+        });
+        node.count = 0;
+        build(begin, mid, centres);
+        node.second = build(mid, end, centres);
+    }
+    m_nodes[index] = node;
+    return index;
+}
+
+// Does the segment from + t * d, 0 <= t <= 1, touch the box?
+static bool hitsBox(double const lo[3], double const hi[3],
+                    Vertex const &from, Vertex const &d)
+{
+    double tMin = 0.0, tMax = 1.0;
+    for (int k = 0; k < 3; ++k) {
+        if (d.p[k] == 0.0) {
+            if (from.p[k] < lo[k] || from.p[k] > hi[k]) {
+                return false;
+            }
+            continue;
+        }
+        double inv = 1.0 / d.p[k];
+        double t0 = (lo[k] - from.p[k]) * inv;
+        double t1 = (hi[k] - from.p[k]) * inv;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMin > tMax) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool QuadBVH::occluded(Vertex const &from, Vertex const &to,
+                       int ignoreA, int ignoreB) const
+{
+    if (m_nodes.empty()) {
+        return false;
+    }
+    Vertex const d = to - from;
+
+    // Deep enough for any tree we'd build.
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        Node const &node = m_nodes[stack[--top]];
+        if (!hitsBox(node.lo, node.hi, from, d)) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (int i = node.first, end = node.first + node.count; i < end; ++i) {
+                int q = m_order[i];
+                if (q != ignoreA && q != ignoreB &&
+                    paraIntersect(m_quads[q], m_vertices, from, to)) {
+                    return true;
+                }
+            }
+        } else {
+            int const index = &node - &m_nodes[0];
+            stack[top++] = index + 1;
+            stack[top++] = node.second;
+        }
+    }
+    return false;
+}
+
+// Squared distance from "p" to the nearest point of the box.
+static double boxDistance2(double const lo[3], double const hi[3],
+                           Vertex const &p)
+{
+    double d2 = 0.0;
+    for (int k = 0; k < 3; ++k) {
+        double d = std::max(0.0, std::max(lo[k] - p.p[k], p.p[k] - hi[k]));
+        d2 += d * d;
+    }
+    return d2;
+}
+
+bool QuadBVH::withinDistance(Vertex const &p, double radius) const
+{
+    if (m_nodes.empty()) {
+        return false;
+    }
+    double const radius2 = radius * radius;
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        Node const &node = m_nodes[stack[--top]];
+        if (boxDistance2(node.lo, node.hi, p) > radius2) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (int i = node.first, end = node.first + node.count; i < end; ++i) {
+                if (paraDistance(m_quads[m_order[i]], m_vertices, p) < radius) {
+                    return true;
+                }
+            }
+        } else {
+            int const index = &node - &m_nodes[0];
+            stack[top++] = index + 1;
+            stack[top++] = node.second;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+////////////////////////////////////////////////////////////////////////
+//
+// bvh.h: Bounding volume hierarchy over quads, for shadow rays and
+// collisions.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_BVH_H
+#define RADIOSITY_BVH_H
+
+#include <vector>
+
+#include "geom.h"
+
+// Axis-aligned boxes, split at the median along the longest axis
+// until each leaf holds a few quads. The quads and vertices must
+// outlive the BVH, and not change.
+class QuadBVH
+{
+public:
+    QuadBVH(std::vector<Vertex> const &vs, std::vector<Quad> const &qs);
+
+    // Is the segment from "from" to "to" blocked by any quad, other
+    // than quads "ignoreA" and "ignoreB" (e.g. the ones the segment
+    // starts and ends on)?
+    bool occluded(Vertex const &from, Vertex const &to,
+                  int ignoreA = -1, int ignoreB = -1) const;
+
+    // Is any quad within "radius" of "p"?
+    bool withinDistance(Vertex const &p, double radius) const;
+
+    int nodeCount() const;
+
+private:
+    struct Node
+    {
+        double lo[3];
+        double hi[3];
+        // Leaves cover m_order[first, first + count). Interior nodes
+        // have count 0, with children at index + 1 and "second".
+        int first;
+        int count;
+        int second;
+    };
+
+    int build(int begin, int end, std::vector<Vertex> const &centres);
+
+    std::vector<Vertex> const &m_vertices;
+    std::vector<Quad> const &m_quads;
+    std::vector<Node> m_nodes;
+    // Quad indices, in leaf order.
+    std::vector<int> m_order;
+};
+
+#endif // RADIOSITY_BVH_H
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////
+//
+// bvh_test.cpp: Tests for bvh.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cstdlib>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "bvh.h"
+#include "geom.h"
+
+class BVHTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(BVHTestCase);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testIgnore);
+    CPPUNIT_TEST(testMatchesBruteForce);
+    CPPUNIT_TEST(testWithinDistance);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testEmpty();
+    void testIgnore();
+    void testMatchesBruteForce();
+    void testWithinDistance();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(BVHTestCase, "BVHTestCase");
+
+void BVHTestCase::testEmpty()
+{
+    std::vector<Vertex> vs;
+    std::vector<Quad> qs;
+    QuadBVH bvh(vs, qs);
+    CPPUNIT_ASSERT_EQUAL(0, bvh.nodeCount());
+    CPPUNIT_ASSERT(!bvh.occluded(Vertex(0.0, 0.0, 0.0), Vertex(1.0, 1.0, 1.0)));
+    CPPUNIT_ASSERT(!bvh.withinDistance(Vertex(0.0, 0.0, 0.0), 1.0));
+}
+
+void BVHTestCase::testIgnore()
+{
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs(cubeFaces);
+    QuadBVH bvh(vs, qs);
+    // Straight through the cube, so through two faces.
+    Vertex from(0.1, -2.0, 0.2), to(0.1, 2.0, 0.2);
+    CPPUNIT_ASSERT(bvh.occluded(from, to));
+    int hit = -1;
+    for (int i = 0; i < 6; ++i) {
+        if (paraIntersect(qs[i], vs, from, to)) {
+            hit = i;
+            CPPUNIT_ASSERT(bvh.occluded(from, to, i));
+        }
+    }
+    int other = -1;
+    for (int i = 0; i < 6; ++i) {
+        if (i != hit && paraIntersect(qs[i], vs, from, to)) {
+            other = i;
+        }
+    }
+    CPPUNIT_ASSERT(other >= 0);
+    CPPUNIT_ASSERT(!bvh.occluded(from, to, hit, other));
+}
+
+// Lots of little quads, tested against lots of segments.
+void BVHTestCase::testMatchesBruteForce()
+{
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs;
+    for (int i = 0; i < 6; ++i) {
+        subdivide(cubeFaces[i], vs, qs, 8, 8);
+    }
+    // And some inside, so rays can be blocked from within.
+    std::vector<Quad> inner(cubeFaces);
+    scale(0.3, inner, vs);
+    rotate(Vertex(1.0, 1.0, 0.0), 0.5, inner, vs);
+    for (int i = 0; i < 6; ++i) {
+        subdivide(inner[i], vs, qs, 3, 3);
+    }
+    QuadBVH bvh(vs, qs);
+    CPPUNIT_ASSERT(bvh.nodeCount() > 1);
+
+    srand(42);
+    int blocked = 0;
+    for (int iter = 0; iter < 2000; ++iter) {
+        double p[6];
+        for (int k = 0; k < 6; ++k) {
+            p[k] = 2.4 * rand() / RAND_MAX - 1.2;
+        }
+        Vertex from(p[0], p[1], p[2]), to(p[3], p[4], p[5]);
+        bool expected = false;
+        for (int i = 0, n = qs.size(); i < n && !expected; ++i) {
+            expected = paraIntersect(qs[i], vs, from, to);
+        }
+        CPPUNIT_ASSERT_EQUAL(expected, bvh.occluded(from, to));
+        blocked += expected;
+    }
+    // Make sure both cases got tested.
+    CPPUNIT_ASSERT(blocked > 100 && blocked < 1900);
+}
+
+// The camera's collision test, against a few big quads, so that
+// being near the middle of one counts even when far from its
+// corners.
+void BVHTestCase::testWithinDistance()
+{
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs(cubeFaces);
+    scale(4.0, qs, vs);
+    QuadBVH bvh(vs, qs);
+    CPPUNIT_ASSERT(bvh.withinDistance(Vertex(0.0, 0.0, 3.8), 0.3));
+    CPPUNIT_ASSERT(!bvh.withinDistance(Vertex(0.0, 0.0, 3.6), 0.3));
+    CPPUNIT_ASSERT(!bvh.withinDistance(Vertex(0.0, 0.0, 0.0), 0.3));
+
+    srand(42);
+    int near = 0;
+    for (int iter = 0; iter < 2000; ++iter) {
+        double p[3];
+        for (int k = 0; k < 3; ++k) {
+            p[k] = 9.6 * rand() / RAND_MAX - 4.8;
+        }
+        Vertex v(p[0], p[1], p[2]);
+        bool expected = false;
+        for (int i = 0, n = qs.size(); i < n && !expected; ++i) {
+            expected = paraDistance(qs[i], vs, v) < 0.5;
+        }
+        CPPUNIT_ASSERT_EQUAL(expected, bvh.withinDistance(v, 0.5));
+        near += expected;
+    }
+    CPPUNIT_ASSERT(near > 100 && near < 1900);
+}
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <vector>
+#include "bvh.h"
 #include "defines.h"
 
 #define MIN_INTERSECTION_DIST 0.3f
@@ -78,8 +79,8 @@ public:
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
-    // returns true when intersection occurs
-    bool ProcessKeyboard(Camera_Movement direction, std::vector<Vertex> v)
+    // returns true when intersection occurs, i.e. the move would take the camera within MIN_INTERSECTION_DIST of any quad in "scene"
+    bool ProcessKeyboard(Camera_Movement direction, QuadBVH const &scene)
     {   
         glm::vec3 initialPosition = Position;
         float velocity = MovementSpeed * 0.005f;
@@ -93,13 +94,8 @@ public:
             Position += Right * velocity;
 
         Vertex camPos = Vertex(Position.x, Position.y, Position.z);
-        
-        float minDist = std::numeric_limits<float>::max();
-        for(Vertex vertex: v){
-            minDist = std::min(minDist, dist(camPos, vertex));
-        }
 
-        if(minDist < MIN_INTERSECTION_DIST){
+        if(scene.withinDistance(camPos, MIN_INTERSECTION_DIST)){
             printf("%s\n", "Collision Detected");
             Position = initialPosition;
             return true;
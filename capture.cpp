@@ -0,0 +1,283 @@
+////////////////////////////////////////////////////////////////////////
+//
+// capture.cpp: Save frames as PNGs without stalling the viewer.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#define GL_GLEXT_PROTOTYPES
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "capture.h"
+#include "parallel.h"
+#include "profile.h"
+
+// Pixel buffers to cycle through. A frame's readback is normally
+// mapped on the next frame, so this leaves room for a few captures
+// in a single frame before one has to wait.
+static int const NUM_PIXEL_BUFFERS = 3;
+
+void writePNG(std::string const &path, int width, int height,
+              std::vector<unsigned char> const &pixels)
+{
+    PROFILE_SCOPE("writePNG");
+    if (pixels.size() != size_t(width) * height * 4) {
+        throw std::runtime_error("Wrong number of pixels for " + path);
+    }
+
+    // PNGs are stored top row first.
+    std::vector<png_bytep> rows(height);
+    for (int i = 0; i < height; ++i) {
+        rows[height - i - 1] =
+            const_cast<png_bytep>(&pixels[size_t(i) * width * 4]);
+    }
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL) {
+        throw std::runtime_error("Couldn't create " + path);
+    }
+
+    // Each call has its own libpng state, so that frames can be
+    // encoded in parallel.
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                              NULL, NULL, NULL);
+    png_infop info = png == NULL ? NULL : png_create_info_struct(png);
+    if (info == NULL) {
+        png_destroy_write_struct(&png, NULL);
+        fclose(f);
+        throw std::runtime_error("Couldn't set up libpng");
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(f);
+        throw std::runtime_error("Couldn't write " + path);
+    }
+
+    png_init_io(png, f);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    png_write_image(png, &rows[0]);
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+
+    if (fclose(f) != 0) {
+        throw std::runtime_error("Couldn't write " + path);
+    }
+}
+
+FrameCapture::FrameCapture(int width, int height, int workers, int maxQueued)
+    : m_width(width),
+      m_height(height),
+      m_maxQueued(maxQueued),
+      m_nextBuffer(0),
+      m_sequenceFrame(0),
+      m_active(0),
+      m_written(0),
+      m_failures(0),
+      m_stopping(false)
+{
+    if (workers <= 0) {
+        workers = defaultThreadCount();
+    }
+    for (int i = 0; i < workers; ++i) {
+        m_workers.push_back(std::thread(&FrameCapture::workerLoop, this));
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_jobs.empty()) {
+            m_done.wait(lock);
+        }
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (int i = 0, n = m_workers.size(); i < n; ++i) {
+        m_workers[i].join();
+    }
+}
+
+void FrameCapture::capture(std::string const &path)
+{
+    PROFILE_SCOPE("FrameCapture::capture");
+    if (m_pixelBuffers.empty()) {
+        m_pixelBuffers.resize(NUM_PIXEL_BUFFERS);
+        glGenBuffers(NUM_PIXEL_BUFFERS, &m_pixelBuffers[0]);
+        for (int i = 0; i < NUM_PIXEL_BUFFERS; ++i) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size_t(m_width) * m_height * 4,
+                         NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    // All in use, so the oldest has to be finished now.
+    if (int(m_readbacks.size()) == NUM_PIXEL_BUFFERS) {
+        completeReadback();
+    }
+
+    Readback readback = { m_nextBuffer, path };
+    m_nextBuffer = (m_nextBuffer + 1) % NUM_PIXEL_BUFFERS;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[readback.buffer]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_readbacks.push_back(readback);
+}
+
+void FrameCapture::startSequence(std::string const &prefix)
+{
+    m_sequencePrefix = prefix;
+    m_sequenceFrame = 0;
+}
+
+void FrameCapture::stopSequence()
+{
+    m_sequencePrefix.clear();
+}
+
+bool FrameCapture::recording() const
+{
+    return !m_sequencePrefix.empty();
+}
+
+void FrameCapture::poll()
+{
+    while (!m_readbacks.empty()) {
+        completeReadback();
+    }
+}
+
+bool FrameCapture::pending() const
+{
+    return !m_readbacks.empty();
+}
+
+void FrameCapture::frame()
+{
+    poll();
+    if (recording()) {
+        std::ostringstream path;
+        path << m_sequencePrefix << std::setw(5) << std::setfill('0')
+             << m_sequenceFrame++ << ".png";
+        capture(path.str());
+    }
+}
+
+void FrameCapture::completeReadback()
+{
+    PROFILE_SCOPE("FrameCapture::completeReadback");
+    Readback const readback = m_readbacks.front();
+    m_readbacks.pop_front();
+
+    size_t const bytes = size_t(m_width) * m_height * 4;
+    std::vector<unsigned char> pixels(bytes);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[readback.buffer]);
+    void const *mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (mapped != NULL) {
+        std::memcpy(&pixels[0], mapped, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (mapped == NULL) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::cerr << "Warning: couldn't read back " << readback.path << std::endl;
+        ++m_failures;
+        return;
+    }
+    submit(readback.path, pixels);
+}
+
+void FrameCapture::submit(std::string const &path,
+                          std::vector<unsigned char> pixels)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_jobs.size() >= m_maxQueued) {
+        m_done.wait(lock);
+    }
+    m_jobs.push_back(Job());
+    m_jobs.back().path = path;
+    m_jobs.back().pixels.swap(pixels);
+    m_wake.notify_one();
+}
+
+void FrameCapture::finish()
+{
+    poll();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_jobs.empty() || m_active > 0) {
+        m_done.wait(lock);
+    }
+}
+
+int FrameCapture::written() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_written;
+}
+
+int FrameCapture::failures() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failures;
+}
+
+void FrameCapture::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        if (m_jobs.empty()) {
+            if (m_stopping) {
+                return;
+            }
+            m_wake.wait(lock);
+            continue;
+        }
+        Job job;
+        job.path.swap(m_jobs.front().path);
+        job.pixels.swap(m_jobs.front().pixels);
+        m_jobs.pop_front();
+        ++m_active;
+        // Room in the queue now.
+        m_done.notify_all();
+
+        lock.unlock();
+        bool ok = true;
+        std::string error;
+        try {
+            writePNG(job.path, m_width, m_height, job.pixels);
+        } catch (std::runtime_error const &e) {
+            ok = false;
+            error = e.what();
+        }
+        lock.lock();
+
+        if (ok) {
+            ++m_written;
+        } else {
+            std::cerr << "Warning: " << error << std::endl;
+            ++m_failures;
+        }
+        --m_active;
+        m_done.notify_all();
+    }
+}
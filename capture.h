@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////
+//
+// capture.h: Save frames as PNGs without stalling the viewer.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_CAPTURE_H
+#define RADIOSITY_CAPTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Write RGBA "pixels", bottom row first as glReadPixels returns them,
+// to a PNG at "path". Throws std::runtime_error on failure.
+void writePNG(std::string const &path, int width, int height,
+              std::vector<unsigned char> const &pixels);
+
+// Frames are read back into pixel buffer objects, so glReadPixels
+// returns straight away, and are only mapped on a later frame, once
+// the GPU has finished with them. The PNGs are then encoded on
+// worker threads. The GL calls must all be made on the thread with
+// the context, which needn't exist until the first capture.
+class FrameCapture
+{
+public:
+    // Captures "width" by "height" from the bottom-left of the
+    // current read buffer. "workers" of 0 means one per core. At most
+    // "maxQueued" frames wait to be encoded; beyond that, handing
+    // over a frame blocks until there's room, so that a sequence
+    // never drops frames.
+    FrameCapture(int width, int height, int workers = 0, int maxQueued = 16);
+    // Waits for the queued frames to be encoded, but leaves any
+    // readbacks still in flight, as the context may already be gone.
+    ~FrameCapture();
+
+    // Start reading back the current frame, to be written to "path".
+    void capture(std::string const &path);
+
+    // Capture every frame shown, to "prefix" followed by a
+    // five-digit frame number and ".png", until stopped.
+    void startSequence(std::string const &prefix);
+    void stopSequence();
+    bool recording() const;
+
+    // Hand earlier readbacks to the encoders. By the time this is
+    // called on a later frame, the GPU should have finished them.
+    void poll();
+    // True if there are readbacks still to be handed over.
+    bool pending() const;
+
+    // Call once a frame, after drawing and before swapping or any
+    // other capture of the frame. Polls, and captures this frame if
+    // recording.
+    void frame();
+
+    // Queue already read back pixels, as for writePNG. Needs no GL.
+    void submit(std::string const &path, std::vector<unsigned char> pixels);
+
+    // Finish the readbacks, and wait for everything to be written.
+    void finish();
+
+    // Frames written, and frames that failed (which are reported on
+    // stderr rather than thrown, as the encoders run in the
+    // background).
+    int written() const;
+    int failures() const;
+
+private:
+    struct Readback
+    {
+        int buffer;
+        std::string path;
+    };
+
+    struct Job
+    {
+        std::string path;
+        std::vector<unsigned char> pixels;
+    };
+
+    // Map the oldest readback, and queue it for encoding.
+    void completeReadback();
+    void workerLoop();
+
+    int const m_width;
+    int const m_height;
+    size_t const m_maxQueued;
+
+    // Ring of pixel buffers, and the readbacks using them, oldest
+    // first.
+    std::vector<unsigned> m_pixelBuffers;
+    int m_nextBuffer;
+    std::deque<Readback> m_readbacks;
+
+    std::string m_sequencePrefix;
+    int m_sequenceFrame;
+
+    std::vector<std::thread> m_workers;
+    std::deque<Job> m_jobs;
+    mutable std::mutex m_mutex;
+    // Signalled when there's work, and when a job completes.
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    int m_active;
+    int m_written;
+    int m_failures;
+    bool m_stopping;
+};
+
+#endif // RADIOSITY_CAPTURE_H
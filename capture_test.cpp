@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////////////////
+//
+// capture_test.cpp: Tests for capture.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <png.h>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "capture.h"
+#include "glut_wrap.h"
+
+class CaptureTestCase : public CppUnit::TestCase
+{
+private:
+    const int SIZE = 16;
+
+    CPPUNIT_TEST_SUITE(CaptureTestCase);
+    CPPUNIT_TEST(testWritePNG);
+    CPPUNIT_TEST(testQueue);
+    CPPUNIT_TEST(testFailure);
+    CPPUNIT_TEST(testReadback);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testWritePNG();
+    void testQueue();
+    void testFailure();
+    void testReadback();
+
+    std::string tempPath(std::string const &name);
+    std::vector<unsigned char> pattern(int seed);
+    // Read an RGBA PNG back, bottom row first, or return nothing if
+    // it isn't a SIZE by SIZE one.
+    std::vector<unsigned char> readPNG(std::string const &path);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(CaptureTestCase, "CaptureTestCase");
+
+std::string CaptureTestCase::tempPath(std::string const &name)
+{
+    std::ostringstream path;
+    path << "/tmp/capture_test." << getpid() << "." << name << ".png";
+    return path.str();
+}
+
+std::vector<unsigned char> CaptureTestCase::pattern(int seed)
+{
+    std::vector<unsigned char> pixels(4 * SIZE * SIZE);
+    for (int i = 0, n = pixels.size(); i < n; ++i) {
+        pixels[i] = (i * 7 + seed) % 251;
+    }
+    return pixels;
+}
+
+std::vector<unsigned char> CaptureTestCase::readPNG(std::string const &path)
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str())) {
+        return std::vector<unsigned char>();
+    }
+    image.format = PNG_FORMAT_RGBA;
+    std::vector<unsigned char> pixels(PNG_IMAGE_SIZE(image));
+    // A negative stride reads the rows bottom up.
+    bool ok = png_image_finish_read(&image, NULL, &pixels[0],
+                                    -int(PNG_IMAGE_ROW_STRIDE(image)), NULL);
+    if (!ok || int(image.width) != SIZE || int(image.height) != SIZE) {
+        return std::vector<unsigned char>();
+    }
+    return pixels;
+}
+
+void CaptureTestCase::testWritePNG()
+{
+    std::string const path = tempPath("single");
+    std::vector<unsigned char> pixels = pattern(0);
+    writePNG(path, SIZE, SIZE, pixels);
+    std::vector<unsigned char> read = readPNG(path);
+    unlink(path.c_str());
+    CPPUNIT_ASSERT(read == pixels);
+
+    std::vector<unsigned char> tooFew(4 * SIZE);
+    CPPUNIT_ASSERT_THROW(writePNG(path, SIZE, SIZE, tooFew), std::runtime_error);
+}
+
+// More frames than the queue holds, so that submitting has to wait
+// for the encoders.
+void CaptureTestCase::testQueue()
+{
+    int const frames = 10;
+    {
+        FrameCapture capture(SIZE, SIZE, 2, 2);
+        for (int i = 0; i < frames; ++i) {
+            std::ostringstream name;
+            name << "queue" << i;
+            capture.submit(tempPath(name.str()), pattern(i));
+        }
+        capture.finish();
+        CPPUNIT_ASSERT_EQUAL(frames, capture.written());
+        CPPUNIT_ASSERT_EQUAL(0, capture.failures());
+        CPPUNIT_ASSERT(!capture.pending());
+    }
+    for (int i = 0; i < frames; ++i) {
+        std::ostringstream name;
+        name << "queue" << i;
+        std::string const path = tempPath(name.str());
+        CPPUNIT_ASSERT(readPNG(path) == pattern(i));
+        unlink(path.c_str());
+    }
+}
+
+// Errors from the encoders are counted, not thrown.
+void CaptureTestCase::testFailure()
+{
+    FrameCapture capture(SIZE, SIZE, 1);
+    capture.submit("/nonexistent/capture_test.png", pattern(0));
+    capture.finish();
+    CPPUNIT_ASSERT_EQUAL(0, capture.written());
+    CPPUNIT_ASSERT_EQUAL(1, capture.failures());
+}
+
+// A sequence of frames through the pixel buffers, each cleared to
+// its own colour.
+void CaptureTestCase::testReadback()
+{
+    int win = gwTransferSetup(SIZE);
+    std::ostringstream prefixStream;
+    prefixStream << "/tmp/capture_test." << getpid() << ".sequence.";
+    std::string const prefix = prefixStream.str();
+    int const frames = 5;
+    {
+        FrameCapture capture(SIZE, SIZE);
+        capture.startSequence(prefix);
+        CPPUNIT_ASSERT(capture.recording());
+        for (int i = 0; i < frames; ++i) {
+            glClearColor(i / 4.0, 1.0 - i / 4.0, 0.0, 1.0);
+            glClear(GL_COLOR_BUFFER_BIT);
+            capture.frame();
+            CPPUNIT_ASSERT(capture.pending());
+        }
+        capture.stopSequence();
+        capture.frame();
+        CPPUNIT_ASSERT(!capture.pending());
+        capture.finish();
+        CPPUNIT_ASSERT_EQUAL(frames, capture.written());
+    }
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    gwTransferTeardown(win);
+
+    for (int i = 0; i < frames; ++i) {
+        std::ostringstream path;
+        path << prefix << "0000" << i << ".png";
+        std::vector<unsigned char> pixels = readPNG(path.str());
+        unlink(path.str().c_str());
+        CPPUNIT_ASSERT_EQUAL(size_t(4 * SIZE * SIZE), pixels.size());
+        // The first pixel's red, and the last one's green.
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(i * 255 / 4.0, pixels[0], 1.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(255 - i * 255 / 4.0,
+                                     pixels[4 * SIZE * SIZE - 3], 1.0);
+    }
+}
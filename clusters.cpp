@@ -0,0 +1,366 @@
+////////////////////////////////////////////////////////////////////////
+//
+// clusters.cpp: Group neighbouring subdivided quads into clusters, so
+// that distant transfers can be handled a cluster at a time.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "clusters.h"
+#include "geom.h"
+#include "parallel.h"
+#include "profile.h"
+#include "radiance.h"
+#include "ray_transfers.h"
+
+PatchClusters::PatchClusters(std::vector<Vertex> const &vs,
+                             std::vector<Quad> const &qs,
+                             std::vector<SubdivInfo> const &subdivs,
+                             int size,
+                             double nearRatio)
+    : m_clusterOf(qs.size(), -1),
+      m_blockCount(0)
+{
+    PROFILE_SCOPE("PatchClusters");
+    size = std::max(1, size);
+
+    // The grid quads each cluster covers, [u0, u1) x [v0, v1).
+    struct Extent
+    {
+        int u0, v0, u1, v1;
+    };
+    std::vector<Extent> extents;
+    std::vector<Vertex> centres;
+    std::vector<double> radii;
+    auto addCluster = [&](SubdivInfo const &info, int u0, int v0, int u1, int v1) {
+        Extent const extent = { u0, v0, u1, v1 };
+        extents.push_back(extent);
+        // Same corner order as the subdivided quads.
+        m_quads.push_back(Quad(info.vertexAt(u0, v0), info.vertexAt(u1, v0),
+                               info.vertexAt(u1, v1), info.vertexAt(u0, v1),
+                               Colour()));
+        centres.push_back(paraCentre(m_quads.back(), vs));
+        radii.push_back(0.5 * (vs[info.vertexAt(u1, v1)] -
+                               vs[info.vertexAt(u0, v0)]).len());
+        m_parents.push_back(-1);
+        m_children.push_back(std::vector<int>());
+        m_members.push_back(std::vector<int>());
+        return int(m_quads.size()) - 1;
+    };
+
+    // The blocks, with each grid's clusters at the current level
+    // kept in rows.
+    int const grids = subdivs.size();
+    std::vector<std::vector<int> > levels(grids);
+    std::vector<int> levelWidths(grids);
+    std::vector<int> levelHeights(grids);
+    for (int s = 0; s < grids; ++s) {
+        SubdivInfo const &info = subdivs[s];
+        for (int v0 = 0; v0 < info.vCount(); v0 += size) {
+            int const v1 = std::min(v0 + size, info.vCount());
+            for (int u0 = 0; u0 < info.uCount(); u0 += size) {
+                int const u1 = std::min(u0 + size, info.uCount());
+                int const cluster = addCluster(info, u0, v0, u1, v1);
+                std::vector<int> &members = m_members[cluster];
+                for (int v = v0; v < v1; ++v) {
+                    for (int u = u0; u < u1; ++u) {
+                        int const f = info.faceAt(u, v);
+                        members.push_back(f);
+                        m_clusterOf[f] = cluster;
+                    }
+                }
+                std::sort(members.begin(), members.end());
+                levels[s].push_back(cluster);
+            }
+        }
+        levelWidths[s] = (info.uCount() + size - 1) / size;
+        levelHeights[s] = (info.vCount() + size - 1) / size;
+    }
+    m_blockCount = m_quads.size();
+
+    // Merge 2 x 2 at a time, until each grid is one cluster. Where
+    // only one is left over at an edge, it moves up a level as it is.
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (int s = 0; s < grids; ++s) {
+            int const w = levelWidths[s];
+            int const h = levelHeights[s];
+            if (w == 1 && h == 1) {
+                continue;
+            }
+            merged = true;
+            std::vector<int> next;
+            for (int j = 0; j < h; j += 2) {
+                for (int i = 0; i < w; i += 2) {
+                    std::vector<int> children;
+                    for (int y = j; y < std::min(j + 2, h); ++y) {
+                        for (int x = i; x < std::min(i + 2, w); ++x) {
+                            children.push_back(levels[s][y * w + x]);
+                        }
+                    }
+                    if (children.size() == 1) {
+                        next.push_back(children[0]);
+                        continue;
+                    }
+                    Extent const first = extents[children.front()];
+                    Extent const last = extents[children.back()];
+                    int const cluster = addCluster(subdivs[s], first.u0, first.v0,
+                                                   last.u1, last.v1);
+                    std::vector<int> &members = m_members[cluster];
+                    for (int k = 0, n = children.size(); k < n; ++k) {
+                        m_parents[children[k]] = cluster;
+                        std::vector<int> const &sub = m_members[children[k]];
+                        members.insert(members.end(), sub.begin(), sub.end());
+                    }
+                    std::sort(members.begin(), members.end());
+                    m_children[cluster] = children;
+                    next.push_back(cluster);
+                }
+            }
+            levels[s].swap(next);
+            levelWidths[s] = (w + 1) / 2;
+            levelHeights[s] = (h + 1) / 2;
+        }
+    }
+
+    // Clusters with some emitters and some reflectors have light that
+    // varies far more across them than the distance test allows for,
+    // so they're always split, down to the blocks.
+    int const count = m_quads.size();
+    std::vector<bool> mixed(count);
+    for (int c = 0; c < count; ++c) {
+        Colour material;
+        double area = 0.0;
+        int emitters = 0;
+        std::vector<int> const &members = m_members[c];
+        for (int k = 0, n = members.size(); k < n; ++k) {
+            double const a = paraArea(qs[members[k]], vs);
+            material += qs[members[k]].materialColour * a;
+            area += a;
+            emitters += qs[members[k]].isEmitter;
+        }
+        m_quads[c].materialColour = material * (area > 0.0 ? 1.0 / area : 0.0);
+        mixed[c] = c >= m_blockCount && emitters > 0 &&
+                   emitters < int(members.size());
+    }
+
+    // Walk down from the top of each grid, stopping at the first
+    // cluster that's far enough away, or at the blocks.
+    m_near.resize(m_blockCount);
+    m_nearSources.resize(m_blockCount);
+    m_far.resize(m_blockCount);
+    std::vector<int> containing(count, -1);
+    for (int a = 0; a < m_blockCount; ++a) {
+        for (int c = a; c >= 0; c = m_parents[c]) {
+            containing[c] = a;
+        }
+        std::vector<int> pending;
+        for (int s = 0; s < grids; ++s) {
+            pending.push_back(levels[s][0]);
+        }
+        while (!pending.empty()) {
+            int const b = pending.back();
+            pending.pop_back();
+            double const limit = nearRatio * (radii[a] + radii[b]);
+            if (containing[b] != a && !mixed[b] &&
+                dist(centres[a], centres[b]) >= limit) {
+                m_far[a].push_back(b);
+            } else if (b < m_blockCount) {
+                m_near[a].push_back(b);
+                m_nearSources[a].insert(m_nearSources[a].end(),
+                                        m_members[b].begin(), m_members[b].end());
+            } else {
+                pending.insert(pending.end(), m_children[b].begin(),
+                               m_children[b].end());
+            }
+        }
+        std::sort(m_near[a].begin(), m_near[a].end());
+        std::sort(m_nearSources[a].begin(), m_nearSources[a].end());
+        std::sort(m_far[a].begin(), m_far[a].end());
+    }
+}
+
+int PatchClusters::count() const
+{
+    return m_members.size();
+}
+
+int PatchClusters::blockCount() const
+{
+    return m_blockCount;
+}
+
+int PatchClusters::clusterOf(int quad) const
+{
+    return m_clusterOf[quad];
+}
+
+int PatchClusters::parent(int cluster) const
+{
+    return m_parents[cluster];
+}
+
+std::vector<int> const &PatchClusters::children(int cluster) const
+{
+    return m_children[cluster];
+}
+
+std::vector<int> const &PatchClusters::members(int cluster) const
+{
+    return m_members[cluster];
+}
+
+std::vector<int> const &PatchClusters::nearClusters(int block) const
+{
+    return m_near[block];
+}
+
+bool PatchClusters::isNear(int a, int b) const
+{
+    return std::binary_search(m_near[a].begin(), m_near[a].end(), b);
+}
+
+std::vector<int> const &PatchClusters::nearSources(int block) const
+{
+    return m_nearSources[block];
+}
+
+std::vector<int> const &PatchClusters::farClusters(int block) const
+{
+    return m_far[block];
+}
+
+std::vector<Quad> const &PatchClusters::quads() const
+{
+    return m_quads;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Calculating the transfers
+
+void calcClusteredTransfers(std::vector<Vertex> const &vs,
+                            std::vector<Quad> const &qs,
+                            PatchClusters const &clusters,
+                            int samples,
+                            TransferMatrix &nearField,
+                            TransferMatrix &farField,
+                            transferProgressFn_t const &progress,
+                            int threads)
+{
+    PROFILE_SCOPE("calcClusteredTransfers");
+    int const n = qs.size();
+    int const blocks = clusters.blockCount();
+
+    // The cluster quads are added to the scene as extra sources.
+    // They lie on top of their members, but shadow rays ignore
+    // anything they only touch at their ends, so the occlusion is
+    // unchanged.
+    std::vector<Quad> scene(qs);
+    scene.insert(scene.end(), clusters.quads().begin(), clusters.quads().end());
+    std::vector<std::vector<int> > sources(blocks);
+    for (int c = 0; c < blocks; ++c) {
+        sources[c] = clusters.nearSources(c);
+        std::vector<int> const &far = clusters.farClusters(c);
+        for (int k = 0, m = far.size(); k < m; ++k) {
+            sources[c].push_back(n + far[k]);
+        }
+    }
+
+    TransferMatrix rows;
+    RayTransferCalculator calc(vs, scene, samples, threads);
+    calc.setRows(0, n);
+    calc.setSources([&clusters, &sources](int target) -> std::vector<int> const & {
+        return sources[clusters.clusterOf(target)];
+    });
+    calc.setProgress(progress);
+    calc.calcAllLights(rows);
+
+    // Split the columns between the two.
+    int const count = clusters.count();
+    nearField.reset(n);
+    farField.reset(count);
+    std::vector<double> nearRow(n);
+    std::vector<double> farRow(count);
+    for (int i = 0; i < n; ++i) {
+        std::fill(nearRow.begin(), nearRow.end(), 0.0);
+        std::fill(farRow.begin(), farRow.end(), 0.0);
+        for (size_t k = rows.rowStart(i), end = rows.rowEnd(i); k < end; ++k) {
+            int const j = rows.column(k);
+            if (j < n) {
+                nearRow[j] = rows.value(k);
+            } else {
+                farRow[j - n] = rows.value(k);
+            }
+        }
+        nearField.addRow(nearRow, i);
+        // The far field isn't square, so there's no diagonal to drop.
+        farField.addRow(farRow, -1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Solving
+
+ClusteredSolver::ClusteredSolver(std::vector<Quad> &qs,
+                                 std::vector<Vertex> const &vs,
+                                 PatchClusters const &clusters,
+                                 TransferMatrix const &nearField,
+                                 TransferMatrix const &farField,
+                                 int threads)
+    : BaseSolver(qs, vs, threads),
+      m_clusters(clusters),
+      m_nearField(nearField),
+      m_farField(farField),
+      m_clusterAreas(clusters.count(), 0.0),
+      m_next(qs.size()),
+      m_clusterColours(clusters.count())
+{
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        m_clusterAreas[clusters.clusterOf(i)] += m_areas[i];
+    }
+    for (int c = clusters.blockCount(), n = clusters.count(); c < n; ++c) {
+        std::vector<int> const &children = clusters.children(c);
+        for (int k = 0, m = children.size(); k < m; ++k) {
+            m_clusterAreas[c] += m_clusterAreas[children[k]];
+        }
+    }
+}
+
+SolverStats ClusteredSolver::iterate()
+{
+    int const blocks = m_clusters.blockCount();
+    parallelFor(blocks, m_threads, [this](int begin, int end) {
+        for (int c = begin; c < end; ++c) {
+            Colour total;
+            std::vector<int> const &members = m_clusters.members(c);
+            for (int k = 0, n = members.size(); k < n; ++k) {
+                total += m_colours.get(members[k]) * m_areas[members[k]];
+            }
+            m_clusterColours.set(c, total * (1.0 / m_clusterAreas[c]));
+        }
+    });
+    // Then up the levels, as the children always come first.
+    for (int c = blocks, count = m_clusters.count(); c < count; ++c) {
+        Colour total;
+        std::vector<int> const &children = m_clusters.children(c);
+        for (int k = 0, n = children.size(); k < n; ++k) {
+            total += m_clusterColours.get(children[k]) * m_clusterAreas[children[k]];
+        }
+        m_clusterColours.set(c, total * (1.0 / m_clusterAreas[c]));
+    }
+
+    int const n = m_quads.size();
+    parallelFor(n, m_threads, [this](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            Colour incoming = gatherRow(m_nearField, i, m_colours) +
+                              gatherRow(m_farField, i, m_clusterColours);
+            m_next.set(i, reflect(i, incoming));
+        }
+    });
+
+    return finishIteration(update(m_next));
+}
@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////////////////
+//
+// clusters.h: Group neighbouring subdivided quads into clusters, so
+// that distant transfers can be handled a cluster at a time.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_CLUSTERS_H
+#define RADIOSITY_CLUSTERS_H
+
+#include <vector>
+
+#include "geom.h"
+#include "progress.h"
+#include "radiance.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+
+// Each SubdivInfo's grid is cut into blocks of quads, which are
+// coplanar neighbours. Seen from far enough away, the quads of a
+// block send light much like one big quad with their average
+// radiosity. The blocks are then merged, 2 x 2 at a time, into
+// larger clusters, up to one covering the whole grid.
+//
+// So the transfers are split in two. The near field links individual
+// quads, but only between pairs of blocks that are close to each
+// other. The far field links each quad to the coarsest clusters that
+// are far enough away, relative to their size. Each receiving block
+// sees a bounded number of clusters at each level, so with a fixed
+// block size the near field grows as O(n), and the far field, along
+// with the form factor work to calculate it, as O(n log n).
+//
+// The exception is clusters holding both emitters and reflectors,
+// whose light varies too much across them to be averaged. They're
+// split down to the blocks, which adds the blocks along the edges of
+// the emitters to each row.
+class PatchClusters
+{
+public:
+    // Blocks of up to "size" x "size" quads. A cluster is far from a
+    // block if their centres are at least "nearRatio" times the sum
+    // of their radii (half their diagonals) apart, and it doesn't
+    // contain the block.
+    PatchClusters(std::vector<Vertex> const &vs,
+                  std::vector<Quad> const &qs,
+                  std::vector<SubdivInfo> const &subdivs,
+                  int size,
+                  double nearRatio);
+
+    // All the clusters, at every level. The blocks come first, as
+    // clusters [0, blockCount()), and every cluster comes after its
+    // children.
+    int count() const;
+    int blockCount() const;
+    // The block holding "quad".
+    int clusterOf(int quad) const;
+    // The cluster one level up, or -1 for the top of a grid.
+    int parent(int cluster) const;
+    // The clusters merged into "cluster", or none for a block.
+    std::vector<int> const &children(int cluster) const;
+    // The quads in the cluster, in order.
+    std::vector<int> const &members(int cluster) const;
+
+    // The blocks near "block", including itself, in order.
+    std::vector<int> const &nearClusters(int block) const;
+    bool isNear(int a, int b) const;
+    // The members of all the blocks near "block", in order: the
+    // sources of the near field for each of its quads.
+    std::vector<int> const &nearSources(int block) const;
+    // The clusters, of any level, far from "block" but with no far
+    // ancestor, in order: the sources of the far field for each of
+    // its quads. Together with the near blocks they cover every quad
+    // exactly once.
+    std::vector<int> const &farClusters(int block) const;
+
+    // One quad per cluster, over the same vertices as the subdivided
+    // quads, with their area-weighted average material.
+    std::vector<Quad> const &quads() const;
+
+private:
+    std::vector<int> m_clusterOf;
+    std::vector<int> m_parents;
+    std::vector<std::vector<int> > m_children;
+    std::vector<std::vector<int> > m_members;
+    std::vector<std::vector<int> > m_near;
+    std::vector<std::vector<int> > m_nearSources;
+    std::vector<std::vector<int> > m_far;
+    std::vector<Quad> m_quads;
+    int m_blockCount;
+};
+
+// Calculate the transfers for "clusters" with RayTransferCalculator,
+// casting "samples" shadow rays per source edge. "nearField" gets a
+// row per quad, from the quads in its block's nearSources.
+// "farField" gets a row per quad, with a column per cluster, from the
+// clusters in its block's farClusters. "progress" is called after each row, and cancels by
+// returning false, as for the other calculators.
+void calcClusteredTransfers(std::vector<Vertex> const &vs,
+                            std::vector<Quad> const &qs,
+                            PatchClusters const &clusters,
+                            int samples,
+                            TransferMatrix &nearField,
+                            TransferMatrix &farField,
+                            transferProgressFn_t const &progress =
+                                transferProgressFn_t(),
+                            int threads = 0);
+
+// Jacobi iteration over the split transfers. Each iteration averages
+// the light over each cluster, from the blocks up, and then gathers
+// the near field from the quads and the far field from the clusters
+// into each quad.
+// Everything must outlive the solver.
+class ClusteredSolver : public BaseSolver
+{
+public:
+    ClusteredSolver(std::vector<Quad> &qs,
+                    std::vector<Vertex> const &vs,
+                    PatchClusters const &clusters,
+                    TransferMatrix const &nearField,
+                    TransferMatrix const &farField,
+                    int threads = 0);
+
+    virtual SolverStats iterate();
+
+private:
+    PatchClusters const &m_clusters;
+    TransferMatrix const &m_nearField;
+    TransferMatrix const &m_farField;
+
+    std::vector<double> m_clusterAreas;
+
+    RadianceBuffer m_next;
+    RadianceBuffer m_clusterColours;
+};
+
+#endif // RADIOSITY_CLUSTERS_H
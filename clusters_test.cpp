@@ -0,0 +1,246 @@
+////////////////////////////////////////////////////////////////////////
+//
+// clusters_test.cpp: Tests for clusters.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "clusters.h"
+#include "geom.h"
+#include "ray_transfers.h"
+#include "solver.h"
+#include "test_scene.h"
+#include "transfer_matrix.h"
+
+class ClustersTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 8;
+    const double TARGET = 1.0e-6;
+
+    CPPUNIT_TEST_SUITE(ClustersTestCase);
+    CPPUNIT_TEST(testLayout);
+    CPPUNIT_TEST(testAllNear);
+    CPPUNIT_TEST(testAllFar);
+    CPPUNIT_TEST(testApproximation);
+    CPPUNIT_TEST(testFarFieldGrowth);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testLayout();
+    void testAllNear();
+    void testAllFar();
+    void testApproximation();
+    void testFarFieldGrowth();
+
+    // The lighting from a Jacobi solve over the full transfers.
+    std::vector<Quad> solveFull(std::vector<Vertex> const &vertices,
+                                std::vector<Quad> const &quads);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ClustersTestCase, "ClustersTestCase");
+
+std::vector<Quad> ClustersTestCase::solveFull(std::vector<Vertex> const &vertices,
+                                              std::vector<Quad> const &quads)
+{
+    TransferMatrix transfers;
+    RayTransferCalculator(vertices, quads).calcAllLights(transfers);
+    std::vector<Quad> lit(quads);
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(SOLVER_JACOBI, lit, vertices, transfers);
+    solveLighting(*solver, TARGET);
+    return lit;
+}
+
+// Blocks of the grid, with edge blocks taking what's left, merged up
+// to one cluster per grid, with cluster quads covering their members.
+void ClustersTestCase::testLayout()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    PatchClusters clusters(vertices, quads, subdivs, 3, 1.0);
+
+    // 3 + 3 + 2 along each side of each face, then 2 + 1, then 1. The
+    // last block merges with nothing, so moves up as it is.
+    CPPUNIT_ASSERT_EQUAL(6 * 3 * 3, clusters.blockCount());
+    CPPUNIT_ASSERT_EQUAL(6 * (3 * 3 + 3 + 1), clusters.count());
+    std::vector<int> seen(quads.size(), 0);
+    int roots = 0;
+    for (int c = 0; c < clusters.count(); ++c) {
+        std::vector<int> const &members = clusters.members(c);
+        double area = 0.0;
+        for (int k = 0, n = members.size(); k < n; ++k) {
+            area += paraArea(quads[members[k]], vertices);
+        }
+        Quad const &q = clusters.quads()[c];
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(area, paraArea(q, vertices), 1.0e-9);
+        // Facing the same way as its members.
+        Vertex const normal = paraCross(quads[members[0]], vertices).norm();
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, dot(normal, paraCross(q, vertices).norm()),
+                                     1.0e-9);
+
+        if (c < clusters.blockCount()) {
+            CPPUNIT_ASSERT(members.size() == 9 || members.size() == 6 ||
+                           members.size() == 4);
+            CPPUNIT_ASSERT(clusters.children(c).empty());
+            for (int k = 0, n = members.size(); k < n; ++k) {
+                CPPUNIT_ASSERT_EQUAL(c, clusters.clusterOf(members[k]));
+                ++seen[members[k]];
+            }
+        } else {
+            // Made of its children, which come before it.
+            std::vector<int> const &children = clusters.children(c);
+            size_t covered = 0;
+            for (int k = 0, n = children.size(); k < n; ++k) {
+                CPPUNIT_ASSERT(children[k] < c);
+                CPPUNIT_ASSERT_EQUAL(c, clusters.parent(children[k]));
+                covered += clusters.members(children[k]).size();
+            }
+            CPPUNIT_ASSERT(children.size() > 1);
+            CPPUNIT_ASSERT_EQUAL(members.size(), covered);
+        }
+        roots += clusters.parent(c) < 0;
+    }
+    CPPUNIT_ASSERT_EQUAL(6, roots);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(1, seen[i]);
+    }
+
+    // The near blocks and far clusters cover every quad just once.
+    for (int a = 0; a < clusters.blockCount(); ++a) {
+        CPPUNIT_ASSERT(clusters.isNear(a, a));
+        std::vector<int> covered(clusters.nearSources(a));
+        std::vector<int> const &far = clusters.farClusters(a);
+        for (int k = 0, n = far.size(); k < n; ++k) {
+            std::vector<int> const &members = clusters.members(far[k]);
+            covered.insert(covered.end(), members.begin(), members.end());
+            // Only blocks may mix emitters and reflectors.
+            if (far[k] >= clusters.blockCount()) {
+                for (int m = 0, count = members.size(); m < count; ++m) {
+                    CPPUNIT_ASSERT_EQUAL(quads[members[0]].isEmitter,
+                                         quads[members[m]].isEmitter);
+                }
+            }
+        }
+        std::sort(covered.begin(), covered.end());
+        CPPUNIT_ASSERT_EQUAL(quads.size(), covered.size());
+        for (int i = 0, n = covered.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_EQUAL(i, covered[i]);
+        }
+    }
+}
+
+// With everything near, the near field is the full transfers, and
+// the solve is plain Jacobi.
+void ClustersTestCase::testAllNear()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    PatchClusters clusters(vertices, quads, subdivs, 4, 100.0);
+    TransferMatrix nearField, farField;
+    calcClusteredTransfers(vertices, quads, clusters, 1, nearField, farField);
+
+    TransferMatrix full;
+    RayTransferCalculator(vertices, quads).calcAllLights(full);
+    CPPUNIT_ASSERT_EQUAL(full.nonZeros(), nearField.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(size_t(0), farField.nonZeros());
+
+    std::vector<Quad> expected = solveFull(vertices, quads);
+    ClusteredSolver solver(quads, vertices, clusters, nearField, farField);
+    solveLighting(solver, TARGET);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[i].screenColour.g,
+                                     quads[i].screenColour.g, 1.0e-9);
+    }
+}
+
+// With single-quad blocks that are only near themselves, everything
+// else is linked through the coarsest clusters. Nothing in the cube
+// is occluded, and form factors add up over the source's area, so
+// each row still gathers the same total as the full transfers.
+void ClustersTestCase::testAllFar()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    PatchClusters clusters(vertices, quads, subdivs, 1, 0.0);
+    CPPUNIT_ASSERT_EQUAL(int(quads.size()), clusters.blockCount());
+    TransferMatrix nearField, farField;
+    calcClusteredTransfers(vertices, quads, clusters, 1, nearField, farField);
+
+    TransferMatrix full;
+    RayTransferCalculator(vertices, quads).calcAllLights(full);
+    CPPUNIT_ASSERT_EQUAL(size_t(0), nearField.nonZeros());
+    CPPUNIT_ASSERT(4 * farField.nonZeros() < full.nonZeros());
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        double expected = 0.0;
+        for (size_t k = full.rowStart(i), end = full.rowEnd(i); k < end; ++k) {
+            expected += full.value(k);
+        }
+        double actual = 0.0;
+        for (size_t k = farField.rowStart(i), end = farField.rowEnd(i); k < end; ++k) {
+            actual += farField.value(k);
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, actual, 1.0e-9);
+    }
+}
+
+// Real clusters need far fewer transfers, for nearly the same
+// lighting.
+void ClustersTestCase::testApproximation()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    PatchClusters clusters(vertices, quads, subdivs, 2, 1.5);
+    TransferMatrix nearField, farField;
+    calcClusteredTransfers(vertices, quads, clusters, 1, nearField, farField);
+
+    TransferMatrix full;
+    RayTransferCalculator(vertices, quads).calcAllLights(full);
+    CPPUNIT_ASSERT(2 * (nearField.nonZeros() + farField.nonZeros()) <
+                   full.nonZeros());
+
+    std::vector<Quad> expected = solveFull(vertices, quads);
+    ClusteredSolver solver(quads, vertices, clusters, nearField, farField);
+    solveLighting(solver, TARGET);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(calcTotalLight(expected, vertices),
+                                 calcTotalLight(quads, vertices),
+                                 0.01 * calcTotalLight(expected, vertices));
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[i].screenColour.g,
+                                     quads[i].screenColour.g,
+                                     0.05 * expected[i].screenColour.g);
+    }
+}
+
+// Doubling the subdivision quadruples the quads, which would give 16
+// times the entries in the full matrix, or a single level of blocks.
+// With the levels of clusters, each row only gains a few more.
+void ClustersTestCase::testFarFieldGrowth()
+{
+    size_t farSizes[2];
+    for (int k = 0; k < 2; ++k) {
+        std::vector<Vertex> vertices;
+        std::vector<Quad> quads;
+        std::vector<SubdivInfo> subdivs;
+        buildLitCube(16 << k, vertices, quads, subdivs);
+        PatchClusters clusters(vertices, quads, subdivs, 4, 1.5);
+        TransferMatrix nearField, farField;
+        calcClusteredTransfers(vertices, quads, clusters, 1, nearField, farField);
+        farSizes[k] = farField.nonZeros();
+    }
+    CPPUNIT_ASSERT(farSizes[1] < 8 * farSizes[0]);
+}
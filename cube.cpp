@@ -14,82 +14,74 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "clusters.h"
 #include "geom.h"
 #include "glut_wrap.h"
+#include "hierarchy.h"
+#include "live_solve.h"
+#include "profile.h"
+#include "progress.h"
+#include "ray_transfers.h"
 #include "rendering.h"
+#include "scene.h"
+#include "session.h"
+#include "solver.h"
+#include "transfer_cache.h"
+#include "transfer_matrix.h"
 #include "transfers.h"
 
-// Relative change in total light in the scene by the point we stop
-// iterating.
-const double CONVERGENCE_TARGET = 0.001;
-
 // Break up each base quad into subdivision^2 subquads for radiosity
 // calculations.
 int const SUBDIVISION = 32;
 
-////////////////////////////////////////////////////////////////////////
-// Radiosity calculations
+// Hemicube resolution for the transfer calculations.
+int const TRANSFER_RESOLUTION = 256;
 
-void initLighting(std::vector<Quad> &qs, std::vector<Vertex> const &vs)
-{
-    for (std::vector<Quad>::iterator iter = qs.begin(), end = qs.end();
-         iter != end; ++iter) {
-        Vertex c = paraCentre(*iter, vs);
-        // Put a big light in the top centre of the box.
-        if (fabs(c.x()) < 0.5 && fabs(c.z()) < 0.5 & c.y() > 0.9) {
-            iter->materialColour = iter->screenColour = Colour(2.0, 2.0, 2.0);
-            iter->isEmitter = true;
-        }
-        // Make the left wall red, the right wall blue.
-        if (c.x() < -0.999) {
-            iter->materialColour = iter->materialColour * Colour(1.0, 0.5, 0.5);
-        } else if (c.x() > 0.999) {
-            iter->materialColour = iter->materialColour * Colour(0.5, 0.5, 1.0);
-        }
-    }
-}
+// With "-transfers=adaptive", rows use between twice this and
+// TRANSFER_RESOLUTION, with this much estimated error per row.
+int const ADAPTIVE_MIN_RESOLUTION = 32;
+double const ADAPTIVE_TOLERANCE = 0.02;
 
-void iterateLighting(std::vector<Quad> &qs, std::vector<double> const &transfers)
-{
-    int const n = qs.size();
-    std::vector<Colour> updatedColours(n);
-
-    // Iterate over targets
-    for (int i = 0; i < n; ++i) {
-        Colour incoming;
-        if (qs[i].isEmitter) {
-            // Emission is just like having 1.0 light arrive.
-            incoming = Colour(1.0, 1.0, 1.0);
-        } else {
-            // Iterate over sources
-            for (int j = 0; j < n; ++j) {
-                if (i == j) {
-                    continue;
-                }
+// Shadow rays per source edge when ray casting the transfers.
+int const RAY_SAMPLES = 2;
 
-                incoming += qs[j].screenColour * transfers[i * n + j];
-            }
-        }
-        updatedColours[i] = incoming * qs[i].materialColour;
-    }
+// How to calculate the transfers.
+enum TransferMethod {
+    TRANSFERS_RENDER,
+    TRANSFERS_ADAPTIVE,
+    TRANSFERS_RAY
+};
 
-    for (int i = 0; i < n; ++i) {
-        qs[i].screenColour = updatedColours[i];
-    }
-}
+// With "-live", the transfers are calculated in about this many
+// batches, with the lighting shown after each.
+int const LIVE_BATCHES = 50;
+
+// Form factor threshold for linking elements in hierarchical mode.
+double const HIERARCHY_EPSILON = 0.01;
 
-// Calculate the total light in the scene, as area-weight sum of
-// screenColour.
-double calcLight(std::vector<Quad> &qs, std::vector<Vertex> const &vs)
+// With "-clusters", blocks of this many quads along each side are
+// clustered, and then merged into larger clusters. Clusters further
+// apart than this many times their radii exchange light as whole
+// clusters.
+int const CLUSTER_SIZE = 4;
+double const CLUSTER_NEAR_RATIO = 2.0;
+
+// Where computed transfers are kept between runs. Like the
+// screenshots, relative to bin/.
+char const *const CACHE_DIR = "../cache";
+
+////////////////////////////////////////////////////////////////////////
+// Radiosity calculations
+
+void initLighting(RadiositySession &session)
 {
-    double totalLight = 0.0;
-    for (std::vector<Quad>::iterator iter = qs.begin(), end = qs.end();
-         iter != end; ++iter) {
-        totalLight += iter->screenColour.asGrey() * paraArea(*iter, vs);
-    }
-    return totalLight;
+    lightCubeScene(session);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -98,60 +90,418 @@ double calcLight(std::vector<Quad> &qs, std::vector<Vertex> const &vs)
 // Geometry.
 static std::vector<Quad> faces;
 static std::vector<Vertex> vertices;
-// Array of quad-to-quad light transfers.
-static std::vector<double> transfers;
 // And data for generating Gouraud shading.
 static std::vector<SubdivInfo> subdivs;
 
 // Subdivide the faces
 void initGeometry(void)
 {
-    vertices = cubeVertices;
-    // Draw the outer 'scene' cube, by subdividing the prototype.
-    for (std::vector<Quad>::const_iterator iter = cubeFaces.begin(),
-             end = cubeFaces.end(); iter != end; ++iter) {
-        subdivs.push_back(subdivide(*iter, vertices, faces,
-                                    SUBDIVISION, SUBDIVISION));
+    buildCubeScene(SUBDIVISION, true, vertices, faces, subdivs);
+}
+
+// The cache key for the transfers "method" calculates. The transfers
+// don't depend on the lighting, so the cache can be used whatever the
+// materials.
+static uint64_t transferKey(RadiositySession &session, TransferMethod method)
+{
+    switch (method) {
+    case TRANSFERS_RAY:
+        return transferCacheKey(session.vertices(), session.quads(),
+                                RAY_SAMPLES, "ray");
+    case TRANSFERS_ADAPTIVE:
+        return transferCacheKey(session.vertices(), session.quads(),
+                                TRANSFER_RESOLUTION,
+                                "adaptive:" +
+                                std::to_string(ADAPTIVE_MIN_RESOLUTION) +
+                                ":" + std::to_string(ADAPTIVE_TOLERANCE));
+    case TRANSFERS_RENDER:
+    default:
+        return transferCacheKey(session.vertices(), session.quads(),
+                                TRANSFER_RESOLUTION);
     }
+}
 
-    // Then draw the inner cube: Take the basic scene cube, scale it
-    // down, rotate and move it...
-    std::vector<Quad> sceneFaces(cubeFaces); // Enclosed cube
-    scale(0.4, sceneFaces, vertices);
-    flip(sceneFaces, vertices);
-    rotate(Vertex(1.0, 0.0, 0.0), M_PI / 3.0, sceneFaces, vertices);
-    rotate(Vertex(0.0, 0.0, 1.0), M_PI / 6.0, sceneFaces, vertices);
-    translate(Vertex(0.0, -0.25, 0.0), sceneFaces, vertices);
-    // Copy the subdivided version into 'faces' (lower subdivisions,
-    // as smaller).
-
-    for (std::vector<Quad>::iterator iter = sceneFaces.begin(),
-             end = sceneFaces.end(); iter != end; ++iter) {
-        iter->isSpecular = true;
-        subdivs.push_back(subdivide(*iter, vertices, faces,
-                                    SUBDIVISION / 2, SUBDIVISION / 2));
+// Calculate the rows of the transfers for targets [begin, end).
+static void calcTransfers(RadiositySession &session, TransferMethod method,
+                          int begin, int end, TransferMatrix &transfers,
+                          transferProgressFn_t const &progress)
+{
+    if (method == TRANSFERS_RAY) {
+        RayTransferCalculator calc(session.vertices(), session.quads(),
+                                   RAY_SAMPLES);
+        calc.setRows(begin, end);
+        calc.setProgress(progress);
+        calc.calcAllLights(transfers);
+    } else {
+        RenderTransferCalculator calc(session.vertices(), session.quads(),
+                                      TRANSFER_RESOLUTION, READBACK_ATLAS);
+        if (method == TRANSFERS_ADAPTIVE) {
+            calc.setAdaptive(ADAPTIVE_MIN_RESOLUTION, ADAPTIVE_TOLERANCE);
+        }
+        calc.setRows(begin, end);
+        calc.setProgress(progress);
+        calc.calcAllLights(transfers);
     }
 }
 
+// Calculate one shard of the transfers into the cache directory, as
+// one of "shards" workers. Throws std::runtime_error on failure.
+static void calcTransferShard(RadiositySession &session, TransferMethod method,
+                              int shard, int shards)
+{
+    int begin, end;
+    transferShardRows(session.quads().size(), shard, shards, begin, end);
+    std::cerr << "Calculating rows " << begin << " to " << end
+              << " (shard " << shard << " of " << shards << ")" << std::endl;
+    TransferMatrix transfers;
+    calcTransfers(session, method, begin, end, transfers,
+                  progressPrinter(std::cerr));
+    saveTransferShard(CACHE_DIR, transferKey(session, method),
+                      shard, shards, transfers);
+}
+
+// Fill in the session's transfers, from the cache if possible. If
+// "mergeShards" is set, they come from that many shards, calculated
+// by calcTransferShard, instead of being calculated here.
+static void initTransfers(RadiositySession &session, bool useCache,
+                          TransferMethod method, int mergeShards)
+{
+    TransferMatrix &transfers = session.transfers();
+    uint64_t const cacheKey = transferKey(session, method);
+    std::string const cachePath = transferCachePath(CACHE_DIR, cacheKey);
+    if (useCache && loadTransferCache(cachePath, cacheKey, transfers)) {
+        std::cerr << "Loaded transfers from " << cachePath << std::endl;
+    } else {
+        if (mergeShards > 0) {
+            if (!mergeTransferShards(CACHE_DIR, cacheKey, mergeShards,
+                                     transfers)) {
+                throw std::runtime_error("Missing or mismatched transfer "
+                                         "shards in " + std::string(CACHE_DIR));
+            }
+            std::cerr << "Merged " << mergeShards << " transfer shards"
+                      << std::endl;
+        } else {
+            int const n = session.quads().size();
+            calcTransfers(session, method, 0, n, transfers,
+                          progressPrinter(std::cerr));
+        }
+        try {
+            saveTransferCache(cachePath, cacheKey, transfers);
+        } catch (std::runtime_error const &e) {
+            // Not fatal, we just have to recompute next time.
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+    std::cerr << transfers.nonZeros() << " non-zero transfers, "
+              << transfers.memoryUsage() / (1024 * 1024) << " MB" << std::endl;
+}
+
+// Solve with clustered transfers, calculated by ray casting, or
+// loaded from the cache if possible.
+static void solveClustered(RadiositySession &session, bool useCache,
+                           solverReportFn_t const &report)
+{
+    std::vector<Vertex> const &vs = session.vertices();
+    std::vector<Quad> &qs = session.quads();
+    PatchClusters clusters(vs, qs, subdivs, CLUSTER_SIZE, CLUSTER_NEAR_RATIO);
+    std::string const params = std::to_string(CLUSTER_SIZE) + ":" +
+                               std::to_string(CLUSTER_NEAR_RATIO);
+    uint64_t const nearKey = transferCacheKey(vs, qs, RAY_SAMPLES,
+                                              "cluster-tree-near:" + params);
+    uint64_t const farKey = transferCacheKey(vs, qs, RAY_SAMPLES,
+                                             "cluster-tree-far:" + params);
+    std::string const nearPath = transferCachePath(CACHE_DIR, nearKey);
+    std::string const farPath = transferCachePath(CACHE_DIR, farKey);
+
+    TransferMatrix nearField, farField;
+    if (useCache && loadTransferCache(nearPath, nearKey, nearField) &&
+        loadTransferCache(farPath, farKey, farField)) {
+        std::cerr << "Loaded clustered transfers from " << CACHE_DIR << std::endl;
+    } else {
+        calcClusteredTransfers(vs, qs, clusters, RAY_SAMPLES, nearField, farField,
+                               progressPrinter(std::cerr));
+        try {
+            saveTransferCache(nearPath, nearKey, nearField);
+            saveTransferCache(farPath, farKey, farField);
+        } catch (std::runtime_error const &e) {
+            // Not fatal, we just have to recompute next time.
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+    std::cerr << clusters.count() << " clusters, "
+              << nearField.nonZeros() << " near and "
+              << farField.nonZeros() << " far transfers, "
+              << (nearField.memoryUsage() + farField.memoryUsage()) / (1024 * 1024)
+              << " MB" << std::endl;
+
+    ClusteredSolver solver(qs, vs, clusters, nearField, farField);
+    solveLighting(solver, CONVERGENCE_TARGET, report);
+}
+
+// Open the viewer straight away, and show the lighting as the
+// transfers and solve progress on a worker thread. Ray cast transfers
+// are calculated in batches on the worker; rendered ones need this
+// thread's GL context, so unless they're cached they're calculated
+// before the window opens, and just the solve is live. So are merged
+// shards, as for initTransfers.
+static void runLive(RadiositySession &session, bool useCache,
+                    TransferMethod method, SolverKind kind,
+                    int mergeShards, solverReportFn_t const &report)
+{
+    TransferMatrix &transfers = session.transfers();
+    uint64_t const cacheKey = transferKey(session, method);
+    std::string const cachePath = transferCachePath(CACHE_DIR, cacheKey);
+    bool background = false;
+    if (mergeShards > 0) {
+        initTransfers(session, useCache, method, mergeShards);
+    } else if (useCache && loadTransferCache(cachePath, cacheKey, transfers)) {
+        std::cerr << "Loaded transfers from " << cachePath << std::endl;
+    } else if (method == TRANSFERS_RAY) {
+        background = true;
+    } else {
+        std::cerr << "Rendering the transfers before opening the window;"
+                  << " use -transfers=ray to watch them fill in" << std::endl;
+        initTransfers(session, false, method, 0);
+    }
+
+    int const n = session.quads().size();
+    // The viewer's copy, which the SubdivInfos refer to.
+    faces = session.quads();
+    LiveSolve live(n, [&session, background, method, kind, cachePath,
+                       cacheKey, n, &report](LiveSolve &live) {
+        if (background) {
+            transferProgressFn_t progress = [&live](TransferProgress const &) {
+                return !live.cancelled();
+            };
+            calcTransfersLive([&session, method, &progress](
+                                  int begin, int end, TransferMatrix &rows) {
+                                  calcTransfers(session, method, begin, end,
+                                                rows, progress);
+                              },
+                              std::max(1, n / LIVE_BATCHES),
+                              session.quads(), session.transfers(), live);
+            std::cerr << session.transfers().nonZeros()
+                      << " non-zero transfers" << std::endl;
+            try {
+                saveTransferCache(cachePath, cacheKey, session.transfers());
+            } catch (std::runtime_error const &e) {
+                std::cerr << "Warning: " << e.what() << std::endl;
+            }
+        }
+        std::unique_ptr<RadiositySolver> solver =
+            makeSolver(kind, session.quads(), session.vertices(),
+                       session.transfers());
+        solveLive(*solver, session.quads(), CONVERGENCE_TARGET, live,
+                  0.1, report);
+    });
+    renderLive(&faces, &vertices, &subdivs, &live);
+}
+
 int main(int argc, char **argv)
 {
-    glutInit(&argc, argv);
+    try {
+        gwInit(&argc, argv);
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    SolverKind solverKind = SOLVER_JACOBI;
+    bool useCache = true;
+    bool hierarchical = false;
+    bool clustered = false;
+    bool stream = false;
+    TransferMethod transferMethod = TRANSFERS_RENDER;
+    bool shaded = false;
+    bool lightmap = false;
+    bool live = false;
+    std::string tracePath;
+    int shard = -1;
+    int shards = 0;
+    int mergeShards = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 8, "-solver=") == 0 &&
+            parseSolverKind(arg.substr(8), solverKind)) {
+            continue;
+        }
+        if (arg == "-no-cache") {
+            useCache = false;
+            continue;
+        }
+        if (arg == "-hierarchical") {
+            hierarchical = true;
+            continue;
+        }
+        if (arg == "-clusters") {
+            clustered = true;
+            continue;
+        }
+        if (arg == "-stream") {
+            stream = true;
+            continue;
+        }
+        if (arg == "-transfers=ray") {
+            transferMethod = TRANSFERS_RAY;
+            continue;
+        }
+        if (arg == "-transfers=adaptive") {
+            transferMethod = TRANSFERS_ADAPTIVE;
+            continue;
+        }
+        if (arg == "-transfers=render") {
+            transferMethod = TRANSFERS_RENDER;
+            continue;
+        }
+        if (arg == "-shaded") {
+            shaded = true;
+            continue;
+        }
+        if (arg == "-lightmap") {
+            lightmap = true;
+            continue;
+        }
+        if (arg == "-live") {
+            live = true;
+            continue;
+        }
+        if (arg.compare(0, 7, "-trace=") == 0) {
+            tracePath = arg.substr(7);
+            continue;
+        }
+        if (arg.compare(0, 7, "-shard=") == 0 &&
+            sscanf(arg.c_str() + 7, "%d/%d", &shard, &shards) == 2 &&
+            shard >= 0 && shard < shards) {
+            continue;
+        }
+        if (arg.compare(0, 7, "-merge=") == 0 &&
+            sscanf(arg.c_str() + 7, "%d", &mergeShards) == 1 &&
+            mergeShards > 0) {
+            continue;
+        }
+        std::cerr << "Usage: " << argv[0]
+                  << " [-solver=jacobi|gauss-seidel|progressive] [-no-cache]"
+                  << " [-hierarchical] [-clusters] [-stream]"
+                  << " [-transfers=render|adaptive|ray]"
+                  << " [-gl=glut|egl|osmesa] [-shaded] [-lightmap]"
+                  << " [-live] [-trace=file.json] [-shard=I/N] [-merge=N]" << std::endl;
+        return 1;
+    }
+    profileReportAtExit(tracePath);
 
     initGeometry();
-    initLighting(faces, vertices);
-    RenderTransferCalculator(vertices, faces, 256).calcAllLights(transfers);
-    double light = 0.0;
-    double relChange;
-    
-    do {
-        iterateLighting(faces, transfers);
-        double newLight = calcLight(faces, vertices);
-        relChange = fabs(light / newLight - 1.0);
-        light = newLight;
-        std::cout << "Total light: " << light << std::endl;
-    } while (relChange > CONVERGENCE_TARGET);
-
-    renderGouraud(&faces, &vertices, &subdivs);    
+    RadiositySession session(vertices, faces, solverKind);
+
+    // A worker for one shard of the transfers just calculates and
+    // saves its rows. Once all N are done, a run with "-merge=N"
+    // picks them up.
+    if (shards > 0) {
+        try {
+            calcTransferShard(session, transferMethod, shard, shards);
+        } catch (std::runtime_error const &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    initLighting(session);
+
+    // Progressive refinement iterates once per shot, so report less
+    // often.
+    int const reportEvery = solverKind == SOLVER_PROGRESSIVE ? 1000 : 1;
+    solverReportFn_t report = [reportEvery](SolverStats const &stats) {
+        if (stats.iteration % reportEvery == 0) {
+            std::cout << "Total light: " << stats.totalLight
+                      << " (residual " << stats.residual << ")" << std::endl;
+        }
+    };
+
+    // Only worth doing with a window to watch, and only the Gouraud
+    // viewer follows the lighting as it changes.
+    if (live && gwBackend() != GL_BACKEND_GLUT) {
+        std::cerr << "Warning: -live needs a window, so is ignored with"
+                  << " -gl=egl or -gl=osmesa" << std::endl;
+        live = false;
+    }
+    if (live && (hierarchical || clustered || stream)) {
+        std::cerr << "Warning: -live can't be used with -hierarchical,"
+                  << " -clusters or -stream, so is ignored" << std::endl;
+        live = false;
+    }
+    if (live && (shaded || lightmap)) {
+        std::cerr << "Warning: -live only updates the Gouraud viewer, so is"
+                  << " ignored with -shaded or -lightmap" << std::endl;
+        live = false;
+    }
+    if (live) {
+        try {
+            runLive(session, useCache, transferMethod, solverKind,
+                    mergeShards, report);
+        } catch (std::runtime_error const &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (hierarchical) {
+        // Builds its own links instead of using the transfers.
+        HierarchicalSolver solver(session.vertices(), session.quads(),
+                                  subdivs, HIERARCHY_EPSILON);
+        std::cerr << solver.elementCount() << " elements, "
+                  << solver.linkCount() << " links" << std::endl;
+        solveLighting(solver, CONVERGENCE_TARGET, report);
+    } else if (clustered) {
+        // Always ray cast: the calculation only visits the near quads
+        // and the far clusters, which a hemicube can't.
+        try {
+            solveClustered(session, useCache, report);
+        } catch (std::runtime_error const &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else if (stream) {
+        // Make sure the transfers are in the cache, and then solve
+        // from the file, with Jacobi iteration, instead of keeping
+        // them in memory.
+        try {
+            initTransfers(session, useCache, transferMethod, mergeShards);
+            session.transfers().reset(0);
+            uint64_t const key = transferKey(session, transferMethod);
+            std::unique_ptr<RadiositySolver> solver =
+                makeStreamingSolver(session.quads(), session.vertices(),
+                                    transferCachePath(CACHE_DIR, key), key);
+            solveLighting(*solver, CONVERGENCE_TARGET, report);
+        } catch (std::runtime_error const &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else {
+        try {
+            initTransfers(session, useCache, transferMethod, mergeShards);
+        } catch (std::runtime_error const &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        session.resolve(CONVERGENCE_TARGET, report);
+    }
+
+    // Headless runs are batch jobs: the transfers are cached, and
+    // there's no window to show the results in.
+    if (gwBackend() != GL_BACKEND_GLUT) {
+        return 0;
+    }
+
+    // The subdivision info refers to our own copy of the faces.
+    faces = session.quads();
+    if (lightmap) {
+        renderLightmap(&faces, &vertices, &subdivs);
+    } else if (shaded) {
+        renderShaded(&faces, &vertices, &subdivs);
+    } else {
+        renderGouraud(&faces, &vertices, &subdivs);
+    }
     
     return 0;
 }
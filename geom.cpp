@@ -11,92 +11,107 @@
 #include <GL/glut.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <map>
+#include <set>
 #include <vector>
 
 #include "geom.h"
+#include "profile.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Vertex
 
-Vertex::Vertex(double ix, double iy, double iz)
+template<typename T>
+BasicVertex<T>::BasicVertex(T ix, T iy, T iz)
     : p {ix, iy, iz}
 {
 }
 
-Vertex::Vertex(Vertex const &v)
+template<typename T>
+BasicVertex<T>::BasicVertex(BasicVertex const &v)
     : p {v.x(), v.y(), v.z()}
 {
 }
 
-double Vertex::len() const
+template<typename T>
+T BasicVertex<T>::len() const
 {
     return std::sqrt(x() * x() + y() * y() + z() * z());
 }
 
-Vertex Vertex::norm() const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::norm() const
 {
-    double l = len();
-    return Vertex(x() / l, y() / l, z() / l);
+    T l = len();
+    return BasicVertex(x() / l, y() / l, z() / l);
 }
 
 // Get an arbitrary perpendicular vector.
-Vertex Vertex::perp() const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::perp() const
 {
     // Choose the axis-aligned vector most orthogonal, and then
     // properly orthogonalise it.
-    double ax = fabs(x()), ay = fabs(y()), az = fabs(z());
+    T ax = std::fabs(x()), ay = std::fabs(y()), az = std::fabs(z());
     if (ax < ay && ax < az) {
-        return orthog(Vertex(1.0, 0.0, 0.0), *this);
+        return orthog(BasicVertex(1.0, 0.0, 0.0), *this);
     }
     if (ay < az) {
-        return orthog(Vertex(0.0, 1.0, 0.0), *this);
+        return orthog(BasicVertex(0.0, 1.0, 0.0), *this);
     } else {
-        return orthog(Vertex(0.0, 0.0, 1.0), *this);
+        return orthog(BasicVertex(0.0, 0.0, 1.0), *this);
     }
 }
 
-Vertex Vertex::scale(double s) const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::scale(T s) const
 {
-    return Vertex(x() * s, y() * s, z() * s);
+    return BasicVertex(x() * s, y() * s, z() * s);
 }
 
-Vertex Vertex::operator+(Vertex const &rhs) const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::operator+(BasicVertex const &rhs) const
 {
-    return Vertex(x() + rhs.x(), y() + rhs.y(), z() + rhs.z());
+    return BasicVertex(x() + rhs.x(), y() + rhs.y(), z() + rhs.z());
 }
 
-Vertex Vertex::operator-(Vertex const &rhs) const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::operator-(BasicVertex const &rhs) const
 {
-    return Vertex(x() - rhs.x(), y() - rhs.y(), z() - rhs.z());
+    return BasicVertex(x() - rhs.x(), y() - rhs.y(), z() - rhs.z());
 }
 
-Vertex Vertex::operator*(float otherNum) const
+template<typename T>
+BasicVertex<T> BasicVertex<T>::operator*(T otherNum) const
 {
-    return Vertex(x() * otherNum, y() * otherNum, z() * otherNum);
-}  
+    return BasicVertex(x() * otherNum, y() * otherNum, z() * otherNum);
+}
 
-double Vertex::x() const { return p[0]; }
-double Vertex::y() const { return p[1]; }
-double Vertex::z() const { return p[2]; }
+template<typename T> T BasicVertex<T>::x() const { return p[0]; }
+template<typename T> T BasicVertex<T>::y() const { return p[1]; }
+template<typename T> T BasicVertex<T>::z() const { return p[2]; }
 
-std::ostream &operator<<(std::ostream &os, Vertex const &v)
+template<typename T>
+std::ostream &operator<<(std::ostream &os, BasicVertex<T> const &v)
 {
     return os << "(" << v.x() << ", " << v.y() << ", " << v.z() << ")";
 }
 
 // Cross product.
-Vertex cross(Vertex const &v1, Vertex const &v2)
+template<typename T>
+BasicVertex<T> cross(BasicVertex<T> const &v1, BasicVertex<T> const &v2)
 {
-    return Vertex(v1.y() * v2.z() - v1.z() * v2.y(),
-                  v1.z() * v2.x() - v1.x() * v2.z(),
-                  v1.x() * v2.y() - v1.y() * v2.x());
+    return BasicVertex<T>(v1.y() * v2.z() - v1.z() * v2.y(),
+                          v1.z() * v2.x() - v1.x() * v2.z(),
+                          v1.x() * v2.y() - v1.y() * v2.x());
 }
 
 // Dot product.
-double dot(Vertex const &v1, Vertex const &v2)
+template<typename T>
+T dot(BasicVertex<T> const &v1, BasicVertex<T> const &v2)
 {
     return v1.x() * v2.x()
          + v1.y() * v2.y()
@@ -104,72 +119,111 @@ double dot(Vertex const &v1, Vertex const &v2)
 }
 
 // Orthogonalise v1, taking away the v2 component.
-Vertex orthog(Vertex const &v1, Vertex const &v2)
+template<typename T>
+BasicVertex<T> orthog(BasicVertex<T> const &v1, BasicVertex<T> const &v2)
 {
-    double c = dot(v1, v2) / dot(v2, v2);
+    T c = dot(v1, v2) / dot(v2, v2);
     return v1 - v2.scale(c);
 }
 
 // Linear interpolation. 0 returns v1, 1 returns v2.
-Vertex lerp(Vertex const &v1, Vertex const &v2, double i)
+template<typename T>
+BasicVertex<T> lerp(BasicVertex<T> const &v1, BasicVertex<T> const &v2, double i)
 {
-    double j = 1.0 - i;
-    return Vertex(v1.x() * j + v2.x() * i,
-                  v1.y() * j + v2.y() * i,
-                  v1.z() * j + v2.z() * i);
+    T const ti = i;
+    T const j = 1.0 - i;
+    return BasicVertex<T>(v1.x() * j + v2.x() * ti,
+                          v1.y() * j + v2.y() * ti,
+                          v1.z() * j + v2.z() * ti);
 }
 
-float dist(Vertex const &v1, Vertex const &v2){
-    return (std::sqrt(std::pow(v1.x() - v2.x(), 2) + std::pow(v1.y() - v2.y(), 2) + std::pow(v1.z() - v2.z(), 2)));
+template<typename T>
+T dist(BasicVertex<T> const &v1, BasicVertex<T> const &v2)
+{
+    return (v1 - v2).len();
 }
 
 ////////////////////////////////////////////////////////////////////////
 // Colour
 
-Colour::Colour(double red, double green, double blue)
+template<typename T>
+BasicColour<T>::BasicColour(T red, T green, T blue)
     : r(red), g(green), b(blue)
 {
 }
 
-Colour::Colour(Colour const &c)
+template<typename T>
+BasicColour<T>::BasicColour(BasicColour const &c)
     : r(c.r), g(c.g), b(c.b)
 {
 }
 
-Colour::Colour()
+template<typename T>
+BasicColour<T>::BasicColour()
     : r(0.0), g(0.0), b(0.0)
 {
 }
 
-Colour Colour::operator*(double x) const
+template<typename T>
+BasicColour<T> BasicColour<T>::operator*(T x) const
 {
-    return Colour(r * x, g * x, b * x);
+    return BasicColour(r * x, g * x, b * x);
 }
 
-Colour Colour::operator*(Colour const &c) const
+template<typename T>
+BasicColour<T> BasicColour<T>::operator*(BasicColour const &c) const
 {
-    return Colour(r * c.r, g * c.g, b * c.b);
+    return BasicColour(r * c.r, g * c.g, b * c.b);
 }
 
-Colour Colour::operator+(Colour const &c) const
+template<typename T>
+BasicColour<T> BasicColour<T>::operator+(BasicColour const &c) const
 {
-    return Colour(r + c.r, g + c.g, b + c.b);
+    return BasicColour(r + c.r, g + c.g, b + c.b);
 }
 
-Colour &Colour::operator+=(Colour const &c)
+template<typename T>
+BasicColour<T> &BasicColour<T>::operator+=(BasicColour const &c)
 {
     r += c.r; g += c.g; b += c.b;
     return *this;
 }
 
-double Colour::asGrey() const
+template<typename T>
+T BasicColour<T>::asGrey() const
 {
     return 0.2126 * r + 0.7152 * g + 0.0722 * b;
 }
 
+// Both precisions are built, whichever the rest of the code uses.
+#define INSTANTIATE_GEOM(T)                                             \
+    template class BasicVertex<T>;                                      \
+    template std::ostream &operator<<(std::ostream &os,                 \
+                                      BasicVertex<T> const &v);         \
+    template BasicVertex<T> cross(BasicVertex<T> const &v1,             \
+                                  BasicVertex<T> const &v2);            \
+    template T dot(BasicVertex<T> const &v1, BasicVertex<T> const &v2); \
+    template BasicVertex<T> orthog(BasicVertex<T> const &v1,            \
+                                   BasicVertex<T> const &v2);           \
+    template BasicVertex<T> lerp(BasicVertex<T> const &v1,              \
+                                 BasicVertex<T> const &v2, double i);   \
+    template T dist(BasicVertex<T> const &v1, BasicVertex<T> const &v2); \
+    template class BasicColour<T>;
+
+INSTANTIATE_GEOM(float)
+INSTANTIATE_GEOM(double)
+
+#undef INSTANTIATE_GEOM
+
 ////////////////////////////////////////////////////////////////////////
 // Quad
 
+// Immediate mode GL calls of the right precision.
+static inline void glVertex(BasicVertex<float> const &v)  { glVertex3fv(v.p); }
+static inline void glVertex(BasicVertex<double> const &v) { glVertex3dv(v.p); }
+static inline void glNormal(BasicVertex<float> const &v)  { glNormal3fv(v.p); }
+static inline void glNormal(BasicVertex<double> const &v) { glNormal3dv(v.p); }
+
 Quad::Quad(int v1, int v2, int v3, int v4, Colour const &c)
     : indices { v1, v2, v3, v4 }, isEmitter(false), isSpecular(false), materialColour(c)
 {
@@ -184,30 +238,29 @@ void Quad::render(std::vector<Vertex> const &v) const
     Vertex n = cross(v3 - v0, v1 - v0).norm();
     glBegin(GL_QUADS);
     glColor3d(screenColour.r, screenColour.g, screenColour.b);
-    glNormal3dv(n.p);
-    glVertex3dv(v0.p);
-    glVertex3dv(v1.p);
-    glVertex3dv(v2.p);
-    glVertex3dv(v3.p);
+    glNormal(n);
+    glVertex(v0);
+    glVertex(v1);
+    glVertex(v2);
+    glVertex(v3);
     glEnd();
 }
 
-void Quad::renderIndex(int index, std::vector<Vertex> const &v) const
+void Quad::renderIndex(unsigned index, std::vector<Vertex> const &v) const
 {
     Vertex const &v0 = v[indices[0]];
     Vertex const &v1 = v[indices[1]];
     Vertex const &v2 = v[indices[2]];
     Vertex const &v3 = v[indices[3]];
-    Vertex n = cross(v3 - v0, v1 - v0).norm();
     glBegin(GL_QUADS);
-    // We're not using that many polys, so skip the low bits. This
-    // means we can see what's going on better if we do a test render.
-    glColor3ub((index << 2) & 0xFC, (index >> 4) & 0xFC, (index >> 10) & 0xFC);
-    glNormal3dv(n.p);
-    glVertex3dv(v0.p);
-    glVertex3dv(v1.p);
-    glVertex3dv(v2.p);
-    glVertex3dv(v3.p);
+    // Flat colour, so no normal needed.
+    GLubyte rgba[4];
+    encodeIndex(index, rgba);
+    glColor4ubv(rgba);
+    glVertex(v0);
+    glVertex(v1);
+    glVertex(v2);
+    glVertex(v3);
     glEnd();
 }
 
@@ -236,6 +289,83 @@ double paraArea(Quad const &q, std::vector<Vertex> const &vs)
     return paraCross(q, vs).len();
 }
 
+// Moller-Trumbore, but with the parallelogram's edges instead of a
+// triangle's, and the direction unnormalised so that the segment is
+// 0 <= t <= 1.
+bool paraIntersect(Quad const &q, std::vector<Vertex> const &vs,
+                   Vertex const &from, Vertex const &to)
+{
+    // Tolerance for the endpoints, and for parallel segments.
+    double const EPSILON = 1.0e-9;
+
+    Vertex const &v0 = vs[q.indices[0]];
+    Vertex e1 = vs[q.indices[1]] - v0;
+    Vertex e3 = vs[q.indices[3]] - v0;
+    Vertex d = to - from;
+
+    Vertex pvec = cross(d, e3);
+    double det = dot(e1, pvec);
+    if (fabs(det) < EPSILON * EPSILON) {
+        return false;
+    }
+    double invDet = 1.0 / det;
+
+    Vertex tvec = from - v0;
+    double a = dot(tvec, pvec) * invDet;
+    if (a < 0.0 || a > 1.0) {
+        return false;
+    }
+    Vertex qvec = cross(tvec, e1);
+    double b = dot(d, qvec) * invDet;
+    if (b < 0.0 || b > 1.0) {
+        return false;
+    }
+    double t = dot(e3, qvec) * invDet;
+    return t > EPSILON && t < 1.0 - EPSILON;
+}
+
+// Distance from "p" to the segment from "a" to "a + e".
+static double segmentDistance(Vertex const &a, Vertex const &e,
+                              Vertex const &p)
+{
+    double const ee = dot(e, e);
+    double t = ee == 0.0 ? 0.0 : dot(p - a, e) / ee;
+    t = std::max(0.0, std::min(1.0, t));
+    return (p - (a + e * t)).len();
+}
+
+double paraDistance(Quad const &q, std::vector<Vertex> const &vs,
+                    Vertex const &p)
+{
+    Vertex const &v0 = vs[q.indices[0]];
+    Vertex e1 = vs[q.indices[1]] - v0;
+    Vertex e3 = vs[q.indices[3]] - v0;
+    Vertex d = p - v0;
+
+    // Project onto the plane, in terms of the edges. If that lands
+    // inside, the nearest point is the projection.
+    double const e11 = dot(e1, e1);
+    double const e13 = dot(e1, e3);
+    double const e33 = dot(e3, e3);
+    double const det = e11 * e33 - e13 * e13;
+    if (det > 0.0) {
+        double const d1 = dot(d, e1);
+        double const d3 = dot(d, e3);
+        double const a = (d1 * e33 - d3 * e13) / det;
+        double const b = (d3 * e11 - d1 * e13) / det;
+        if (a >= 0.0 && a <= 1.0 && b >= 0.0 && b <= 1.0) {
+            return (d - e1 * a - e3 * b).len();
+        }
+    }
+
+    // Otherwise, it's on an edge.
+    Vertex const v2 = v0 + e1 + e3;
+    return std::min(std::min(segmentDistance(v0, e1, p),
+                             segmentDistance(v0, e3, p)),
+                    std::min(segmentDistance(v2, e1 * -1.0, p),
+                             segmentDistance(v2, e3 * -1.0, p)));
+}
+
 // Applies a transform to the requested vertices, with a cache.
 class VertexTransformer
 {
@@ -407,18 +537,28 @@ void GouraudQuad::render(std::vector<Vertex> const &v) const
     Vertex const &v3 = v[m_indices[3]];
     Vertex n = cross(v3 - v0, v1 - v0).norm();
     glBegin(GL_QUADS);
-    glNormal3dv(n.p);
+    glNormal(n);
     glColor3d(m_colours[0].r, m_colours[0].g, m_colours[0].b);
-    glVertex3dv(v0.p);
+    glVertex(v0);
     glColor3d(m_colours[1].r, m_colours[1].g, m_colours[1].b);
-    glVertex3dv(v1.p);
+    glVertex(v1);
     glColor3d(m_colours[2].r, m_colours[2].g, m_colours[2].b);
-    glVertex3dv(v2.p);
+    glVertex(v2);
     glColor3d(m_colours[3].r, m_colours[3].g, m_colours[3].b);
-    glVertex3dv(v3.p);
+    glVertex(v3);
     glEnd();
 }
 
+int GouraudQuad::vertexIndex(int corner) const
+{
+    return m_indices[corner];
+}
+
+Colour const &GouraudQuad::colour(int corner) const
+{
+    return m_colours[corner];
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Subdivision.
 
@@ -426,19 +566,25 @@ static int buildGrid(int uCount, int vCount, Quad const &quad,
                      std::vector<Vertex> const &vsIn,
                      std::vector<Vertex> &vsOut)
 {
+    PROFILE_SCOPE("buildGrid");
     int const vertexStart = vsOut.size();
     Vertex v0 = vsIn[quad.indices[0]];
     Vertex v1 = vsIn[quad.indices[1]];
     Vertex v2 = vsIn[quad.indices[2]];
     Vertex v3 = vsIn[quad.indices[3]];
 
+    // The ends of each column only depend on u.
+    std::vector<Vertex> top, bottom;
+    for (int u = 0; u < uCount + 1; ++u) {
+        top.push_back(lerp(v0, v1, static_cast<double>(u) / uCount));
+        bottom.push_back(lerp(v3, v2, static_cast<double>(u) / uCount));
+    }
+
     // Generate the grid of points we will build the quads from.
     for (int v = 0; v < vCount + 1; ++v) {
+        double const t = static_cast<double>(v) / vCount;
         for (int u = 0; u < uCount + 1; ++u) {
-            Vertex u0 = lerp(v0, v1, static_cast<double>(u) / uCount);
-            Vertex u1 = lerp(v3, v2, static_cast<double>(u) / uCount);
-            Vertex pt = lerp(u0, u1, static_cast<double>(v) / vCount);
-            vsOut.push_back(pt);
+            vsOut.push_back(lerp(top[u], bottom[u], t));
         }
     }
 
@@ -452,6 +598,8 @@ SubdivInfo subdivide(Quad const &quad,
                      std::vector<Quad> &qs,
                      int uCount, int vCount)
 {
+    PROFILE_SCOPE("subdivide");
+    PROFILE_COUNT("quads subdivided", uCount * vCount);
     int const vertexStart = buildGrid(uCount, vCount, quad, vs, vs);
 
     // Build the corners of the quads.
@@ -483,6 +631,45 @@ SubdivInfo::SubdivInfo(Quad const &baseQuad,
 {
 }
 
+SubdivInfo::SubdivInfo(Quad const &baseQuad,
+                       int uCount, int vCount,
+                       std::vector<int> const &gridVertices, int faceStart,
+                       std::vector<Vertex> const &vs,
+                       std::vector<Quad> const &qs)
+    : m_baseQuad(baseQuad),
+      m_uCount(uCount), m_vCount(vCount),
+      m_vertexStart(-1), m_faceStart(faceStart),
+      m_gridVertices(gridVertices),
+      m_vertices(vs), m_faces(qs)
+{
+}
+
+Quad const &SubdivInfo::baseQuad() const
+{
+    return m_baseQuad;
+}
+
+int SubdivInfo::uCount() const
+{
+    return m_uCount;
+}
+
+int SubdivInfo::vCount() const
+{
+    return m_vCount;
+}
+
+int SubdivInfo::vertexAt(int u, int v) const
+{
+    int const point = v * (m_uCount + 1) + u;
+    return m_gridVertices.empty() ? m_vertexStart + point : m_gridVertices[point];
+}
+
+int SubdivInfo::faceAt(int u, int v) const
+{
+    return m_faceStart + v * m_uCount + u;
+}
+
 // Quick helper to tell us if a particular grid square is emitter.
 bool SubdivInfo::emitsAt(int u, int v) const
 {
@@ -531,6 +718,47 @@ Colour SubdivInfo::colourAt(int u, int v, int offU, int offV) const
     return rawColourAt(u + offU, v + offV);
 }
 
+int SubdivInfo::gouraudQuadCount() const
+{
+    return 4 * m_uCount * m_vCount;
+}
+
+// Interpolated colours for the 3x3 "half-unit" grid over quad (u, v),
+// in reading order:
+// a b c
+// d e f
+// g h i
+void SubdivInfo::halfGridColours(int u, int v, Colour *cs) const
+{
+    // Look up colours in the quads on the unit grid:
+    Colour ca = colourAt(u, v, -1, -1);
+    Colour cb = colourAt(u, v,  0, -1);
+    Colour cc = colourAt(u, v, +1, -1);
+    Colour cd = colourAt(u, v, -1,  0);
+    Colour ce = colourAt(u, v,  0,  0);
+    Colour cf = colourAt(u, v, +1,  0);
+    Colour cg = colourAt(u, v, -1, +1);
+    Colour ch = colourAt(u, v,  0, +1);
+    Colour ci = colourAt(u, v, +1, +1);
+    // And interpolate horizontally...
+    ca = ca * 0.5 + cb * 0.5; cc = cb * 0.5 + cc * 0.5;
+    cd = cd * 0.5 + ce * 0.5; cf = ce * 0.5 + cf * 0.5;
+    cg = cg * 0.5 + ch * 0.5; ci = ch * 0.5 + ci * 0.5;
+    // And vertically.
+    ca = ca * 0.5 + cd * 0.5; cg = cd * 0.5 + cg * 0.5;
+    cb = cb * 0.5 + ce * 0.5; ch = ce * 0.5 + ch * 0.5;
+    cc = cc * 0.5 + cf * 0.5; ci = cf * 0.5 + ci * 0.5;
+    cs[0] = ca; cs[1] = cb; cs[2] = cc;
+    cs[3] = cd; cs[4] = ce; cs[5] = cf;
+    cs[6] = cg; cs[7] = ch; cs[8] = ci;
+}
+
+// Corners of the four Gouraud quads covering each unit quad, as
+// positions in the half-unit grid.
+static int const GOURAUD_CORNERS[4][4] = {
+    { 0, 1, 4, 3 }, { 1, 2, 5, 4 }, { 3, 4, 7, 6 }, { 4, 5, 8, 7 }
+};
+
 void SubdivInfo::generateGouraudQuads(
     std::vector<GouraudQuad> &qsOut,
     std::vector<Vertex> &vsOut) const
@@ -538,53 +766,243 @@ void SubdivInfo::generateGouraudQuads(
     // Build a grid 2x resolution of original:
     int const vertexStart = buildGrid(m_uCount * 2, m_vCount * 2,
                                       m_baseQuad, m_vertices, vsOut);
+    std::vector<int> grid((m_uCount * 2 + 1) * (m_vCount * 2 + 1));
+    for (int i = 0, n = grid.size(); i < n; ++i) {
+        grid[i] = vertexStart + i;
+    }
+    addGouraudQuads(grid, qsOut);
+}
+
+void SubdivInfo::addGouraudQuads(std::vector<int> const &grid,
+                                 std::vector<GouraudQuad> &qsOut) const
+{
+    int const rowLen = m_uCount * 2 + 1;
 
     // And then fill in a 2x2 "half-unit" grid for each quad in the
     // original:
     for (int v = 0; v < m_vCount; ++v) {
         for (int u = 0; u < m_uCount; ++u) {
-            // We'll arrange the grid like this:
-            // a b c
-            // d e f
-            // g h i
-            int u2 = u * 2, v2 = v * 2;
             // Find indices into the vertex array for the points we
             // need.
-            int idxa = vertexStart + v2 * (m_uCount * 2 + 1) + u2;
-            int idxd = idxa + m_uCount * 2 + 1;
-            int idxg = idxd + m_uCount * 2 + 1;
-            int idxb = idxa + 1, idxc = idxa + 2;
-            int idxe = idxd + 1, idxf = idxd + 2;
-            int idxh = idxg + 1, idxi = idxg + 2;
-            // And then look up colours in the quads on the unit grid:
-            Colour ca = colourAt(u, v, -1, -1);
-            Colour cb = colourAt(u, v,  0, -1);
-            Colour cc = colourAt(u, v, +1, -1);
-            Colour cd = colourAt(u, v, -1,  0);
-            Colour ce = colourAt(u, v,  0,  0);
-            Colour cf = colourAt(u, v, +1,  0);
-            Colour cg = colourAt(u, v, -1, +1);
-            Colour ch = colourAt(u, v,  0, +1);
-            Colour ci = colourAt(u, v, +1, +1);
-            // And interpolate horizontally...
-            ca = ca * 0.5 + cb * 0.5; cc = cb * 0.5 + cc * 0.5;
-            cd = cd * 0.5 + ce * 0.5; cf = ce * 0.5 + cf * 0.5;
-            cg = cg * 0.5 + ch * 0.5; ci = ch * 0.5 + ci * 0.5;
-            // And vertically.
-            ca = ca * 0.5 + cd * 0.5; cg = cd * 0.5 + cg * 0.5;
-            cb = cb * 0.5 + ce * 0.5; ch = ce * 0.5 + ch * 0.5;
-            cc = cc * 0.5 + cf * 0.5; ci = cf * 0.5 + ci * 0.5;
+            int idxa = v * 2 * rowLen + u * 2;
+            int idxs[9];
+            for (int k = 0; k < 9; ++k) {
+                idxs[k] = grid[idxa + (k / 3) * rowLen + k % 3];
+            }
+            Colour cs[9];
+            halfGridColours(u, v, cs);
             // And then create the quads
-            qsOut.push_back(GouraudQuad(idxa, idxb, idxe, idxd,
-                                        ca,   cb,   ce,   cd));
-            qsOut.push_back(GouraudQuad(idxb, idxc, idxf, idxe,
-                                        cb,   cc,   cf,   ce));
-            qsOut.push_back(GouraudQuad(idxd, idxe, idxh, idxg,
-                                        cd,   ce,   ch,   cg));
-            qsOut.push_back(GouraudQuad(idxe, idxf, idxi, idxh,
-                                        ce,   cf,   ci,   ch));
+            for (int q = 0; q < 4; ++q) {
+                int const *c = GOURAUD_CORNERS[q];
+                qsOut.push_back(GouraudQuad(idxs[c[0]], idxs[c[1]],
+                                            idxs[c[2]], idxs[c[3]],
+                                            cs[c[0]], cs[c[1]],
+                                            cs[c[2]], cs[c[3]]));
+            }
+        }
+    }
+}
+
+void SubdivInfo::generateGouraudColours(std::vector<Colour> &coloursOut) const
+{
+    for (int v = 0; v < m_vCount; ++v) {
+        for (int u = 0; u < m_uCount; ++u) {
+            Colour cs[9];
+            halfGridColours(u, v, cs);
+            for (int q = 0; q < 4; ++q) {
+                for (int k = 0; k < 4; ++k) {
+                    coloursOut.push_back(cs[GOURAUD_CORNERS[q][k]]);
+                }
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Building many subdivisions at once.
+
+void MeshBuilder::add(Quad const &quad, int uCount, int vCount)
+{
+    Grid g = { quad, uCount, vCount };
+    m_grids.push_back(g);
+}
+
+bool MeshBuilder::Edge::operator<(Edge const &other) const
+{
+    if (from != other.from) {
+        return from < other.from;
+    }
+    if (to != other.to) {
+        return to < other.to;
+    }
+    return segments < other.segments;
+}
+
+MeshBuilder::Edge MeshBuilder::edge(int a, int b, int segments)
+{
+    Edge e = { std::min(a, b), std::max(a, b), segments };
+    return e;
+}
+
+size_t MeshBuilder::countVertices() const
+{
+    std::set<int> corners;
+    std::set<Edge> edges;
+    size_t count = 0;
+    for (int i = 0, n = m_grids.size(); i < n; ++i) {
+        Grid const &g = m_grids[i];
+        int const *c = g.quad.indices;
+        corners.insert(c, c + 4);
+        Edge const es[4] = {
+            edge(c[0], c[1], g.uCount), edge(c[1], c[2], g.vCount),
+            edge(c[3], c[2], g.uCount), edge(c[0], c[3], g.vCount)
+        };
+        for (int k = 0; k < 4; ++k) {
+            if (edges.insert(es[k]).second) {
+                count += es[k].segments - 1;
+            }
+        }
+        count += (g.uCount - 1) * (g.vCount - 1);
+    }
+    return count + corners.size();
+}
+
+void MeshBuilder::placeGrid(Grid const &g,
+                            std::vector<Vertex> const &vsIn,
+                            std::vector<Vertex> &vsOut)
+{
+    int const uCount = g.uCount;
+    int const vCount = g.vCount;
+    int const *c = g.quad.indices;
+
+    // As buildGrid, the ends of each column first.
+    m_top.clear();
+    m_bottom.clear();
+    for (int u = 0; u < uCount + 1; ++u) {
+        double const s = static_cast<double>(u) / uCount;
+        m_top.push_back(lerp(vsIn[c[0]], vsIn[c[1]], s));
+        m_bottom.push_back(lerp(vsIn[c[3]], vsIn[c[2]], s));
+    }
+
+    // The edges, in the order bottom, right, top, left, each running
+    // from the lower u or v. A new edge reserves its run of points,
+    // which are filled in below.
+    int const ends[4][2] = {
+        { c[0], c[1] }, { c[1], c[2] }, { c[3], c[2] }, { c[0], c[3] }
+    };
+    int starts[4];
+    bool created[4];
+    bool forwards[4];
+    for (int k = 0; k < 4; ++k) {
+        int const segments = k % 2 == 0 ? uCount : vCount;
+        Edge const e = edge(ends[k][0], ends[k][1], segments);
+        std::map<Edge, int>::iterator iter = m_edges.find(e);
+        created[k] = iter == m_edges.end();
+        if (created[k]) {
+            iter = m_edges.insert(std::make_pair(e, int(vsOut.size()))).first;
+            vsOut.insert(vsOut.end(), segments - 1, Vertex(0.0, 0.0, 0.0));
         }
+        starts[k] = iter->second;
+        forwards[k] = e.from == ends[k][0];
+    }
+
+    m_gridVertices.resize((uCount + 1) * (vCount + 1));
+    for (int v = 0; v < vCount + 1; ++v) {
+        double const t = static_cast<double>(v) / vCount;
+        for (int u = 0; u < uCount + 1; ++u) {
+            int &index = m_gridVertices[v * (uCount + 1) + u];
+            bool const uEdge = u == 0 || u == uCount;
+            bool const vEdge = v == 0 || v == vCount;
+            if (uEdge && vEdge) {
+                int const corner = v == 0 ? (u == 0 ? c[0] : c[1]) :
+                                            (u == 0 ? c[3] : c[2]);
+                std::map<int, int>::iterator iter = m_corners.find(corner);
+                if (iter != m_corners.end()) {
+                    index = iter->second;
+                    continue;
+                }
+                index = vsOut.size();
+                m_corners[corner] = index;
+                vsOut.push_back(lerp(m_top[u], m_bottom[u], t));
+            } else if (uEdge || vEdge) {
+                int const k = v == 0 ? 0 : u == uCount ? 1 : v == vCount ? 2 : 3;
+                int const segments = k % 2 == 0 ? uCount : vCount;
+                int const along = k % 2 == 0 ? u : v;
+                index = starts[k] + (forwards[k] ? along - 1 : segments - along - 1);
+                if (created[k]) {
+                    vsOut[index] = lerp(m_top[u], m_bottom[u], t);
+                }
+            } else {
+                index = vsOut.size();
+                vsOut.push_back(lerp(m_top[u], m_bottom[u], t));
+            }
+        }
+    }
+}
+
+void MeshBuilder::build(std::vector<Vertex> &vs,
+                        std::vector<Quad> &qs,
+                        std::vector<SubdivInfo> &subdivs)
+{
+    PROFILE_SCOPE("MeshBuilder::build");
+    m_corners.clear();
+    m_edges.clear();
+
+    size_t faces = 0;
+    for (int i = 0, n = m_grids.size(); i < n; ++i) {
+        faces += m_grids[i].uCount * m_grids[i].vCount;
+    }
+    vs.reserve(vs.size() + countVertices());
+    qs.reserve(qs.size() + faces);
+    subdivs.reserve(subdivs.size() + m_grids.size());
+
+    for (int i = 0, n = m_grids.size(); i < n; ++i) {
+        Grid const &g = m_grids[i];
+        PROFILE_COUNT("quads subdivided", g.uCount * g.vCount);
+        // Nothing reallocates, so the corners can be read from "vs"
+        // as it grows.
+        placeGrid(g, vs, vs);
+
+        int const faceStart = qs.size();
+        int const rowLen = g.uCount + 1;
+        for (int v = 0; v < g.vCount; ++v) {
+            for (int u = 0; u < g.uCount; ++u) {
+                int const *p = &m_gridVertices[v * rowLen + u];
+                qs.push_back(Quad(p[0], p[1], p[rowLen + 1], p[rowLen],
+                                  g.quad.materialColour));
+                qs.back().isEmitter = g.quad.isEmitter;
+                qs.back().isSpecular = g.quad.isSpecular;
+            }
+        }
+        subdivs.push_back(SubdivInfo(g.quad, g.uCount, g.vCount,
+                                     m_gridVertices, faceStart, vs, qs));
+    }
+    m_grids.clear();
+}
+
+void MeshBuilder::buildGouraud(std::vector<SubdivInfo> const &subdivs,
+                               std::vector<GouraudQuad> &qsOut,
+                               std::vector<Vertex> &vsOut)
+{
+    PROFILE_SCOPE("MeshBuilder::buildGouraud");
+    m_grids.clear();
+    m_corners.clear();
+    m_edges.clear();
+
+    size_t quads = 0;
+    for (int i = 0, n = subdivs.size(); i < n; ++i) {
+        SubdivInfo const &info = subdivs[i];
+        add(info.baseQuad(), info.uCount() * 2, info.vCount() * 2);
+        quads += info.gouraudQuadCount();
+    }
+    vsOut.reserve(vsOut.size() + countVertices());
+    qsOut.reserve(qsOut.size() + quads);
+
+    for (int i = 0, n = subdivs.size(); i < n; ++i) {
+        placeGrid(m_grids[i], subdivs[i].m_vertices, vsOut);
+        subdivs[i].addGouraudQuads(m_gridVertices, qsOut);
     }
+    m_grids.clear();
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -15,71 +15,102 @@
 #endif
 
 #include <iostream>
+#include <map>
 #include <vector>
 
+#include "real.h"
+
 ////////////////////////////////////////////////////////////////////////
 // Yet another 3d point class
+//
+// Vertices and colours are templated on their precision, with the
+// members in geom.cpp, instantiated for float and double. The rest of
+// the code uses the Vertex and Colour of the build's real_t.
 
-class Vertex
+template<typename T>
+class BasicVertex
 {
 public:
-    Vertex(double ix, double iy, double iz);
-    Vertex(Vertex const &v);
-
-    double len() const;
-    Vertex norm() const;
-    Vertex perp() const;
-    Vertex scale(double s) const;
-
-    Vertex operator+(Vertex const &rhs) const;
-    Vertex operator-(Vertex const &rhs) const;
-    Vertex operator*(float otherNum) const;    
-
-    double x() const;
-    double y() const;
-    double z() const;
-
-    double p[3];
+    BasicVertex(T ix, T iy, T iz);
+    BasicVertex(BasicVertex const &v);
+    // Between precisions.
+    template<typename U>
+    explicit BasicVertex(BasicVertex<U> const &v)
+        : p {T(v.x()), T(v.y()), T(v.z())}
+    {
+    }
+
+    T len() const;
+    BasicVertex norm() const;
+    BasicVertex perp() const;
+    BasicVertex scale(T s) const;
+
+    BasicVertex operator+(BasicVertex const &rhs) const;
+    BasicVertex operator-(BasicVertex const &rhs) const;
+    BasicVertex operator*(T otherNum) const;
+
+    T x() const;
+    T y() const;
+    T z() const;
+
+    T p[3];
 };
 
-std::ostream &operator<<(std::ostream &os, Vertex const &v);
+typedef BasicVertex<real_t> Vertex;
+
+template<typename T>
+std::ostream &operator<<(std::ostream &os, BasicVertex<T> const &v);
 
 // Cross product.
-Vertex cross(Vertex const &v1, Vertex const &v2);
+template<typename T>
+BasicVertex<T> cross(BasicVertex<T> const &v1, BasicVertex<T> const &v2);
 
 // Dot product.
-double dot(Vertex const &v1, Vertex const &v2);
+template<typename T>
+T dot(BasicVertex<T> const &v1, BasicVertex<T> const &v2);
 
 // Orthogonalise v1, taking away the v2 component.
-Vertex orthog(Vertex const &v1, Vertex const &v2);
+template<typename T>
+BasicVertex<T> orthog(BasicVertex<T> const &v1, BasicVertex<T> const &v2);
 
 // Linear interpolation. 0 returns v1, 1 returns v2.
-Vertex lerp(Vertex const &v1, Vertex const &v2, double i);
+template<typename T>
+BasicVertex<T> lerp(BasicVertex<T> const &v1, BasicVertex<T> const &v2, double i);
 
-float dist(Vertex const &v1, Vertex const &v2);
+template<typename T>
+T dist(BasicVertex<T> const &v1, BasicVertex<T> const &v2);
 
 ////////////////////////////////////////////////////////////////////////
 // Colours
 
 // Simple red, green and blue components aren't particularly
 // realistic, physically, but they'll do for us.
-class Colour
+template<typename T>
+class BasicColour
 {
 public:
-    Colour(double red, double green, double blue);
-    Colour(Colour const &c);
-    Colour();
-
-    Colour operator*(double x) const;
-    Colour operator*(Colour const &c) const;
-    Colour operator+(Colour const &c) const;;
-    Colour &operator+=(Colour const &c);
-
-    double asGrey() const;
-
-    double r, g, b;
+    BasicColour(T red, T green, T blue);
+    BasicColour(BasicColour const &c);
+    BasicColour();
+    // Between precisions.
+    template<typename U>
+    explicit BasicColour(BasicColour<U> const &c)
+        : r(c.r), g(c.g), b(c.b)
+    {
+    }
+
+    BasicColour operator*(T x) const;
+    BasicColour operator*(BasicColour const &c) const;
+    BasicColour operator+(BasicColour const &c) const;
+    BasicColour &operator+=(BasicColour const &c);
+
+    T asGrey() const;
+
+    T r, g, b;
 };
 
+typedef BasicColour<real_t> Colour;
+
 ////////////////////////////////////////////////////////////////////////
 // And a quadrilateral
 
@@ -91,8 +122,9 @@ public:
          Colour const &c);
 
     void render(std::vector<Vertex> const &v) const;
-    // For transfer calculations.
-    void renderIndex(int index, std::vector<Vertex> const &v) const;
+    // For transfer calculations. Draws the quad in a flat colour
+    // that encodes "index", see encodeIndex.
+    void renderIndex(unsigned index, std::vector<Vertex> const &v) const;
 
     int indices[4];
     // Does this quad emit light, or just reflect?
@@ -105,6 +137,23 @@ public:
     Colour screenColour;
 };
 
+// Quad indices are drawn as RGBA8 colours for the transfer
+// calculations, one byte per channel with red lowest, so all 32 bits
+// are used. Index 0 is left for the background.
+inline void encodeIndex(unsigned index, GLubyte *rgba)
+{
+    rgba[0] = index & 0xFF;
+    rgba[1] = (index >> 8) & 0xFF;
+    rgba[2] = (index >> 16) & 0xFF;
+    rgba[3] = (index >> 24) & 0xFF;
+}
+
+inline unsigned decodeIndex(GLubyte const *rgba)
+{
+    return rgba[0] | (rgba[1] << 8) | (rgba[2] << 16) |
+        (static_cast<unsigned>(rgba[3]) << 24);
+}
+
 // Return the centre of the quad. Assumes paralellogram.
 Vertex paraCentre(Quad const &q, std::vector<Vertex> const &vs);
 
@@ -116,6 +165,15 @@ Vertex paraCross(Quad const &q, std::vector<Vertex> const &vs);
 // Find area of given parallelogram.
 double paraArea(Quad const &q, std::vector<Vertex> const &vs);
 
+// Does the segment from "from" to "to" pass through the given
+// parallelogram? Touching it at the endpoints doesn't count.
+bool paraIntersect(Quad const &q, std::vector<Vertex> const &vs,
+                   Vertex const &from, Vertex const &to);
+
+// Distance from "p" to the nearest point of the given parallelogram.
+double paraDistance(Quad const &q, std::vector<Vertex> const &vs,
+                    Vertex const &p);
+
 // Translate the given quads, in-place
 void translate(Vertex const &t,
            std::vector<Quad> &qs,
@@ -147,6 +205,10 @@ public:
 
     void render(std::vector<Vertex> const &v) const;
 
+    // Vertex index and colour of each corner.
+    int vertexIndex(int corner) const;
+    Colour const &colour(int corner) const;
+
 private:
     int m_indices[4];
     Colour m_colours[4];
@@ -166,22 +228,52 @@ public:
                int vertexStart, int faceStart,
                std::vector<Vertex> const &vs,
                std::vector<Quad> const &qs);
+    // For grids whose points aren't contiguous: "gridVertices" has
+    // the index of each point, row by row.
+    SubdivInfo(Quad const &baseQuad,
+               int uCount, int vCount,
+               std::vector<int> const &gridVertices, int faceStart,
+               std::vector<Vertex> const &vs,
+               std::vector<Quad> const &qs);
 
     void generateGouraudQuads(std::vector<GouraudQuad> &qsOut,
                               std::vector<Vertex> &vsOut) const;
+    // Just the colours generateGouraudQuads would give, four per
+    // Gouraud quad in the same order, for when only the lighting has
+    // changed.
+    void generateGouraudColours(std::vector<Colour> &coloursOut) const;
+    // Number of Gouraud quads generated.
+    int gouraudQuadCount() const;
+
+    Quad const &baseQuad() const;
+    int uCount() const;
+    int vCount() const;
+    // Index of the grid point (u, v), for 0 <= u <= uCount, 0 <= v
+    // <= vCount.
+    int vertexAt(int u, int v) const;
+    // Index of the subdivided quad at (u, v).
+    int faceAt(int u, int v) const;
 
 private:
     bool emitsAt(int u, int v) const;
     Colour const &rawColourAt(int u, int v) const;
     Colour colourAt(int u, int v, int offU, int offV) const;
+    void halfGridColours(int u, int v, Colour *cs) const;
+    // Gouraud quads over the 2x resolution grid, whose points'
+    // vertex indices are given by "grid", row by row.
+    void addGouraudQuads(std::vector<int> const &grid,
+                         std::vector<GouraudQuad> &qsOut) const;
 
     friend class GeomTestCase;
+    friend class MeshBuilder;
 
     Quad m_baseQuad;
     int m_uCount;
     int m_vCount;
     int m_vertexStart;
     int m_faceStart;
+    // Empty if the grid's points are contiguous from m_vertexStart.
+    std::vector<int> m_gridVertices;
     std::vector<Vertex> const &m_vertices;
     std::vector<Quad> const &m_faces;
 
@@ -194,6 +286,71 @@ SubdivInfo subdivide(Quad const &quad,
                      std::vector<Quad> &qs,
                      int uCount, int vCount);
 
+// Subdivides many quads at once. The output sizes are worked out
+// before anything is written, so each array grows just once, and the
+// vertices along an edge shared by two of the quads, subdivided
+// alike along it, are only created once. Edges are matched by their
+// end points' indices. A builder can be reused, keeping its
+// working space.
+class MeshBuilder
+{
+public:
+    // Queue "quad", with indices into the vertices passed to build,
+    // to be broken into uCount by vCount quads.
+    void add(Quad const &quad, int uCount, int vCount);
+
+    // Subdivide the queued quads in order, as subdivide would, adding
+    // the new quads to "qs", the new vertices to "vs" and a SubdivInfo
+    // per quad to "subdivs". Empties the queue.
+    void build(std::vector<Vertex> &vs,
+               std::vector<Quad> &qs,
+               std::vector<SubdivInfo> &subdivs);
+
+    // The Gouraud quads generateGouraudQuads would give for each of
+    // "subdivs", in order, with the vertices shared as above.
+    void buildGouraud(std::vector<SubdivInfo> const &subdivs,
+                      std::vector<GouraudQuad> &qsOut,
+                      std::vector<Vertex> &vsOut);
+
+private:
+    struct Grid
+    {
+        Quad quad;
+        int uCount;
+        int vCount;
+    };
+
+    // An edge between two vertices, lowest index first, in so many
+    // segments.
+    struct Edge
+    {
+        bool operator<(Edge const &other) const;
+
+        int from;
+        int to;
+        int segments;
+    };
+
+    static Edge edge(int a, int b, int segments);
+
+    // New vertices needed for m_grids, after sharing.
+    size_t countVertices() const;
+    // Find or create each point of "g"'s grid, with the corners taken
+    // from "vsIn", putting their indices in m_gridVertices.
+    void placeGrid(Grid const &g,
+                   std::vector<Vertex> const &vsIn,
+                   std::vector<Vertex> &vsOut);
+
+    std::vector<Grid> m_grids;
+    // Working space, kept between builds.
+    std::map<int, int> m_corners;
+    // The first of an edge's run of interior points, from "from".
+    std::map<Edge, int> m_edges;
+    std::vector<int> m_gridVertices;
+    std::vector<Vertex> m_top;
+    std::vector<Vertex> m_bottom;
+};
+
 ////////////////////////////////////////////////////////////////////////
 // Basic shapes.
 
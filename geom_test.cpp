@@ -35,6 +35,7 @@ private:
     CPPUNIT_TEST(testVertexOrthog);
     CPPUNIT_TEST(testVertexCross);
     CPPUNIT_TEST(testVertexLerp);
+    CPPUNIT_TEST(testVertexFloat);
     // Colour cases
     CPPUNIT_TEST(testColourConstructExplicit);
     CPPUNIT_TEST(testColourConstructCopy);
@@ -49,8 +50,15 @@ private:
     CPPUNIT_TEST(testParaCentre);
     CPPUNIT_TEST(testParaCross);
     CPPUNIT_TEST(testParaArea);
+    CPPUNIT_TEST(testParaIntersect);
+    CPPUNIT_TEST(testParaDistance);
+    CPPUNIT_TEST(testIndexEncoding);
     CPPUNIT_TEST(testQuadTrivialSubdivision);
     CPPUNIT_TEST(testQuadSubdivision);
+    CPPUNIT_TEST(testSubdivIndices);
+    CPPUNIT_TEST(testGouraudColours);
+    CPPUNIT_TEST(testMeshBuilder);
+    CPPUNIT_TEST(testMeshBuilderGouraud);
     CPPUNIT_TEST(testScale);
     CPPUNIT_TEST(testRotation);
     CPPUNIT_TEST(testTranslation);
@@ -75,6 +83,7 @@ private:
     void testVertexOrthog();
     void testVertexCross();
     void testVertexLerp();
+    void testVertexFloat();
     // Colour cases
     void testColourConstructExplicit();
     void testColourConstructCopy();
@@ -89,8 +98,15 @@ private:
     void testParaCentre();
     void testParaCross();
     void testParaArea();
+    void testParaIntersect();
+    void testParaDistance();
+    void testIndexEncoding();
     void testQuadTrivialSubdivision();
     void testQuadSubdivision();
+    void testSubdivIndices();
+    void testGouraudColours();
+    void testMeshBuilder();
+    void testMeshBuilderGouraud();
     void testScale();
     void testRotation();
     void testTranslation();
@@ -99,6 +115,8 @@ private:
     void testCubeProperties();
     // Helpers
     void assertVectorsEqual(Vertex const &v1, Vertex const &v2);
+    void buildCubeMesh(std::vector<Vertex> &vs, std::vector<Quad> &qs,
+                       std::vector<SubdivInfo> &subdivs);
 };
 
 Colour const GeomTestCase::TEST_COLOUR = Colour(0.1, 0.2, 0.3);
@@ -267,6 +285,29 @@ void GeomTestCase::testVertexLerp()
     assertVectorsEqual(v025, lerp(v000, v100, 0.25));
 }
 
+// The single precision versions, whatever the build uses.
+void GeomTestCase::testVertexFloat()
+{
+    BasicVertex<float> v1(1.0f, 2.0f, 2.0f);
+    BasicVertex<float> v2(0.0f, 1.0f, 0.0f);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, v1.len(), 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, dot(v1, v2), 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(3.0, dist(v1, BasicVertex<float>(0.0f, 0.0f, 0.0f)), 1e-6);
+    BasicVertex<float> c = cross(v1, v2);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(-2.0, c.x(), 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, c.y(), 1e-6);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, c.z(), 1e-6);
+    BasicVertex<float> half = lerp(v1, v2, 0.5);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.5, half.y(), 1e-6);
+
+    // Converting keeps the value, to float's precision.
+    BasicVertex<double> d(BasicVertex<float>(0.1f, 0.2f, 0.3f));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.1, d.x(), 1e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.3, d.z(), 1e-7);
+    BasicColour<float> f(BasicColour<double>(0.1, 0.2, 0.3) * 2.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.4, f.g, 1e-7);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Colour cases
 
@@ -389,6 +430,75 @@ void GeomTestCase::testParaArea()
     CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, paraArea(q, vs), 1e-9);
 }
 
+void GeomTestCase::testParaIntersect()
+{
+    std::vector<Vertex> vs;
+    vs.push_back(Vertex(1.0, 0.0, 0.0));
+    vs.push_back(Vertex(1.0, 1.0, 0.0));
+    vs.push_back(Vertex(2.0, 2.0, 0.0));
+    vs.push_back(Vertex(2.0, 1.0, 0.0));
+    Quad q(0, 1, 2, 3, TEST_COLOUR);
+    // Straight through, either way.
+    CPPUNIT_ASSERT(paraIntersect(q, vs, Vertex(1.5, 1.0, -1.0),
+                                 Vertex(1.5, 1.0, 1.0)));
+    CPPUNIT_ASSERT(paraIntersect(q, vs, Vertex(1.5, 1.0, 1.0),
+                                 Vertex(1.2, 0.5, -1.0)));
+    // Misses the sheared sides.
+    CPPUNIT_ASSERT(!paraIntersect(q, vs, Vertex(1.1, 1.5, -1.0),
+                                  Vertex(1.1, 1.5, 1.0)));
+    // Stops short, or starts on the quad.
+    CPPUNIT_ASSERT(!paraIntersect(q, vs, Vertex(1.5, 1.0, -1.0),
+                                  Vertex(1.5, 1.0, -0.1)));
+    CPPUNIT_ASSERT(!paraIntersect(q, vs, Vertex(1.5, 1.0, 0.0),
+                                  Vertex(1.5, 1.0, 1.0)));
+    // Parallel.
+    CPPUNIT_ASSERT(!paraIntersect(q, vs, Vertex(0.0, 1.0, 0.0),
+                                  Vertex(3.0, 1.0, 0.0)));
+}
+
+void GeomTestCase::testParaDistance()
+{
+    std::vector<Vertex> vs;
+    vs.push_back(Vertex(1.0, 0.0, 0.0));
+    vs.push_back(Vertex(1.0, 1.0, 0.0));
+    vs.push_back(Vertex(2.0, 2.0, 0.0));
+    vs.push_back(Vertex(2.0, 1.0, 0.0));
+    Quad q(0, 1, 2, 3, TEST_COLOUR);
+    double const EPSILON = 1.0e-6;
+    // Above the middle, and on it.
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5, paraDistance(q, vs, Vertex(1.5, 1.0, 0.5)),
+                                 EPSILON);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, paraDistance(q, vs, Vertex(1.5, 1.0, 0.0)),
+                                 EPSILON);
+    // Beside a sheared edge, in the plane: the nearest point is on
+    // the edge from (1, 0) to (2, 1), not its bounding box.
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(std::sqrt(0.5),
+                                 paraDistance(q, vs, Vertex(2.0, 0.0, 0.0)),
+                                 EPSILON);
+    // Off a corner.
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(std::sqrt(2.0),
+                                 paraDistance(q, vs, Vertex(3.0, 2.0, 1.0)),
+                                 EPSILON);
+}
+
+void GeomTestCase::testIndexEncoding()
+{
+    unsigned const indices[] = { 0, 1, 0xFF, 0x100, 0x40000, 0x123456,
+                                 0x1000000, 0xFFFFFFFF };
+    for (int i = 0; i < 8; ++i) {
+        GLubyte rgba[4];
+        encodeIndex(indices[i], rgba);
+        CPPUNIT_ASSERT_EQUAL(indices[i], decodeIndex(rgba));
+    }
+    // Every bit of every channel is used.
+    GLubyte rgba[4];
+    encodeIndex(0x04030201, rgba);
+    CPPUNIT_ASSERT_EQUAL(1, int(rgba[0]));
+    CPPUNIT_ASSERT_EQUAL(2, int(rgba[1]));
+    CPPUNIT_ASSERT_EQUAL(3, int(rgba[2]));
+    CPPUNIT_ASSERT_EQUAL(4, int(rgba[3]));
+}
+
 void GeomTestCase::testQuadTrivialSubdivision()
 {
     std::vector<Vertex> vs;
@@ -452,6 +562,140 @@ void GeomTestCase::testQuadSubdivision()
     CPPUNIT_ASSERT_EQUAL(0, info.m_faceStart);   // First entry in fresh vector.
 }
 
+void GeomTestCase::testSubdivIndices()
+{
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs;
+    subdivide(cubeFaces[0], vs, qs, 2, 2);
+    SubdivInfo info = subdivide(cubeFaces[1], vs, qs, 3, 2);
+    CPPUNIT_ASSERT_EQUAL(3, info.uCount());
+    CPPUNIT_ASSERT_EQUAL(2, info.vCount());
+    CPPUNIT_ASSERT_EQUAL(cubeFaces[1].indices[2], info.baseQuad().indices[2]);
+    for (int v = 0; v < 2; ++v) {
+        for (int u = 0; u < 3; ++u) {
+            Quad const &q = qs[info.faceAt(u, v)];
+            CPPUNIT_ASSERT_EQUAL(info.vertexAt(u, v), q.indices[0]);
+            CPPUNIT_ASSERT_EQUAL(info.vertexAt(u + 1, v), q.indices[1]);
+            CPPUNIT_ASSERT_EQUAL(info.vertexAt(u + 1, v + 1), q.indices[2]);
+            CPPUNIT_ASSERT_EQUAL(info.vertexAt(u, v + 1), q.indices[3]);
+        }
+    }
+}
+
+// The colours alone match those of the full Gouraud quads.
+void GeomTestCase::testGouraudColours()
+{
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs;
+    SubdivInfo info = subdivide(cubeFaces[0], vs, qs, 3, 2);
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        qs[i].screenColour = Colour(0.1 * i, 0.2, 1.0 - 0.1 * i);
+    }
+    qs[4].isEmitter = true;
+
+    std::vector<GouraudQuad> gouraud;
+    std::vector<Vertex> gouraudVertices;
+    info.generateGouraudQuads(gouraud, gouraudVertices);
+    std::vector<Colour> colours;
+    info.generateGouraudColours(colours);
+
+    CPPUNIT_ASSERT_EQUAL(info.gouraudQuadCount(), int(gouraud.size()));
+    CPPUNIT_ASSERT_EQUAL(4 * gouraud.size(), colours.size());
+    for (int i = 0, n = gouraud.size(); i < n; ++i) {
+        for (int k = 0; k < 4; ++k) {
+            CPPUNIT_ASSERT_EQUAL(gouraud[i].colour(k).r, colours[4 * i + k].r);
+            CPPUNIT_ASSERT_EQUAL(gouraud[i].colour(k).b, colours[4 * i + k].b);
+        }
+    }
+}
+
+// The same quads as subdividing each face by itself, but with the
+// cube's edges and corners shared.
+void GeomTestCase::testMeshBuilder()
+{
+    int const n = 4;
+    std::vector<Vertex> vs(cubeVertices);
+    std::vector<Quad> qs;
+    std::vector<SubdivInfo> subdivs;
+    MeshBuilder builder;
+    for (int i = 0, m = cubeFaces.size(); i < m; ++i) {
+        builder.add(cubeFaces[i], n, i == 5 ? n - 1 : n);
+    }
+    builder.build(vs, qs, subdivs);
+
+    std::vector<Vertex> expectedVs(cubeVertices);
+    std::vector<Quad> expectedQs;
+    for (int i = 0, m = cubeFaces.size(); i < m; ++i) {
+        subdivide(cubeFaces[i], expectedVs, expectedQs, n, i == 5 ? n - 1 : n);
+    }
+
+    // Face 5 is split differently along two of its edges, so those
+    // aren't shared.
+    int const created = 5 * (n - 1) * (n - 1) + (n - 1) * (n - 2) +
+                        12 * (n - 1) + 2 * (n - 2) + 8;
+    CPPUNIT_ASSERT_EQUAL(cubeVertices.size() + created, vs.size());
+    CPPUNIT_ASSERT_EQUAL(vs.size(), vs.capacity());
+    CPPUNIT_ASSERT_EQUAL(expectedQs.size(), qs.size());
+    CPPUNIT_ASSERT_EQUAL(cubeFaces.size(), subdivs.size());
+    for (int i = 0, m = qs.size(); i < m; ++i) {
+        CPPUNIT_ASSERT_EQUAL(expectedQs[i].isEmitter, qs[i].isEmitter);
+        for (int k = 0; k < 4; ++k) {
+            assertVectorsEqual(expectedVs[expectedQs[i].indices[k]],
+                               vs[qs[i].indices[k]]);
+        }
+    }
+
+    for (int s = 0, m = subdivs.size(); s < m; ++s) {
+        SubdivInfo const &info = subdivs[s];
+        for (int v = 0; v < info.vCount(); ++v) {
+            for (int u = 0; u < info.uCount(); ++u) {
+                Quad const &q = qs[info.faceAt(u, v)];
+                CPPUNIT_ASSERT_EQUAL(info.vertexAt(u, v), q.indices[0]);
+                CPPUNIT_ASSERT_EQUAL(info.vertexAt(u + 1, v + 1), q.indices[2]);
+            }
+        }
+    }
+
+    // Faces 0 and 1 share the edge from vertex 3 to vertex 2, along
+    // the top of one and the bottom of the other.
+    SubdivInfo const &a = subdivs[0];
+    SubdivInfo const &b = subdivs[1];
+    for (int u = 0; u <= n; ++u) {
+        CPPUNIT_ASSERT_EQUAL(a.vertexAt(u, n), b.vertexAt(u, 0));
+    }
+}
+
+// Shared vertices, but otherwise what generateGouraudQuads gives.
+void GeomTestCase::testMeshBuilderGouraud()
+{
+    std::vector<Vertex> vs;
+    std::vector<Quad> qs;
+    std::vector<SubdivInfo> subdivs;
+    buildCubeMesh(vs, qs, subdivs);
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        qs[i].screenColour = Colour(0.01 * i, 0.2, 1.0 - 0.01 * i);
+    }
+
+    std::vector<GouraudQuad> expected;
+    std::vector<Vertex> expectedVs;
+    for (int i = 0, n = subdivs.size(); i < n; ++i) {
+        subdivs[i].generateGouraudQuads(expected, expectedVs);
+    }
+    std::vector<GouraudQuad> gouraud;
+    std::vector<Vertex> gouraudVs;
+    MeshBuilder().buildGouraud(subdivs, gouraud, gouraudVs);
+
+    CPPUNIT_ASSERT_EQUAL(expected.size(), gouraud.size());
+    CPPUNIT_ASSERT(gouraudVs.size() < expectedVs.size());
+    for (int i = 0, n = gouraud.size(); i < n; ++i) {
+        for (int k = 0; k < 4; ++k) {
+            assertVectorsEqual(expectedVs[expected[i].vertexIndex(k)],
+                               gouraudVs[gouraud[i].vertexIndex(k)]);
+            CPPUNIT_ASSERT_EQUAL(expected[i].colour(k).r, gouraud[i].colour(k).r);
+        }
+    }
+}
+
 void GeomTestCase::testFlip()
 {
     std::vector<Vertex> vs;
@@ -547,3 +791,16 @@ void GeomTestCase::assertVectorsEqual(Vertex const &v1, Vertex const &v2)
 {
     CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, (v1 - v2).len(), 1e-9);
 }
+
+void GeomTestCase::buildCubeMesh(std::vector<Vertex> &vs,
+                                 std::vector<Quad> &qs,
+                                 std::vector<SubdivInfo> &subdivs)
+{
+    vs = cubeVertices;
+    MeshBuilder builder;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        builder.add(cubeFaces[i], 3, 2);
+    }
+    builder.build(vs, qs, subdivs);
+    qs[4].isEmitter = true;
+}
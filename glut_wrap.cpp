@@ -5,38 +5,285 @@
 // Copyright (c) Simon Frankau 2018
 //
 
+// Needed for the GLSL entry points outside MacOS.
+#define GL_GLEXT_PROTOTYPES
+
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
 #include <GL/glut.h>
 #endif
 
+#ifdef RADIOSITY_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef RADIOSITY_HAVE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "glut_wrap.h"
 
+////////////////////////////////////////////////////////////////////////
+// Context creation backends.
+
+static GLBackend backend = GL_BACKEND_GLUT;
+
+bool parseGLBackend(std::string const &name, GLBackend &result)
+{
+    if (name == "glut") {
+        result = GL_BACKEND_GLUT;
+    } else if (name == "egl") {
+        result = GL_BACKEND_EGL;
+    } else if (name == "osmesa") {
+        result = GL_BACKEND_OSMESA;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void setBackend(std::string const &name)
+{
+    if (!parseGLBackend(name, backend)) {
+        throw std::runtime_error("Unknown GL backend: " + name);
+    }
+#ifndef RADIOSITY_HAVE_EGL
+    if (backend == GL_BACKEND_EGL) {
+        throw std::runtime_error("Not built with EGL support");
+    }
+#endif
+#ifndef RADIOSITY_HAVE_OSMESA
+    if (backend == GL_BACKEND_OSMESA) {
+        throw std::runtime_error("Not built with OSMesa support");
+    }
+#endif
+}
+
+void gwInit(int *argc, char **argv)
+{
+    char const *env = getenv("RADIOSITY_GL_BACKEND");
+    if (env != NULL && *env != '\0') {
+        setBackend(env);
+    }
+    int out = 1;
+    for (int i = 1; i < *argc; ++i) {
+        if (strncmp(argv[i], "-gl=", 4) == 0) {
+            setBackend(argv[i] + 4);
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    *argc = out;
+    argv[out] = NULL;
+
+    if (backend == GL_BACKEND_GLUT) {
+        glutInit(argc, argv);
+    }
+}
+
+GLBackend gwBackend()
+{
+    return backend;
+}
+
 static void doNothing()
 {
 }
 
-int gwTransferSetup(int size)
+static int glutSetup(int size)
 {
     // Configure window
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
+    // Quad indices use the alpha channel too.
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_ALPHA | GLUT_DEPTH);
     glutInitWindowSize(size, size);
     int win = glutCreateWindow("Transfer calculator");
     // This is needed as otherwise any glutMainLoop called gets
     // unhappy, even if we've already destroyed the window.
     glutDisplayFunc(doNothing);
+    return win;
+}
+
+#ifdef RADIOSITY_HAVE_EGL
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+
+struct EGLHandle
+{
+    EGLSurface surface;
+    EGLContext context;
+};
+
+static std::map<int, EGLHandle> eglHandles;
+static int nextEGLHandle = 1;
+
+// Prefer a real GPU, when the driver can enumerate them, and
+// otherwise take whatever the default platform gives us.
+static EGLDisplay openEGLDisplay()
+{
+    PFNEGLQUERYDEVICESEXTPROC queryDevices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (getPlatformDisplay != NULL) {
+        EGLDeviceEXT device;
+        EGLint count = 0;
+        if (queryDevices != NULL && queryDevices(1, &device, &count) && count > 0) {
+            display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+        }
+        if (display == EGL_NO_DISPLAY) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                         EGL_DEFAULT_DISPLAY, NULL);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        throw std::runtime_error("Couldn't initialise an EGL display");
+    }
+    // The transfer rendering uses the fixed-function pipeline.
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        throw std::runtime_error("EGL display doesn't support desktop OpenGL");
+    }
+    return display;
+}
+
+static int eglSetup(int size)
+{
+    if (eglDisplay == EGL_NO_DISPLAY) {
+        eglDisplay = openEGLDisplay();
+    }
+    EGLint const configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &count) ||
+        count == 0) {
+        throw std::runtime_error("No suitable EGL config");
+    }
+    EGLint const surfaceAttribs[] = {
+        EGL_WIDTH, size,
+        EGL_HEIGHT, size,
+        EGL_NONE
+    };
+    EGLHandle h;
+    h.surface = eglCreatePbufferSurface(eglDisplay, config, surfaceAttribs);
+    if (h.surface == EGL_NO_SURFACE) {
+        throw std::runtime_error("Couldn't create EGL pbuffer");
+    }
+    h.context = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if (h.context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(eglDisplay, h.surface, h.surface, h.context)) {
+        eglDestroySurface(eglDisplay, h.surface);
+        throw std::runtime_error("Couldn't create EGL context");
+    }
+    int const id = nextEGLHandle++;
+    eglHandles[id] = h;
+    return id;
+}
+
+static void eglTeardown(int id)
+{
+    EGLHandle const &h = eglHandles[id];
+    eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(eglDisplay, h.context);
+    eglDestroySurface(eglDisplay, h.surface);
+    eglHandles.erase(id);
+}
+
+#endif // RADIOSITY_HAVE_EGL
+
+#ifdef RADIOSITY_HAVE_OSMESA
+
+// OSMesa renders into memory we provide.
+struct OSMesaHandle
+{
+    OSMesaContext context;
+    std::vector<GLubyte> buffer;
+};
+
+static std::map<int, OSMesaHandle> osmesaHandles;
+static int nextOSMesaHandle = 1;
+
+static int osmesaSetup(int size)
+{
+    int const id = nextOSMesaHandle++;
+    OSMesaHandle &h = osmesaHandles[id];
+    h.context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+    if (h.context == NULL) {
+        osmesaHandles.erase(id);
+        throw std::runtime_error("Couldn't create OSMesa context");
+    }
+    h.buffer.resize(4 * size * size);
+    if (!OSMesaMakeCurrent(h.context, &h.buffer[0], GL_UNSIGNED_BYTE,
+                           size, size)) {
+        OSMesaDestroyContext(h.context);
+        osmesaHandles.erase(id);
+        throw std::runtime_error("Couldn't make OSMesa context current");
+    }
+    return id;
+}
+
+static void osmesaTeardown(int id)
+{
+    OSMesaDestroyContext(osmesaHandles[id].context);
+    osmesaHandles.erase(id);
+}
+
+#endif // RADIOSITY_HAVE_OSMESA
+
+int gwTransferSetup(int size)
+{
+    int handle = 0;
+    // OSMesa contexts are single buffered.
+    GLenum readBuffer = GL_BACK;
+    switch (backend) {
+#ifdef RADIOSITY_HAVE_EGL
+    case GL_BACKEND_EGL:
+        handle = eglSetup(size);
+        break;
+#endif
+#ifdef RADIOSITY_HAVE_OSMESA
+    case GL_BACKEND_OSMESA:
+        handle = osmesaSetup(size);
+        readBuffer = GL_FRONT;
+        break;
+#endif
+    default:
+        handle = glutSetup(size);
+        break;
+    }
+
     // Flat shading.
     glEnable(GL_COLOR_MATERIAL);
     // Use depth buffering for hidden surface elimination.
     glEnable(GL_DEPTH_TEST);
     // Back-face culling.
     glEnable(GL_CULL_FACE);
+    // Index colours must come out exactly as drawn.
+    glDisable(GL_DITHER);
+    // The background decodes as no quad.
+    glClearColor(0.0, 0.0, 0.0, 0.0);
     // To read from the scene...
-    glReadBuffer(GL_BACK);
+    glReadBuffer(readBuffer);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     // Set up the view to be one face of the cube-map.
@@ -47,7 +294,26 @@ int gwTransferSetup(int size)
                    0.001, // Z near
                    10.0); // Z far
 
-    return win;
+    return handle;
+}
+
+void gwTransferTeardown(int handle)
+{
+    switch (backend) {
+#ifdef RADIOSITY_HAVE_EGL
+    case GL_BACKEND_EGL:
+        eglTeardown(handle);
+        break;
+#endif
+#ifdef RADIOSITY_HAVE_OSMESA
+    case GL_BACKEND_OSMESA:
+        osmesaTeardown(handle);
+        break;
+#endif
+    default:
+        glutDestroyWindow(handle);
+        break;
+    }
 }
 
 // Not re-entrant but I don't think GLUT is.
@@ -73,6 +339,11 @@ static void dispFnWrapper()
 
 void gwRenderOnce(void (*f)())
 {
+    // No event loop without GLUT.
+    if (backend != GL_BACKEND_GLUT) {
+        f();
+        return;
+    }
 #ifdef VANILLA_GLUT
     // Reading the definition of 'glutMainLoop', unwinding the stack
     // from the idle function shouldn't break anything. Horrible way
@@ -101,6 +372,58 @@ void gwRenderOnce(void (*f)())
 #endif
 }
 
+static GLuint compileShader(GLenum type, char const *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        GLint len = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+        std::vector<GLchar> log(len + 1);
+        glGetShaderInfoLog(shader, len, NULL, &log[0]);
+        glDeleteShader(shader);
+        throw std::runtime_error(std::string("Shader compile failed: ") +
+                                 &log[0]);
+    }
+    return shader;
+}
+
+GLuint gwCompileProgram(char const *vertexSource,
+                        char const *fragmentSource,
+                        std::vector<char const *> const &attributes)
+{
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    for (int i = 0, n = attributes.size(); i < n; ++i) {
+        glBindAttribLocation(program, i, attributes[i]);
+    }
+    glLinkProgram(program);
+    // Flagged for deletion once the program goes.
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        GLint len = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+        std::vector<GLchar> log(len + 1);
+        glGetProgramInfoLog(program, len, NULL, &log[0]);
+        glDeleteProgram(program);
+        throw std::runtime_error(std::string("Shader link failed: ") +
+                                 &log[0]);
+    }
+    return program;
+}
+
 Camera::Camera(Vertex const &eyePos, Vertex const &lookAt, Vertex const &upDir)
     : m_eyePos(eyePos), m_lookAt(lookAt), m_upDir(upDir)
 {
@@ -14,17 +14,57 @@
 #include <GL/glut.h>
 #endif
 
+#include <string>
+#include <vector>
+
 #include "geom.h"
 
-// Set the flags etc. up for rendering a cube map. Returns window id.
+// Where the transfer calculations get their GL context from. GLUT
+// needs a display; the others run headless. EGL uses a pbuffer on
+// the first GPU device, falling back to Mesa's surfaceless platform,
+// and OSMesa renders in software. The headless backends are only
+// available if built with RADIOSITY_HAVE_EGL or RADIOSITY_HAVE_OSMESA.
+enum GLBackend {
+    GL_BACKEND_GLUT,
+    GL_BACKEND_EGL,
+    GL_BACKEND_OSMESA
+};
+
+// Parse "glut", "egl" or "osmesa". Returns false, leaving "backend"
+// alone, otherwise.
+bool parseGLBackend(std::string const &name, GLBackend &backend);
+
+// Replaces glutInit at the top of main. Picks the backend from the
+// RADIOSITY_GL_BACKEND environment variable, overridden by a "-gl="
+// argument, which is removed from argv. Only initialises GLUT if
+// that's the backend chosen. Throws std::runtime_error on a bad
+// backend name, or one that wasn't built in.
+void gwInit(int *argc, char **argv);
+
+// The backend chosen by gwInit.
+GLBackend gwBackend();
+
+// Set the flags etc. up for rendering a cube map, in a new context
+// from the current backend, and make it current. Returns a handle
+// for gwTransferTeardown.
 int gwTransferSetup(int size);
 
+// Destroy the context created by gwTransferSetup.
+void gwTransferTeardown(int handle);
+
 // Run the display function a single time, entering and leaving the
-// event loop. It might be possible to draw this outside the event
+// event loop (if there is one). It might be possible to draw this outside the event
 // loop, but I haven't poked around the event loop code enough to be
 // sure.
 void gwRenderOnce(void (*f)());
 
+// Compile and link a GLSL program from vertex and fragment shader
+// source. Attribute locations are bound in order of the names given,
+// starting at zero. Throws std::runtime_error with the log on failure.
+GLuint gwCompileProgram(char const *vertexSource,
+                        char const *fragmentSource,
+                        std::vector<char const *> const &attributes);
+
 // Camera object, used to pass camera set-up to the
 // TransferCalculators.
 class Camera
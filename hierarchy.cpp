@@ -0,0 +1,338 @@
+////////////////////////////////////////////////////////////////////////
+//
+// hierarchy.cpp: Hierarchical radiosity over the subdivided quads.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include "geom.h"
+#include "hierarchy.h"
+#include "parallel.h"
+#include "solver.h"
+
+// Links that are partly in shadow get refined to this fraction of
+// the normal threshold, to keep shadow edges sharp.
+static double const SHADOW_REFINEMENT = 0.1;
+
+// Number of rays cast to estimate the visibility between elements.
+static int const VISIBILITY_SAMPLES = 4;
+
+HierarchicalSolver::Element::Element(int iSubdiv,
+                                     int iU0, int iV0, int iU1, int iV1,
+                                     Vertex const &iCorner,
+                                     Vertex const &iUEdge,
+                                     Vertex const &iVEdge)
+    : subdiv(iSubdiv),
+      u0(iU0), v0(iV0), u1(iU1), v1(iV1),
+      childCount(0),
+      quad(-1),
+      corner(iCorner), uEdge(iUEdge), vEdge(iVEdge),
+      centre(iCorner + iUEdge.scale(0.5) + iVEdge.scale(0.5)),
+      // paraCross points away from the lit side, so go the other way.
+      normal(cross(iUEdge, iVEdge).norm()),
+      area(cross(iUEdge, iVEdge).len())
+{
+    for (int i = 0; i < 4; ++i) {
+        children[i] = -1;
+    }
+}
+
+HierarchicalSolver::HierarchicalSolver(std::vector<Vertex> const &vs,
+                                       std::vector<Quad> &qs,
+                                       std::vector<SubdivInfo> const &subdivs,
+                                       double epsilon,
+                                       int threads)
+    : m_vertices(vs),
+      m_quads(qs),
+      m_subdivs(subdivs),
+      m_epsilon(epsilon),
+      m_threads(threads)
+{
+    for (int i = 0, n = subdivs.size(); i < n; ++i) {
+        int root = buildElement(i, 0, 0, subdivs[i].uCount(), subdivs[i].vCount());
+        pullMaterials(root);
+        m_roots.push_back(root);
+    }
+
+    // Links into an element are only ever created while refining
+    // from its root, so the roots can be refined in parallel.
+    int const n = m_elements.size();
+    m_links.resize(n);
+    int const roots = m_roots.size();
+    parallelFor(roots, m_threads, [this, roots](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            for (int j = 0; j < roots; ++j) {
+                if (i != j) {
+                    refine(m_roots[i], m_roots[j]);
+                }
+            }
+        }
+    });
+
+    // Start from the quads' current colours.
+    m_radiosity.resize(n);
+    m_gathered.resize(n);
+    for (int e = 0; e < n; ++e) {
+        if (m_elements[e].quad >= 0) {
+            m_radiosity[e] = m_quads[m_elements[e].quad].screenColour;
+        }
+    }
+    for (int i = 0; i < roots; ++i) {
+        pullRadiosity(m_roots[i]);
+    }
+    m_stats.start(totalLight());
+}
+
+// The roots cover the whole scene, with their radiosity the area
+// average of what they cover.
+double HierarchicalSolver::totalLight() const
+{
+    double total = 0.0;
+    for (int i = 0, n = m_roots.size(); i < n; ++i) {
+        total += m_radiosity[m_roots[i]].asGrey() * m_elements[m_roots[i]].area;
+    }
+    return total;
+}
+
+int HierarchicalSolver::elementCount() const
+{
+    return m_elements.size();
+}
+
+size_t HierarchicalSolver::linkCount() const
+{
+    size_t count = 0;
+    for (int i = 0, n = m_links.size(); i < n; ++i) {
+        count += m_links[i].size();
+    }
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Building the hierarchy
+
+// Build the element covering the given grid rectangle, and all its
+// descendants, splitting each dimension in half until we reach the
+// grid quads. Returns the element's index.
+int HierarchicalSolver::buildElement(int subdiv, int u0, int v0, int u1, int v1)
+{
+    SubdivInfo const &info = m_subdivs[subdiv];
+    Vertex const &corner = m_vertices[info.vertexAt(u0, v0)];
+    Vertex uEdge = m_vertices[info.vertexAt(u1, v0)] - corner;
+    Vertex vEdge = m_vertices[info.vertexAt(u0, v1)] - corner;
+    int const e = m_elements.size();
+    m_elements.push_back(Element(subdiv, u0, v0, u1, v1, corner, uEdge, vEdge));
+
+    bool const splitU = u1 - u0 > 1;
+    bool const splitV = v1 - v0 > 1;
+    if (!splitU && !splitV) {
+        m_elements[e].quad = info.faceAt(u0, v0);
+        return e;
+    }
+
+    int const uMid = splitU ? (u0 + u1) / 2 : u1;
+    int const vMid = splitV ? (v0 + v1) / 2 : v1;
+    int const us[] = { u0, uMid, u1 };
+    int const vs[] = { v0, vMid, v1 };
+    for (int j = 0; j < (splitV ? 2 : 1); ++j) {
+        for (int i = 0; i < (splitU ? 2 : 1); ++i) {
+            int child = buildElement(subdiv, us[i], vs[j], us[i + 1], vs[j + 1]);
+            // Careful: m_elements may have been reallocated.
+            Element &el = m_elements[e];
+            el.children[el.childCount++] = child;
+        }
+    }
+    return e;
+}
+
+// Fill in the emission and reflectance of the element's subtree from
+// the grid quads. As elsewhere, emitters don't reflect.
+void HierarchicalSolver::pullMaterials(int e)
+{
+    Element &el = m_elements[e];
+    if (el.childCount == 0) {
+        Quad const &q = m_quads[el.quad];
+        el.emission = q.isEmitter ? q.materialColour : Colour();
+        el.reflectance = q.isEmitter ? Colour() : q.materialColour;
+        return;
+    }
+    Colour emission, reflectance;
+    for (int i = 0; i < el.childCount; ++i) {
+        pullMaterials(el.children[i]);
+        Element const &child = m_elements[el.children[i]];
+        emission += child.emission * child.area;
+        reflectance += child.reflectance * child.area;
+    }
+    el.emission = emission * (1.0 / el.area);
+    el.reflectance = reflectance * (1.0 / el.area);
+}
+
+// Points spread over the element, for visibility testing.
+Vertex HierarchicalSolver::samplePoint(Element const &e, int i) const
+{
+    double s = (i & 1) ? 0.75 : 0.25;
+    double t = (i & 2) ? 0.75 : 0.25;
+    return e.corner + e.uEdge.scale(s) + e.vEdge.scale(t);
+}
+
+// Fraction of rays between the elements that aren't blocked by any
+// other base quad.
+double HierarchicalSolver::visibility(Element const &p, Element const &q) const
+{
+    int visible = 0;
+    for (int k = 0; k < VISIBILITY_SAMPLES; ++k) {
+        // Cross the samples over, so the rays aren't all parallel.
+        Vertex from = samplePoint(p, k);
+        Vertex to = samplePoint(q, VISIBILITY_SAMPLES - 1 - k);
+        bool blocked = false;
+        for (int b = 0, n = m_subdivs.size(); b < n && !blocked; ++b) {
+            if (b != p.subdiv && b != q.subdiv) {
+                blocked = paraIntersect(m_subdivs[b].baseQuad(), m_vertices,
+                                        from, to);
+            }
+        }
+        if (!blocked) {
+            ++visible;
+        }
+    }
+    return static_cast<double>(visible) / VISIBILITY_SAMPLES;
+}
+
+// Unoccluded fraction of q's radiosity arriving at p, treating both
+// as points at their centres. Matches AnalyticTransferCalculator.
+double HierarchicalSolver::estimateTransfer(Element const &p,
+                                            Element const &q) const
+{
+    Vertex d = q.centre - p.centre;
+    double r2 = dot(d, d);
+    if (r2 == 0.0) {
+        return 0.0;
+    }
+    Vertex dir = d.scale(1.0 / sqrt(r2));
+    double cosP = dot(p.normal, dir);
+    double cosQ = -dot(q.normal, dir);
+    if (cosP <= 0.0 || cosQ <= 0.0) {
+        return 0.0;
+    }
+    return cosP * cosQ * q.area / (M_PI * r2);
+}
+
+// Link q to p, or refine whichever is bigger and try again.
+void HierarchicalSolver::refine(int p, int q)
+{
+    Element const &ep = m_elements[p];
+    Element const &eq = m_elements[q];
+
+    double transfer = estimateTransfer(ep, eq);
+    if (transfer <= 0.0) {
+        return;
+    }
+    // With only a few samples, no visible rays doesn't mean big
+    // elements can't see each other, so treat it as partial.
+    double vis = visibility(ep, eq);
+    double threshold = vis < 1.0 ? m_epsilon * SHADOW_REFINEMENT : m_epsilon;
+    bool const splitP = ep.childCount > 0;
+    bool const splitQ = eq.childCount > 0;
+    if (transfer < threshold || (!splitP && !splitQ)) {
+        if (vis > 0.0) {
+            Link link = { q, transfer * vis };
+            m_links[p].push_back(link);
+        }
+        return;
+    }
+
+    if (splitQ && (!splitP || eq.area > ep.area)) {
+        for (int i = 0; i < eq.childCount; ++i) {
+            refine(p, eq.children[i]);
+        }
+    } else {
+        for (int i = 0; i < ep.childCount; ++i) {
+            refine(ep.children[i], q);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Solving
+
+// Set the radiosity of the element's subtree from its grid quads.
+void HierarchicalSolver::pullRadiosity(int e)
+{
+    Element const &el = m_elements[e];
+    if (el.childCount == 0) {
+        return;
+    }
+    Colour total;
+    for (int i = 0; i < el.childCount; ++i) {
+        int child = el.children[i];
+        pullRadiosity(child);
+        total += m_radiosity[child] * m_elements[child].area;
+    }
+    m_radiosity[e] = total * (1.0 / el.area);
+}
+
+// Push the light gathered at each level down to the grid quads,
+// where it's reflected, and pull the resulting radiosities back up.
+// Adds the area-weighted change at the grid quads to "residual".
+Colour HierarchicalSolver::pushPull(int e, Colour const &above,
+                                    double &residual)
+{
+    Element const &el = m_elements[e];
+    Colour irradiance = above + m_gathered[e];
+    Colour b;
+    if (el.childCount == 0) {
+        b = el.emission + irradiance * el.reflectance;
+        Colour delta = b + m_radiosity[e] * -1.0;
+        residual += fabs(delta.asGrey()) * el.area;
+    } else {
+        for (int i = 0; i < el.childCount; ++i) {
+            int child = el.children[i];
+            b += pushPull(child, irradiance, residual) * m_elements[child].area;
+        }
+        b = b * (1.0 / el.area);
+    }
+    m_radiosity[e] = b;
+    return b;
+}
+
+SolverStats HierarchicalSolver::iterate()
+{
+    // Gather along the links, from the previous iteration's values.
+    int const n = m_elements.size();
+    parallelFor(n, m_threads, [this](int begin, int end) {
+        for (int e = begin; e < end; ++e) {
+            Colour gathered;
+            std::vector<Link> const &links = m_links[e];
+            for (int i = 0, count = links.size(); i < count; ++i) {
+                gathered += m_radiosity[links[i].source] * links[i].transfer;
+            }
+            m_gathered[e] = gathered;
+        }
+    });
+
+    int const roots = m_roots.size();
+    std::vector<double> residuals(roots);
+    parallelFor(roots, m_threads, [this, &residuals](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            pushPull(m_roots[i], Colour(), residuals[i]);
+        }
+    });
+
+    double residual = 0.0;
+    for (int i = 0; i < roots; ++i) {
+        residual += residuals[i];
+    }
+    return m_stats.finish(totalLight(), residual);
+}
+
+void HierarchicalSolver::writeBack()
+{
+    for (int e = 0, n = m_elements.size(); e < n; ++e) {
+        if (m_elements[e].quad >= 0) {
+            m_quads[m_elements[e].quad].screenColour = m_radiosity[e];
+        }
+    }
+}
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////
+//
+// hierarchy.h: Hierarchical radiosity over the subdivided quads.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_HIERARCHY_H
+#define RADIOSITY_HIERARCHY_H
+
+#include <vector>
+
+#include "geom.h"
+#include "solver.h"
+
+// Rather than linking every subdivided quad with every other, each
+// base quad's grid is treated as a quadtree of elements, and pairs
+// of elements are linked at the coarsest level where the form factor
+// estimate is small enough that treating them as single patches is
+// accurate. Only nearby pairs and shadow boundaries get refined down
+// to the grid, so the number of links is closer to O(n) than O(n^2).
+//
+// The finest elements are the subdivided quads themselves, so the
+// results are written back to their screenColours, and the usual
+// Gouraud shading works unchanged. Visibility is tested by casting
+// rays against the base quads.
+class HierarchicalSolver : public RadiositySolver
+{
+public:
+    // Refine links until the estimated form factor of each is below
+    // "epsilon" (or the elements can't be split further). Partially
+    // occluded links are refined more aggressively, to get sharp
+    // shadows. An epsilon of 0 links every pair of grid quads.
+    HierarchicalSolver(std::vector<Vertex> const &vs,
+                       std::vector<Quad> &qs,
+                       std::vector<SubdivInfo> const &subdivs,
+                       double epsilon,
+                       int threads = 0);
+
+    virtual SolverStats iterate();
+    virtual void writeBack();
+
+    int elementCount() const;
+    size_t linkCount() const;
+
+private:
+    // A rectangle of grid quads, [u0, u1) x [v0, v1), from one
+    // SubdivInfo.
+    struct Element
+    {
+        Element(int subdiv, int u0, int v0, int u1, int v1,
+                Vertex const &corner, Vertex const &uEdge, Vertex const &vEdge);
+
+        int subdiv;
+        int u0, v0, u1, v1;
+        // Children, if split.
+        int children[4];
+        int childCount;
+        // The grid quad, for the finest elements, otherwise -1.
+        int quad;
+
+        Vertex corner, uEdge, vEdge;
+        Vertex centre;
+        // Unit normal, on the side light arrives from.
+        Vertex normal;
+        double area;
+
+        // Area-weighted averages over the grid quads covered.
+        Colour emission;
+        Colour reflectance;
+    };
+
+    // Light arriving from element "source", as a fraction of its
+    // radiosity.
+    struct Link
+    {
+        int source;
+        double transfer;
+    };
+
+    int buildElement(int subdiv, int u0, int v0, int u1, int v1);
+    void pullMaterials(int e);
+    Vertex samplePoint(Element const &e, int i) const;
+    double visibility(Element const &p, Element const &q) const;
+    double estimateTransfer(Element const &p, Element const &q) const;
+    void refine(int p, int q);
+    Colour pushPull(int e, Colour const &above, double &residual);
+    void pullRadiosity(int e);
+    double totalLight() const;
+
+    std::vector<Vertex> const &m_vertices;
+    std::vector<Quad> &m_quads;
+    std::vector<SubdivInfo> const &m_subdivs;
+    double const m_epsilon;
+    int const m_threads;
+
+    std::vector<Element> m_elements;
+    // Top level element for each SubdivInfo.
+    std::vector<int> m_roots;
+    // Links gathering light into each element.
+    std::vector<std::vector<Link> > m_links;
+
+    // Current radiosity of each element, and the light arriving
+    // through its own links on this iteration.
+    std::vector<Colour> m_radiosity;
+    std::vector<Colour> m_gathered;
+
+    SolverStatsTracker m_stats;
+};
+
+#endif // RADIOSITY_HIERARCHY_H
@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////
+//
+// hierarchy_test.cpp: Tests for hierarchy.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "hierarchy.h"
+#include "solver.h"
+#include "test_scene.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class HierarchyTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+    const double TARGET = 1.0e-6;
+
+    CPPUNIT_TEST_SUITE(HierarchyTestCase);
+    CPPUNIT_TEST(testFullRefinementMatchesUniform);
+    CPPUNIT_TEST(testFewerLinks);
+    CPPUNIT_TEST(testOcclusion);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testFullRefinementMatchesUniform();
+    void testFewerLinks();
+    void testOcclusion();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(HierarchyTestCase, "HierarchyTestCase");
+
+// With no threshold, every pair of grid quads gets linked, with the
+// same weights as the analytic transfers.
+void HierarchyTestCase::testFullRefinementMatchesUniform()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+
+    TransferMatrix transfers;
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(transfers);
+    std::vector<Quad> reference(quads);
+    // The reference's transfers may be single precision.
+    double const epsilon = sizeof(transfer_t) < sizeof(double) ? 1.0e-6 : 1.0e-9;
+
+    HierarchicalSolver solver(vertices, quads, subdivs, 0.0, 2);
+    CPPUNIT_ASSERT_EQUAL(transfers.nonZeros(), solver.linkCount());
+    for (int iter = 0; iter < 3; ++iter) {
+        solver.iterate();
+        iterateLighting(reference, transfers);
+    }
+    solver.writeBack();
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.r,
+                                     quads[i].screenColour.r, epsilon);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.b,
+                                     quads[i].screenColour.b, epsilon);
+    }
+}
+
+// A modest threshold should cut the links a lot, without changing
+// the answer much.
+void HierarchyTestCase::testFewerLinks()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(16, vertices, quads, subdivs);
+
+    std::vector<Quad> coarse(quads);
+    HierarchicalSolver full(vertices, quads, subdivs, 0.0);
+    solveLighting(full, TARGET);
+    HierarchicalSolver hier(vertices, coarse, subdivs, 0.01);
+    solveLighting(hier, TARGET);
+
+    CPPUNIT_ASSERT(hier.linkCount() * 10 < full.linkCount());
+    double fullLight = calcTotalLight(quads, vertices);
+    double hierLight = calcTotalLight(coarse, vertices);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fullLight, hierLight, 0.05 * fullLight);
+}
+
+// An emitter above a receiver, with a blocker in between.
+void HierarchyTestCase::testOcclusion()
+{
+    std::vector<Vertex> vertices;
+    // Emitter facing down, receiver facing up.
+    vertices.push_back(Vertex(-1.0, 1.0, -1.0));
+    vertices.push_back(Vertex( 1.0, 1.0, -1.0));
+    vertices.push_back(Vertex( 1.0, 1.0,  1.0));
+    vertices.push_back(Vertex(-1.0, 1.0,  1.0));
+    vertices.push_back(Vertex(-1.0, -1.0, -1.0));
+    vertices.push_back(Vertex(-1.0, -1.0,  1.0));
+    vertices.push_back(Vertex( 1.0, -1.0,  1.0));
+    vertices.push_back(Vertex( 1.0, -1.0, -1.0));
+    // Blocker covering x < 0.5, at y = 0, facing up. It hides the
+    // whole emitter from receiver points with x < 0.
+    vertices.push_back(Vertex(-2.0, 0.0, -2.0));
+    vertices.push_back(Vertex(-2.0, 0.0,  2.0));
+    vertices.push_back(Vertex( 0.5, 0.0,  2.0));
+    vertices.push_back(Vertex( 0.5, 0.0, -2.0));
+
+    Quad emitter(0, 1, 2, 3, Colour(1.0, 1.0, 1.0));
+    emitter.isEmitter = true;
+    emitter.screenColour = emitter.materialColour;
+    Quad receiver(4, 5, 6, 7, Colour(0.5, 0.5, 0.5));
+    Quad blocker(8, 9, 10, 11, Colour(0.5, 0.5, 0.5));
+
+    std::vector<Quad> quads;
+    quads.reserve(3 * SUBDIVISION * SUBDIVISION);
+    std::vector<SubdivInfo> subdivs;
+    subdivs.push_back(subdivide(emitter, vertices, quads, SUBDIVISION, SUBDIVISION));
+    subdivs.push_back(subdivide(receiver, vertices, quads, SUBDIVISION, SUBDIVISION));
+    subdivs.push_back(subdivide(blocker, vertices, quads, 1, 1));
+
+    HierarchicalSolver solver(vertices, quads, subdivs, 0.001);
+    solveLighting(solver, TARGET);
+
+    // The blocker's back can't reflect anything down, so the shaded
+    // part of the receiver is completely dark.
+    SubdivInfo const &info = subdivs[1];
+    for (int v = 0; v < SUBDIVISION; ++v) {
+        for (int u = 0; u < SUBDIVISION; ++u) {
+            Quad const &q = quads[info.faceAt(u, v)];
+            double x = paraCentre(q, vertices).x();
+            if (x < -0.5) {
+                CPPUNIT_ASSERT_EQUAL(0.0, q.screenColour.r);
+            } else if (x > 0.5) {
+                CPPUNIT_ASSERT(q.screenColour.r > 0.0);
+            }
+        }
+    }
+}
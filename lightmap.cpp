@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////
+//
+// lightmap.cpp: Draw the solved scene as its base quads, textured
+// with the radiosity baked into a lightmap atlas.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+// Needed for the buffer entry points outside MacOS.
+#define GL_GLEXT_PROTOTYPES
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "geom.h"
+#include "lightmap.h"
+
+// Floats per vertex: position, texture coordinates.
+static int const ATTRIB_FLOATS = 3 + 2;
+
+// Texture coordinates of the base quad's corners, in units of the
+// grid, matching the order of the subdivided quads' corners.
+static int const CORNERS[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+// Clamped, as GL would when drawing.
+static void setTexel(GLubyte *texel, Colour const &c)
+{
+    double const channels[] = { c.r, c.g, c.b };
+    for (int i = 0; i < 3; ++i) {
+        double x = std::min(std::max(channels[i], 0.0), 1.0);
+        texel[i] = static_cast<GLubyte>(x * 255.0 + 0.5);
+    }
+    texel[3] = 255;
+}
+
+LightmapScene::LightmapScene()
+    : m_width(0),
+      m_height(0),
+      m_brightnessScale(1.0),
+      m_buffer(0),
+      m_texture(0),
+      m_uploaded(false)
+{
+}
+
+LightmapScene::~LightmapScene()
+{
+    clear();
+}
+
+// Shelf packing: tallest first, left to right, starting a new row
+// when one fills up. The width is a power of two near the square
+// root of the total area, so the atlas comes out roughly square.
+void LightmapScene::pack(std::vector<SubdivInfo> const &subdivs)
+{
+    int const n = subdivs.size();
+    std::vector<int> order(n);
+    long area = 0;
+    int widest = 0;
+    for (int i = 0; i < n; ++i) {
+        order[i] = i;
+        int const w = subdivs[i].uCount() + 2;
+        area += long(w) * (subdivs[i].vCount() + 2);
+        widest = std::max(widest, w);
+    }
+    std::stable_sort(order.begin(), order.end(), [&subdivs](int a, int b) {
+        return subdivs[a].vCount() > subdivs[b].vCount();
+    });
+
+    m_width = 1;
+    while (m_width < widest || double(m_width) * m_width < area) {
+        m_width *= 2;
+    }
+
+    m_rects.resize(n);
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+    for (int i = 0; i < n; ++i) {
+        SubdivInfo const &info = subdivs[order[i]];
+        int const w = info.uCount() + 2;
+        if (x + w > m_width) {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        m_rects[order[i]].x = x + 1;
+        m_rects[order[i]].y = y + 1;
+        x += w;
+        shelfHeight = std::max(shelfHeight, info.vCount() + 2);
+    }
+    m_height = std::max(1, y + shelfHeight);
+}
+
+void LightmapScene::build(std::vector<Quad> const &qs,
+                          std::vector<Vertex> const &vs,
+                          std::vector<SubdivInfo> const &subdivs)
+{
+    // Brightness target and scale, as in ShadedScene.
+    double const TARGET = 1.0;
+    double max = 0.0;
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        Quad const &q = qs[i];
+        if (!q.isEmitter) {
+            max = std::max<double>(max, q.screenColour.r);
+            max = std::max<double>(max, q.screenColour.g);
+            max = std::max<double>(max, q.screenColour.b);
+        }
+    }
+    m_brightnessScale = max > 0.0 && max < TARGET ? TARGET / max : 1.0;
+
+    pack(subdivs);
+    m_texels.assign(size_t(4) * m_width * m_height, 0);
+    m_attribs.clear();
+    m_attribs.reserve(subdivs.size() * 4 * ATTRIB_FLOATS);
+    for (int s = 0, n = subdivs.size(); s < n; ++s) {
+        SubdivInfo const &info = subdivs[s];
+        int const uCount = info.uCount();
+        int const vCount = info.vCount();
+        Rect const &r = m_rects[s];
+
+        // The grid plus its border, with the border texels taking
+        // the colour of the nearest quad on the grid.
+        for (int v = -1; v <= vCount; ++v) {
+            int const cv = std::min(std::max(v, 0), vCount - 1);
+            for (int u = -1; u <= uCount; ++u) {
+                int const cu = std::min(std::max(u, 0), uCount - 1);
+                Quad const &face = qs[info.faceAt(cu, cv)];
+                // Emitters aren't normalised.
+                Colour c = face.isEmitter ? face.screenColour :
+                                            face.screenColour * m_brightnessScale;
+                setTexel(&m_texels[4 * (size_t(r.y + v) * m_width + r.x + u)], c);
+            }
+        }
+
+        // The corners of the grid are the outer edges of its outer
+        // texels, so that filtering reaches the edge colours there.
+        for (int k = 0; k < 4; ++k) {
+            int const cu = CORNERS[k][0] * uCount;
+            int const cv = CORNERS[k][1] * vCount;
+            Vertex const &p = vs[info.vertexAt(cu, cv)];
+            GLfloat const a[ATTRIB_FLOATS] = {
+                GLfloat(p.x()), GLfloat(p.y()), GLfloat(p.z()),
+                GLfloat(double(r.x + cu) / m_width),
+                GLfloat(double(r.y + cv) / m_height)
+            };
+            m_attribs.insert(m_attribs.end(), a, a + ATTRIB_FLOATS);
+        }
+    }
+    m_uploaded = false;
+}
+
+double LightmapScene::brightnessScale() const
+{
+    return m_brightnessScale;
+}
+
+int LightmapScene::width() const
+{
+    return m_width;
+}
+
+int LightmapScene::height() const
+{
+    return m_height;
+}
+
+std::vector<GLubyte> const &LightmapScene::texels() const
+{
+    return m_texels;
+}
+
+LightmapScene::Rect const &LightmapScene::rect(int subdiv) const
+{
+    return m_rects[subdiv];
+}
+
+void LightmapScene::upload()
+{
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (m_width > maxSize || m_height > maxSize) {
+        std::ostringstream error;
+        error << "Lightmap atlas of " << m_width << "x" << m_height
+              << " is bigger than the GL's limit of " << maxSize;
+        throw std::runtime_error(error.str());
+    }
+
+    if (m_buffer == 0) {
+        glGenBuffers(1, &m_buffer);
+        glGenTextures(1, &m_texture);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, m_attribs.size() * sizeof(GLfloat),
+                 m_attribs.empty() ? NULL : &m_attribs[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 m_texels.empty() ? NULL : &m_texels[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_uploaded = true;
+}
+
+void LightmapScene::draw()
+{
+    if (!m_uploaded) {
+        upload();
+    }
+    if (m_attribs.empty()) {
+        return;
+    }
+
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, ATTRIB_FLOATS * sizeof(GLfloat), 0);
+    glTexCoordPointer(2, GL_FLOAT, ATTRIB_FLOATS * sizeof(GLfloat),
+                      reinterpret_cast<GLvoid const *>(3 * sizeof(GLfloat)));
+    glDrawArrays(GL_QUADS, 0, m_attribs.size() / ATTRIB_FLOATS);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glDisable(GL_TEXTURE_2D);
+}
+
+void LightmapScene::clear()
+{
+    if (m_buffer != 0) {
+        glDeleteTextures(1, &m_texture);
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = m_texture = 0;
+    }
+    m_uploaded = false;
+}
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////
+//
+// lightmap.h: Draw the solved scene as its base quads, textured with
+// the radiosity baked into a lightmap atlas.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_LIGHTMAP_H
+#define RADIOSITY_LIGHTMAP_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <vector>
+
+#include "geom.h"
+
+// Each SubdivInfo's grid of colours becomes a rectangle of texels,
+// one per subdivided quad, packed into a single texture. Only the
+// base quads are drawn, and bilinear filtering does the smoothing
+// that the Gouraud quads would, so the cost of a frame depends on
+// the scene's geometry rather than how finely it's been subdivided.
+//
+// The lighting is baked with a fixed brightness scale, as in
+// ShadedScene, and there are no specular highlights.
+//
+// GL objects are created on the first draw, so the scene can be
+// built before there's a context.
+class LightmapScene
+{
+public:
+    // Where a SubdivInfo's texels are in the atlas. Its uCount by
+    // vCount texels start at (x, y), with a border of one texel all
+    // round, repeating the edges, so that filtering doesn't pick up
+    // the neighbours.
+    struct Rect
+    {
+        int x;
+        int y;
+    };
+
+    LightmapScene();
+    ~LightmapScene();
+
+    // Take the geometry and lighting from "qs", whose screenColours
+    // should hold the unscaled radiosity. The SubdivInfos must refer
+    // to "qs" and "vs".
+    void build(std::vector<Quad> const &qs,
+               std::vector<Vertex> const &vs,
+               std::vector<SubdivInfo> const &subdivs);
+
+    double brightnessScale() const;
+
+    // The atlas, RGBA, bottom row first.
+    int width() const;
+    int height() const;
+    std::vector<GLubyte> const &texels() const;
+    Rect const &rect(int subdiv) const;
+
+    // Draw with the current matrices. Throws std::runtime_error if
+    // the atlas is too big for the GL.
+    void draw();
+
+    // Release the GL objects.
+    void clear();
+
+private:
+    void pack(std::vector<SubdivInfo> const &subdivs);
+    void upload();
+
+    // Not copyable, as it owns GL objects.
+    LightmapScene(LightmapScene const &);
+    LightmapScene &operator=(LightmapScene const &);
+
+    std::vector<Rect> m_rects;
+    int m_width;
+    int m_height;
+    std::vector<GLubyte> m_texels;
+    // Per vertex: position, then texture coordinates.
+    std::vector<GLfloat> m_attribs;
+    double m_brightnessScale;
+
+    GLuint m_buffer;
+    GLuint m_texture;
+    bool m_uploaded;
+};
+
+#endif // RADIOSITY_LIGHTMAP_H
@@ -0,0 +1,173 @@
+////////////////////////////////////////////////////////////////////////
+//
+// lightmap_test.cpp: Tests for lightmap.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "lightmap.h"
+
+class LightmapTestCase : public CppUnit::TestCase
+{
+private:
+    const int SIZE = 16;
+
+    CPPUNIT_TEST_SUITE(LightmapTestCase);
+    CPPUNIT_TEST(testPacking);
+    CPPUNIT_TEST(testTexels);
+    CPPUNIT_TEST(testDraw);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testPacking();
+    void testTexels();
+    void testDraw();
+
+    // The cube, with each face subdivided differently, and the
+    // quads lit with a pattern.
+    void buildCube(std::vector<Vertex> &vertices,
+                   std::vector<Quad> &quads,
+                   std::vector<SubdivInfo> &subdivs);
+    GLubyte expected(double c, double scale);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(LightmapTestCase, "LightmapTestCase");
+
+void LightmapTestCase::buildCube(std::vector<Vertex> &vertices,
+                                 std::vector<Quad> &quads,
+                                 std::vector<SubdivInfo> &subdivs)
+{
+    int const sizes[6][2] = { { 4, 4 }, { 8, 2 }, { 1, 1 },
+                              { 3, 7 }, { 5, 5 }, { 2, 6 } };
+    MeshBuilder builder;
+    for (int i = 0; i < 6; ++i) {
+        builder.add(cubeFaces[i], sizes[i][0], sizes[i][1]);
+    }
+    vertices = cubeVertices;
+    builder.build(vertices, quads, subdivs);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        quads[i].screenColour = Colour((i % 7) / 14.0, (i % 5) / 10.0, 0.25);
+    }
+    // An emitter, which isn't scaled.
+    quads[3].isEmitter = true;
+    quads[3].screenColour = Colour(2.0, 1.0, 0.5);
+}
+
+GLubyte LightmapTestCase::expected(double c, double scale)
+{
+    double x = std::min(std::max(c * scale, 0.0), 1.0);
+    return static_cast<GLubyte>(x * 255.0 + 0.5);
+}
+
+// Every rectangle, with its border, fits in the atlas without
+// overlapping another.
+void LightmapTestCase::testPacking()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildCube(vertices, quads, subdivs);
+
+    LightmapScene scene;
+    scene.build(quads, vertices, subdivs);
+    int const w = scene.width();
+    int const h = scene.height();
+    CPPUNIT_ASSERT_EQUAL(0, w & (w - 1));
+
+    std::vector<int> owner(w * h, -1);
+    int used = 0;
+    for (int s = 0, n = subdivs.size(); s < n; ++s) {
+        LightmapScene::Rect const &r = scene.rect(s);
+        for (int y = r.y - 1; y <= r.y + subdivs[s].vCount(); ++y) {
+            for (int x = r.x - 1; x <= r.x + subdivs[s].uCount(); ++x) {
+                CPPUNIT_ASSERT(x >= 0 && x < w && y >= 0 && y < h);
+                CPPUNIT_ASSERT_EQUAL(-1, owner[y * w + x]);
+                owner[y * w + x] = s;
+                ++used;
+            }
+        }
+    }
+    // Not too wasteful, for such differently shaped rectangles.
+    CPPUNIT_ASSERT(used * 2 >= w * h);
+}
+
+// One texel per quad, scaled as ShadedScene would, with the border
+// repeating the edges.
+void LightmapTestCase::testTexels()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildCube(vertices, quads, subdivs);
+
+    LightmapScene scene;
+    scene.build(quads, vertices, subdivs);
+    // The brightest non-emitter's red is 6/14.
+    double const scale = scene.brightnessScale();
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(14.0 / 6.0, scale, 1.0e-9);
+
+    std::vector<GLubyte> const &texels = scene.texels();
+    int const w = scene.width();
+    for (int s = 0, n = subdivs.size(); s < n; ++s) {
+        SubdivInfo const &info = subdivs[s];
+        LightmapScene::Rect const &r = scene.rect(s);
+        for (int v = -1; v <= info.vCount(); ++v) {
+            for (int u = -1; u <= info.uCount(); ++u) {
+                int cu = std::min(std::max(u, 0), info.uCount() - 1);
+                int cv = std::min(std::max(v, 0), info.vCount() - 1);
+                Quad const &q = quads[info.faceAt(cu, cv)];
+                double const qs = q.isEmitter ? 1.0 : scale;
+                GLubyte const *t = &texels[4 * ((r.y + v) * w + r.x + u)];
+                CPPUNIT_ASSERT_EQUAL(int(expected(q.screenColour.r, qs)), int(t[0]));
+                CPPUNIT_ASSERT_EQUAL(int(expected(q.screenColour.g, qs)), int(t[1]));
+                CPPUNIT_ASSERT_EQUAL(int(expected(q.screenColour.b, qs)), int(t[2]));
+                CPPUNIT_ASSERT_EQUAL(255, int(t[3]));
+            }
+        }
+    }
+}
+
+// A quad across the view, subdivided in two, is filtered from one
+// colour to the other across the middle.
+void LightmapTestCase::testDraw()
+{
+    std::vector<Vertex> vertices;
+    for (int i = 0; i < 2; ++i) {
+        double x = -1.0 + 2.0 * i;
+        vertices.push_back(Vertex(x, -1.0, -1.0));
+        vertices.push_back(Vertex(x,  1.0, -1.0));
+    }
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    subdivs.push_back(subdivide(Quad(0, 2, 3, 1, Colour()),
+                                vertices, quads, 2, 1));
+    quads[0].screenColour = Colour(0.25, 0.25, 0.25);
+    quads[1].screenColour = Colour(0.5, 0.5, 0.5);
+
+    int win = gwTransferSetup(SIZE);
+    LightmapScene scene;
+    scene.build(quads, vertices, subdivs);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    scene.draw();
+    std::vector<GLubyte> pixels(4 * SIZE * SIZE);
+    glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    scene.clear();
+    gwTransferTeardown(win);
+
+    int const row = 4 * SIZE * (SIZE / 2);
+    CPPUNIT_ASSERT_EQUAL(128, int(pixels[row + 4 * 2]));
+    CPPUNIT_ASSERT_EQUAL(255, int(pixels[row + 4 * (SIZE - 3)]));
+    // Rising through the middle.
+    int const left = pixels[row + 4 * (SIZE / 2 - 1)];
+    int const right = pixels[row + 4 * (SIZE / 2)];
+    CPPUNIT_ASSERT(left > 128 && left < right && right < 255);
+}
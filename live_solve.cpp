@@ -0,0 +1,166 @@
+////////////////////////////////////////////////////////////////////////
+//
+// live_solve.cpp: Calculate and solve on a worker thread, while the
+// viewer shows the lighting so far.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "live_solve.h"
+#include "parallel.h"
+#include "profile.h"
+#include "progress.h"
+#include "radiance.h"
+
+LiveSolve::LiveSolve(int quads, workFn_t const &work)
+    : m_back(quads),
+      m_ready(quads),
+      m_fresh(false),
+      m_published(0),
+      m_cancelled(false),
+      m_finished(false),
+      m_failed(false)
+{
+    m_thread = std::thread(&LiveSolve::run, this, work);
+}
+
+LiveSolve::~LiveSolve()
+{
+    cancel();
+    m_thread.join();
+}
+
+void LiveSolve::run(workFn_t work)
+{
+    try {
+        work(*this);
+    } catch (TransferCancelled const &) {
+        // Nothing to report.
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << std::endl;
+        m_failed = true;
+    }
+    m_finished = true;
+}
+
+void LiveSolve::publish(std::vector<Quad> const &qs)
+{
+    m_back.resize(qs.size());
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        m_back[i] = qs[i].screenColour;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_back.swap(m_ready);
+    m_fresh = true;
+    ++m_published;
+}
+
+bool LiveSolve::cancelled() const
+{
+    return m_cancelled;
+}
+
+bool LiveSolve::take(std::vector<Colour> &colours)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_fresh) {
+        return false;
+    }
+    colours.swap(m_ready);
+    m_fresh = false;
+    return true;
+}
+
+bool LiveSolve::finished() const
+{
+    return m_finished;
+}
+
+bool LiveSolve::failed() const
+{
+    return m_failed;
+}
+
+void LiveSolve::cancel()
+{
+    m_cancelled = true;
+}
+
+int LiveSolve::published() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_published;
+}
+
+void previewSweep(std::vector<Quad> &qs, TransferMatrix const &transfers,
+                  int threads)
+{
+    PROFILE_SCOPE("previewSweep");
+    int const rows = transfers.rowCount();
+    RadianceBuffer src;
+    src.load(qs);
+    std::vector<Colour> next(rows);
+    parallelFor(rows, threads, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            Quad const &q = qs[i];
+            // Emission is just like having 1.0 light arrive.
+            next[i] = q.isEmitter ? q.materialColour :
+                gatherRow(transfers, i, src) * q.materialColour;
+        }
+    });
+    for (int i = 0; i < rows; ++i) {
+        qs[i].screenColour = next[i];
+    }
+}
+
+void calcTransfersLive(rowsFn_t const &calcRows, int batch,
+                       std::vector<Quad> &qs, TransferMatrix &transfers,
+                       LiveSolve &live)
+{
+    int const n = qs.size();
+    transfers.reset(n);
+    TransferMatrix rows;
+    for (int begin = 0; begin < n; begin += batch) {
+        if (live.cancelled()) {
+            throw TransferCancelled();
+        }
+        int const end = std::min(n, begin + batch);
+        calcRows(begin, end, rows);
+        transfers.appendRows(rows);
+        previewSweep(qs, transfers);
+        live.publish(qs);
+    }
+}
+
+int solveLive(RadiositySolver &solver, std::vector<Quad> &qs,
+              double target, LiveSolve &live, double interval,
+              solverReportFn_t const &report)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point lastPublished = clock::now();
+    SolverStats stats;
+    do {
+        {
+            PROFILE_SCOPE("RadiositySolver::iterate");
+            stats = solver.iterate();
+        }
+        if (report) {
+            report(stats);
+        }
+        clock::time_point const now = clock::now();
+        if (std::chrono::duration<double>(now - lastPublished).count() >= interval) {
+            solver.writeBack();
+            live.publish(qs);
+            lastPublished = now;
+        }
+    } while (stats.residual > target * stats.totalLight && !live.cancelled());
+    solver.writeBack();
+    live.publish(qs);
+    return stats.iteration;
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////
+//
+// live_solve.h: Calculate and solve on a worker thread, while the
+// viewer shows the lighting so far.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_LIVE_SOLVE_H
+#define RADIOSITY_LIVE_SOLVE_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "geom.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+
+// Runs a piece of work (typically the transfers and then the solve)
+// on its own thread. As it goes, the work publishes snapshots of the
+// quads' light levels, and the viewer picks up the latest one. The
+// snapshots are double buffered: publishing fills the worker's own
+// buffer and then swaps it with the shared one under a lock, and
+// taking swaps the shared one out, so neither side holds the lock
+// for longer than a swap, and the buffers are only allocated once.
+class LiveSolve
+{
+public:
+    typedef std::function<void(LiveSolve &)> workFn_t;
+
+    // Start "work" on a new thread, for a scene of "quads" quads.
+    // If the work throws TransferCancelled it just stops, and if it
+    // throws std::runtime_error, the message is printed and failed()
+    // becomes true.
+    LiveSolve(int quads, workFn_t const &work);
+    // Cancels, and waits for the worker.
+    ~LiveSolve();
+
+    // For the worker: make the screenColours of "qs" the latest
+    // snapshot.
+    void publish(std::vector<Quad> const &qs);
+    // True once the work should stop early.
+    bool cancelled() const;
+
+    // For the viewer: if there's been a snapshot since the last
+    // call, swap it into "colours", which is resized to match, and
+    // return true.
+    bool take(std::vector<Colour> &colours);
+    // True once the work has returned. Any snapshot it published
+    // before returning can still be taken.
+    bool finished() const;
+    bool failed() const;
+    void cancel();
+
+    // Number of snapshots published so far.
+    int published() const;
+
+private:
+    void run(workFn_t work);
+
+    // Not copyable, as the worker refers to it.
+    LiveSolve(LiveSolve const &);
+    LiveSolve &operator=(LiveSolve const &);
+
+    // Only touched by the worker.
+    std::vector<Colour> m_back;
+    // Guarded by m_mutex.
+    std::vector<Colour> m_ready;
+    bool m_fresh;
+    int m_published;
+    mutable std::mutex m_mutex;
+
+    std::atomic<bool> m_cancelled;
+    std::atomic<bool> m_finished;
+    std::atomic<bool> m_failed;
+    std::thread m_thread;
+};
+
+// One Jacobi sweep over the rows of "transfers" calculated so far,
+// updating the screenColours of those quads. Emitters take their
+// material colour, and the quads without rows are left alone.
+void previewSweep(std::vector<Quad> &qs, TransferMatrix const &transfers,
+                  int threads = 0);
+
+// Calculates rows [begin, end) of the transfers into "rows", as for
+// setRows and calcAllLights on a transfer calculator.
+typedef std::function<void(int begin, int end, TransferMatrix &rows)> rowsFn_t;
+
+// Fill in "transfers" for all of "qs", "batch" rows at a time with
+// "calcRows". After each batch, the lighting gets a preview sweep and
+// is published, so it fills in as the rows arrive. Throws
+// TransferCancelled if cancelled between batches.
+void calcTransfersLive(rowsFn_t const &calcRows, int batch,
+                       std::vector<Quad> &qs, TransferMatrix &transfers,
+                       LiveSolve &live);
+
+// As solveLighting, for a solver working on "qs", but publishing the
+// lighting after iterations at most every "interval" seconds, and at
+// the end. Stops early, with the lighting so far written back, if
+// cancelled. Returns the number of iterations.
+int solveLive(RadiositySolver &solver, std::vector<Quad> &qs,
+              double target, LiveSolve &live, double interval = 0.1,
+              solverReportFn_t const &report = solverReportFn_t());
+
+#endif // RADIOSITY_LIVE_SOLVE_H
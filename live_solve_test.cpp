@@ -0,0 +1,232 @@
+////////////////////////////////////////////////////////////////////////
+//
+// live_solve_test.cpp: Tests for live_solve.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "live_solve.h"
+#include "radiance.h"
+#include "ray_transfers.h"
+#include "solver.h"
+#include "test_scene.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class LiveSolveTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+
+    CPPUNIT_TEST_SUITE(LiveSolveTestCase);
+    CPPUNIT_TEST(testSnapshots);
+    CPPUNIT_TEST(testCancel);
+    CPPUNIT_TEST(testFailure);
+    CPPUNIT_TEST(testPreviewSweep);
+    CPPUNIT_TEST(testCalcTransfersLive);
+    CPPUNIT_TEST(testSolveLive);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testSnapshots();
+    void testCancel();
+    void testFailure();
+    void testPreviewSweep();
+    void testCalcTransfersLive();
+    void testSolveLive();
+
+    void waitUntilFinished(LiveSolve &live);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(LiveSolveTestCase, "LiveSolveTestCase");
+
+void LiveSolveTestCase::waitUntilFinished(LiveSolve &live)
+{
+    for (int i = 0; i < 1000 && !live.finished(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CPPUNIT_ASSERT(live.finished());
+}
+
+// The viewer gets the latest snapshot, once.
+void LiveSolveTestCase::testSnapshots()
+{
+    std::vector<Quad> quads(3, Quad(0, 1, 2, 3, Colour()));
+    LiveSolve live(quads.size(), [&quads](LiveSolve &live) {
+        for (int k = 1; k <= 5; ++k) {
+            for (int i = 0; i < 3; ++i) {
+                quads[i].screenColour = Colour(k, i, 0.0);
+            }
+            live.publish(quads);
+        }
+    });
+    waitUntilFinished(live);
+    CPPUNIT_ASSERT(!live.failed());
+    CPPUNIT_ASSERT_EQUAL(5, live.published());
+
+    std::vector<Colour> colours;
+    CPPUNIT_ASSERT(live.take(colours));
+    CPPUNIT_ASSERT_EQUAL(size_t(3), colours.size());
+    for (int i = 0; i < 3; ++i) {
+        CPPUNIT_ASSERT_EQUAL(5.0, double(colours[i].r));
+        CPPUNIT_ASSERT_EQUAL(double(i), double(colours[i].g));
+    }
+    CPPUNIT_ASSERT(!live.take(colours));
+}
+
+// Work that checks for cancellation stops when asked, and the
+// destructor waits for it.
+void LiveSolveTestCase::testCancel()
+{
+    std::vector<Quad> quads(1, Quad(0, 1, 2, 3, Colour()));
+    std::unique_ptr<LiveSolve> live(
+        new LiveSolve(1, [&quads](LiveSolve &live) {
+            while (!live.cancelled()) {
+                live.publish(quads);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }));
+    CPPUNIT_ASSERT(!live->finished());
+    live->cancel();
+    waitUntilFinished(*live);
+    CPPUNIT_ASSERT(!live->failed());
+    live.reset();
+}
+
+void LiveSolveTestCase::testFailure()
+{
+    LiveSolve live(1, [](LiveSolve &) {
+        throw std::runtime_error("Expected failure from testFailure");
+    });
+    waitUntilFinished(live);
+    CPPUNIT_ASSERT(live.failed());
+}
+
+// With all the rows, a sweep is a Jacobi iteration. With only some,
+// the other quads are left alone.
+void LiveSolveTestCase::testPreviewSweep()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    TransferMatrix transfers;
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(transfers);
+    int const n = quads.size();
+    // The sweep's working copy may be single precision.
+    double const epsilon = sizeof(radiance_t) < sizeof(double) ? 1.0e-6 : 1.0e-12;
+
+    std::vector<Quad> reference(quads);
+    std::vector<Quad> swept(quads);
+    iterateLighting(reference, transfers);
+    previewSweep(swept, transfers, 3);
+    for (int i = 0; i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.r,
+                                     swept[i].screenColour.r, epsilon);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.b,
+                                     swept[i].screenColour.b, epsilon);
+    }
+
+    TransferMatrix half(n);
+    for (int i = 0; i < n / 2; ++i) {
+        std::vector<double> row(n);
+        for (int j = 0; j < n; ++j) {
+            row[j] = transfers.at(i, j);
+        }
+        half.addRow(row);
+    }
+    std::vector<Quad> partial(quads);
+    previewSweep(partial, half);
+    for (int i = 0; i < n; ++i) {
+        double const expected = i < n / 2 ? reference[i].screenColour.g :
+                                            quads[i].screenColour.g;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, partial[i].screenColour.g, epsilon);
+    }
+}
+
+// Calculating in batches gives the same transfers, with the lighting
+// published after each batch.
+void LiveSolveTestCase::testCalcTransfersLive()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    int const n = quads.size();
+    RayTransferCalculator calc(vertices, quads, 1, 2);
+    TransferMatrix reference;
+    calc.calcAllLights(reference);
+
+    TransferMatrix transfers;
+    std::vector<Quad> lit(quads);
+    LiveSolve live(n, [&](LiveSolve &live) {
+        calcTransfersLive([&calc](int begin, int end, TransferMatrix &rows) {
+                              calc.setRows(begin, end);
+                              calc.calcAllLights(rows);
+                          },
+                          n / 4, lit, transfers, live);
+    });
+    waitUntilFinished(live);
+    CPPUNIT_ASSERT(!live.failed());
+    CPPUNIT_ASSERT_EQUAL(4, live.published());
+    CPPUNIT_ASSERT_EQUAL(n, transfers.rowCount());
+    CPPUNIT_ASSERT_EQUAL(reference.nonZeros(), transfers.nonZeros());
+    for (int i = 0; i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(reference.rowEnd(i), transfers.rowEnd(i));
+    }
+    for (size_t k = 0, nnz = reference.nonZeros(); k < nnz; ++k) {
+        CPPUNIT_ASSERT_EQUAL(reference.column(k), transfers.column(k));
+        CPPUNIT_ASSERT_EQUAL(reference.value(k), transfers.value(k));
+    }
+
+    // The last snapshot is the lighting after the final sweep.
+    std::vector<Colour> colours;
+    CPPUNIT_ASSERT(live.take(colours));
+    for (int i = 0; i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(lit[i].screenColour.r, colours[i].r);
+    }
+}
+
+// The same answer as solveLighting, with a snapshot at least at the
+// end.
+void LiveSolveTestCase::testSolveLive()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    TransferMatrix transfers;
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(transfers);
+    int const n = quads.size();
+
+    std::vector<Quad> reference(quads);
+    std::unique_ptr<RadiositySolver> referenceSolver =
+        makeSolver(SOLVER_JACOBI, reference, vertices, transfers, 2);
+    int const referenceIterations = solveLighting(*referenceSolver, 1.0e-4);
+
+    int iterations = 0;
+    std::vector<Quad> lit(quads);
+    LiveSolve live(n, [&](LiveSolve &live) {
+        std::unique_ptr<RadiositySolver> solver =
+            makeSolver(SOLVER_JACOBI, lit, vertices, transfers, 2);
+        // Publish after every iteration.
+        iterations = solveLive(*solver, lit, 1.0e-4, live, 0.0);
+    });
+    waitUntilFinished(live);
+    CPPUNIT_ASSERT_EQUAL(referenceIterations, iterations);
+    CPPUNIT_ASSERT_EQUAL(iterations + 1, live.published());
+    for (int i = 0; i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(reference[i].screenColour.r, lit[i].screenColour.r);
+        CPPUNIT_ASSERT_EQUAL(reference[i].screenColour.b, lit[i].screenColour.b);
+    }
+}
@@ -0,0 +1,179 @@
+////////////////////////////////////////////////////////////////////////
+//
+// parallel.cpp: Simple data-parallel loops over threads.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+int defaultThreadCount()
+{
+    // hardware_concurrency may return 0 if it can't tell.
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+////////////////////////////////////////////////////////////////////////
+// Thread pool, so that the solvers don't have to create threads on
+// every iteration.
+
+namespace {
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int workers)
+        : m_stopping(false)
+    {
+        for (int i = 0; i < workers; ++i) {
+            m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (int i = 0, n = m_workers.size(); i < n; ++i) {
+            m_workers[i].join();
+        }
+    }
+
+    void submit(std::function<void()> const &task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(task);
+        }
+        m_wake.notify_one();
+    }
+
+    // Run queued tasks on the calling thread until "done" returns
+    // true. Helping out, rather than just blocking, means a
+    // parallelFor inside a task can't deadlock the pool.
+    void runUntil(std::function<bool()> const &done)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!done()) {
+            if (m_tasks.empty()) {
+                m_finished.wait(lock);
+                continue;
+            }
+            runOne(lock);
+        }
+    }
+
+private:
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            if (m_stopping) {
+                return;
+            }
+            if (m_tasks.empty()) {
+                m_wake.wait(lock);
+                continue;
+            }
+            runOne(lock);
+        }
+    }
+
+    // Pop and run a task, with the lock released while it runs.
+    void runOne(std::unique_lock<std::mutex> &lock)
+    {
+        std::function<void()> task = m_tasks.front();
+        m_tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+        m_finished.notify_all();
+    }
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()> > m_tasks;
+    std::mutex m_mutex;
+    // Signalled when there's work, and when a task completes.
+    std::condition_variable m_wake;
+    std::condition_variable m_finished;
+    bool m_stopping;
+};
+
+ThreadPool &pool()
+{
+    // The calling thread always does some of the work itself.
+    static ThreadPool instance(defaultThreadCount() - 1);
+    return instance;
+}
+
+} // namespace
+
+void parallelFor(int count, int threads,
+                 std::function<void(int, int)> const &fn)
+{
+    if (threads <= 0) {
+        threads = defaultThreadCount();
+    }
+    threads = std::max(1, std::min(threads, count));
+    if (threads == 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Completion count and first exception, guarded by their own
+    // mutex as the pool's is released while tasks run.
+    std::mutex mutex;
+    int remaining = 0;
+    std::exception_ptr error;
+
+    ThreadPool &p = pool();
+    int const chunk = (count + threads - 1) / threads;
+    for (int begin = chunk; begin < count; begin += chunk) {
+        int const end = std::min(count, begin + chunk);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++remaining;
+        }
+        p.submit([&, begin, end]() {
+            try {
+                fn(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            --remaining;
+        });
+    }
+
+    try {
+        fn(0, std::min(count, chunk));
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+    p.runUntil([&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return remaining == 0;
+    });
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,25 @@
+////////////////////////////////////////////////////////////////////////
+//
+// parallel.h: Simple data-parallel loops over threads.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_PARALLEL_H
+#define RADIOSITY_PARALLEL_H
+
+#include <functional>
+
+// Number of threads to use when the caller asks for 0: one per core.
+int defaultThreadCount();
+
+// Split [0, count) into contiguous chunks, one per thread, and call
+// fn(begin, end) for each chunk. Returns once all chunks are done.
+// The calling thread takes the first chunk, and the rest run on a
+// shared pool of worker threads. Calls may be nested. If a chunk
+// throws, the first exception is rethrown once all chunks are done.
+// "threads" of 0 means defaultThreadCount().
+void parallelFor(int count, int threads,
+                 std::function<void(int, int)> const &fn);
+
+#endif // RADIOSITY_PARALLEL_H
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////
+//
+// parallel_test.cpp: Tests for parallel.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "parallel.h"
+
+class ParallelTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(ParallelTestCase);
+    CPPUNIT_TEST(testCoversRange);
+    CPPUNIT_TEST(testMoreThreadsThanItems);
+    CPPUNIT_TEST(testNested);
+    CPPUNIT_TEST(testException);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testCoversRange();
+    void testMoreThreadsThanItems();
+    void testNested();
+    void testException();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ParallelTestCase, "ParallelTestCase");
+
+void ParallelTestCase::testCoversRange()
+{
+    // Repeatedly, as the pool is reused.
+    for (int iter = 0; iter < 100; ++iter) {
+        std::vector<int> hits(1000);
+        parallelFor(hits.size(), 7, [&hits](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                ++hits[i];
+            }
+        });
+        for (int i = 0, n = hits.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_EQUAL(1, hits[i]);
+        }
+    }
+}
+
+void ParallelTestCase::testMoreThreadsThanItems()
+{
+    std::atomic<int> calls(0);
+    std::atomic<int> total(0);
+    parallelFor(3, 16, [&](int begin, int end) {
+        ++calls;
+        total += end - begin;
+    });
+    CPPUNIT_ASSERT_EQUAL(3, calls.load());
+    CPPUNIT_ASSERT_EQUAL(3, total.load());
+
+    parallelFor(0, 4, [&](int begin, int end) {
+        total += end - begin;
+    });
+    CPPUNIT_ASSERT_EQUAL(3, total.load());
+}
+
+void ParallelTestCase::testNested()
+{
+    std::atomic<int> total(0);
+    parallelFor(8, 8, [&total](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            parallelFor(100, 4, [&total](int b, int e) {
+                total += e - b;
+            });
+        }
+    });
+    CPPUNIT_ASSERT_EQUAL(800, total.load());
+}
+
+void ParallelTestCase::testException()
+{
+    std::atomic<int> total(0);
+    CPPUNIT_ASSERT_THROW(
+        parallelFor(4, 4, [&total](int begin, int end) {
+            total += end - begin;
+            if (begin == 3) {
+                throw std::runtime_error("chunk failed");
+            }
+        }),
+        std::runtime_error);
+    // The other chunks still ran to completion.
+    CPPUNIT_ASSERT_EQUAL(4, total.load());
+}
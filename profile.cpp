@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////
+//
+// profile.cpp: Scoped timers and counters for the hot paths.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profile.h"
+
+namespace {
+
+typedef std::chrono::steady_clock profileClock_t;
+
+struct ScopeStats
+{
+    ScopeStats() : calls(0), totalSeconds(0.0), maxSeconds(0.0) {}
+
+    long long calls;
+    double totalSeconds;
+    double maxSeconds;
+};
+
+struct TraceEvent
+{
+    char const *name;
+    int thread;
+    // Microseconds, from the registry's epoch.
+    double start;
+    double duration;
+};
+
+// Everything recorded, behind a single lock. Scopes are placed
+// around whole stages or rows, not inner loops, so contention isn't
+// a concern.
+struct Registry
+{
+    Registry() : epoch(profileClock_t::now()), keepTrace(false) {}
+
+    std::mutex mutex;
+    profileClock_t::time_point const epoch;
+    std::map<std::string, ScopeStats> scopes;
+    std::map<std::string, long long> counters;
+    bool keepTrace;
+    std::vector<TraceEvent> events;
+    // Small ids for the trace, in order of first appearance.
+    std::map<std::thread::id, int> threads;
+    std::string tracePath;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+double microseconds(profileClock_t::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+#ifdef RADIOSITY_PROFILE
+void reportAtExit()
+{
+    profileReport(std::cerr);
+    std::string const &path = registry().tracePath;
+    if (!path.empty()) {
+        try {
+            profileWriteTrace(path);
+            std::cerr << "Wrote trace to " << path << std::endl;
+        } catch (std::runtime_error const &e) {
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+}
+#endif
+
+} // namespace
+
+ProfileScope::ProfileScope(char const *name)
+    : m_name(name),
+      m_start(profileClock_t::now())
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+    profileClock_t::time_point const end = profileClock_t::now();
+    double const seconds = std::chrono::duration<double>(end - m_start).count();
+
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    ScopeStats &stats = r.scopes[m_name];
+    ++stats.calls;
+    stats.totalSeconds += seconds;
+    stats.maxSeconds = std::max(stats.maxSeconds, seconds);
+    if (r.keepTrace) {
+        std::thread::id const id = std::this_thread::get_id();
+        std::map<std::thread::id, int>::iterator iter = r.threads.find(id);
+        if (iter == r.threads.end()) {
+            iter = r.threads.insert(std::make_pair(id, r.threads.size())).first;
+        }
+        TraceEvent event = { m_name, iter->second,
+                             microseconds(m_start - r.epoch),
+                             microseconds(end - m_start) };
+        r.events.push_back(event);
+    }
+}
+
+void profileCount(char const *name, long long amount)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.counters[name] += amount;
+}
+
+long long profileCalls(char const *name)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::map<std::string, ScopeStats>::const_iterator iter = r.scopes.find(name);
+    return iter == r.scopes.end() ? 0 : iter->second.calls;
+}
+
+long long profileCounter(char const *name)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::map<std::string, long long>::const_iterator iter = r.counters.find(name);
+    return iter == r.counters.end() ? 0 : iter->second;
+}
+
+void profileKeepTrace(bool keep)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.keepTrace = keep;
+}
+
+void profileReport(std::ostream &out)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.scopes.empty() && r.counters.empty()) {
+        return;
+    }
+
+    typedef std::pair<std::string, ScopeStats> entry_t;
+    std::vector<entry_t> scopes(r.scopes.begin(), r.scopes.end());
+    std::sort(scopes.begin(), scopes.end(),
+              [](entry_t const &a, entry_t const &b) {
+                  return a.second.totalSeconds > b.second.totalSeconds;
+              });
+
+    std::ios_base::fmtflags const flags = out.flags();
+    std::streamsize const precision = out.precision();
+    out << std::left << std::setw(28) << "Scope" << std::right
+        << std::setw(10) << "Calls"
+        << std::setw(14) << "Total ms"
+        << std::setw(12) << "Mean ms"
+        << std::setw(12) << "Max ms" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (int i = 0, n = scopes.size(); i < n; ++i) {
+        ScopeStats const &s = scopes[i].second;
+        out << std::left << std::setw(28) << scopes[i].first << std::right
+            << std::setw(10) << s.calls
+            << std::setw(14) << s.totalSeconds * 1000.0
+            << std::setw(12) << s.totalSeconds * 1000.0 / s.calls
+            << std::setw(12) << s.maxSeconds * 1000.0 << std::endl;
+    }
+    for (std::map<std::string, long long>::const_iterator
+             iter = r.counters.begin(), end = r.counters.end();
+         iter != end; ++iter) {
+        out << std::left << std::setw(28) << iter->first << std::right
+            << std::setw(10) << iter->second << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void profileWriteTrace(std::string const &path)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::ofstream out(path.c_str());
+    if (!out) {
+        throw std::runtime_error("Couldn't create trace " + path);
+    }
+    // Scope names are literals from our own code, so don't need
+    // escaping.
+    out << "{\"traceEvents\": [";
+    out << std::fixed << std::setprecision(3);
+    for (int i = 0, n = r.events.size(); i < n; ++i) {
+        TraceEvent const &e = r.events[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "{\"name\": \"" << e.name << "\", \"ph\": \"X\""
+            << ", \"pid\": 1, \"tid\": " << e.thread
+            << ", \"ts\": " << e.start << ", \"dur\": " << e.duration << "}";
+    }
+    out << "\n]}\n";
+    if (!out) {
+        throw std::runtime_error("Couldn't write trace " + path);
+    }
+}
+
+void profileReset()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.scopes.clear();
+    r.counters.clear();
+    r.events.clear();
+}
+
+void profileReportAtExit(std::string const &tracePath)
+{
+#ifdef RADIOSITY_PROFILE
+    // Create the registry first, so it's still there when the
+    // handler runs.
+    Registry &r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.tracePath = tracePath;
+        r.keepTrace = r.keepTrace || !tracePath.empty();
+    }
+    std::atexit(reportAtExit);
+#else
+    // Nothing will be recorded.
+    if (!tracePath.empty()) {
+        std::cerr << "Warning: built without RADIOSITY_PROFILE, "
+                  << "so no trace will be written" << std::endl;
+    }
+#endif
+}
@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////
+//
+// profile.h: Scoped timers and counters for the hot paths.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_PROFILE_H
+#define RADIOSITY_PROFILE_H
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+
+// PROFILE_SCOPE times the rest of the enclosing block, and
+// PROFILE_COUNT adds to a named counter. Both are thread-safe, and
+// compile to nothing unless built with RADIOSITY_PROFILE. Names must
+// be string literals, as they're kept by pointer.
+#ifdef RADIOSITY_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define PROFILE_COUNT(name, amount) profileCount(name, amount)
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_COUNT(name, amount) do {} while (0)
+#endif
+
+// Records the time from construction to destruction against "name".
+class ProfileScope
+{
+public:
+    explicit ProfileScope(char const *name);
+    ~ProfileScope();
+
+private:
+    char const *const m_name;
+    std::chrono::steady_clock::time_point const m_start;
+};
+
+void profileCount(char const *name, long long amount);
+
+// Number of times the named scope has completed, or the total of
+// the named counter.
+long long profileCalls(char const *name);
+long long profileCounter(char const *name);
+
+// Keep every scope's start and duration, for profileWriteTrace, as
+// well as the totals. Off by default, as it grows with the run.
+void profileKeepTrace(bool keep);
+
+// Print a table of calls and times per scope, slowest first, and the
+// counters. Prints nothing if nothing has been recorded.
+void profileReport(std::ostream &out);
+
+// Write the kept scopes in Chrome's trace event format, for
+// chrome://tracing or Perfetto. Throws std::runtime_error if the
+// file can't be written.
+void profileWriteTrace(std::string const &path);
+
+// Forget everything recorded so far.
+void profileReset();
+
+// On exit, print the report to stderr, and write the trace to
+// "tracePath" if it isn't empty (which turns on profileKeepTrace).
+// The viewer's event loop never returns, so this is the only place
+// to do it. Does nothing but warn about the trace without
+// RADIOSITY_PROFILE.
+void profileReportAtExit(std::string const &tracePath);
+
+#endif // RADIOSITY_PROFILE_H
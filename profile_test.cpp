@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////
+//
+// profile_test.cpp: Tests for profile.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "parallel.h"
+#include "profile.h"
+
+// These use ProfileScope directly, so they work whether or not the
+// macros are compiled in. The other tests may have recorded scopes
+// too, so everything is reset first.
+class ProfileTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(ProfileTestCase);
+    CPPUNIT_TEST(testScopes);
+    CPPUNIT_TEST(testCounters);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testReport);
+    CPPUNIT_TEST(testTrace);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testScopes();
+    void testCounters();
+    void testThreads();
+    void testReport();
+    void testTrace();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ProfileTestCase, "ProfileTestCase");
+
+void ProfileTestCase::testScopes()
+{
+    profileReset();
+    CPPUNIT_ASSERT_EQUAL(0LL, profileCalls("outer"));
+    for (int i = 0; i < 3; ++i) {
+        ProfileScope outer("outer");
+        ProfileScope inner("inner");
+    }
+    CPPUNIT_ASSERT_EQUAL(3LL, profileCalls("outer"));
+    CPPUNIT_ASSERT_EQUAL(3LL, profileCalls("inner"));
+    profileReset();
+    CPPUNIT_ASSERT_EQUAL(0LL, profileCalls("outer"));
+}
+
+void ProfileTestCase::testCounters()
+{
+    profileReset();
+    profileCount("pixels", 10);
+    profileCount("pixels", 5);
+    CPPUNIT_ASSERT_EQUAL(15LL, profileCounter("pixels"));
+    CPPUNIT_ASSERT_EQUAL(0LL, profileCounter("missing"));
+}
+
+void ProfileTestCase::testThreads()
+{
+    profileReset();
+    parallelFor(1000, 8, [](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            ProfileScope scope("row");
+            profileCount("rows", 1);
+        }
+    });
+    CPPUNIT_ASSERT_EQUAL(1000LL, profileCalls("row"));
+    CPPUNIT_ASSERT_EQUAL(1000LL, profileCounter("rows"));
+}
+
+void ProfileTestCase::testReport()
+{
+    profileReset();
+    std::ostringstream empty;
+    profileReport(empty);
+    CPPUNIT_ASSERT(empty.str().empty());
+
+    {
+        ProfileScope scope("glReadPixels");
+    }
+    profileCount("pixels decoded", 1234);
+    std::ostringstream out;
+    profileReport(out);
+    CPPUNIT_ASSERT(out.str().find("glReadPixels") != std::string::npos);
+    CPPUNIT_ASSERT(out.str().find("1234") != std::string::npos);
+    // The stream's formatting is left as it was.
+    CPPUNIT_ASSERT_EQUAL(std::streamsize(6), out.precision());
+    CPPUNIT_ASSERT(!(out.flags() & std::ios_base::fixed));
+}
+
+void ProfileTestCase::testTrace()
+{
+    profileReset();
+    profileKeepTrace(true);
+    {
+        ProfileScope scope("traced");
+    }
+    profileKeepTrace(false);
+    {
+        ProfileScope scope("untraced");
+    }
+
+    std::ostringstream path;
+    path << "/tmp/profile_test." << getpid() << ".json";
+    profileWriteTrace(path.str());
+    std::ifstream in(path.str().c_str());
+    std::string trace((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    unlink(path.str().c_str());
+
+    CPPUNIT_ASSERT(trace.compare(0, 17, "{\"traceEvents\": [") == 0);
+    CPPUNIT_ASSERT(trace.find("\"name\": \"traced\"") != std::string::npos);
+    CPPUNIT_ASSERT(trace.find("\"ph\": \"X\"") != std::string::npos);
+    CPPUNIT_ASSERT(trace.find("untraced") == std::string::npos);
+    profileReset();
+}
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////
+//
+// progress.cpp: Progress reporting and cancellation for the transfer
+// calculations.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+#include "progress.h"
+
+// Lines printed by progressPrinter over a calculation.
+static int const PRINTER_STEPS = 10;
+
+TransferCancelled::TransferCancelled()
+    : std::runtime_error("Transfer calculation cancelled")
+{
+}
+
+ProgressTracker::ProgressTracker(int total,
+                                 transferProgressFn_t const &progress)
+    : m_total(total),
+      m_progress(progress),
+      m_start(std::chrono::steady_clock::now()),
+      m_done(0),
+      m_cancelled(false)
+{
+}
+
+void ProgressTracker::rowDone()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_cancelled) {
+        throw TransferCancelled();
+    }
+    ++m_done;
+    if (!m_progress) {
+        return;
+    }
+
+    TransferProgress p;
+    p.done = m_done;
+    p.total = m_total;
+    p.elapsedSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - m_start).count();
+    p.rowsPerSecond = p.elapsedSeconds > 0.0 ? m_done / p.elapsedSeconds : 0.0;
+    p.secondsRemaining = p.rowsPerSecond > 0.0 ?
+        (m_total - m_done) / p.rowsPerSecond : 0.0;
+    if (!m_progress(p)) {
+        m_cancelled = true;
+        throw TransferCancelled();
+    }
+}
+
+transferProgressFn_t progressPrinter(std::ostream &out)
+{
+    return [&out](TransferProgress const &p) {
+        // Print when we cross into the next step.
+        if (p.done * PRINTER_STEPS / p.total !=
+            (p.done - 1) * PRINTER_STEPS / p.total) {
+            std::ios_base::fmtflags const flags = out.flags();
+            std::streamsize const precision = out.precision();
+            out << std::fixed << std::setprecision(1)
+                << p.done << "/" << p.total << " rows, "
+                << p.rowsPerSecond << " rows/s, "
+                << p.secondsRemaining << "s remaining" << std::endl;
+            out.flags(flags);
+            out.precision(precision);
+        }
+        return true;
+    };
+}
@@ -0,0 +1,67 @@
+////////////////////////////////////////////////////////////////////////
+//
+// progress.h: Progress reporting and cancellation for the transfer
+// calculations.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_PROGRESS_H
+#define RADIOSITY_PROGRESS_H
+
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <stdexcept>
+
+// How far through a calculation we are.
+struct TransferProgress
+{
+    // Rows (target quads) finished, out of "total".
+    int done;
+    int total;
+    double elapsedSeconds;
+    double rowsPerSecond;
+    // Estimated from the rate so far. Zero until a row is done.
+    double secondsRemaining;
+};
+
+// Called after each row. Return false to cancel the calculation.
+typedef std::function<bool(TransferProgress const &)> transferProgressFn_t;
+
+// Thrown out of calcAllLights when the progress function cancels.
+// The transfers being built are left incomplete.
+class TransferCancelled : public std::runtime_error
+{
+public:
+    TransferCancelled();
+};
+
+// Counts rows for a calculation, calling the progress function,
+// which may be empty. Rows may be finished on any thread; the calls
+// are serialised.
+class ProgressTracker
+{
+public:
+    ProgressTracker(int total, transferProgressFn_t const &progress);
+
+    // Record another row done. Throws TransferCancelled if the
+    // progress function asks to stop, or already has, so that rows
+    // on other threads stop too.
+    void rowDone();
+
+private:
+    int const m_total;
+    transferProgressFn_t const m_progress;
+    std::chrono::steady_clock::time_point const m_start;
+    std::mutex m_mutex;
+    int m_done;
+    bool m_cancelled;
+};
+
+// A progress function that prints a line with the rate and ETA to
+// "out" each time another tenth of the rows is done.
+transferProgressFn_t progressPrinter(std::ostream &out);
+
+#endif // RADIOSITY_PROGRESS_H
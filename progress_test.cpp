@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////
+//
+// progress_test.cpp: Tests for progress.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "progress.h"
+#include "ray_transfers.h"
+#include "scene.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class ProgressTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+
+    CPPUNIT_TEST_SUITE(ProgressTestCase);
+    CPPUNIT_TEST(testTracker);
+    CPPUNIT_TEST(testCancel);
+    CPPUNIT_TEST(testPrinter);
+    CPPUNIT_TEST(testAnalyticReports);
+    CPPUNIT_TEST(testRayCancel);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testTracker();
+    void testCancel();
+    void testPrinter();
+    void testAnalyticReports();
+    void testRayCancel();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ProgressTestCase, "ProgressTestCase");
+
+void ProgressTestCase::testTracker()
+{
+    std::vector<TransferProgress> seen;
+    ProgressTracker tracker(4, [&seen](TransferProgress const &p) {
+        seen.push_back(p);
+        return true;
+    });
+    for (int i = 0; i < 4; ++i) {
+        tracker.rowDone();
+    }
+    CPPUNIT_ASSERT_EQUAL(4, static_cast<int>(seen.size()));
+    for (int i = 0; i < 4; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i + 1, seen[i].done);
+        CPPUNIT_ASSERT_EQUAL(4, seen[i].total);
+        CPPUNIT_ASSERT(seen[i].elapsedSeconds >= 0.0);
+        CPPUNIT_ASSERT(seen[i].secondsRemaining >= 0.0);
+    }
+    CPPUNIT_ASSERT_EQUAL(0.0, seen[3].secondsRemaining);
+
+    // With no progress function, it just counts.
+    ProgressTracker silent(2, transferProgressFn_t());
+    silent.rowDone();
+    silent.rowDone();
+}
+
+void ProgressTestCase::testCancel()
+{
+    int calls = 0;
+    ProgressTracker tracker(10, [&calls](TransferProgress const &p) {
+        ++calls;
+        return p.done < 3;
+    });
+    tracker.rowDone();
+    tracker.rowDone();
+    CPPUNIT_ASSERT_THROW(tracker.rowDone(), TransferCancelled);
+    // Stays cancelled, without asking again.
+    CPPUNIT_ASSERT_THROW(tracker.rowDone(), TransferCancelled);
+    CPPUNIT_ASSERT_EQUAL(3, calls);
+}
+
+void ProgressTestCase::testPrinter()
+{
+    std::ostringstream out;
+    ProgressTracker tracker(100, progressPrinter(out));
+    for (int i = 0; i < 100; ++i) {
+        tracker.rowDone();
+    }
+    std::string const printed = out.str();
+    int lines = 0;
+    for (size_t i = 0; i < printed.size(); ++i) {
+        lines += printed[i] == '\n';
+    }
+    CPPUNIT_ASSERT_EQUAL(10, lines);
+    CPPUNIT_ASSERT(printed.find("100/100 rows") != std::string::npos);
+    // The stream's formatting is left as it was.
+    CPPUNIT_ASSERT_EQUAL(std::streamsize(6), out.precision());
+    CPPUNIT_ASSERT(!(out.flags() & std::ios_base::fixed));
+}
+
+void ProgressTestCase::testAnalyticReports()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildCubeScene(SUBDIVISION, false, vertices, quads, subdivs);
+
+    int last = 0;
+    AnalyticTransferCalculator calc(vertices, quads);
+    calc.setProgress([&last](TransferProgress const &p) {
+        CPPUNIT_ASSERT_EQUAL(last + 1, p.done);
+        last = p.done;
+        return true;
+    });
+    TransferMatrix transfers;
+    calc.calcAllLights(transfers);
+    CPPUNIT_ASSERT_EQUAL(static_cast<int>(quads.size()), last);
+}
+
+// Cancelling from one thread stops the others, rather than them
+// finishing all their rows first.
+void ProgressTestCase::testRayCancel()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildCubeScene(SUBDIVISION, false, vertices, quads, subdivs);
+
+    std::atomic<int> calls(0);
+    RayTransferCalculator calc(vertices, quads, 1, 4);
+    calc.setProgress([&calls](TransferProgress const &p) {
+        ++calls;
+        return p.done < 5;
+    });
+    TransferMatrix transfers;
+    CPPUNIT_ASSERT_THROW(calc.calcAllLights(transfers), TransferCancelled);
+    CPPUNIT_ASSERT_EQUAL(5, calls.load());
+
+    calls = 0;
+    std::vector<double> weights;
+    CPPUNIT_ASSERT_THROW(calc.calcAllLights(weights), TransferCancelled);
+    CPPUNIT_ASSERT_EQUAL(5, calls.load());
+}
@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////
+//
+// quad_buffer.cpp: Quads uploaded to a GL vertex buffer, so a whole
+// scene can be drawn with one call.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+// Needed for the buffer entry points outside MacOS.
+#define GL_GLEXT_PROTOTYPES
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "geom.h"
+#include "quad_buffer.h"
+
+QuadBuffer::QuadBuffer()
+    : m_buffer(0),
+      m_allocated(0),
+      m_dirtyBegin(0),
+      m_dirtyEnd(0)
+{
+}
+
+QuadBuffer::~QuadBuffer()
+{
+    clear();
+}
+
+void QuadBuffer::setPosition(BufferVertex &bv, Vertex const &v)
+{
+    for (int i = 0; i < 3; ++i) {
+        bv.position[i] = v.p[i];
+    }
+}
+
+// Clamped, as GL would when drawing.
+void QuadBuffer::setColour(BufferVertex &bv, Colour const &c)
+{
+    double const channels[] = { c.r, c.g, c.b };
+    for (int i = 0; i < 3; ++i) {
+        double x = std::min(std::max(channels[i], 0.0), 1.0);
+        bv.colour[i] = static_cast<GLubyte>(x * 255.0 + 0.5);
+    }
+    bv.colour[3] = 255;
+}
+
+void QuadBuffer::setIndexQuads(std::vector<Quad> const &qs,
+                               std::vector<Vertex> const &vs,
+                               unsigned first)
+{
+    m_data.resize(4 * qs.size());
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            BufferVertex &bv = m_data[4 * i + j];
+            setPosition(bv, vs[qs[i].indices[j]]);
+            encodeIndex(first + i, bv.colour);
+        }
+    }
+    m_dirtyBegin = 0;
+    m_dirtyEnd = m_data.size();
+}
+
+void QuadBuffer::setFlatQuads(std::vector<Quad> const &qs,
+                              std::vector<Vertex> const &vs)
+{
+    m_data.resize(4 * qs.size());
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            BufferVertex &bv = m_data[4 * i + j];
+            setPosition(bv, vs[qs[i].indices[j]]);
+            setColour(bv, qs[i].screenColour);
+        }
+    }
+    m_dirtyBegin = 0;
+    m_dirtyEnd = m_data.size();
+}
+
+void QuadBuffer::setGouraudQuads(std::vector<GouraudQuad> const &qs,
+                                 std::vector<Vertex> const &vs)
+{
+    m_data.resize(4 * qs.size());
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            BufferVertex &bv = m_data[4 * i + j];
+            setPosition(bv, vs[qs[i].vertexIndex(j)]);
+            setColour(bv, qs[i].colour(j));
+        }
+    }
+    m_dirtyBegin = 0;
+    m_dirtyEnd = m_data.size();
+}
+
+void QuadBuffer::setColours(int first, std::vector<Colour> const &colours)
+{
+    int const begin = 4 * first;
+    int const end = begin + colours.size();
+    for (int i = begin; i < end; ++i) {
+        setColour(m_data[i], colours[i - begin]);
+    }
+    if (m_dirtyBegin == m_dirtyEnd) {
+        m_dirtyBegin = begin;
+        m_dirtyEnd = end;
+    } else {
+        m_dirtyBegin = std::min(m_dirtyBegin, begin);
+        m_dirtyEnd = std::max(m_dirtyEnd, end);
+    }
+}
+
+// Send the changed vertices to GL, reallocating the buffer if the
+// number of quads has changed.
+void QuadBuffer::upload()
+{
+    if (m_buffer == 0) {
+        glGenBuffers(1, &m_buffer);
+    }
+    int const n = m_data.size();
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    if (n != m_allocated) {
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(BufferVertex),
+                     n == 0 ? NULL : &m_data[0], GL_STATIC_DRAW);
+        m_allocated = n;
+    } else if (m_dirtyBegin < m_dirtyEnd) {
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        m_dirtyBegin * sizeof(BufferVertex),
+                        (m_dirtyEnd - m_dirtyBegin) * sizeof(BufferVertex),
+                        &m_data[m_dirtyBegin]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+int QuadBuffer::size() const
+{
+    return m_data.size() / 4;
+}
+
+void QuadBuffer::draw()
+{
+    if (m_data.empty()) {
+        return;
+    }
+    if (m_buffer == 0 || m_dirtyBegin < m_dirtyEnd) {
+        upload();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(BufferVertex),
+                    reinterpret_cast<GLvoid const *>(
+                        offsetof(BufferVertex, position)));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BufferVertex),
+                   reinterpret_cast<GLvoid const *>(
+                       offsetof(BufferVertex, colour)));
+    glDrawArrays(GL_QUADS, 0, m_data.size());
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void QuadBuffer::clear()
+{
+    if (m_buffer != 0) {
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+    m_data.clear();
+    m_allocated = 0;
+    m_dirtyBegin = m_dirtyEnd = 0;
+}
@@ -0,0 +1,83 @@
+////////////////////////////////////////////////////////////////////////
+//
+// quad_buffer.h: Quads uploaded to a GL vertex buffer, so a whole
+// scene can be drawn with one call.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_QUAD_BUFFER_H
+#define RADIOSITY_QUAD_BUFFER_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <vector>
+
+#include "geom.h"
+
+// Holds four vertices per quad, each with a position and an RGBA8
+// colour, interleaved in a single vertex buffer. Changes are kept
+// on the CPU side and uploaded when next drawn, so the quads can be
+// set before there's a GL context. Call clear() before destroying
+// the context it was drawn in.
+class QuadBuffer
+{
+public:
+    QuadBuffer();
+    ~QuadBuffer();
+
+    // Quads drawn in flat colours encoding their index, see
+    // encodeIndex. Quad i gets index "first + i".
+    void setIndexQuads(std::vector<Quad> const &qs,
+                       std::vector<Vertex> const &vs,
+                       unsigned first = 1);
+    // Quads drawn in their flat screen colours.
+    void setFlatQuads(std::vector<Quad> const &qs,
+                      std::vector<Vertex> const &vs);
+    // Quads with per-corner colours.
+    void setGouraudQuads(std::vector<GouraudQuad> const &qs,
+                         std::vector<Vertex> const &vs);
+
+    // Replace the colours of quads [first, first + colours.size() / 4),
+    // keeping their positions. Four colours per quad, in corner
+    // order. Only that range is re-uploaded.
+    void setColours(int first, std::vector<Colour> const &colours);
+
+    // Number of quads held.
+    int size() const;
+
+    // Draw everything, with the current GL state.
+    void draw();
+
+    // Release the GL buffer.
+    void clear();
+
+private:
+    struct BufferVertex
+    {
+        GLfloat position[3];
+        GLubyte colour[4];
+    };
+
+    static void setPosition(BufferVertex &bv, Vertex const &v);
+    static void setColour(BufferVertex &bv, Colour const &c);
+    void upload();
+
+    // Not copyable, as it owns the buffer.
+    QuadBuffer(QuadBuffer const &);
+    QuadBuffer &operator=(QuadBuffer const &);
+
+    std::vector<BufferVertex> m_data;
+    GLuint m_buffer;
+    // Vertices the GL buffer was allocated for.
+    int m_allocated;
+    // Range of vertices changed since the last upload.
+    int m_dirtyBegin;
+    int m_dirtyEnd;
+};
+
+#endif // RADIOSITY_QUAD_BUFFER_H
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////
+//
+// quad_buffer_test.cpp: Tests for quad_buffer.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "quad_buffer.h"
+
+class QuadBufferTestCase : public CppUnit::TestCase
+{
+private:
+    const int SIZE = 16;
+
+    CPPUNIT_TEST_SUITE(QuadBufferTestCase);
+    CPPUNIT_TEST(testIndexQuads);
+    CPPUNIT_TEST(testFlatQuads);
+    CPPUNIT_TEST(testSetColours);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testIndexQuads();
+    void testFlatQuads();
+    void testSetColours();
+
+    void buildScene(std::vector<Vertex> &vertices, std::vector<Quad> &quads);
+    std::vector<GLubyte> drawAndRead(QuadBuffer &buffer);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(QuadBufferTestCase, "QuadBufferTestCase");
+
+// Two quads in front of the camera, covering the left and right
+// halves of the view.
+void QuadBufferTestCase::buildScene(std::vector<Vertex> &vertices,
+                                    std::vector<Quad> &quads)
+{
+    for (int i = 0; i < 3; ++i) {
+        double x = -2.0 + 2.0 * i;
+        vertices.push_back(Vertex(x, -2.0, -1.0));
+        vertices.push_back(Vertex(x,  2.0, -1.0));
+    }
+    quads.push_back(Quad(0, 2, 3, 1, Colour(1.0, 0.5, 0.0)));
+    quads.push_back(Quad(2, 4, 5, 3, Colour(0.0, 0.25, 2.0)));
+    for (int i = 0; i < 2; ++i) {
+        quads[i].screenColour = quads[i].materialColour;
+    }
+}
+
+std::vector<GLubyte> QuadBufferTestCase::drawAndRead(QuadBuffer &buffer)
+{
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    buffer.draw();
+    std::vector<GLubyte> pixels(4 * SIZE * SIZE);
+    glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    return pixels;
+}
+
+void QuadBufferTestCase::testIndexQuads()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildScene(vertices, quads);
+
+    int win = gwTransferSetup(SIZE);
+    QuadBuffer buffer;
+    buffer.setIndexQuads(quads, vertices, 0x01020304);
+    CPPUNIT_ASSERT_EQUAL(2, buffer.size());
+    std::vector<GLubyte> pixels = drawAndRead(buffer);
+    for (int y = 0; y < SIZE; ++y) {
+        for (int x = 0; x < SIZE; ++x) {
+            unsigned expected = 0x01020304 + (x < SIZE / 2 ? 0 : 1);
+            CPPUNIT_ASSERT_EQUAL(expected,
+                                 decodeIndex(&pixels[4 * (y * SIZE + x)]));
+        }
+    }
+    buffer.clear();
+    CPPUNIT_ASSERT_EQUAL(0, buffer.size());
+    gwTransferTeardown(win);
+}
+
+void QuadBufferTestCase::testFlatQuads()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildScene(vertices, quads);
+
+    int win = gwTransferSetup(SIZE);
+    QuadBuffer buffer;
+    buffer.setFlatQuads(quads, vertices);
+    std::vector<GLubyte> pixels = drawAndRead(buffer);
+    buffer.clear();
+    gwTransferTeardown(win);
+
+    // Left is orange, right is blue, clamped.
+    GLubyte const *left = &pixels[4 * (SIZE / 2 * SIZE + 1)];
+    CPPUNIT_ASSERT_EQUAL(255, int(left[0]));
+    CPPUNIT_ASSERT_EQUAL(128, int(left[1]));
+    CPPUNIT_ASSERT_EQUAL(0, int(left[2]));
+    GLubyte const *right = &pixels[4 * (SIZE / 2 * SIZE + SIZE - 2)];
+    CPPUNIT_ASSERT_EQUAL(0, int(right[0]));
+    CPPUNIT_ASSERT_EQUAL(64, int(right[1]));
+    CPPUNIT_ASSERT_EQUAL(255, int(right[2]));
+}
+
+// Recolouring one quad after the first draw only changes that quad.
+void QuadBufferTestCase::testSetColours()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildScene(vertices, quads);
+
+    int win = gwTransferSetup(SIZE);
+    QuadBuffer buffer;
+    buffer.setFlatQuads(quads, vertices);
+    drawAndRead(buffer);
+    buffer.setColours(1, std::vector<Colour>(4, Colour(0.0, 1.0, 0.0)));
+    std::vector<GLubyte> pixels = drawAndRead(buffer);
+    buffer.clear();
+    gwTransferTeardown(win);
+
+    GLubyte const *left = &pixels[4 * (SIZE / 2 * SIZE + 1)];
+    CPPUNIT_ASSERT_EQUAL(255, int(left[0]));
+    CPPUNIT_ASSERT_EQUAL(128, int(left[1]));
+    GLubyte const *right = &pixels[4 * (SIZE / 2 * SIZE + SIZE - 2)];
+    CPPUNIT_ASSERT_EQUAL(0, int(right[0]));
+    CPPUNIT_ASSERT_EQUAL(255, int(right[1]));
+    CPPUNIT_ASSERT_EQUAL(0, int(right[2]));
+}
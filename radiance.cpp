@@ -0,0 +1,378 @@
+////////////////////////////////////////////////////////////////////////
+//
+// radiance.cpp: Structure-of-arrays light levels for the solver.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "geom.h"
+#include "parallel.h"
+#include "radiance.h"
+#include "transfer_matrix.h"
+
+RadianceBuffer::RadianceBuffer(int size)
+{
+    resize(size);
+}
+
+void RadianceBuffer::resize(int size)
+{
+    r.resize(size);
+    g.resize(size);
+    b.resize(size);
+}
+
+int RadianceBuffer::size() const
+{
+    return r.size();
+}
+
+void RadianceBuffer::load(std::vector<Quad> const &qs)
+{
+    int const n = qs.size();
+    resize(n);
+    for (int i = 0; i < n; ++i) {
+        set(i, qs[i].screenColour);
+    }
+}
+
+void RadianceBuffer::store(std::vector<Quad> &qs) const
+{
+    for (int i = 0, n = size(); i < n; ++i) {
+        qs[i].screenColour = get(i);
+    }
+}
+
+Colour RadianceBuffer::get(int i) const
+{
+    return Colour(r[i], g[i], b[i]);
+}
+
+void RadianceBuffer::set(int i, Colour const &c)
+{
+    r[i] = c.r;
+    g[i] = c.g;
+    b[i] = c.b;
+}
+
+void RadianceBuffer::add(int i, Colour const &c)
+{
+    r[i] += c.r;
+    g[i] += c.g;
+    b[i] += c.b;
+}
+
+void RadianceBuffer::swap(RadianceBuffer &other)
+{
+    r.swap(other.r);
+    g.swap(other.g);
+    b.swap(other.b);
+}
+
+RadianceBatch::RadianceBatch(int size, int scenarios)
+{
+    resize(size, scenarios);
+}
+
+void RadianceBatch::resize(int size, int scenarios)
+{
+    m_scenarios = scenarios;
+    values.resize(size_t(size) * scenarios * 3);
+}
+
+int RadianceBatch::size() const
+{
+    return values.size() / (3 * m_scenarios);
+}
+
+int RadianceBatch::scenarios() const
+{
+    return m_scenarios;
+}
+
+void RadianceBatch::load(int s, std::vector<Quad> const &qs)
+{
+    for (int i = 0, n = size(); i < n; ++i) {
+        set(i, s, qs[i].screenColour);
+    }
+}
+
+void RadianceBatch::store(int s, std::vector<Quad> &qs) const
+{
+    for (int i = 0, n = size(); i < n; ++i) {
+        qs[i].screenColour = get(i, s);
+    }
+}
+
+Colour RadianceBatch::get(int i, int s) const
+{
+    radiance_t const *p = quad(i) + 3 * s;
+    return Colour(p[0], p[1], p[2]);
+}
+
+void RadianceBatch::set(int i, int s, Colour const &c)
+{
+    radiance_t *p = &values[(size_t(i) * m_scenarios + s) * 3];
+    p[0] = c.r;
+    p[1] = c.g;
+    p[2] = c.b;
+}
+
+radiance_t const *RadianceBatch::quad(int i) const
+{
+    return &values[size_t(i) * m_scenarios * 3];
+}
+
+////////////////////////////////////////////////////////////////////////
+// The inner loop. This is where the solver spends nearly all its time.
+
+#ifdef __AVX2__
+
+#ifdef __FMA__
+#define MUL_ADD_PD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define MUL_ADD_PS(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define MUL_ADD_PD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#define MUL_ADD_PS(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+static double hsum(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+static double hsum(__m256 v)
+{
+    // Widen before adding up, to keep some precision.
+    __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+    __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+    return hsum(_mm256_add_pd(lo, hi));
+}
+
+#ifndef RADIOSITY_FLOAT_TRANSFERS
+
+// Four doubles at a time.
+static size_t gatherBlock(int const *columns, double const *values,
+                          size_t k, size_t end,
+                          RadianceBuffer const &src,
+                          double &r, double &g, double &b)
+{
+    __m256d accR = _mm256_setzero_pd();
+    __m256d accG = _mm256_setzero_pd();
+    __m256d accB = _mm256_setzero_pd();
+    for (; k + 4 <= end; k += 4) {
+        __m128i idx = _mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(columns + k));
+        __m256d w = _mm256_loadu_pd(values + k);
+        accR = MUL_ADD_PD(w, _mm256_i32gather_pd(src.r.data(), idx, 8), accR);
+        accG = MUL_ADD_PD(w, _mm256_i32gather_pd(src.g.data(), idx, 8), accG);
+        accB = MUL_ADD_PD(w, _mm256_i32gather_pd(src.b.data(), idx, 8), accB);
+    }
+    r += hsum(accR);
+    g += hsum(accG);
+    b += hsum(accB);
+    return k;
+}
+
+#else // RADIOSITY_FLOAT_TRANSFERS
+
+// Eight floats at a time.
+static size_t gatherBlock(int const *columns, float const *values,
+                          size_t k, size_t end,
+                          RadianceBuffer const &src,
+                          double &r, double &g, double &b)
+{
+    __m256 accR = _mm256_setzero_ps();
+    __m256 accG = _mm256_setzero_ps();
+    __m256 accB = _mm256_setzero_ps();
+    for (; k + 8 <= end; k += 8) {
+        __m256i idx = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(columns + k));
+        __m256 w = _mm256_loadu_ps(values + k);
+        accR = MUL_ADD_PS(w, _mm256_i32gather_ps(src.r.data(), idx, 4), accR);
+        accG = MUL_ADD_PS(w, _mm256_i32gather_ps(src.g.data(), idx, 4), accG);
+        accB = MUL_ADD_PS(w, _mm256_i32gather_ps(src.b.data(), idx, 4), accB);
+    }
+    r += hsum(accR);
+    g += hsum(accG);
+    b += hsum(accB);
+    return k;
+}
+
+#endif // RADIOSITY_FLOAT_TRANSFERS
+
+static __m256d load4(double const *p)
+{
+    return _mm256_loadu_pd(p);
+}
+
+static __m256d load4(float const *p)
+{
+    return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+// Four setups from a batch: twelve contiguous levels from each
+// source, as three vectors.
+static void gatherBatchBlock4(int const *columns, transfer_t const *values,
+                              size_t k, size_t end,
+                              radiance_t const *levels, int stride, int offset,
+                              double *out)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    for (; k != end; ++k) {
+        radiance_t const *p = levels + size_t(columns[k]) * stride + offset;
+        __m256d w = _mm256_set1_pd(values[k]);
+        acc0 = MUL_ADD_PD(w, load4(p), acc0);
+        acc1 = MUL_ADD_PD(w, load4(p + 4), acc1);
+        acc2 = MUL_ADD_PD(w, load4(p + 8), acc2);
+    }
+    _mm256_storeu_pd(out + offset, acc0);
+    _mm256_storeu_pd(out + offset + 4, acc1);
+    _mm256_storeu_pd(out + offset + 8, acc2);
+}
+
+#endif // __AVX2__
+
+Colour gatherRow(TransferMatrix const &transfers, int i,
+                 RadianceBuffer const &src)
+{
+    int const *columns = transfers.columns();
+    transfer_t const *values = transfers.values();
+    radiance_t const *srcR = src.r.data();
+    radiance_t const *srcG = src.g.data();
+    radiance_t const *srcB = src.b.data();
+
+    double r = 0.0, g = 0.0, b = 0.0;
+    size_t k = transfers.rowStart(i);
+    size_t const end = transfers.rowEnd(i);
+#ifdef __AVX2__
+    k = gatherBlock(columns, values, k, end, src, r, g, b);
+#endif
+    // Remainder, or everything on targets without gathers (NEON has
+    // none, so the scalar loop is as good as it gets there).
+    for (; k < end; ++k) {
+        int j = columns[k];
+        double w = values[k];
+        r += w * srcR[j];
+        g += w * srcG[j];
+        b += w * srcB[j];
+    }
+    return Colour(r, g, b);
+}
+
+// "Width" levels from each source, starting at "offset", summed in
+// locals so they can stay in registers.
+template<int Width>
+static void gatherBatchBlock(int const *columns, transfer_t const *values,
+                             size_t k, size_t end,
+                             radiance_t const *levels, int stride, int offset,
+                             double *out)
+{
+    double acc[Width] = {};
+    for (; k != end; ++k) {
+        radiance_t const *p = levels + size_t(columns[k]) * stride + offset;
+        double const w = values[k];
+        for (int c = 0; c < Width; ++c) {
+            acc[c] += w * p[c];
+        }
+    }
+    for (int c = 0; c < Width; ++c) {
+        out[offset + c] = acc[c];
+    }
+}
+
+void gatherRow(TransferMatrix const &transfers, int i,
+               RadianceBatch const &src, double *out)
+{
+    int const *columns = transfers.columns();
+    transfer_t const *values = transfers.values();
+    radiance_t const *levels = src.values.data();
+    size_t const start = transfers.rowStart(i);
+    size_t const end = transfers.rowEnd(i);
+    // Four setups at a time, and then any left over singly. The row
+    // is re-read for each block, but from cache rather than memory.
+    int const stride = 3 * src.scenarios();
+    int s = 0;
+    for (; s + 4 <= src.scenarios(); s += 4) {
+#ifdef __AVX2__
+        gatherBatchBlock4(columns, values, start, end, levels, stride, 3 * s, out);
+#else
+        gatherBatchBlock<12>(columns, values, start, end, levels, stride, 3 * s, out);
+#endif
+    }
+    for (; s < src.scenarios(); ++s) {
+        gatherBatchBlock<3>(columns, values, start, end, levels, stride, 3 * s, out);
+    }
+}
+
+void gatherAll(SymmetricTransferMatrix const &transfers,
+               RadianceBuffer const &src, RadianceBuffer &out,
+               int threads)
+{
+    int const n = transfers.size();
+    TransferMatrix const &upper = transfers.upper();
+
+    // With the areas folded into the source, both halves use the
+    // kernel as it is stored.
+    RadianceBuffer shot(n);
+    for (int j = 0; j < n; ++j) {
+        shot.set(j, src.get(j) * transfers.area(j));
+    }
+
+    // Row lengths fall towards the bottom of the triangle, so split
+    // the rows into chunks of roughly equal entries instead.
+    if (threads <= 0) {
+        threads = defaultThreadCount();
+    }
+    int const chunks = std::max(1, std::min(threads, n));
+    std::vector<int> bounds(chunks + 1, n);
+    bounds[0] = 0;
+    size_t const *rowStarts = upper.rowStarts();
+    for (int c = 1; c < chunks; ++c) {
+        size_t const target = upper.nonZeros() * c / chunks;
+        bounds[c] = std::lower_bound(rowStarts, rowStarts + n, target) - rowStarts;
+    }
+
+    out.resize(n);
+    std::vector<RadianceBuffer> columnSums(chunks, RadianceBuffer(n));
+    parallelFor(chunks, chunks, [&](int begin, int end) {
+        for (int c = begin; c < end; ++c) {
+            RadianceBuffer &sums = columnSums[c];
+            for (int i = bounds[c]; i < bounds[c + 1]; ++i) {
+                out.set(i, gatherRow(upper, i, shot));
+                radiance_t const r = shot.r[i], g = shot.g[i], b = shot.b[i];
+                for (size_t k = upper.rowStart(i), kEnd = upper.rowEnd(i);
+                     k != kEnd; ++k) {
+                    int j = upper.column(k);
+                    radiance_t w = upper.value(k);
+                    sums.r[j] += w * r;
+                    sums.g[j] += w * g;
+                    sums.b[j] += w * b;
+                }
+            }
+        }
+    });
+
+    parallelFor(n, threads, [&](int begin, int end) {
+        for (int c = 0; c < chunks; ++c) {
+            RadianceBuffer const &sums = columnSums[c];
+            for (int j = begin; j < end; ++j) {
+                out.r[j] += sums.r[j];
+                out.g[j] += sums.g[j];
+                out.b[j] += sums.b[j];
+            }
+        }
+    });
+}
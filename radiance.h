@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////
+//
+// radiance.h: Structure-of-arrays light levels for the solver.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_RADIANCE_H
+#define RADIOSITY_RADIANCE_H
+
+#include <vector>
+
+#include "geom.h"
+#include "transfer_matrix.h"
+
+// Light levels are kept at the same precision as the transfers, so
+// that the inner loop needs no conversions.
+typedef transfer_t radiance_t;
+
+// The solver's working copy of the quads' light levels. Keeping the
+// channels in separate contiguous arrays means the inner loop only
+// touches the data it needs, and can be vectorised.
+class RadianceBuffer
+{
+public:
+    explicit RadianceBuffer(int size = 0);
+
+    void resize(int size);
+    int size() const;
+
+    // Copy from/to the quads' screenColours.
+    void load(std::vector<Quad> const &qs);
+    void store(std::vector<Quad> &qs) const;
+
+    Colour get(int i) const;
+    void set(int i, Colour const &c);
+    void add(int i, Colour const &c);
+
+    void swap(RadianceBuffer &other);
+
+    std::vector<radiance_t> r, g, b;
+};
+
+// Several sets of light levels for the same quads, one per lighting
+// setup. A quad's levels are kept together, red, green and blue for
+// each setup in turn, so that a transfer entry is loaded once and
+// applied to all of them.
+class RadianceBatch
+{
+public:
+    explicit RadianceBatch(int size = 0, int scenarios = 1);
+
+    void resize(int size, int scenarios);
+    int size() const;
+    int scenarios() const;
+
+    // Copy from/to the screenColours of quads for setup "s".
+    void load(int s, std::vector<Quad> const &qs);
+    void store(int s, std::vector<Quad> &qs) const;
+
+    Colour get(int i, int s) const;
+    void set(int i, int s, Colour const &c);
+
+    // The 3 * scenarios() levels of quad "i".
+    radiance_t const *quad(int i) const;
+
+    std::vector<radiance_t> values;
+
+private:
+    int m_scenarios;
+};
+
+// The light arriving at quad "i": row "i" of the transfers, dotted
+// with the light levels in "src". Uses AVX2 gathers if compiled with
+// them enabled.
+Colour gatherRow(TransferMatrix const &transfers, int i,
+                 RadianceBuffer const &src);
+
+// As above, for every setup in the batch at once. Writes
+// 3 * src.scenarios() sums to "out".
+void gatherRow(TransferMatrix const &transfers, int i,
+               RadianceBatch const &src, double *out);
+
+// The light arriving at every quad, as if gatherRow were called on
+// each row of the expanded matrix. Each stored entry is used for
+// both its row and its column; the column sums are kept per thread
+// and added up at the end. "threads" of 0 means one per core.
+void gatherAll(SymmetricTransferMatrix const &transfers,
+               RadianceBuffer const &src, RadianceBuffer &out,
+               int threads = 0);
+
+#endif // RADIOSITY_RADIANCE_H
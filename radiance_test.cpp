@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////
+//
+// radiance_test.cpp: Tests for radiance.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "radiance.h"
+#include "transfer_matrix.h"
+
+class RadianceTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(RadianceTestCase);
+    CPPUNIT_TEST(testLoadStore);
+    CPPUNIT_TEST(testGatherRow);
+    CPPUNIT_TEST(testGatherAll);
+    CPPUNIT_TEST(testGatherBatch);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testLoadStore();
+    void testGatherRow();
+    void testGatherAll();
+    void testGatherBatch();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(RadianceTestCase, "RadianceTestCase");
+
+void RadianceTestCase::testLoadStore()
+{
+    std::vector<Quad> qs;
+    for (int i = 0; i < 3; ++i) {
+        qs.push_back(Quad(0, 1, 2, 3, Colour()));
+        qs[i].screenColour = Colour(i, 0.5 * i, 0.25);
+    }
+
+    RadianceBuffer buffer;
+    buffer.load(qs);
+    CPPUNIT_ASSERT_EQUAL(3, buffer.size());
+    buffer.add(1, Colour(1.0, 1.0, 1.0));
+    buffer.store(qs);
+    CPPUNIT_ASSERT_EQUAL(2.0, qs[1].screenColour.r);
+    CPPUNIT_ASSERT_EQUAL(1.5, qs[1].screenColour.g);
+    CPPUNIT_ASSERT_EQUAL(1.25, qs[1].screenColour.b);
+    CPPUNIT_ASSERT_EQUAL(2.0, qs[2].screenColour.r);
+}
+
+// Rows of assorted lengths, so that both the vector blocks and the
+// remainder get exercised.
+void RadianceTestCase::testGatherRow()
+{
+    int const n = 37;
+    RadianceBuffer src(n);
+    for (int j = 0; j < n; ++j) {
+        src.set(j, Colour(0.5 + j, 1.0 / (j + 1), 0.25 * (j % 4)));
+    }
+
+    TransferMatrix m(n);
+    for (int i = 0; i < n; ++i) {
+        std::vector<double> row(n);
+        for (int j = 0; j < n; ++j) {
+            if ((i + j) % (i % 5 + 1) == 0) {
+                row[j] = 0.01 * ((i * 7 + j * 3) % 11 + 1);
+            }
+        }
+        m.addRow(row);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        double r = 0.0, g = 0.0, b = 0.0;
+        for (size_t k = m.rowStart(i), end = m.rowEnd(i); k != end; ++k) {
+            Colour c = src.get(m.column(k));
+            r += c.r * m.value(k);
+            g += c.g * m.value(k);
+            b += c.b * m.value(k);
+        }
+        Colour c = gatherRow(m, i, src);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(r, c.r, 1.0e-5 * r + 1.0e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(g, c.g, 1.0e-5 * g + 1.0e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(b, c.b, 1.0e-5 * b + 1.0e-12);
+    }
+}
+
+// Enough rows for each thread to get a chunk, and matching the rows
+// of the expanded matrix.
+void RadianceTestCase::testGatherAll()
+{
+    int const n = 41;
+    RadianceBuffer src(n);
+    std::vector<double> areas(n);
+    for (int j = 0; j < n; ++j) {
+        src.set(j, Colour(0.5 + j, 1.0 / (j + 1), 0.25 * (j % 4)));
+        areas[j] = 0.5 + 0.125 * (j % 3);
+    }
+
+    SymmetricTransferMatrix m;
+    m.reset(areas);
+    for (int i = 0; i < n; ++i) {
+        std::vector<double> row(n);
+        for (int j = i + 1; j < n; ++j) {
+            if ((i + j) % 3 != 0) {
+                row[j] = 0.01 * ((i * 7 + j * 3) % 11 + 1);
+            }
+        }
+        m.addRow(row);
+    }
+    TransferMatrix full;
+    m.expand(full);
+
+    double const epsilon = sizeof(radiance_t) < sizeof(double) ? 1.0e-4 : 1.0e-12;
+    int const threadCounts[] = { 1, 4 };
+    for (int t = 0; t < 2; ++t) {
+        RadianceBuffer out;
+        gatherAll(m, src, out, threadCounts[t]);
+        CPPUNIT_ASSERT_EQUAL(n, out.size());
+        for (int i = 0; i < n; ++i) {
+            Colour expected = gatherRow(full, i, src);
+            Colour c = out.get(i);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.r, c.r, epsilon * expected.r);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.g, c.g, epsilon);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.b, c.b, epsilon * (1.0 + expected.b));
+        }
+    }
+}
+
+// Each setup in the batch gets what gatherRow would give it alone.
+void RadianceTestCase::testGatherBatch()
+{
+    int const n = 23;
+    int const scenarios = 3;
+    std::vector<RadianceBuffer> srcs(scenarios, RadianceBuffer(n));
+    RadianceBatch batch(n, scenarios);
+    CPPUNIT_ASSERT_EQUAL(n, batch.size());
+    CPPUNIT_ASSERT_EQUAL(scenarios, batch.scenarios());
+    for (int s = 0; s < scenarios; ++s) {
+        for (int j = 0; j < n; ++j) {
+            Colour c(0.5 + j * s, 1.0 / (j + s + 1), 0.25 * ((j + s) % 4));
+            srcs[s].set(j, c);
+            batch.set(j, s, c);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(srcs[2].get(5).g, batch.get(5, 2).g);
+
+    TransferMatrix m(n);
+    for (int i = 0; i < n; ++i) {
+        std::vector<double> row(n);
+        for (int j = 0; j < n; ++j) {
+            if ((i + j) % (i % 4 + 1) == 0) {
+                row[j] = 0.01 * ((i * 5 + j * 3) % 7 + 1);
+            }
+        }
+        m.addRow(row);
+    }
+
+    std::vector<double> out(3 * scenarios);
+    for (int i = 0; i < n; ++i) {
+        gatherRow(m, i, batch, out.data());
+        for (int s = 0; s < scenarios; ++s) {
+            Colour expected = gatherRow(m, i, srcs[s]);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.r, out[3 * s], 1.0e-5 * expected.r + 1.0e-12);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.g, out[3 * s + 1], 1.0e-5 * expected.g + 1.0e-12);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.b, out[3 * s + 2], 1.0e-5 * expected.b + 1.0e-12);
+        }
+    }
+}
@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////////////////////
+//
+// ray_transfers.cpp: Calculate the light transfers on the CPU, with
+// shadow rays for visibility.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "bvh.h"
+#include "geom.h"
+#include "parallel.h"
+#include "progress.h"
+#include "ray_transfers.h"
+#include "transfer_matrix.h"
+
+// Rows are calculated in batches of this many, in parallel, then
+// added to the matrix in order.
+static int const ROW_BATCH = 256;
+
+// Clip the polygon to the half-space in front of the plane through
+// "eye" with normal "normal" (Sutherland-Hodgman).
+static std::vector<Vertex> clipToHemisphere(std::vector<Vertex> const &poly,
+                                            Vertex const &eye,
+                                            Vertex const &normal)
+{
+    std::vector<Vertex> out;
+    int const n = poly.size();
+    for (int i = 0; i < n; ++i) {
+        Vertex const &a = poly[i];
+        Vertex const &b = poly[(i + 1) % n];
+        double da = dot(a - eye, normal);
+        double db = dot(b - eye, normal);
+        if (da >= 0.0) {
+            out.push_back(a);
+        }
+        if ((da >= 0.0) != (db >= 0.0)) {
+            out.push_back(lerp(a, b, da / (da - db)));
+        }
+    }
+    return out;
+}
+
+// Form factor from a differential area at "eye", facing "normal", to
+// the polygon, by Lambert's contour integral. The polygon must be
+// planar and in front of the eye.
+static double pointToPolygon(std::vector<Vertex> const &poly,
+                             Vertex const &eye,
+                             Vertex const &normal)
+{
+    double sum = 0.0;
+    int const n = poly.size();
+    for (int i = 0; i < n; ++i) {
+        Vertex r0 = (poly[i] - eye).norm();
+        Vertex r1 = (poly[(i + 1) % n] - eye).norm();
+        Vertex c = cross(r0, r1);
+        double len = c.len();
+        if (len == 0.0) {
+            continue;
+        }
+        double angle = atan2(len, dot(r0, r1));
+        sum += angle * dot(normal, c) / len;
+    }
+    // The sign depends on the winding.
+    return fabs(sum) / (2.0 * M_PI);
+}
+
+RayTransferCalculator::RayTransferCalculator(std::vector<Vertex> const &vertices,
+                                             std::vector<Quad> const &faces,
+                                             int samples,
+                                             int threads)
+    : m_vertices(vertices),
+      m_faces(faces),
+      m_samples(std::max(1, samples)),
+      m_threads(threads),
+      m_bvh(vertices, faces),
+      m_rowBegin(0),
+      m_rowEnd(faces.size())
+{
+    for (int i = 0, n = faces.size(); i < n; ++i) {
+        m_centres.push_back(paraCentre(faces[i], vertices));
+        // paraCross points away from the lit side.
+        m_normals.push_back(paraCross(faces[i], vertices).norm().scale(-1.0));
+    }
+}
+
+double RayTransferCalculator::calcSingleQuadLight(int target,
+                                                  Vertex const &eye,
+                                                  Vertex const &normal,
+                                                  int source) const
+{
+    if (source == target) {
+        return 0.0;
+    }
+    // Sources facing away, or edge on, send nothing.
+    if (dot(m_normals[source], eye - m_centres[source]) <= 0.0) {
+        return 0.0;
+    }
+
+    Quad const &q = m_faces[source];
+    std::vector<Vertex> poly;
+    for (int c = 0; c < 4; ++c) {
+        poly.push_back(m_vertices[q.indices[c]]);
+    }
+    poly = clipToHemisphere(poly, eye, normal);
+    if (poly.size() < 3) {
+        return 0.0;
+    }
+    double ff = pointToPolygon(poly, eye, normal);
+    if (ff == 0.0) {
+        return 0.0;
+    }
+
+    // Visibility, from a grid of points on the source.
+    Vertex const &v0 = m_vertices[q.indices[0]];
+    Vertex uEdge = m_vertices[q.indices[1]] - v0;
+    Vertex vEdge = m_vertices[q.indices[3]] - v0;
+    int visible = 0;
+    for (int j = 0; j < m_samples; ++j) {
+        for (int i = 0; i < m_samples; ++i) {
+            Vertex pt = v0 + uEdge.scale((i + 0.5) / m_samples) +
+                             vEdge.scale((j + 0.5) / m_samples);
+            if (!m_bvh.occluded(eye, pt, target, source)) {
+                ++visible;
+            }
+        }
+    }
+    return ff * visible / (m_samples * m_samples);
+}
+
+std::vector<double> RayTransferCalculator::calcRow(int target) const
+{
+    int const n = m_faces.size();
+    Vertex const &eye = m_centres[target];
+    Vertex const &normal = m_normals[target];
+    std::vector<double> row(n);
+    if (m_sources) {
+        std::vector<int> const &sources = m_sources(target);
+        for (int k = 0, count = sources.size(); k < count; ++k) {
+            row[sources[k]] = calcSingleQuadLight(target, eye, normal, sources[k]);
+        }
+        return row;
+    }
+    for (int j = 0; j < n; ++j) {
+        row[j] = calcSingleQuadLight(target, eye, normal, j);
+    }
+    return row;
+}
+
+void RayTransferCalculator::setProgress(transferProgressFn_t const &progress)
+{
+    m_progress = progress;
+}
+
+void RayTransferCalculator::setRows(int begin, int end)
+{
+    if (begin < 0 || begin > end || end > int(m_faces.size())) {
+        throw std::runtime_error("Transfer rows out of range");
+    }
+    m_rowBegin = begin;
+    m_rowEnd = end;
+}
+
+void RayTransferCalculator::setSources(sourcesFn_t const &sources)
+{
+    m_sources = sources;
+}
+
+void RayTransferCalculator::calcAllLights(std::vector<double> &weights) const
+{
+    int const n = m_faces.size();
+    int const rows = m_rowEnd - m_rowBegin;
+    weights.assign(rows * n, 0.0);
+    ProgressTracker tracker(rows, m_progress);
+    parallelFor(rows, m_threads, [this, n, &weights, &tracker](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            std::vector<double> row = calcRow(m_rowBegin + i);
+            std::copy(row.begin(), row.end(), weights.begin() + i * n);
+            tracker.rowDone();
+        }
+    });
+}
+
+void RayTransferCalculator::calcAllLights(TransferMatrix &transfers) const
+{
+    transfers.reset(m_faces.size());
+    std::vector<std::vector<double> > rows(ROW_BATCH);
+    ProgressTracker tracker(m_rowEnd - m_rowBegin, m_progress);
+    for (int start = m_rowBegin; start < m_rowEnd; start += ROW_BATCH) {
+        int const count = std::min(ROW_BATCH, m_rowEnd - start);
+        parallelFor(count, m_threads,
+                    [this, start, &rows, &tracker](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                rows[i] = calcRow(start + i);
+                tracker.rowDone();
+            }
+        });
+        for (int i = 0; i < count; ++i) {
+            transfers.addRow(rows[i], start + i);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////
+//
+// ray_transfers.h: Calculate the light transfers on the CPU, with
+// shadow rays for visibility.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_RAY_TRANSFERS_H
+#define RADIOSITY_RAY_TRANSFERS_H
+
+#include <functional>
+#include <vector>
+
+#include "bvh.h"
+#include "geom.h"
+#include "progress.h"
+#include "transfer_matrix.h"
+
+// A drop-in alternative to RenderTransferCalculator, producing the
+// same weights, that needs no GL context. The form factor from the
+// centre of each target to each whole source quad is calculated
+// exactly, and then scaled by the fraction of shadow rays from the
+// target centre to points on the source that aren't blocked. Rows
+// are calculated in parallel.
+class RayTransferCalculator
+{
+public:
+    // The source quads whose transfers to "target" are wanted.
+    typedef std::function<std::vector<int> const &(int target)> sourcesFn_t;
+
+    // "samples" is the number of shadow rays per source, along each
+    // edge (so samples^2 per pair). "threads" of 0 means one per
+    // core.
+    RayTransferCalculator(std::vector<Vertex> const &vertices,
+                          std::vector<Quad> const &faces,
+                          int samples = 1,
+                          int threads = 0);
+
+    // The light arriving at quad "target" from each quad.
+    std::vector<double> calcRow(int target) const;
+    // As for the other calculators: all n*n weights, or the sparse
+    // matrix.
+    void calcAllLights(std::vector<double> &weights) const;
+    void calcAllLights(TransferMatrix &transfers) const;
+
+    // Called after each row of calcAllLights, from whichever thread
+    // finished it. Return false to cancel, and calcAllLights throws
+    // TransferCancelled.
+    void setProgress(transferProgressFn_t const &progress);
+
+    // As for RenderTransferCalculator.
+    void setRows(int begin, int end);
+
+    // Only calculate the transfers from the sources "sources" lists
+    // for each target, leaving the rest 0, e.g. for the near field of
+    // PatchClusters. An empty function goes back to all of them.
+    void setSources(sourcesFn_t const &sources);
+
+private:
+    double calcSingleQuadLight(int target, Vertex const &eye,
+                               Vertex const &normal, int source) const;
+
+    std::vector<Vertex> const &m_vertices;
+    std::vector<Quad> const &m_faces;
+    int const m_samples;
+    int const m_threads;
+    QuadBVH m_bvh;
+
+    // Per quad, so rows needn't recalculate them.
+    std::vector<Vertex> m_centres;
+    std::vector<Vertex> m_normals;
+
+    // Targets calculated by calcAllLights.
+    int m_rowBegin;
+    int m_rowEnd;
+
+    transferProgressFn_t m_progress;
+    sourcesFn_t m_sources;
+};
+
+#endif // RADIOSITY_RAY_TRANSFERS_H
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////
+//
+// ray_transfers_test.cpp: Tests for ray_transfers.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "ray_transfers.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class RayTransfersTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+
+    CPPUNIT_TEST_SUITE(RayTransfersTestCase);
+    CPPUNIT_TEST(testRowsSumToOne);
+    CPPUNIT_TEST(testMatchesAnalyticWhenFar);
+    CPPUNIT_TEST(testSparseMatchesDense);
+    CPPUNIT_TEST(testOcclusion);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testRowsSumToOne();
+    void testMatchesAnalyticWhenFar();
+    void testSparseMatchesDense();
+    void testOcclusion();
+
+    void buildCube(std::vector<Vertex> &vertices, std::vector<Quad> &quads);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(RayTransfersTestCase,
+                                      "RayTransfersTestCase");
+
+void RayTransfersTestCase::buildCube(std::vector<Vertex> &vertices,
+                                     std::vector<Quad> &quads)
+{
+    vertices = cubeVertices;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, SUBDIVISION, SUBDIVISION);
+    }
+}
+
+// Inside a closed box, the exact form factors from any point add up
+// to one.
+void RayTransfersTestCase::testRowsSumToOne()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildCube(vertices, quads);
+    RayTransferCalculator calc(vertices, quads);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        std::vector<double> row = calc.calcRow(i);
+        double sum = 0.0;
+        for (int j = 0; j < n; ++j) {
+            sum += row[j];
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, sum, 1.0e-9);
+    }
+}
+
+// The analytic calculator treats sources as points, which is fine
+// for pairs on opposite faces.
+void RayTransfersTestCase::testMatchesAnalyticWhenFar()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildCube(vertices, quads);
+    std::vector<double> analytic;
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(analytic);
+    std::vector<double> ray;
+    RayTransferCalculator(vertices, quads).calcAllLights(ray);
+
+    int const n = quads.size();
+    int compared = 0;
+    for (int i = 0; i < n; ++i) {
+        Vertex ci = paraCentre(quads[i], vertices);
+        for (int j = 0; j < n; ++j) {
+            Vertex cj = paraCentre(quads[j], vertices);
+            if ((ci - cj).len() > 1.9 && analytic[i * n + j] > 0.0) {
+                double w = analytic[i * n + j];
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(w, ray[i * n + j], 0.05 * w);
+                ++compared;
+            }
+        }
+    }
+    CPPUNIT_ASSERT(compared > 0);
+}
+
+void RayTransfersTestCase::testSparseMatchesDense()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildCube(vertices, quads);
+    RayTransferCalculator calc(vertices, quads, 2, 3);
+    std::vector<double> dense;
+    calc.calcAllLights(dense);
+    TransferMatrix sparse;
+    calc.calcAllLights(sparse);
+
+    int const n = quads.size();
+    CPPUNIT_ASSERT_EQUAL(n, sparse.rowCount());
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            double expected = i == j ? 0.0 : dense[i * n + j];
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, sparse.at(i, j), 1.0e-7);
+        }
+    }
+}
+
+// A big quad between two faces casts a shadow.
+void RayTransfersTestCase::testOcclusion()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildCube(vertices, quads);
+    int const cubeQuads = quads.size();
+    std::vector<Quad> blocker(1, cubeFaces[0]);
+    scale(0.5, blocker, vertices);
+    quads.push_back(blocker[0]);
+
+    std::vector<double> open;
+    std::vector<Quad> cubeOnly(quads.begin(), quads.begin() + cubeQuads);
+    RayTransferCalculator(vertices, cubeOnly).calcAllLights(open);
+    std::vector<double> shaded;
+    RayTransferCalculator(vertices, quads).calcAllLights(shaded);
+
+    // Every transfer between the cube's quads can only go down, and
+    // some through the middle must be blocked.
+    int const m = quads.size();
+    int blocked = 0;
+    for (int i = 0; i < cubeQuads; ++i) {
+        for (int j = 0; j < cubeQuads; ++j) {
+            double before = open[i * cubeQuads + j];
+            double after = shaded[i * m + j];
+            CPPUNIT_ASSERT(after <= before);
+            if (before > 0.0 && after == 0.0) {
+                ++blocked;
+            }
+        }
+    }
+    CPPUNIT_ASSERT(blocked > 0);
+}
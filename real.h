@@ -0,0 +1,24 @@
+////////////////////////////////////////////////////////////////////////
+//
+// real.h: The precision used for geometry, lighting and transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_REAL_H
+#define RADIOSITY_REAL_H
+
+// Everything is double by default. Build with -DRADIOSITY_FLOAT to
+// use single precision for the vertices, colours, weight tables and
+// transfers, halving the memory traffic and doubling the SIMD width
+// of the solver. The Makefile builds the tests in double either way.
+#ifdef RADIOSITY_FLOAT
+typedef float real_t;
+#ifndef RADIOSITY_FLOAT_TRANSFERS
+#define RADIOSITY_FLOAT_TRANSFERS
+#endif
+#else
+typedef double real_t;
+#endif
+
+#endif // RADIOSITY_REAL_H
@@ -11,22 +11,59 @@
 #include <GL/glut.h>
 #endif
 
+#include <memory>
 #include <vector>
-#include <png.h>
 #include "defines.h"
 #include "geom.h"
 #include <chrono>
+#include "bvh.h"
 #include "camera.h"
+#include "capture.h"
+#include "lightmap.h"
+#include "live_solve.h"
+#include "parallel.h"
+#include "profile.h"
+#include "quad_buffer.h"
 #include "rendering.h"
+#include "shaded_scene.h"
 
 static const Vertex EYE_POS = Vertex(0.0, 0.0, -3.0);
 
 static std::vector<Quad> flatFaces;
 static std::vector<GouraudQuad> gouraudFaces;
 static std::vector<Vertex> vertices;
-
-png_structp png_ptr;
-png_infop info_ptr;
+// The faces above, ready to draw.
+static QuadBuffer flatBuffer;
+static QuadBuffer gouraudBuffer;
+// The Gouraud geometry is only built once. After that, only the
+// colours are updated, so keep track of where each SubdivInfo's
+// quads are, and the brightness scaling last applied to them.
+static std::vector<int> gouraudStarts;
+static double lastBrightnessScale = 0.0;
+// Set when the radiosity itself has changed, so every colour needs
+// updating.
+static bool lightingChanged = false;
+// Set if the GLSL path is doing the shading instead.
+static ShadedScene shadedScene;
+static bool useShadedScene = false;
+// Or the base quads, textured with the baked lighting.
+static LightmapScene lightmapScene;
+static bool useLightmap = false;
+// The scene's quads, for the camera to collide with. Built once the
+// geometry is known, and then never changes.
+static std::unique_ptr<QuadBVH> collisionBVH;
+
+// Screenshots and recorded sequences, read back and written out in
+// the background. Created with the window.
+static std::unique_ptr<FrameCapture> frameCapture;
+// Where to save the next frame drawn, if anywhere.
+static std::string screenshotPath;
+
+// A solve still running in the background, if any, polled this often
+// for new lighting.
+static LiveSolve *liveSolve = NULL;
+static std::vector<Colour> liveColours;
+static int const LIVE_POLL_MS = 50;
 
 SceneCamera sceneCamera(glm::vec3(EYE_POS.x(), EYE_POS.y(), EYE_POS.z()));
 
@@ -37,66 +74,56 @@ std::vector<SubdivInfo> *radiositySubdivs;
 
 static bool firstRender = true;
 
-static void screenshotPNG(const char *filename)
+static void drawScene(void)
 {
-    const size_t format_nchannels = 4;
-    size_t nvals = format_nchannels * WIDTH * HEIGHT;
-
-    // Assuming a GLubyte is a png_byte...
-    std::vector<png_byte> pixels(nvals);
-    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
-
-    std::vector<png_byte *> png_rows(HEIGHT);
-    for (size_t i = 0; i < HEIGHT; i++) {
-        png_rows[HEIGHT - i - 1] = &pixels[i * WIDTH * format_nchannels];
+    if (useShadedScene) {
+        std::vector<float> pos = getCameraPos();
+        shadedScene.draw(Vertex(pos[0], pos[1], pos[2]));
+        return;
     }
-
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                                              NULL, NULL, NULL);
-    
-    if (png_ptr == NULL) {
-        throw std::runtime_error("png_create_write_struct failed");
+    if (useLightmap) {
+        lightmapScene.draw();
+        return;
     }
+    flatBuffer.draw();
+    gouraudBuffer.draw();
+}
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if ((info_ptr == NULL) || (!info_ptr)) {
-        throw std::runtime_error("png_create_info_struct failed");
+// The shaders follow the camera by themselves, and the lightmap
+// doesn't depend on it.
+static void cameraMoved()
+{
+    if (!useShadedScene && !useLightmap) {
+        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
     }
+}
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        throw std::runtime_error("Something failed in libpng");
-    }
-    
-    FILE *f = fopen(filename, "wb");
-    if(f==NULL){
-        printf("%s\n", "File couldnt be created");
-    }
-    png_init_io(png_ptr, f);
-    
-    png_set_IHDR(png_ptr, info_ptr, WIDTH, HEIGHT, 8, PNG_COLOR_TYPE_RGB_ALPHA,
-                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
-    
-    png_write_info(png_ptr, info_ptr);
-    
-    png_write_image(png_ptr, &png_rows[0]);
-    
-    png_write_end(png_ptr, NULL);
-    
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    
-    fclose(f);
+// Hand over the readbacks once the GPU's had a chance to finish them,
+// even if nothing else is drawn.
+static void captureIdle()
+{
+    frameCapture->poll();
+    glutIdleFunc(NULL);
 }
 
-static void drawScene(void)
-{   
-    for (std::vector<Quad>::const_iterator iter = flatFaces.begin(),
-             end = flatFaces.end(); iter != end; ++iter) {
-        iter->render(vertices);
+// Pick up the latest lighting from the background solve, until it
+// finishes.
+static void livePoll(int)
+{
+    // Anything published before it finished is still taken below.
+    bool const done = liveSolve->finished();
+    if (liveSolve->take(liveColours)) {
+        for (int i = 0, n = radiosityMap.size(); i < n; ++i) {
+            radiosityMap[i].screenColour = liveColours[i];
+        }
+        lightingChanged = true;
+        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
+        glutPostRedisplay();
     }
-    for (std::vector<GouraudQuad>::const_iterator iter = gouraudFaces.begin(),
-             end = gouraudFaces.end(); iter != end; ++iter) {
-        iter->render(vertices);
+    if (done) {
+        printf("%s\n", liveSolve->failed() ? "Solve failed" : "Solve finished");
+    } else {
+        glutTimerFunc(LIVE_POLL_MS, livePoll, 0);
     }
 }
 
@@ -104,11 +131,19 @@ static void display(void)
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     drawScene();
+    frameCapture->frame();
     if (firstRender) {
-        screenshotPNG("../png/scene.png");
+        frameCapture->capture("../png/scene.png");
         firstRender = false;
     }
+    if (!screenshotPath.empty()) {
+        frameCapture->capture(screenshotPath);
+        screenshotPath.clear();
+    }
     glutSwapBuffers();
+    if (frameCapture->pending()) {
+        glutIdleFunc(captureIdle);
+    }
 }
 
 static void initGL(void)
@@ -140,8 +175,9 @@ static bool facesUs(Quad const &q, std::vector<Vertex> const &vs)
                paraCross(q, vs)) > 0;
 }
 
-// Normalise the brightness of non-emitting components
-void normaliseBrightness(std::vector<Quad> *qs, std::vector<Vertex> *vs)
+// Normalise the brightness of non-emitting components. Returns the
+// scale applied.
+double normaliseBrightness(std::vector<Quad> *qs, std::vector<Vertex> *vs)
 {
     const double TARGET = 1.0;
 
@@ -150,19 +186,21 @@ void normaliseBrightness(std::vector<Quad> *qs, std::vector<Vertex> *vs)
          iter != end; ++iter) {
         // Only include non-emitters, facing us.
         if (!iter->isEmitter && facesUs(*iter, *vs)) {
-            max = std::max(max, iter->screenColour.r);
-            max = std::max(max, iter->screenColour.g);
-            max = std::max(max, iter->screenColour.b);
+            max = std::max<double>(max, iter->screenColour.r);
+            max = std::max<double>(max, iter->screenColour.g);
+            max = std::max<double>(max, iter->screenColour.b);
         }
     }
 
-    double scale = max < TARGET ? TARGET / max : 1.0;
+    // Nothing may be lit yet, if the solve's still going.
+    double scale = max > 0.0 && max < TARGET ? TARGET / max : 1.0;
     for (std::vector<Quad>::iterator iter = qs->begin(), end = qs->end();
          iter != end; ++iter) {
         if (!iter->isEmitter) {
             iter->screenColour = iter->screenColour * scale;
         }
     }
+    return scale;
 }
 
 void MouseCallback(int x, int y){
@@ -178,12 +216,12 @@ void KeyboardCallback(unsigned char key, int x, int y){
     // Keyboard Inputs for movement
     bool isIntersection;
     if(key == 'w'){
-        isIntersection = sceneCamera.ProcessKeyboard(FORWARD, vertices);
+        isIntersection = sceneCamera.ProcessKeyboard(FORWARD, *collisionBVH);
         if(isIntersection == true){
             return;
         }
         
-        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
+        cameraMoved();
 
         glLoadIdentity();
         gluLookAt(sceneCamera.Position.x, sceneCamera.Position.y, sceneCamera.Position.z,
@@ -192,12 +230,12 @@ void KeyboardCallback(unsigned char key, int x, int y){
         glutPostRedisplay();
     }
     else if(key == 's'){
-        isIntersection = sceneCamera.ProcessKeyboard(BACKWARD, vertices);
+        isIntersection = sceneCamera.ProcessKeyboard(BACKWARD, *collisionBVH);
         if(isIntersection == true){
             return;
         }
         
-        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
+        cameraMoved();
 
         glLoadIdentity();
         gluLookAt(sceneCamera.Position.x, sceneCamera.Position.y, sceneCamera.Position.z,
@@ -206,12 +244,12 @@ void KeyboardCallback(unsigned char key, int x, int y){
         glutPostRedisplay();
     }
     else if(key == 'a'){
-        isIntersection = sceneCamera.ProcessKeyboard(LEFT, vertices);
+        isIntersection = sceneCamera.ProcessKeyboard(LEFT, *collisionBVH);
         if(isIntersection == true){
             return;
         }
         
-        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
+        cameraMoved();
 
         glLoadIdentity();
         gluLookAt(sceneCamera.Position.x, sceneCamera.Position.y, sceneCamera.Position.z,
@@ -220,12 +258,12 @@ void KeyboardCallback(unsigned char key, int x, int y){
         glutPostRedisplay();
     }
     else if(key == 'd'){
-        isIntersection = sceneCamera.ProcessKeyboard(RIGHT, vertices);
+        isIntersection = sceneCamera.ProcessKeyboard(RIGHT, *collisionBVH);
         if(isIntersection == true){
             return;
         }
         
-        generateQuads(radiosityFaces, radiosityVertices, radiositySubdivs);
+        cameraMoved();
 
         glLoadIdentity();
         gluLookAt(sceneCamera.Position.x, sceneCamera.Position.y, sceneCamera.Position.z,
@@ -236,96 +274,144 @@ void KeyboardCallback(unsigned char key, int x, int y){
 
     // Keyboard input for saving current screenshot
     else if(key == 'c'){
-        std::string path = "../png/" + currentDateTime() + ".png";
-        screenshotPNG(path.c_str());
+        screenshotPath = "../png/" + currentDateTime() + ".png";
+        glutPostRedisplay();
     }
-}
 
+    // Start or stop recording every frame, for a walkthrough
+    else if(key == 'v'){
+        if (frameCapture->recording()) {
+            frameCapture->stopSequence();
+            printf("%s\n", "Recording stopped");
+        } else {
+            std::string prefix = "../png/" + currentDateTime() + "-";
+            frameCapture->startSequence(prefix);
+            printf("Recording to %s*.png\n", prefix.c_str());
+            glutPostRedisplay();
+        }
+    }
+}
 
-void computeSpecularity(std::vector<Quad> *qs, std::vector<Vertex> *vs){
 
-    int const n = radiosityMap.size();
-    std::vector<Colour> updatedColours(n);
-    std::vector<float> pos = getCameraPos();
+// Precomputed for computeSpecularity, as the geometry doesn't change:
+// the emitters and specular quads, and every quad's centre and unit
+// normal.
+static std::vector<int> specularEmitters;
+static std::vector<int> specularTargets;
+static std::vector<Vertex> quadCentres;
+static std::vector<Vertex> quadNormals;
 
-    Vertex lightVector(0, 0, 0);
-    Vertex viewVector(0, 0, 0);
-    Vertex normalVector(0, 0, 0);
-    Vertex reflectedVector(0, 0, 0);
-    Colour whiteLight(1, 1, 1);
-    float dotProduct;
-    float specularVal;
-    float specularPower = 128.0f;
-    float specularFactor = 0.02f;
-
-    // Iterate over targets
-    for (int i = 0; i < n; ++i) {
-
-        updatedColours[i] = radiosityMap[i].screenColour;
-        Colour incoming = Colour(0.0f, 0.0f, 0.0f);
-        
-        if (radiosityMap[i].isSpecular == false) {
-            continue;
+static void initSpecularity(std::vector<Vertex> const &vs)
+{
+    for (int i = 0, n = radiosityMap.size(); i < n; ++i) {
+        Quad const &q = radiosityMap[i];
+        if (q.isEmitter) {
+            specularEmitters.push_back(i);
+        }
+        if (q.isSpecular) {
+            specularTargets.push_back(i);
         }
+        quadCentres.push_back(paraCentre(q, vs));
+        quadNormals.push_back(paraCross(q, vs).norm());
+    }
+}
 
-        else {
-            // Iterate over sources
-            for (int j = 0; j < n; ++j) {
-                if (i == j) {
-                    continue;
-                }
+// x^(2^n), by repeated squaring.
+static float powPow2(float x, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        x *= x;
+    }
+    return x;
+}
 
-                if(radiosityMap[j].isEmitter){
-                    //Get the light vector
-                    lightVector = paraCentre(radiosityMap[i], *vs) - paraCentre(radiosityMap[j], *vs);
-                    lightVector = lightVector.norm();
+void computeSpecularity(std::vector<Quad> *qs, std::vector<Vertex> *vs){
+    PROFILE_SCOPE("computeSpecularity");
 
-                    //Get the normal vector
-                    normalVector = paraCross(radiosityMap[i], *vs);
-                    normalVector = normalVector.norm();
+    // Specular power is 2^7 = 128.
+    int const specularPowerLog2 = 7;
+    float const specularFactor = 0.02f;
+    Colour const whiteLight(1, 1, 1);
 
-                    //Get the reflected vector
-                    dotProduct = 2 * dot(normalVector, lightVector);
-                    reflectedVector = (normalVector * dotProduct) - lightVector;
-                    reflectedVector = reflectedVector.norm();
+    if (quadCentres.empty()) {
+        initSpecularity(*vs);
+    }
 
-                    //Get the view vector
-                    viewVector = Vertex(pos[0], pos[1], pos[2]) - paraCentre(radiosityMap[i], *vs);
-                    viewVector = viewVector.norm() * -1.0f;
+    int const n = radiosityMap.size();
+    for (int i = 0; i < n; ++i) {
+        qs->at(i).screenColour = radiosityMap[i].screenColour;
+    }
 
-                    //Get the specular quantitiy
-                    specularVal = std::pow(std::max((float)dot(reflectedVector, viewVector), 0.0f), specularPower);
-                    incoming += whiteLight * specularVal * specularFactor;
+    std::vector<float> pos = getCameraPos();
+    Vertex const eye(pos[0], pos[1], pos[2]);
+    int const targets = specularTargets.size();
+    parallelFor(targets, 0, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            int const i = specularTargets[t];
+            Vertex const &centre = quadCentres[i];
+            Vertex const &normalVector = quadNormals[i];
+            //Get the view vector
+            Vertex viewVector = (eye - centre).norm() * -1.0f;
+
+            Colour incoming;
+            for (int k = 0, m = specularEmitters.size(); k < m; ++k) {
+                int const j = specularEmitters[k];
+                if (i == j) {
+                    continue;
                 }
+                //Get the light vector
+                Vertex lightVector = (centre - quadCentres[j]).norm();
+
+                //Get the reflected vector
+                float dotProduct = 2 * dot(normalVector, lightVector);
+                Vertex reflectedVector =
+                    ((normalVector * dotProduct) - lightVector).norm();
+
+                //Get the specular quantitiy
+                float specularVal = powPow2(
+                    std::max((float)dot(reflectedVector, viewVector), 0.0f),
+                    specularPowerLog2);
+                incoming += whiteLight * specularVal * specularFactor;
             }
-
-            updatedColours[i] = updatedColours[i] + incoming;   //
-            // printf("specular color %f %f %f\n", incoming.r, incoming.g, incoming.b); 
+            (*qs)[i].screenColour = radiosityMap[i].screenColour + incoming;
         }
-
-    }
-
-    for (int i = 0; i < n; ++i) {
-        qs->at(i).screenColour = updatedColours[i];
-    }
+    });
 }
 
 
 void generateQuads(std::vector<Quad> *f, std::vector<Vertex> *v, std::vector<SubdivInfo> *subdivs){
+    PROFILE_SCOPE("generateQuads");
 
     computeSpecularity(f, v);
-    normaliseBrightness(f, v);
-    
-    std::vector<Vertex> gVertices;
-    std::vector<GouraudQuad> gourauds;
-
-    for (std::vector<SubdivInfo>::iterator iter = subdivs->begin(),
-             end = subdivs->end(); iter != end; ++iter) {
-        iter->generateGouraudQuads(gourauds, gVertices);
+    double scale = normaliseBrightness(f, v);
+
+    if (gouraudStarts.empty()) {
+        int start = gouraudFaces.size();
+        for (std::vector<SubdivInfo>::iterator iter = subdivs->begin(),
+                 end = subdivs->end(); iter != end; ++iter) {
+            gouraudStarts.push_back(start);
+            start += iter->gouraudQuadCount();
+        }
+        MeshBuilder().buildGouraud(*subdivs, gouraudFaces, vertices);
+        gouraudBuffer.setGouraudQuads(gouraudFaces, vertices);
+        lastBrightnessScale = scale;
+        return;
     }
 
-    gouraudFaces = gourauds;
-    vertices = gVertices;
+    // Moving the camera only changes the specular highlights, unless
+    // the brightness normalisation changed too.
+    bool const all = lightingChanged || scale != lastBrightnessScale;
+    lastBrightnessScale = scale;
+    lightingChanged = false;
+    std::vector<Colour> colours;
+    for (int i = 0, n = subdivs->size(); i < n; ++i) {
+        SubdivInfo const &info = (*subdivs)[i];
+        if (all || info.baseQuad().isSpecular) {
+            colours.clear();
+            info.generateGouraudColours(colours);
+            gouraudBuffer.setColours(gouraudStarts[i], colours);
+        }
+    }
 }
 
 static void render()
@@ -338,6 +424,10 @@ static void render()
     glutDisplayFunc(display);
     glutPassiveMotionFunc(MouseCallback);
     glutKeyboardFunc(KeyboardCallback);
+    frameCapture.reset(new FrameCapture(WIDTH, HEIGHT));
+    if (liveSolve != NULL) {
+        glutTimerFunc(LIVE_POLL_MS, livePoll, 0);
+    }
     initGL();
     printf("%s\n", "Initialized Opengl");
     // Render one-off first, so we can get it saved to disk without
@@ -352,6 +442,8 @@ void renderFlat(std::vector<Quad> f, std::vector<Vertex> v)
 {
     flatFaces = f;
     vertices = v;
+    flatBuffer.setFlatQuads(flatFaces, vertices);
+    collisionBVH.reset(new QuadBVH(vertices, flatFaces));
     render();
 }
 
@@ -361,11 +453,43 @@ void renderGouraud(std::vector<Quad> *f, std::vector<Vertex> *v, std::vector<Sub
     radiosityFaces = f;
     radiosityVertices = v;
     radiositySubdivs = subdivs;
+    collisionBVH.reset(new QuadBVH(*v, *f));
 
     generateQuads(f, v, subdivs);
     render();
 }
 
+void renderLive(std::vector<Quad> *f, std::vector<Vertex> *v,
+                std::vector<SubdivInfo> *subdivs, LiveSolve *live)
+{
+    liveSolve = live;
+    renderGouraud(f, v, subdivs);
+}
+
+void renderShaded(std::vector<Quad> *f, std::vector<Vertex> *v, std::vector<SubdivInfo> *subdivs)
+{
+    radiosityFaces = f;
+    radiosityVertices = v;
+    radiositySubdivs = subdivs;
+    collisionBVH.reset(new QuadBVH(*v, *f));
+
+    shadedScene.build(*f, *v, *subdivs);
+    useShadedScene = true;
+    render();
+}
+
+void renderLightmap(std::vector<Quad> *f, std::vector<Vertex> *v, std::vector<SubdivInfo> *subdivs)
+{
+    radiosityFaces = f;
+    radiosityVertices = v;
+    radiositySubdivs = subdivs;
+    collisionBVH.reset(new QuadBVH(*v, *f));
+
+    lightmapScene.build(*f, *v, *subdivs);
+    useLightmap = true;
+    render();
+}
+
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
 const std::string currentDateTime() {
     time_t     now = time(0);
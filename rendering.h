@@ -14,6 +14,26 @@ void renderFlat(std::vector<Quad> f, std::vector<Vertex> v);
 // Render the scene with Gouraud shading
 void renderGouraud(std::vector<Quad> *faces, std::vector<Vertex> *vertices, std::vector<SubdivInfo> *subdivs);
 
+class LiveSolve;
+
+// Like renderGouraud, but starting from whatever lighting "faces"
+// has, and then refreshing the colours with each new snapshot from
+// "live" until it finishes.
+void renderLive(std::vector<Quad> *faces, std::vector<Vertex> *vertices,
+                std::vector<SubdivInfo> *subdivs, LiveSolve *live);
+
+// Like renderGouraud, but with the specular highlights and brightness
+// normalisation done in GLSL shaders, so moving the camera doesn't
+// touch the geometry. The brightness scale is fixed from the solved
+// lighting, rather than following the view.
+void renderShaded(std::vector<Quad> *faces, std::vector<Vertex> *vertices, std::vector<SubdivInfo> *subdivs);
+
+// Draw just the base quads, with the lighting baked into a filtered
+// texture, so the cost of a frame doesn't grow with the subdivision.
+// As with renderShaded, the brightness scale is fixed, and there are
+// no specular highlights.
+void renderLightmap(std::vector<Quad> *faces, std::vector<Vertex> *vertices, std::vector<SubdivInfo> *subdivs);
+
 // Normalise the brightness of non-emitting components
 void normaliseBrightness(std::vector<Quad> &qs, std::vector<Vertex> const &vs);
 
@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////////
+//
+// scene.cpp: The demo scene, shared by the viewer and the benchmarks.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include "geom.h"
+#include "scene.h"
+#include "session.h"
+
+void buildCubeScene(int subdivision, bool innerCube,
+                    std::vector<Vertex> &vertices,
+                    std::vector<Quad> &faces,
+                    std::vector<SubdivInfo> &subdivs)
+{
+    vertices = cubeVertices;
+    // Draw the outer 'scene' cube, by subdividing the prototype. The
+    // faces share their edges, so build them all together.
+    MeshBuilder builder;
+    for (std::vector<Quad>::const_iterator iter = cubeFaces.begin(),
+             end = cubeFaces.end(); iter != end; ++iter) {
+        builder.add(*iter, subdivision, subdivision);
+    }
+    if (!innerCube) {
+        builder.build(vertices, faces, subdivs);
+        return;
+    }
+
+    // Then draw the inner cube: Take the basic scene cube, scale it
+    // down, rotate and move it... The transforms add new vertices, so
+    // the outer cube's corners are left alone.
+    std::vector<Quad> sceneFaces(cubeFaces); // Enclosed cube
+    scale(0.4, sceneFaces, vertices);
+    flip(sceneFaces, vertices);
+    rotate(Vertex(1.0, 0.0, 0.0), M_PI / 3.0, sceneFaces, vertices);
+    rotate(Vertex(0.0, 0.0, 1.0), M_PI / 6.0, sceneFaces, vertices);
+    translate(Vertex(0.0, -0.25, 0.0), sceneFaces, vertices);
+    // Copy the subdivided version into 'faces' (lower subdivisions,
+    // as smaller).
+
+    for (std::vector<Quad>::iterator iter = sceneFaces.begin(),
+             end = sceneFaces.end(); iter != end; ++iter) {
+        iter->isSpecular = true;
+        builder.add(*iter, subdivision / 2, subdivision / 2);
+    }
+    builder.build(vertices, faces, subdivs);
+}
+
+void lightCubeScene(RadiositySession &session)
+{
+    std::vector<Quad> const &qs = session.quads();
+    std::vector<Vertex> const &vs = session.vertices();
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        Vertex c = paraCentre(qs[i], vs);
+        Colour material = qs[i].materialColour;
+        // Put a big light in the top centre of the box.
+        if (fabs(c.x()) < 0.5 && fabs(c.z()) < 0.5 && c.y() > 0.9) {
+            material = Colour(2.0, 2.0, 2.0);
+            session.setEmitter(i, true);
+        }
+        // Make the left wall red, the right wall blue.
+        if (c.x() < -0.999) {
+            material = material * Colour(1.0, 0.5, 0.5);
+        } else if (c.x() > 0.999) {
+            material = material * Colour(0.5, 0.5, 1.0);
+        }
+        session.setMaterial(i, material);
+    }
+}
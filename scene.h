@@ -0,0 +1,33 @@
+////////////////////////////////////////////////////////////////////////
+//
+// scene.h: The demo scene, shared by the viewer and the benchmarks.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_SCENE_H
+#define RADIOSITY_SCENE_H
+
+#include <vector>
+
+#include "geom.h"
+#include "session.h"
+
+// Unaccounted-for light, relative to the total light in the scene,
+// by the point we stop iterating.
+double const CONVERGENCE_TARGET = 0.001;
+
+// Build the scene: the unit cube, each face broken up into
+// subdivision^2 subquads, optionally with a smaller rotated specular
+// cube inside it (at half the subdivision, as it's smaller). The
+// SubdivInfos refer to "vertices" and "faces".
+void buildCubeScene(int subdivision, bool innerCube,
+                    std::vector<Vertex> &vertices,
+                    std::vector<Quad> &faces,
+                    std::vector<SubdivInfo> &subdivs);
+
+// Put a big light in the top centre of the box, and make the left
+// wall red, the right wall blue.
+void lightCubeScene(RadiositySession &session);
+
+#endif // RADIOSITY_SCENE_H
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////
+//
+// session.cpp: Geometry plus its transfers, so the lighting can be
+// changed and re-solved without recalculating the transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <memory>
+#include <vector>
+
+#include "geom.h"
+#include "session.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+
+RadiositySession::RadiositySession(std::vector<Vertex> const &vs,
+                                   std::vector<Quad> const &qs,
+                                   SolverKind kind,
+                                   int threads)
+    : m_vertices(vs),
+      m_quads(qs),
+      m_transfers(qs.size()),
+      m_kind(kind),
+      m_threads(threads)
+{
+}
+
+TransferMatrix &RadiositySession::transfers()
+{
+    return m_transfers;
+}
+
+void RadiositySession::setEmitter(int i, bool isEmitter)
+{
+    Quad &q = m_quads[i];
+    q.isEmitter = isEmitter;
+    if (isEmitter) {
+        // No need to wait for the solver to light it up.
+        q.screenColour = q.materialColour;
+    }
+}
+
+void RadiositySession::setMaterial(int i, Colour const &c)
+{
+    Quad &q = m_quads[i];
+    q.materialColour = c;
+    if (q.isEmitter) {
+        q.screenColour = c;
+    }
+}
+
+int RadiositySession::resolve(double target,
+                              solverReportFn_t const &report)
+{
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(m_kind, m_quads, m_vertices, m_transfers, m_threads);
+    return solveLighting(*solver, target, report);
+}
+
+std::vector<Vertex> const &RadiositySession::vertices() const
+{
+    return m_vertices;
+}
+
+std::vector<Quad> &RadiositySession::quads()
+{
+    return m_quads;
+}
+
+std::vector<Quad> const &RadiositySession::quads() const
+{
+    return m_quads;
+}
@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////
+//
+// session.h: Geometry plus its transfers, so the lighting can be
+// changed and re-solved without recalculating the transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_SESSION_H
+#define RADIOSITY_SESSION_H
+
+#include <vector>
+
+#include "geom.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+
+// The transfers only depend on the geometry, so once they're
+// calculated, emitters and materials can be changed freely. Each
+// resolve starts from the previous solution, so small changes
+// converge quickly.
+class RadiositySession
+{
+public:
+    RadiositySession(std::vector<Vertex> const &vs,
+                     std::vector<Quad> const &qs,
+                     SolverKind kind = SOLVER_GAUSS_SEIDEL,
+                     int threads = 0);
+
+    // The transfers must be filled in (calculated, or loaded from
+    // the cache) before the first resolve.
+    TransferMatrix &transfers();
+
+    // Turn emission on or off for quad "i". Emitters take their
+    // emission from their material colour.
+    void setEmitter(int i, bool isEmitter);
+    // Set the reflectance of quad "i", or its emission if it's an
+    // emitter.
+    void setMaterial(int i, Colour const &c);
+
+    // Re-solve, warm-starting from the current screenColours.
+    // Returns the number of iterations taken.
+    int resolve(double target,
+                solverReportFn_t const &report = solverReportFn_t());
+
+    std::vector<Vertex> const &vertices() const;
+    // The quads' screenColours may be modified (e.g. for display),
+    // but materials should be changed through the session.
+    std::vector<Quad> &quads();
+    std::vector<Quad> const &quads() const;
+
+private:
+    std::vector<Vertex> m_vertices;
+    std::vector<Quad> m_quads;
+    TransferMatrix m_transfers;
+    SolverKind m_kind;
+    int m_threads;
+};
+
+#endif // RADIOSITY_SESSION_H
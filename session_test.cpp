@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////
+//
+// session_test.cpp: Tests for session.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "session.h"
+#include "solver.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class SessionTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+    const double TARGET = 1.0e-6;
+
+    CPPUNIT_TEST_SUITE(SessionTestCase);
+    CPPUNIT_TEST(testSetEmitter);
+    CPPUNIT_TEST(testMoveLight);
+    CPPUNIT_TEST(testWarmStartIsFaster);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testSetEmitter();
+    void testMoveLight();
+    void testWarmStartIsFaster();
+
+    void buildGeometry(std::vector<Vertex> &vertices,
+                       std::vector<Quad> &quads);
+    // Index of the first quad with its centre in the given direction
+    // from the origin.
+    int findQuad(RadiositySession const &session, Vertex const &dir);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(SessionTestCase, "SessionTestCase");
+
+void SessionTestCase::buildGeometry(std::vector<Vertex> &vertices,
+                                    std::vector<Quad> &quads)
+{
+    vertices = cubeVertices;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, SUBDIVISION, SUBDIVISION);
+    }
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        quads[i].materialColour = Colour(0.5, 0.4, 0.3);
+    }
+}
+
+int SessionTestCase::findQuad(RadiositySession const &session,
+                              Vertex const &dir)
+{
+    std::vector<Quad> const &qs = session.quads();
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        if (dot(paraCentre(qs[i], session.vertices()), dir) > 0.7) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void SessionTestCase::testSetEmitter()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildGeometry(vertices, quads);
+    RadiositySession session(vertices, quads);
+
+    session.setEmitter(3, true);
+    session.setMaterial(3, Colour(2.0, 1.0, 0.5));
+    CPPUNIT_ASSERT(session.quads()[3].isEmitter);
+    CPPUNIT_ASSERT_EQUAL(1.0, session.quads()[3].screenColour.g);
+
+    // Turning emission off leaves the light for the solver to
+    // remove.
+    session.setEmitter(3, false);
+    session.setMaterial(3, Colour(0.5, 0.5, 0.5));
+    CPPUNIT_ASSERT(!session.quads()[3].isEmitter);
+    CPPUNIT_ASSERT_EQUAL(1.0, session.quads()[3].screenColour.g);
+}
+
+// Moving the light and re-solving gives the same answer as starting
+// from scratch with the light in the new place.
+void SessionTestCase::testMoveLight()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildGeometry(vertices, quads);
+
+    RadiositySession session(vertices, quads);
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(session.transfers());
+    int top = findQuad(session, Vertex(0.0, 1.0, 0.0));
+    int side = findQuad(session, Vertex(1.0, 0.0, 0.0));
+    CPPUNIT_ASSERT(top >= 0 && side >= 0);
+
+    session.setEmitter(top, true);
+    session.setMaterial(top, Colour(2.0, 2.0, 2.0));
+    session.resolve(TARGET);
+    session.setEmitter(top, false);
+    session.setMaterial(top, Colour(0.5, 0.4, 0.3));
+    session.setEmitter(side, true);
+    session.setMaterial(side, Colour(2.0, 2.0, 2.0));
+    session.resolve(TARGET);
+
+    RadiositySession fresh(vertices, quads);
+    fresh.transfers() = session.transfers();
+    fresh.setEmitter(side, true);
+    fresh.setMaterial(side, Colour(2.0, 2.0, 2.0));
+    fresh.resolve(TARGET);
+
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(fresh.quads()[i].screenColour.r,
+                                     session.quads()[i].screenColour.r,
+                                     1.0e-4);
+    }
+}
+
+void SessionTestCase::testWarmStartIsFaster()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    buildGeometry(vertices, quads);
+
+    RadiositySession session(vertices, quads, SOLVER_JACOBI);
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(session.transfers());
+    int top = findQuad(session, Vertex(0.0, 1.0, 0.0));
+    session.setEmitter(top, true);
+    session.setMaterial(top, Colour(2.0, 2.0, 2.0));
+    int cold = session.resolve(TARGET);
+
+    // Nudging one wall's colour should need far fewer iterations.
+    int side = findQuad(session, Vertex(1.0, 0.0, 0.0));
+    session.setMaterial(side, Colour(0.45, 0.4, 0.3));
+    int warm = session.resolve(TARGET);
+    CPPUNIT_ASSERT(warm < cold);
+}
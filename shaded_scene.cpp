@@ -0,0 +1,232 @@
+////////////////////////////////////////////////////////////////////////
+//
+// shaded_scene.cpp: Draw the solved scene with a GLSL program doing
+// the camera-dependent shading.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+// Needed for the GLSL entry points outside MacOS.
+#define GL_GLEXT_PROTOTYPES
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "shaded_scene.h"
+
+// Floats per vertex: position, colour, normal, flags.
+static int const ATTRIB_FLOATS = 3 + 3 + 3 + 2;
+
+// Emitter texture width. As with the transfer sums, a power of two
+// keeps the shader's index arithmetic exact.
+static int const EMITTER_WIDTH = 1024;
+
+// Matches computeSpecularity in rendering.cpp.
+static char const *const SHADED_VERTEX_SHADER =
+    "#version 120\n"
+    "uniform sampler2D emitters;\n"
+    "uniform vec2 emittersSize;\n"
+    "uniform int emitterCount;\n"
+    "uniform vec3 eye;\n"
+    "uniform float brightnessScale;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 radiosity;\n"
+    "attribute vec3 normal;\n"
+    "attribute vec2 flags;\n"
+    "varying vec3 colour;\n"
+    "void main() {\n"
+    "    vec3 c = radiosity;\n"
+    "    if (flags.y > 0.5) {\n"
+    "        vec3 view = -normalize(eye - position);\n"
+    "        float specular = 0.0;\n"
+    "        for (int i = 0; i < emitterCount; ++i) {\n"
+    "            float y = floor(float(i) / emittersSize.x);\n"
+    "            float x = float(i) - y * emittersSize.x;\n"
+    "            vec3 source = texture2DLod(emitters,\n"
+    "                vec2((x + 0.5) / emittersSize.x,\n"
+    "                     (y + 0.5) / emittersSize.y), 0.0).xyz;\n"
+    "            vec3 light = normalize(position - source);\n"
+    "            vec3 reflected = normalize(normal * 2.0 * dot(normal, light) - light);\n"
+    "            specular += pow(max(dot(reflected, view), 0.0), 128.0);\n"
+    "        }\n"
+    "        c += vec3(0.02 * specular);\n"
+    "    }\n"
+    "    // Emitters aren't normalised.\n"
+    "    colour = flags.x > 0.5 ? c : c * brightnessScale;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.0);\n"
+    "}\n";
+
+static char const *const SHADED_FRAGMENT_SHADER =
+    "#version 120\n"
+    "varying vec3 colour;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(colour, 1.0);\n"
+    "}\n";
+
+ShadedScene::ShadedScene()
+    : m_emitterCount(0),
+      m_brightnessScale(1.0),
+      m_program(0),
+      m_buffer(0),
+      m_emitterTexture(0),
+      m_emitterWidth(0),
+      m_emitterHeight(0),
+      m_uploaded(false)
+{
+}
+
+ShadedScene::~ShadedScene()
+{
+    clear();
+}
+
+void ShadedScene::build(std::vector<Quad> const &qs,
+                        std::vector<Vertex> const &vs,
+                        std::vector<SubdivInfo> const &subdivs)
+{
+    // Brightness target, as in normaliseBrightness. The scale is
+    // fixed here, rather than following the camera, so that frames
+    // don't need a pass over the quads.
+    double const TARGET = 1.0;
+    double max = 0.0;
+    m_emitters.clear();
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        Quad const &q = qs[i];
+        if (q.isEmitter) {
+            Vertex c = paraCentre(q, vs);
+            m_emitters.insert(m_emitters.end(), { GLfloat(c.x()), GLfloat(c.y()),
+                                                  GLfloat(c.z()), 1.0f });
+        } else {
+            max = std::max<double>(max, q.screenColour.r);
+            max = std::max<double>(max, q.screenColour.g);
+            max = std::max<double>(max, q.screenColour.b);
+        }
+    }
+    m_emitterCount = m_emitters.size() / 4;
+    m_brightnessScale = max > 0.0 && max < TARGET ? TARGET / max : 1.0;
+
+    m_attribs.clear();
+    std::vector<GouraudQuad> gourauds;
+    std::vector<Vertex> gouraudVertices;
+    std::vector<Colour> colours;
+    for (int s = 0, n = subdivs.size(); s < n; ++s) {
+        SubdivInfo const &info = subdivs[s];
+        gourauds.clear();
+        gouraudVertices.clear();
+        info.generateGouraudQuads(gourauds, gouraudVertices);
+        Vertex normal = paraCross(info.baseQuad(), vs).norm();
+        int const firstFace = info.faceAt(0, 0);
+        for (int g = 0, gn = gourauds.size(); g < gn; ++g) {
+            // Four Gouraud quads per subdivided quad, in order.
+            Quad const &face = qs[firstFace + g / 4];
+            for (int k = 0; k < 4; ++k) {
+                Vertex const &p = gouraudVertices[gourauds[g].vertexIndex(k)];
+                Colour const &c = gourauds[g].colour(k);
+                GLfloat const v[ATTRIB_FLOATS] = {
+                    GLfloat(p.x()), GLfloat(p.y()), GLfloat(p.z()),
+                    GLfloat(c.r), GLfloat(c.g), GLfloat(c.b),
+                    GLfloat(normal.x()), GLfloat(normal.y()), GLfloat(normal.z()),
+                    face.isEmitter ? 1.0f : 0.0f,
+                    face.isSpecular ? 1.0f : 0.0f
+                };
+                m_attribs.insert(m_attribs.end(), v, v + ATTRIB_FLOATS);
+            }
+        }
+    }
+    m_uploaded = false;
+}
+
+double ShadedScene::brightnessScale() const
+{
+    return m_brightnessScale;
+}
+
+void ShadedScene::upload()
+{
+    if (m_program == 0) {
+        m_program = gwCompileProgram(SHADED_VERTEX_SHADER,
+                                     SHADED_FRAGMENT_SHADER,
+                                     { "position", "radiosity",
+                                       "normal", "flags" });
+        glGenBuffers(1, &m_buffer);
+        glGenTextures(1, &m_emitterTexture);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, m_attribs.size() * sizeof(GLfloat),
+                 m_attribs.empty() ? NULL : &m_attribs[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Always at least one texel, so the texture is complete.
+    m_emitterWidth = std::max(1, std::min(m_emitterCount, EMITTER_WIDTH));
+    m_emitterHeight = std::max(1, (m_emitterCount + EMITTER_WIDTH - 1) / EMITTER_WIDTH);
+    if (m_emitterHeight > 1) {
+        m_emitterWidth = EMITTER_WIDTH;
+    }
+    std::vector<GLfloat> texels(m_emitters);
+    texels.resize(4 * m_emitterWidth * m_emitterHeight);
+    glBindTexture(GL_TEXTURE_2D, m_emitterTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_emitterWidth, m_emitterHeight,
+                 0, GL_RGBA, GL_FLOAT, &texels[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_uploaded = true;
+}
+
+void ShadedScene::draw(Vertex const &eye)
+{
+    if (!m_uploaded) {
+        upload();
+    }
+
+    glUseProgram(m_program);
+    glUniform1i(glGetUniformLocation(m_program, "emitters"), 0);
+    glUniform2f(glGetUniformLocation(m_program, "emittersSize"),
+                m_emitterWidth, m_emitterHeight);
+    glUniform1i(glGetUniformLocation(m_program, "emitterCount"), m_emitterCount);
+    glUniform3f(glGetUniformLocation(m_program, "eye"), eye.x(), eye.y(), eye.z());
+    glUniform1f(glGetUniformLocation(m_program, "brightnessScale"),
+                m_brightnessScale);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_emitterTexture);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    int const sizes[] = { 3, 3, 3, 2 };
+    int offset = 0;
+    for (int i = 0; i < 4; ++i) {
+        glEnableVertexAttribArray(i);
+        glVertexAttribPointer(i, sizes[i], GL_FLOAT, GL_FALSE,
+                              ATTRIB_FLOATS * sizeof(GLfloat),
+                              reinterpret_cast<GLvoid const *>(offset * sizeof(GLfloat)));
+        offset += sizes[i];
+    }
+    glDrawArrays(GL_QUADS, 0, m_attribs.size() / ATTRIB_FLOATS);
+    for (int i = 0; i < 4; ++i) {
+        glDisableVertexAttribArray(i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void ShadedScene::clear()
+{
+    if (m_program != 0) {
+        glDeleteTextures(1, &m_emitterTexture);
+        glDeleteBuffers(1, &m_buffer);
+        glDeleteProgram(m_program);
+        m_program = m_buffer = m_emitterTexture = 0;
+    }
+    m_uploaded = false;
+}
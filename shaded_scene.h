@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////
+//
+// shaded_scene.h: Draw the solved scene with a GLSL program doing
+// the camera-dependent shading.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_SHADED_SCENE_H
+#define RADIOSITY_SHADED_SCENE_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <vector>
+
+#include "geom.h"
+
+// The Gouraud-shaded scene, uploaded once with the solved radiosity
+// as a per-vertex attribute. The vertex shader adds the specular
+// highlights from each emitter and applies the brightness scaling,
+// so moving the camera is just a change of uniforms, and costs the
+// CPU nothing per quad.
+//
+// GL objects are created on the first draw, so the scene can be
+// built before there's a context.
+class ShadedScene
+{
+public:
+    ShadedScene();
+    ~ShadedScene();
+
+    // Take the geometry and lighting from "qs", whose screenColours
+    // should hold the unscaled radiosity. The SubdivInfos must refer
+    // to "qs". The brightness scale is
+    // chosen, as for the CPU path, to bring the brightest
+    // non-emitter up to 1.
+    void build(std::vector<Quad> const &qs,
+               std::vector<Vertex> const &vs,
+               std::vector<SubdivInfo> const &subdivs);
+
+    double brightnessScale() const;
+
+    // Draw with the current matrices, for a camera at "eye". Throws
+    // std::runtime_error if the shaders can't be compiled.
+    void draw(Vertex const &eye);
+
+    // Release the GL objects.
+    void clear();
+
+private:
+    void upload();
+
+    // Not copyable, as it owns GL objects.
+    ShadedScene(ShadedScene const &);
+    ShadedScene &operator=(ShadedScene const &);
+
+    // Per vertex: position, radiosity, normal, then flags for
+    // emitting and specular.
+    std::vector<GLfloat> m_attribs;
+    // Emitter centres, padded to RGBA.
+    std::vector<GLfloat> m_emitters;
+    int m_emitterCount;
+    double m_brightnessScale;
+
+    GLuint m_program;
+    GLuint m_buffer;
+    GLuint m_emitterTexture;
+    int m_emitterWidth;
+    int m_emitterHeight;
+    bool m_uploaded;
+};
+
+#endif // RADIOSITY_SHADED_SCENE_H
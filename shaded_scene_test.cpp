@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////
+//
+// shaded_scene_test.cpp: Tests for shaded_scene.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <vector>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "shaded_scene.h"
+
+class ShadedSceneTestCase : public CppUnit::TestCase
+{
+private:
+    const int SIZE = 16;
+
+    CPPUNIT_TEST_SUITE(ShadedSceneTestCase);
+    CPPUNIT_TEST(testBrightnessScale);
+    CPPUNIT_TEST(testSpecular);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testBrightnessScale();
+    void testSpecular();
+
+    void buildScene(std::vector<Vertex> &vertices,
+                    std::vector<Quad> &quads,
+                    std::vector<SubdivInfo> &subdivs,
+                    bool withEmitter);
+    std::vector<GLubyte> drawAndRead(std::vector<Vertex> const &vertices,
+                                     std::vector<Quad> const &quads,
+                                     std::vector<SubdivInfo> const &subdivs);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(ShadedSceneTestCase, "ShadedSceneTestCase");
+
+// A dim specular quad on the left of the view and a brighter plain
+// one on the right, with an optional emitter behind the camera.
+void ShadedSceneTestCase::buildScene(std::vector<Vertex> &vertices,
+                                     std::vector<Quad> &quads,
+                                     std::vector<SubdivInfo> &subdivs,
+                                     bool withEmitter)
+{
+    for (int i = 0; i < 3; ++i) {
+        double x = -1.0 + i;
+        vertices.push_back(Vertex(x, -1.0, -1.0));
+        vertices.push_back(Vertex(x,  1.0, -1.0));
+    }
+    Quad left(0, 2, 3, 1, Colour());
+    left.isSpecular = true;
+    Quad right(2, 4, 5, 3, Colour());
+
+    MeshBuilder builder;
+    builder.add(left, 2, 2);
+    builder.add(right, 2, 2);
+    builder.build(vertices, quads, subdivs);
+    for (int i = 0; i < 8; ++i) {
+        quads[i].screenColour = i < 4 ? Colour(0.25, 0.25, 0.25) :
+                                        Colour(0.5, 0.5, 0.5);
+    }
+    if (withEmitter) {
+        int base = vertices.size();
+        vertices.push_back(Vertex(-0.01, -0.01, 0.5));
+        vertices.push_back(Vertex( 0.01, -0.01, 0.5));
+        vertices.push_back(Vertex( 0.01,  0.01, 0.5));
+        vertices.push_back(Vertex(-0.01,  0.01, 0.5));
+        quads.push_back(Quad(base, base + 1, base + 2, base + 3,
+                             Colour(1.0, 1.0, 1.0)));
+        quads.back().isEmitter = true;
+        quads.back().screenColour = quads.back().materialColour;
+    }
+}
+
+std::vector<GLubyte> ShadedSceneTestCase::drawAndRead(
+    std::vector<Vertex> const &vertices,
+    std::vector<Quad> const &quads,
+    std::vector<SubdivInfo> const &subdivs)
+{
+    int win = gwTransferSetup(SIZE);
+    ShadedScene scene;
+    scene.build(quads, vertices, subdivs);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    scene.draw(Vertex(0.0, 0.0, 0.0));
+    std::vector<GLubyte> pixels(4 * SIZE * SIZE);
+    glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    scene.clear();
+    gwTransferTeardown(win);
+    return pixels;
+}
+
+// The brightest non-emitter is scaled up to 1.
+void ShadedSceneTestCase::testBrightnessScale()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildScene(vertices, quads, subdivs, false);
+
+    ShadedScene scene;
+    scene.build(quads, vertices, subdivs);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, scene.brightnessScale(), 1.0e-9);
+
+    std::vector<GLubyte> pixels = drawAndRead(vertices, quads, subdivs);
+    int const row = 4 * SIZE * (SIZE / 2);
+    CPPUNIT_ASSERT_EQUAL(128, int(pixels[row + 4 * 2]));
+    CPPUNIT_ASSERT_EQUAL(255, int(pixels[row + 4 * (SIZE - 3)]));
+}
+
+// An emitter behind the camera reflects straight back at it from the
+// specular quad.
+void ShadedSceneTestCase::testSpecular()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    std::vector<SubdivInfo> subdivs;
+    buildScene(vertices, quads, subdivs, true);
+
+    std::vector<GLubyte> pixels = drawAndRead(vertices, quads, subdivs);
+    int const row = 4 * SIZE * (SIZE / 2);
+    // Just left of centre, the highlight is nearly at full strength.
+    int lit = pixels[row + 4 * (SIZE / 2 - 1)];
+    CPPUNIT_ASSERT(lit > 128 + 5);
+    // Plain quads don't shine.
+    CPPUNIT_ASSERT_EQUAL(255, int(pixels[row + 4 * (SIZE - 3)]));
+}
@@ -0,0 +1,550 @@
+////////////////////////////////////////////////////////////////////////
+//
+// solver.cpp: Solve for the light levels, given the transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+#include "parallel.h"
+#include "profile.h"
+#include "radiance.h"
+#include "solver.h"
+#include "transfer_cache.h"
+#include "transfer_matrix.h"
+
+void iterateLighting(std::vector<Quad> &qs, TransferMatrix const &transfers)
+{
+    PROFILE_SCOPE("iterateLighting");
+    int const n = qs.size();
+    std::vector<Colour> updatedColours(n);
+
+    // Iterate over targets
+    for (int i = 0; i < n; ++i) {
+        Colour incoming;
+        if (qs[i].isEmitter) {
+            // Emission is just like having 1.0 light arrive.
+            incoming = Colour(1.0, 1.0, 1.0);
+        } else {
+            // Iterate over the sources that can be seen. The diagonal
+            // is never stored.
+            for (size_t k = transfers.rowStart(i), end = transfers.rowEnd(i);
+                 k != end; ++k) {
+                incoming += qs[transfers.column(k)].screenColour *
+                            transfers.value(k);
+            }
+        }
+        updatedColours[i] = incoming * qs[i].materialColour;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        qs[i].screenColour = updatedColours[i];
+    }
+}
+
+double calcTotalLight(std::vector<Quad> const &qs,
+                      std::vector<Vertex> const &vs)
+{
+    double totalLight = 0.0;
+    for (std::vector<Quad>::const_iterator iter = qs.begin(), end = qs.end();
+         iter != end; ++iter) {
+        totalLight += iter->screenColour.asGrey() * paraArea(*iter, vs);
+    }
+    return totalLight;
+}
+
+bool parseSolverKind(std::string const &name, SolverKind &kind)
+{
+    if (name == "jacobi") {
+        kind = SOLVER_JACOBI;
+    } else if (name == "gauss-seidel") {
+        kind = SOLVER_GAUSS_SEIDEL;
+    } else if (name == "progressive") {
+        kind = SOLVER_PROGRESSIVE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+RadiositySolver::~RadiositySolver()
+{
+}
+
+SolverStatsTracker::SolverStatsTracker()
+    : m_iteration(0),
+      m_lastLight(0.0)
+{
+}
+
+void SolverStatsTracker::start(double totalLight)
+{
+    m_iteration = 0;
+    m_lastLight = totalLight;
+}
+
+SolverStats SolverStatsTracker::finish(double totalLight, double residual)
+{
+    SolverStats stats;
+    stats.iteration = ++m_iteration;
+    stats.totalLight = totalLight;
+    stats.relChange = totalLight == 0.0 ? 0.0 :
+        std::fabs(m_lastLight / totalLight - 1.0);
+    stats.residual = residual;
+    m_lastLight = totalLight;
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Common state for all the solvers.
+
+BaseSolver::BaseSolver(std::vector<Quad> &qs,
+                       std::vector<Vertex> const &vs,
+                       int threads)
+    : m_quads(qs),
+      m_threads(threads)
+{
+    int const n = qs.size();
+    m_colours.load(qs);
+    m_areas.resize(n);
+    for (int i = 0; i < n; ++i) {
+        m_areas[i] = paraArea(qs[i], vs);
+    }
+    m_stats.start(totalLight());
+}
+
+void BaseSolver::writeBack()
+{
+    m_colours.store(m_quads);
+}
+
+Colour BaseSolver::reflect(int i, Colour const &incoming) const
+{
+    Quad const &q = m_quads[i];
+    if (q.isEmitter) {
+        // Emission is just like having 1.0 light arrive.
+        return q.materialColour;
+    }
+    return incoming * q.materialColour;
+}
+
+double BaseSolver::totalLight() const
+{
+    double total = 0.0;
+    for (int i = 0, n = m_colours.size(); i < n; ++i) {
+        total += m_colours.get(i).asGrey() * m_areas[i];
+    }
+    return total;
+}
+
+double BaseSolver::update(RadianceBuffer &next)
+{
+    double residual = 0.0;
+    for (int i = 0, n = m_colours.size(); i < n; ++i) {
+        Colour delta = next.get(i) + m_colours.get(i) * -1.0;
+        residual += std::fabs(delta.asGrey()) * m_areas[i];
+    }
+    m_colours.swap(next);
+    return residual;
+}
+
+SolverStats BaseSolver::finishIteration(double residual)
+{
+    return m_stats.finish(totalLight(), residual);
+}
+
+////////////////////////////////////////////////////////////////////////
+// The solvers that work a row of the transfers at a time.
+
+class RowSolver : public BaseSolver
+{
+public:
+    RowSolver(std::vector<Quad> &qs,
+              std::vector<Vertex> const &vs,
+              TransferMatrix const &transfers,
+              int threads)
+        : BaseSolver(qs, vs, threads),
+          m_transfers(transfers)
+    {
+    }
+
+protected:
+    // The light level quad "i" should have, given the light levels
+    // in "src".
+    Colour gather(int i, RadianceBuffer const &src) const
+    {
+        if (m_quads[i].isEmitter) {
+            return m_quads[i].materialColour;
+        }
+        return reflect(i, gatherRow(m_transfers, i, src));
+    }
+
+    TransferMatrix const &m_transfers;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Jacobi: every target is updated from the previous iteration's
+// values, so the targets can be split across threads freely.
+
+class JacobiSolver : public RowSolver
+{
+public:
+    JacobiSolver(std::vector<Quad> &qs,
+                 std::vector<Vertex> const &vs,
+                 TransferMatrix const &transfers,
+                 int threads)
+        : RowSolver(qs, vs, transfers, threads),
+          m_next(qs.size())
+    {
+    }
+
+    virtual SolverStats iterate()
+    {
+        int const n = m_colours.size();
+        parallelFor(n, m_threads, [this](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                m_next.set(i, gather(i, m_colours));
+            }
+        });
+
+        return finishIteration(update(m_next));
+    }
+
+private:
+    RadianceBuffer m_next;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Jacobi over symmetric transfers. All the incoming light is
+// gathered in one pass, as each stored entry feeds two quads.
+
+class SymmetricJacobiSolver : public BaseSolver
+{
+public:
+    SymmetricJacobiSolver(std::vector<Quad> &qs,
+                          std::vector<Vertex> const &vs,
+                          SymmetricTransferMatrix const &transfers,
+                          int threads)
+        : BaseSolver(qs, vs, threads),
+          m_transfers(transfers),
+          m_next(qs.size())
+    {
+    }
+
+    virtual SolverStats iterate()
+    {
+        gatherAll(m_transfers, m_colours, m_next, m_threads);
+        for (int i = 0, n = m_next.size(); i < n; ++i) {
+            m_next.set(i, reflect(i, m_next.get(i)));
+        }
+        return finishIteration(update(m_next));
+    }
+
+private:
+    SymmetricTransferMatrix const &m_transfers;
+    RadianceBuffer m_next;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Jacobi, with the transfers streamed from disk. Each block's rows
+// are split across threads while the next block is read.
+
+class StreamingJacobiSolver : public BaseSolver
+{
+public:
+    StreamingJacobiSolver(std::vector<Quad> &qs,
+                          std::vector<Vertex> const &vs,
+                          std::string const &path,
+                          uint64_t key,
+                          int threads)
+        : BaseSolver(qs, vs, threads),
+          m_stream(path, key),
+          m_next(qs.size())
+    {
+        if (m_stream.size() != int(qs.size()) ||
+            m_stream.rowCount() != int(qs.size())) {
+            throw std::runtime_error("Transfer cache doesn't match the scene");
+        }
+    }
+
+    virtual SolverStats iterate()
+    {
+        TransferMatrix block;
+        int first;
+        while (m_stream.next(block, first)) {
+            parallelFor(block.rowCount(), m_threads,
+                        [this, &block, first](int begin, int end) {
+                for (int k = begin; k < end; ++k) {
+                    int const i = first + k;
+                    m_next.set(i, reflect(i, gatherRow(block, k, m_colours)));
+                }
+            });
+        }
+        m_stream.rewind();
+        return finishIteration(update(m_next));
+    }
+
+private:
+    TransferStream m_stream;
+    RadianceBuffer m_next;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Red-black Gauss-Seidel. Every quad can see most others, so this
+// isn't a true red-black ordering: within a colour, updates are
+// Jacobi-style, so they can be done in parallel. But the odd quads
+// see the even quads' new values, which roughly halves the number of
+// sweeps needed compared with plain Jacobi.
+
+class GaussSeidelSolver : public RowSolver
+{
+public:
+    GaussSeidelSolver(std::vector<Quad> &qs,
+                      std::vector<Vertex> const &vs,
+                      TransferMatrix const &transfers,
+                      int threads)
+        : RowSolver(qs, vs, transfers, threads),
+          m_next(qs.size())
+    {
+    }
+
+    virtual SolverStats iterate()
+    {
+        double residual = sweep(0) + sweep(1);
+        return finishIteration(residual);
+    }
+
+private:
+    // Update all quads with index parity "colour".
+    double sweep(int colour)
+    {
+        int const n = m_colours.size();
+        int const count = (n - colour + 1) / 2;
+        parallelFor(count, m_threads, [this, colour](int begin, int end) {
+            for (int k = begin; k < end; ++k) {
+                int i = 2 * k + colour;
+                m_next.set(i, gather(i, m_colours));
+            }
+        });
+
+        double residual = 0.0;
+        for (int i = colour; i < n; i += 2) {
+            Colour next = m_next.get(i);
+            Colour delta = next + m_colours.get(i) * -1.0;
+            residual += std::fabs(delta.asGrey()) * m_areas[i];
+            m_colours.set(i, next);
+        }
+        return residual;
+    }
+
+    RadianceBuffer m_next;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Progressive refinement. We track the residual for each quad: the
+// difference between the light it should have given everything
+// else's current light, and the light it has. Shooting a quad
+// accepts its residual, and passes the change on to the residuals of
+// every quad that can see it. Starting from black, this is the
+// classic "shoot from the brightest emitter" algorithm, but it also
+// works when warm-started from an existing solution.
+
+class ProgressiveSolver : public RowSolver
+{
+public:
+    ProgressiveSolver(std::vector<Quad> &qs,
+                      std::vector<Vertex> const &vs,
+                      TransferMatrix const &transfers,
+                      int threads)
+        : RowSolver(qs, vs, transfers, threads),
+          m_unshot(qs.size())
+    {
+        // Need to find everything a quad can send light to.
+        transfers.transpose(m_shooting);
+
+        int const n = m_colours.size();
+        parallelFor(n, m_threads, [this](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                m_unshot.set(i, gather(i, m_colours) + m_colours.get(i) * -1.0);
+            }
+        });
+    }
+
+    virtual SolverStats iterate()
+    {
+        int const n = m_colours.size();
+
+        // Find the quad with the most unshot light.
+        int best = -1;
+        double bestEnergy = 0.0;
+        for (int i = 0; i < n; ++i) {
+            double energy = std::fabs(m_unshot.get(i).asGrey()) * m_areas[i];
+            if (energy > bestEnergy) {
+                best = i;
+                bestEnergy = energy;
+            }
+        }
+
+        if (best >= 0) {
+            Colour const shot = m_unshot.get(best);
+            m_colours.add(best, shot);
+            m_unshot.set(best, Colour());
+            for (size_t k = m_shooting.rowStart(best), end = m_shooting.rowEnd(best);
+                 k != end; ++k) {
+                int i = m_shooting.column(k);
+                Quad const &q = m_quads[i];
+                if (!q.isEmitter) {
+                    m_unshot.add(i, shot * m_shooting.value(k) * q.materialColour);
+                }
+            }
+        }
+
+        double residual = 0.0;
+        for (int i = 0; i < n; ++i) {
+            residual += std::fabs(m_unshot.get(i).asGrey()) * m_areas[i];
+        }
+        return finishIteration(residual);
+    }
+
+private:
+    TransferMatrix m_shooting;
+    RadianceBuffer m_unshot;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<RadiositySolver> makeSolver(SolverKind kind,
+                                            std::vector<Quad> &qs,
+                                            std::vector<Vertex> const &vs,
+                                            TransferMatrix const &transfers,
+                                            int threads)
+{
+    switch (kind) {
+    case SOLVER_GAUSS_SEIDEL:
+        return std::unique_ptr<RadiositySolver>(
+            new GaussSeidelSolver(qs, vs, transfers, threads));
+    case SOLVER_PROGRESSIVE:
+        return std::unique_ptr<RadiositySolver>(
+            new ProgressiveSolver(qs, vs, transfers, threads));
+    case SOLVER_JACOBI:
+    default:
+        return std::unique_ptr<RadiositySolver>(
+            new JacobiSolver(qs, vs, transfers, threads));
+    }
+}
+
+std::unique_ptr<RadiositySolver> makeSolver(std::vector<Quad> &qs,
+                                            std::vector<Vertex> const &vs,
+                                            SymmetricTransferMatrix const &transfers,
+                                            int threads)
+{
+    return std::unique_ptr<RadiositySolver>(
+        new SymmetricJacobiSolver(qs, vs, transfers, threads));
+}
+
+std::unique_ptr<RadiositySolver> makeStreamingSolver(std::vector<Quad> &qs,
+                                                     std::vector<Vertex> const &vs,
+                                                     std::string const &path,
+                                                     uint64_t key,
+                                                     int threads)
+{
+    return std::unique_ptr<RadiositySolver>(
+        new StreamingJacobiSolver(qs, vs, path, key, threads));
+}
+
+int solveLighting(RadiositySolver &solver, double target,
+                  solverReportFn_t const &report)
+{
+    SolverStats stats;
+    do {
+        PROFILE_SCOPE("RadiositySolver::iterate");
+        stats = solver.iterate();
+        if (report) {
+            report(stats);
+        }
+    } while (stats.residual > target * stats.totalLight);
+    solver.writeBack();
+    return stats.iteration;
+}
+
+std::vector<int> solveLightingBatch(std::vector<std::vector<Quad> > &scenarios,
+                                    std::vector<Vertex> const &vs,
+                                    TransferMatrix const &transfers,
+                                    double target,
+                                    int threads)
+{
+    PROFILE_SCOPE("solveLightingBatch");
+    int const count = scenarios.size();
+    int const n = transfers.rowCount();
+    if (count == 0) {
+        return std::vector<int>();
+    }
+    for (int s = 0; s < count; ++s) {
+        if (int(scenarios[s].size()) != n || transfers.size() != n) {
+            throw std::runtime_error("Lighting setup doesn't match the transfers");
+        }
+    }
+
+    std::vector<double> areas(n);
+    for (int i = 0; i < n; ++i) {
+        areas[i] = paraArea(scenarios[0][i], vs);
+    }
+
+    RadianceBatch colours(n, count);
+    RadianceBatch next(n, count);
+    for (int s = 0; s < count; ++s) {
+        colours.load(s, scenarios[s]);
+    }
+
+    // Setups that have converged are still gathered (the matrix pass
+    // costs the same either way), but no longer updated.
+    std::vector<int> iterations(count, 0);
+    std::vector<int> active;
+    for (int s = 0; s < count; ++s) {
+        active.push_back(s);
+    }
+    for (int iteration = 1; !active.empty(); ++iteration) {
+        parallelFor(n, threads, [&](int begin, int end) {
+            std::vector<double> incoming(3 * count);
+            for (int i = begin; i < end; ++i) {
+                gatherRow(transfers, i, colours, incoming.data());
+                for (int k = 0, nk = active.size(); k < nk; ++k) {
+                    int const s = active[k];
+                    Quad const &q = scenarios[s][i];
+                    // Emission is just like having 1.0 light arrive.
+                    next.set(i, s, q.isEmitter ? q.materialColour :
+                             Colour(incoming[3 * s],
+                                    incoming[3 * s + 1],
+                                    incoming[3 * s + 2]) * q.materialColour);
+                }
+            }
+        });
+
+        std::vector<int> stillActive;
+        for (int k = 0, nk = active.size(); k < nk; ++k) {
+            int const s = active[k];
+            double residual = 0.0;
+            double light = 0.0;
+            for (int i = 0; i < n; ++i) {
+                Colour const updated = next.get(i, s);
+                Colour delta = updated + colours.get(i, s) * -1.0;
+                residual += std::fabs(delta.asGrey()) * areas[i];
+                light += updated.asGrey() * areas[i];
+                colours.set(i, s, updated);
+            }
+            if (residual > target * light) {
+                stillActive.push_back(s);
+            } else {
+                iterations[s] = iteration;
+                colours.store(s, scenarios[s]);
+            }
+        }
+        active.swap(stillActive);
+    }
+    return iterations;
+}
@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////
+//
+// solver.h: Solve for the light levels, given the transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_SOLVER_H
+#define RADIOSITY_SOLVER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+#include "radiance.h"
+#include "transfer_matrix.h"
+
+// One Jacobi iteration, single-threaded: work out the light arriving
+// at each quad given the current screenColours, and update them all.
+void iterateLighting(std::vector<Quad> &qs, TransferMatrix const &transfers);
+
+// Calculate the total light in the scene, as area-weight sum of
+// screenColour.
+double calcTotalLight(std::vector<Quad> const &qs,
+                      std::vector<Vertex> const &vs);
+
+enum SolverKind {
+    // Jacobi iteration, with the targets split across threads.
+    SOLVER_JACOBI,
+    // Red-black Gauss-Seidel: update the even quads, then the odd
+    // quads using the new even values.
+    SOLVER_GAUSS_SEIDEL,
+    // Southwell-style progressive refinement: repeatedly shoot light
+    // from the quad with the most unshot energy.
+    SOLVER_PROGRESSIVE
+};
+
+// Parse "jacobi", "gauss-seidel" or "progressive". Returns false if
+// the name isn't recognised.
+bool parseSolverKind(std::string const &name, SolverKind &kind);
+
+// What happened on a single iteration.
+struct SolverStats
+{
+    int iteration;
+    // Area-weighted sum of quad brightnesses.
+    double totalLight;
+    // Relative change in total light over the iteration.
+    double relChange;
+    // Area-weighted brightness still to be accounted for: the sum of
+    // the changes made (Jacobi, Gauss-Seidel), or of the remaining
+    // unshot light (progressive).
+    double residual;
+};
+
+// Solvers start from the screenColours of the quads they're given,
+// and work on their own copy until writeBack is called. The quads,
+// vertices and transfers must outlive the solver.
+class RadiositySolver
+{
+public:
+    virtual ~RadiositySolver();
+
+    // Do one iteration: a full sweep for the iterative solvers, or a
+    // single shot for progressive refinement.
+    virtual SolverStats iterate() = 0;
+
+    // Copy the current light levels into the quads' screenColours.
+    virtual void writeBack() = 0;
+};
+
+// Fills in the SolverStats after each iteration, so that every solver
+// counts iterations and measures the change in light the same way.
+class SolverStatsTracker
+{
+public:
+    SolverStatsTracker();
+
+    // Set the total light before the first iteration.
+    void start(double totalLight);
+
+    // The stats for the iteration just done.
+    SolverStats finish(double totalLight, double residual);
+
+private:
+    int m_iteration;
+    double m_lastLight;
+};
+
+// Common state for the solvers over the subdivided quads. They work
+// on their own structure-of-arrays copy of the light levels, and only
+// write them back to the quads when asked.
+class BaseSolver : public RadiositySolver
+{
+public:
+    BaseSolver(std::vector<Quad> &qs,
+               std::vector<Vertex> const &vs,
+               int threads);
+
+    virtual void writeBack();
+
+protected:
+    // The light level quad "i" should have, given the light arriving
+    // at it.
+    Colour reflect(int i, Colour const &incoming) const;
+
+    // Area-weighted sum of the current light levels.
+    double totalLight() const;
+
+    // Replace the light levels with "next", returning the residual.
+    double update(RadianceBuffer &next);
+
+    // Fill in the stats at the end of an iteration.
+    SolverStats finishIteration(double residual);
+
+    std::vector<Quad> &m_quads;
+    int const m_threads;
+
+    RadianceBuffer m_colours;
+    std::vector<double> m_areas;
+
+private:
+    SolverStatsTracker m_stats;
+};
+
+// Create a solver over the given scene. "threads" of 0 means one per
+// core.
+std::unique_ptr<RadiositySolver> makeSolver(SolverKind kind,
+                                            std::vector<Quad> &qs,
+                                            std::vector<Vertex> const &vs,
+                                            TransferMatrix const &transfers,
+                                            int threads = 0);
+
+// A Jacobi solver over symmetric transfers. For the other kinds,
+// expand the matrix first.
+std::unique_ptr<RadiositySolver> makeSolver(std::vector<Quad> &qs,
+                                            std::vector<Vertex> const &vs,
+                                            SymmetricTransferMatrix const &transfers,
+                                            int threads = 0);
+
+// A Jacobi solver that streams the transfers from the cache file at
+// "path" (see transfer_cache.h) a block of rows at a time, instead of
+// holding them in memory, so only the light levels stay resident.
+// Each iteration reads the whole file, overlapping the reads with the
+// gathering. Throws std::runtime_error if the file can't be read.
+std::unique_ptr<RadiositySolver> makeStreamingSolver(std::vector<Quad> &qs,
+                                                     std::vector<Vertex> const &vs,
+                                                     std::string const &path,
+                                                     uint64_t key,
+                                                     int threads = 0);
+
+typedef std::function<void(SolverStats const &)> solverReportFn_t;
+
+// Iterate until the residual is below "target" times the total
+// light, calling "report" (if set) after each iteration, and then
+// write back the result. Returns the number of iterations.
+int solveLighting(RadiositySolver &solver, double target,
+                  solverReportFn_t const &report = solverReportFn_t());
+
+// Jacobi over several lighting setups of the same geometry at once.
+// Each of "scenarios" is a copy of the scene's quads with its own
+// materials, emitters and starting light, and all share "vs" and
+// "transfers". Each pass over the transfers updates every setup, so
+// the matrix is read once per iteration rather than once per setup.
+// Each setup stops iterating when it meets "target", as in
+// solveLighting, and has its result written back. Returns the
+// number of iterations each took. Throws std::runtime_error if the
+// setups don't all match the transfers.
+std::vector<int> solveLightingBatch(std::vector<std::vector<Quad> > &scenarios,
+                                    std::vector<Vertex> const &vs,
+                                    TransferMatrix const &transfers,
+                                    double target,
+                                    int threads = 0);
+
+#endif // RADIOSITY_SOLVER_H
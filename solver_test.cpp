@@ -0,0 +1,317 @@
+////////////////////////////////////////////////////////////////////////
+//
+// solver_test.cpp: Tests for solver.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "glut_wrap.h"
+#include "radiance.h"
+#include "solver.h"
+#include "test_scene.h"
+#include "transfer_cache.h"
+#include "transfer_matrix.h"
+#include "transfers.h"
+
+class SolverTestCase : public CppUnit::TestCase
+{
+private:
+    const int SUBDIVISION = 4;
+    const double TARGET = 1.0e-6;
+
+    CPPUNIT_TEST_SUITE(SolverTestCase);
+    CPPUNIT_TEST(testJacobiMatchesIterateLighting);
+    CPPUNIT_TEST(testSolversAgree);
+    CPPUNIT_TEST(testProgressiveShootsEmitterFirst);
+    CPPUNIT_TEST(testWarmStart);
+    CPPUNIT_TEST(testParseSolverKind);
+    CPPUNIT_TEST(testWriteBackOnlyWhenAsked);
+    CPPUNIT_TEST(testSymmetricMatchesJacobi);
+    CPPUNIT_TEST(testStreamingMatchesJacobi);
+    CPPUNIT_TEST(testBatchMatchesJacobi);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testJacobiMatchesIterateLighting();
+    void testSolversAgree();
+    void testProgressiveShootsEmitterFirst();
+    void testWarmStart();
+    void testParseSolverKind();
+    void testWriteBackOnlyWhenAsked();
+    void testSymmetricMatchesJacobi();
+    void testStreamingMatchesJacobi();
+    void testBatchMatchesJacobi();
+
+    void buildScene(std::vector<Vertex> &vertices,
+                    std::vector<Quad> &quads,
+                    TransferMatrix &transfers);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(SolverTestCase, "SolverTestCase");
+
+// A subdivided cube, with the middle of the top lit up. The analytic
+// transfers overestimate at this subdivision, so keep the walls dark
+// enough to converge quickly.
+void SolverTestCase::buildScene(std::vector<Vertex> &vertices,
+                                std::vector<Quad> &quads,
+                                TransferMatrix &transfers)
+{
+    std::vector<SubdivInfo> subdivs;
+    buildLitCube(SUBDIVISION, vertices, quads, subdivs);
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(transfers);
+}
+
+void SolverTestCase::testJacobiMatchesIterateLighting()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+    std::vector<Quad> reference(quads);
+    // The solver's working copy may be single precision.
+    double const epsilon = sizeof(radiance_t) < sizeof(double) ? 1.0e-6 : 1.0e-12;
+
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(SOLVER_JACOBI, quads, vertices, transfers, 3);
+    for (int iter = 0; iter < 3; ++iter) {
+        solver->iterate();
+        solver->writeBack();
+        iterateLighting(reference, transfers);
+        for (int i = 0, n = quads.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.r,
+                                         quads[i].screenColour.r, epsilon);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.b,
+                                         quads[i].screenColour.b, epsilon);
+        }
+    }
+}
+
+void SolverTestCase::testSolversAgree()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+
+    std::vector<Quad> reference(quads);
+    for (int iter = 0; iter < 200; ++iter) {
+        iterateLighting(reference, transfers);
+    }
+    double referenceLight = calcTotalLight(reference, vertices);
+
+    SolverKind kinds[] = { SOLVER_JACOBI, SOLVER_GAUSS_SEIDEL, SOLVER_PROGRESSIVE };
+    int iterations[3];
+    for (int k = 0; k < 3; ++k) {
+        std::vector<Quad> qs(quads);
+        std::unique_ptr<RadiositySolver> solver =
+            makeSolver(kinds[k], qs, vertices, transfers, 2);
+        iterations[k] = solveLighting(*solver, TARGET);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(referenceLight,
+                                     calcTotalLight(qs, vertices),
+                                     1.0e-4 * referenceLight);
+        for (int i = 0, n = qs.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.g,
+                                         qs[i].screenColour.g, 1.0e-4);
+        }
+    }
+    // Gauss-Seidel should need fewer sweeps than Jacobi.
+    CPPUNIT_ASSERT(iterations[1] < iterations[0]);
+}
+
+void SolverTestCase::testProgressiveShootsEmitterFirst()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+    // Start completely black.
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        quads[i].screenColour = Colour();
+    }
+
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(SOLVER_PROGRESSIVE, quads, vertices, transfers, 1);
+    SolverStats first = solver->iterate();
+    CPPUNIT_ASSERT_EQUAL(1, first.iteration);
+    CPPUNIT_ASSERT(first.totalLight > 0.0);
+    solver->writeBack();
+
+    // Exactly one emitter has been lit, and nothing else yet.
+    int lit = 0;
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        if (quads[i].screenColour.r != 0.0) {
+            CPPUNIT_ASSERT(quads[i].isEmitter);
+            ++lit;
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(1, lit);
+
+    SolverStats second = solver->iterate();
+    CPPUNIT_ASSERT(second.totalLight > first.totalLight);
+}
+
+void SolverTestCase::testWarmStart()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(SOLVER_JACOBI, quads, vertices, transfers);
+    CPPUNIT_ASSERT(solveLighting(*solver, TARGET) > 1);
+
+    // Starting from the converged solution, there's nothing to do.
+    SolverKind kinds[] = { SOLVER_JACOBI, SOLVER_GAUSS_SEIDEL, SOLVER_PROGRESSIVE };
+    for (int k = 0; k < 3; ++k) {
+        std::unique_ptr<RadiositySolver> warm =
+            makeSolver(kinds[k], quads, vertices, transfers);
+        CPPUNIT_ASSERT_EQUAL(1, solveLighting(*warm, TARGET));
+    }
+}
+
+void SolverTestCase::testParseSolverKind()
+{
+    SolverKind kind = SOLVER_JACOBI;
+    CPPUNIT_ASSERT(parseSolverKind("progressive", kind));
+    CPPUNIT_ASSERT_EQUAL(SOLVER_PROGRESSIVE, kind);
+    CPPUNIT_ASSERT(parseSolverKind("gauss-seidel", kind));
+    CPPUNIT_ASSERT_EQUAL(SOLVER_GAUSS_SEIDEL, kind);
+    CPPUNIT_ASSERT(parseSolverKind("jacobi", kind));
+    CPPUNIT_ASSERT_EQUAL(SOLVER_JACOBI, kind);
+    CPPUNIT_ASSERT(!parseSolverKind("magic", kind));
+    CPPUNIT_ASSERT_EQUAL(SOLVER_JACOBI, kind);
+}
+
+void SolverTestCase::testWriteBackOnlyWhenAsked()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+    double before = calcTotalLight(quads, vertices);
+
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(SOLVER_GAUSS_SEIDEL, quads, vertices, transfers);
+    SolverStats stats = solver->iterate();
+    CPPUNIT_ASSERT_EQUAL(before, calcTotalLight(quads, vertices));
+    solver->writeBack();
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(stats.totalLight,
+                                 calcTotalLight(quads, vertices), 1.0e-9);
+}
+
+void SolverTestCase::testSymmetricMatchesJacobi()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+    SymmetricTransferMatrix symmetric;
+    AnalyticTransferCalculator(vertices, quads).calcAllLights(symmetric);
+
+    std::vector<Quad> reference(quads);
+    std::unique_ptr<RadiositySolver> referenceSolver =
+        makeSolver(SOLVER_JACOBI, reference, vertices, transfers, 2);
+    std::unique_ptr<RadiositySolver> solver =
+        makeSolver(quads, vertices, symmetric, 2);
+    for (int iter = 0; iter < 3; ++iter) {
+        SolverStats expected = referenceSolver->iterate();
+        SolverStats stats = solver->iterate();
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected.residual, stats.residual,
+                                     1.0e-5 * expected.residual);
+    }
+
+    int iterations = solveLighting(*solver, TARGET);
+    CPPUNIT_ASSERT_EQUAL(solveLighting(*referenceSolver, TARGET), iterations);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(reference[i].screenColour.g,
+                                     quads[i].screenColour.g, 1.0e-5);
+    }
+}
+
+void SolverTestCase::testStreamingMatchesJacobi()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+    std::ostringstream path;
+    path << "/tmp/solver_test." << getpid() << ".xfer";
+    saveTransferCache(path.str(), 42, transfers);
+
+    std::vector<Quad> reference(quads);
+    std::unique_ptr<RadiositySolver> referenceSolver =
+        makeSolver(SOLVER_JACOBI, reference, vertices, transfers, 2);
+    std::unique_ptr<RadiositySolver> solver =
+        makeStreamingSolver(quads, vertices, path.str(), 42, 2);
+    unlink(path.str().c_str());
+
+    int iterations = solveLighting(*solver, TARGET);
+    CPPUNIT_ASSERT_EQUAL(solveLighting(*referenceSolver, TARGET), iterations);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(reference[i].screenColour.g,
+                             quads[i].screenColour.g);
+    }
+
+    // A cache for some other scene.
+    TransferMatrix other(3);
+    saveTransferCache(path.str(), 42, other);
+    CPPUNIT_ASSERT_THROW(makeStreamingSolver(quads, vertices, path.str(), 42),
+                         std::runtime_error);
+    unlink(path.str().c_str());
+}
+
+// Setups with different materials and emitters converge at different
+// rates, and each should match solving it alone.
+void SolverTestCase::testBatchMatchesJacobi()
+{
+    std::vector<Vertex> vertices;
+    std::vector<Quad> quads;
+    TransferMatrix transfers;
+    buildScene(vertices, quads, transfers);
+
+    int const count = 3;
+    std::vector<std::vector<Quad> > scenarios(count, quads);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        if (!quads[i].isEmitter) {
+            scenarios[1][i].materialColour = Colour(0.2, 0.2, 0.6);
+        }
+    }
+    // An extra light on the floor.
+    scenarios[2][0].isEmitter = true;
+    scenarios[2][0].materialColour = Colour(1.0, 0.5, 0.5);
+
+    std::vector<std::vector<Quad> > expected(scenarios);
+    std::vector<int> expectedIterations;
+    for (int s = 0; s < count; ++s) {
+        std::unique_ptr<RadiositySolver> solver =
+            makeSolver(SOLVER_JACOBI, expected[s], vertices, transfers, 2);
+        expectedIterations.push_back(solveLighting(*solver, TARGET));
+    }
+    CPPUNIT_ASSERT(expectedIterations[1] != expectedIterations[0]);
+
+    std::vector<int> iterations =
+        solveLightingBatch(scenarios, vertices, transfers, TARGET, 2);
+    CPPUNIT_ASSERT_EQUAL(count, static_cast<int>(iterations.size()));
+    for (int s = 0; s < count; ++s) {
+        CPPUNIT_ASSERT_EQUAL(expectedIterations[s], iterations[s]);
+        for (int i = 0, n = quads.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[s][i].screenColour.r,
+                                         scenarios[s][i].screenColour.r, 1.0e-6);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[s][i].screenColour.b,
+                                         scenarios[s][i].screenColour.b, 1.0e-6);
+        }
+    }
+
+    std::vector<std::vector<Quad> > wrong(1, std::vector<Quad>(3, quads[0]));
+    CPPUNIT_ASSERT_THROW(solveLightingBatch(wrong, vertices, transfers, TARGET),
+                         std::runtime_error);
+}
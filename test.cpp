@@ -12,13 +12,17 @@
 #endif
 
 #include <cmath>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/ui/text/TestRunner.h>
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/TestCase.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include "glut_wrap.h"
+
 CppUnit::Test *suite()
 {
     CppUnit::TestFactoryRegistry &registry =
@@ -30,13 +34,53 @@ CppUnit::Test *suite()
         &CppUnit::TestFactoryRegistry::getRegistry("WeightingTestCase"));
     registry.registerFactory(
         &CppUnit::TestFactoryRegistry::getRegistry("TransfersTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("TransferMatrixTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("SolverTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("RadianceTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("TransferCacheTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("SessionTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("HierarchyTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("ParallelTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("BVHTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("RayTransfersTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("QuadBufferTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("ShadedSceneTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("ProfileTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("ProgressTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("CaptureTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("LightmapTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("LiveSolveTestCase"));
+    registry.registerFactory(
+        &CppUnit::TestFactoryRegistry::getRegistry("ClustersTestCase"));
 
     return registry.makeTest();
 }
 
 int main(int argc, char* argv[])
 {
-    glutInit(&argc, argv);
+    // Run with RADIOSITY_GL_BACKEND=egl or osmesa to test headless.
+    try {
+        gwInit(&argc, argv);
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
     // if command line contains "-selftest" then this is the post build check
     // => the output must be in the compiler error format.
@@ -0,0 +1,29 @@
+////////////////////////////////////////////////////////////////////////
+//
+// test_scene.cpp: The lit cube shared by the solver and transfer tests.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <vector>
+
+#include "geom.h"
+#include "scene.h"
+#include "test_scene.h"
+
+void buildLitCube(int subdivision,
+                  std::vector<Vertex> &vertices,
+                  std::vector<Quad> &quads,
+                  std::vector<SubdivInfo> &subdivs)
+{
+    buildCubeScene(subdivision, false, vertices, quads, subdivs);
+    for (int i = 0, n = quads.size(); i < n; ++i) {
+        Vertex c = paraCentre(quads[i], vertices);
+        quads[i].materialColour = Colour(0.5, 0.4, 0.3);
+        if (std::fabs(c.x()) < 0.5 && std::fabs(c.z()) < 0.5 && c.y() > 0.9) {
+            quads[i].materialColour = quads[i].screenColour = Colour(2.0, 2.0, 2.0);
+            quads[i].isEmitter = true;
+        }
+    }
+}
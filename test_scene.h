@@ -0,0 +1,23 @@
+////////////////////////////////////////////////////////////////////////
+//
+// test_scene.h: The lit cube shared by the solver and transfer tests.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_TEST_SCENE_H
+#define RADIOSITY_TEST_SCENE_H
+
+#include <vector>
+
+#include "geom.h"
+
+// buildCubeScene's outer cube, with a plain material on every quad,
+// and the middle of the ceiling lit up. The walls are dark enough for
+// the solves to converge quickly.
+void buildLitCube(int subdivision,
+                  std::vector<Vertex> &vertices,
+                  std::vector<Quad> &quads,
+                  std::vector<SubdivInfo> &subdivs);
+
+#endif // RADIOSITY_TEST_SCENE_H
@@ -0,0 +1,477 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_cache.cpp: On-disk cache of transfer matrices, so that
+// repeat runs over the same geometry can skip the form factor
+// calculation.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "geom.h"
+#include "transfer_cache.h"
+#include "transfer_matrix.h"
+
+// Bump if the layout changes.
+static char const CACHE_MAGIC[8] = { 'R', 'A', 'D', 'X', 'F', 'E', 'R', '1' };
+
+// The file is this header, then the row starts, column indices and
+// weights, each padded to 8 bytes so they can be used in place.
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t key;
+    uint32_t sizeofSize;
+    uint32_t sizeofTransfer;
+    int32_t size;
+    int32_t rows;
+    uint64_t nonZeros;
+};
+
+static size_t pad8(size_t n)
+{
+    return (n + 7) & ~size_t(7);
+}
+
+// Where each section of a file with the given header starts, and the
+// file's expected length.
+struct CacheLayout
+{
+    explicit CacheLayout(CacheHeader const &header)
+        : rowStarts(pad8(sizeof(CacheHeader))),
+          columns(rowStarts + pad8((header.rows + 1) * sizeof(size_t))),
+          values(columns + pad8(header.nonZeros * sizeof(int))),
+          length(values + header.nonZeros * sizeof(transfer_t))
+    {
+    }
+
+    size_t rowStarts;
+    size_t columns;
+    size_t values;
+    size_t length;
+};
+
+// Is this the header of a cache for "key", written by a build like
+// this one?
+static bool validHeader(CacheHeader const &header, uint64_t key)
+{
+    return memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+           header.key == key &&
+           header.sizeofSize == sizeof(size_t) &&
+           header.sizeofTransfer == sizeof(transfer_t) &&
+           header.rows >= 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Keying
+
+// FNV-1a, 64 bit.
+static void hashBytes(uint64_t &h, void const *data, size_t len)
+{
+    unsigned char const *p = static_cast<unsigned char const *>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+}
+
+uint64_t transferCacheKey(std::vector<Vertex> const &vs,
+                          std::vector<Quad> const &qs,
+                          int resolution,
+                          std::string const &method)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0, n = vs.size(); i < n; ++i) {
+        hashBytes(h, vs[i].p, sizeof(vs[i].p));
+    }
+    for (int i = 0, n = qs.size(); i < n; ++i) {
+        hashBytes(h, qs[i].indices, sizeof(qs[i].indices));
+    }
+    hashBytes(h, &resolution, sizeof(resolution));
+    hashBytes(h, method.data(), method.size());
+    uint32_t const precision = sizeof(transfer_t);
+    hashBytes(h, &precision, sizeof(precision));
+    return h;
+}
+
+std::string transferCachePath(std::string const &dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.xfer",
+             static_cast<unsigned long long>(key));
+    return dir + "/" + name;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Loading
+
+namespace {
+
+// Owns a read-only mapping, and unmaps it when the last matrix
+// using it goes away.
+class MappedFile
+{
+public:
+    MappedFile(void const *data, size_t length)
+        : m_data(data), m_length(length)
+    {
+    }
+
+    ~MappedFile()
+    {
+        munmap(const_cast<void *>(m_data), m_length);
+    }
+
+    char const *data() const
+    {
+        return static_cast<char const *>(m_data);
+    }
+
+private:
+    MappedFile(MappedFile const &);
+    MappedFile &operator=(MappedFile const &);
+
+    void const *m_data;
+    size_t m_length;
+};
+
+} // namespace
+
+bool loadTransferCache(std::string const &path, uint64_t key,
+                       TransferMatrix &transfers)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t const length = st.st_size;
+    void *data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    std::shared_ptr<MappedFile> file(new MappedFile(data, length));
+
+    CacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (!validHeader(header, key)) {
+        return false;
+    }
+    CacheLayout const layout(header);
+    if (length != layout.length) {
+        return false;
+    }
+
+    char const *base = file->data();
+    size_t const *rowStarts =
+        reinterpret_cast<size_t const *>(base + layout.rowStarts);
+    if (rowStarts[header.rows] != header.nonZeros) {
+        return false;
+    }
+    transfers.attach(header.size, header.rows,
+                     rowStarts,
+                     reinterpret_cast<int const *>(base + layout.columns),
+                     reinterpret_cast<transfer_t const *>(base + layout.values),
+                     file);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Saving
+
+static void writeOrThrow(FILE *f, void const *data, size_t len)
+{
+    static char const zeros[8] = { 0 };
+    if (len > 0 && fwrite(data, len, 1, f) != 1) {
+        throw std::runtime_error("Couldn't write transfer cache");
+    }
+    size_t const padding = pad8(len) - len;
+    if (padding > 0 && fwrite(zeros, padding, 1, f) != 1) {
+        throw std::runtime_error("Couldn't write transfer cache");
+    }
+}
+
+void saveTransferCache(std::string const &path, uint64_t key,
+                       TransferMatrix const &transfers)
+{
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.key = key;
+    header.sizeofSize = sizeof(size_t);
+    header.sizeofTransfer = sizeof(transfer_t);
+    header.size = transfers.size();
+    header.rows = transfers.rowCount();
+    header.nonZeros = transfers.nonZeros();
+
+    std::ostringstream tmp;
+    tmp << path << ".tmp." << getpid();
+    std::string const tmpPath = tmp.str();
+
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (f == NULL) {
+        throw std::runtime_error("Couldn't create transfer cache " + tmpPath);
+    }
+    try {
+        writeOrThrow(f, &header, sizeof(header));
+        writeOrThrow(f, transfers.rowStarts(),
+                     (header.rows + 1) * sizeof(size_t));
+        writeOrThrow(f, transfers.columns(), header.nonZeros * sizeof(int));
+        // Final section isn't padded, so the file size is exact.
+        if (header.nonZeros > 0 &&
+            fwrite(transfers.values(), header.nonZeros * sizeof(transfer_t),
+                   1, f) != 1) {
+            throw std::runtime_error("Couldn't write transfer cache");
+        }
+    } catch (...) {
+        fclose(f);
+        unlink(tmpPath.c_str());
+        throw;
+    }
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        throw std::runtime_error("Couldn't write transfer cache " + path);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Streaming
+
+// pread until "len" bytes are in, as it may return short.
+static void readOrThrow(int fd, void *data, size_t len, size_t offset)
+{
+    char *p = static_cast<char *>(data);
+    while (len > 0) {
+        ssize_t got = pread(fd, p, len, offset);
+        if (got <= 0) {
+            throw std::runtime_error("Couldn't read transfer cache");
+        }
+        p += got;
+        len -= got;
+        offset += got;
+    }
+}
+
+TransferStream::TransferStream(std::string const &path, uint64_t key,
+                               size_t blockBytes)
+    : m_fd(open(path.c_str(), O_RDONLY)),
+      m_nextBlock(0)
+{
+    if (m_fd < 0) {
+        throw std::runtime_error("Couldn't open transfer cache " + path);
+    }
+    try {
+        struct stat st;
+        CacheHeader header;
+        if (fstat(m_fd, &st) != 0 || size_t(st.st_size) < sizeof(header)) {
+            throw std::runtime_error("Not a transfer cache: " + path);
+        }
+        readOrThrow(m_fd, &header, sizeof(header), 0);
+        CacheLayout const layout(header);
+        if (!validHeader(header, key) || size_t(st.st_size) != layout.length) {
+            throw std::runtime_error("Not a transfer cache: " + path);
+        }
+        m_size = header.size;
+        m_columnsOffset = layout.columns;
+        m_valuesOffset = layout.values;
+        m_rowStarts.resize(header.rows + 1);
+        readOrThrow(m_fd, m_rowStarts.data(),
+                    m_rowStarts.size() * sizeof(size_t), layout.rowStarts);
+        if (m_rowStarts.back() != header.nonZeros) {
+            throw std::runtime_error("Not a transfer cache: " + path);
+        }
+    } catch (...) {
+        close(m_fd);
+        throw;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Ask for aggressive readahead, as every pass reads it all in
+    // order.
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    size_t const entryBytes = sizeof(int) + sizeof(transfer_t);
+    size_t const blockEntries = std::max<size_t>(1, blockBytes / entryBytes);
+    int const rows = rowCount();
+    m_blockStarts.push_back(0);
+    for (int i = 0; i < rows; ) {
+        // Furthest row end within the block size, but at least one
+        // row.
+        size_t const limit = m_rowStarts[i] + blockEntries;
+        int end = std::upper_bound(m_rowStarts.begin() + i + 1,
+                                   m_rowStarts.end(), limit) -
+                  m_rowStarts.begin() - 1;
+        i = std::max(end, i + 1);
+        m_blockStarts.push_back(i);
+    }
+    prefetch(0);
+}
+
+TransferStream::~TransferStream()
+{
+    if (m_pending.valid()) {
+        // It may have failed, but there's nobody to tell.
+        try {
+            m_pending.get();
+        } catch (std::runtime_error const &) {
+        }
+    }
+    close(m_fd);
+}
+
+int TransferStream::size() const
+{
+    return m_size;
+}
+
+int TransferStream::rowCount() const
+{
+    return m_rowStarts.size() - 1;
+}
+
+size_t TransferStream::nonZeros() const
+{
+    return m_rowStarts.back();
+}
+
+void TransferStream::read(int block, Buffer &buffer) const
+{
+    int const begin = m_blockStarts[block];
+    int const end = m_blockStarts[block + 1];
+    size_t const first = m_rowStarts[begin];
+    size_t const count = m_rowStarts[end] - first;
+    buffer.rowStarts.resize(end - begin + 1);
+    for (int i = begin; i <= end; ++i) {
+        buffer.rowStarts[i - begin] = m_rowStarts[i] - first;
+    }
+    buffer.columns.resize(count);
+    buffer.values.resize(count);
+    readOrThrow(m_fd, buffer.columns.data(), count * sizeof(int),
+                m_columnsOffset + first * sizeof(int));
+    readOrThrow(m_fd, buffer.values.data(), count * sizeof(transfer_t),
+                m_valuesOffset + first * sizeof(transfer_t));
+}
+
+void TransferStream::prefetch(int block)
+{
+    m_nextBlock = block;
+    if (block + 1 < int(m_blockStarts.size())) {
+        Buffer &buffer = m_buffers[block % 2];
+        m_pending = std::async(std::launch::async, [this, block, &buffer]() {
+            read(block, buffer);
+        });
+    }
+}
+
+void TransferStream::rewind()
+{
+    if (m_pending.valid()) {
+        m_pending.get();
+    }
+    prefetch(0);
+}
+
+bool TransferStream::next(TransferMatrix &block, int &firstRow)
+{
+    if (!m_pending.valid()) {
+        return false;
+    }
+    int const current = m_nextBlock;
+    m_pending.get();
+    // The caller's done with the other buffer now.
+    prefetch(current + 1);
+
+    Buffer const &buffer = m_buffers[current % 2];
+    firstRow = m_blockStarts[current];
+    // The buffer outlives the block, so there's nothing to hold on to.
+    std::shared_ptr<void const> backing(&buffer, [](void const *) {});
+    block.attach(m_size, buffer.rowStarts.size() - 1,
+                 buffer.rowStarts.data(), buffer.columns.data(),
+                 buffer.values.data(), backing);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Sharding
+
+// The key a shard's header holds.
+static uint64_t shardKey(uint64_t key, int shard, int shards)
+{
+    uint64_t h = key;
+    int32_t const range[2] = { shard, shards };
+    hashBytes(h, range, sizeof(range));
+    return h;
+}
+
+void transferShardRows(int rows, int shard, int shards, int &begin, int &end)
+{
+    begin = static_cast<int>(static_cast<long long>(rows) * shard / shards);
+    end = static_cast<int>(static_cast<long long>(rows) * (shard + 1) / shards);
+}
+
+std::string transferShardPath(std::string const &dir, uint64_t key,
+                              int shard, int shards)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx.%d-of-%d.xfer",
+             static_cast<unsigned long long>(key), shard, shards);
+    return dir + "/" + name;
+}
+
+void saveTransferShard(std::string const &dir, uint64_t key,
+                       int shard, int shards,
+                       TransferMatrix const &transfers)
+{
+    saveTransferCache(transferShardPath(dir, key, shard, shards),
+                      shardKey(key, shard, shards), transfers);
+}
+
+bool mergeTransferShards(std::string const &dir, uint64_t key, int shards,
+                         TransferMatrix &transfers)
+{
+    if (shards <= 0) {
+        return false;
+    }
+    std::vector<TransferMatrix> parts(shards);
+    for (int s = 0; s < shards; ++s) {
+        if (!loadTransferCache(transferShardPath(dir, key, s, shards),
+                               shardKey(key, s, shards), parts[s])) {
+            return false;
+        }
+    }
+    int const size = parts[0].size();
+    for (int s = 0; s < shards; ++s) {
+        int begin, end;
+        transferShardRows(size, s, shards, begin, end);
+        if (parts[s].size() != size || parts[s].rowCount() != end - begin) {
+            return false;
+        }
+    }
+
+    // The shards are mapped, so this is the only copy made.
+    transfers.reset(size);
+    for (int s = 0; s < shards; ++s) {
+        transfers.appendRows(parts[s]);
+    }
+    return true;
+}
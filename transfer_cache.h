@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_cache.h: On-disk cache of transfer matrices, so that
+// repeat runs over the same geometry can skip the form factor
+// calculation.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_TRANSFER_CACHE_H
+#define RADIOSITY_TRANSFER_CACHE_H
+
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+#include "transfer_matrix.h"
+
+// Hash of everything the transfers depend on: vertex positions,
+// quad indices, the calculation method and its resolution, and
+// weight precision. Materials and emitters don't change the
+// transfers, so aren't included.
+uint64_t transferCacheKey(std::vector<Vertex> const &vs,
+                          std::vector<Quad> const &qs,
+                          int resolution,
+                          std::string const &method = "render");
+
+// File name for the given key, inside "dir".
+std::string transferCachePath(std::string const &dir, uint64_t key);
+
+// Memory-map the cache file, and attach "transfers" to it. Returns
+// false, leaving "transfers" alone, if the file is missing or isn't
+// a cache for "key".
+bool loadTransferCache(std::string const &path, uint64_t key,
+                       TransferMatrix &transfers);
+
+// Write the matrix out. Writes to a temporary file and renames it
+// into place, so readers never see a partial file. Throws
+// std::runtime_error on failure.
+void saveTransferCache(std::string const &path, uint64_t key,
+                       TransferMatrix const &transfers);
+
+// Reads a cache file's rows a block at a time, so that the solver
+// needn't hold the whole matrix in memory. While the caller works on
+// one block, a background thread reads the next, in large sequential
+// reads. Only the row starts are kept for the whole file.
+class TransferStream
+{
+public:
+    // Throws std::runtime_error if the file's missing, or isn't a
+    // cache for "key". Blocks are about "blockBytes" of entries, but
+    // always at least one row.
+    TransferStream(std::string const &path, uint64_t key,
+                   size_t blockBytes = 64 << 20);
+    ~TransferStream();
+
+    int size() const;
+    int rowCount() const;
+    size_t nonZeros() const;
+
+    // Go back to the first row.
+    void rewind();
+
+    // Point "block" at the next rows, with row 0 of "block" being
+    // target "firstRow". It stays valid until the next call. Returns
+    // false once all the rows have been read. Throws
+    // std::runtime_error if a read fails.
+    bool next(TransferMatrix &block, int &firstRow);
+
+private:
+    TransferStream(TransferStream const &);
+    TransferStream &operator=(TransferStream const &);
+
+    struct Buffer
+    {
+        // Row starts, relative to the block's first entry.
+        std::vector<size_t> rowStarts;
+        std::vector<int> columns;
+        std::vector<transfer_t> values;
+    };
+
+    // Read the block of rows starting at "block" into "buffer".
+    void read(int block, Buffer &buffer) const;
+    // Start reading block "block" in the background, if there is one.
+    void prefetch(int block);
+
+    int m_fd;
+    int m_size;
+    size_t m_columnsOffset;
+    size_t m_valuesOffset;
+    std::vector<size_t> m_rowStarts;
+    // Rows at which each block starts, plus the end.
+    std::vector<int> m_blockStarts;
+
+    // Block being read into m_buffers[m_nextBlock % 2].
+    int m_nextBlock;
+    std::future<void> m_pending;
+    Buffer m_buffers[2];
+};
+
+// Sharding: a big calculation can be split across processes (or
+// machines sharing the cache directory), each calculating a
+// contiguous range of rows into a shard file, which are then merged.
+
+// The rows [begin, end) of "rows" that shard "shard" of "shards"
+// covers. The shards are as even as possible, and cover every row.
+void transferShardRows(int rows, int shard, int shards, int &begin, int &end);
+
+// File name for the given shard of the transfers for "key".
+std::string transferShardPath(std::string const &dir, uint64_t key,
+                              int shard, int shards);
+
+// Write out one shard, "transfers" holding just its rows. It's in
+// the cache format, but keyed on the shard too, so it can't be loaded
+// as the whole matrix. Throws std::runtime_error on failure.
+void saveTransferShard(std::string const &dir, uint64_t key,
+                       int shard, int shards,
+                       TransferMatrix const &transfers);
+
+// Load all "shards" shards for "key" from "dir", and join them into
+// "transfers". Returns false, leaving "transfers" alone, if any is
+// missing, or they don't fit together.
+bool mergeTransferShards(std::string const &dir, uint64_t key, int shards,
+                         TransferMatrix &transfers);
+
+#endif // RADIOSITY_TRANSFER_CACHE_H
@@ -0,0 +1,230 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_cache_test.cpp: Tests for transfer_cache.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "geom.h"
+#include "ray_transfers.h"
+#include "transfer_cache.h"
+#include "transfer_matrix.h"
+
+class TransferCacheTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(TransferCacheTestCase);
+    CPPUNIT_TEST(testKey);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testWrongKey);
+    CPPUNIT_TEST(testMissing);
+    CPPUNIT_TEST(testShards);
+    CPPUNIT_TEST(testStream);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testKey();
+    void testRoundTrip();
+    void testWrongKey();
+    void testMissing();
+    void testShards();
+    void testStream();
+
+    std::string tempPath();
+    void buildMatrix(TransferMatrix &m);
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TransferCacheTestCase,
+                                      "TransferCacheTestCase");
+
+std::string TransferCacheTestCase::tempPath()
+{
+    std::ostringstream path;
+    path << "/tmp/transfer_cache_test." << getpid() << ".xfer";
+    return path.str();
+}
+
+void TransferCacheTestCase::buildMatrix(TransferMatrix &m)
+{
+    m.reset(4);
+    m.addRow({ 0.0, 0.25, 0.0, 0.5 });
+    m.addRow({ 0.0, 0.0, 0.0, 0.0 });
+    m.addRow({ 0.125, 0.25, 0.0, 0.375 });
+    m.addRow({ 1.0, 0.0, 0.0625, 0.0 });
+}
+
+void TransferCacheTestCase::testKey()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads(cubeFaces);
+    uint64_t key = transferCacheKey(vertices, quads, 256);
+    CPPUNIT_ASSERT_EQUAL(key, transferCacheKey(vertices, quads, 256));
+    CPPUNIT_ASSERT(key != transferCacheKey(vertices, quads, 128));
+    CPPUNIT_ASSERT(key != transferCacheKey(vertices, quads, 256, "ray"));
+
+    // Materials don't matter...
+    quads[0].materialColour = Colour(0.1, 0.2, 0.3);
+    quads[0].isEmitter = true;
+    CPPUNIT_ASSERT_EQUAL(key, transferCacheKey(vertices, quads, 256));
+
+    // ... but geometry does.
+    vertices[0].p[1] += 1.0e-9;
+    CPPUNIT_ASSERT(key != transferCacheKey(vertices, quads, 256));
+}
+
+void TransferCacheTestCase::testRoundTrip()
+{
+    TransferMatrix original;
+    buildMatrix(original);
+    std::string path = tempPath();
+    saveTransferCache(path, 42, original);
+
+    TransferMatrix loaded;
+    CPPUNIT_ASSERT(loadTransferCache(path, 42, loaded));
+    unlink(path.c_str());
+
+    // Still usable after the file's gone, as it's mapped.
+    CPPUNIT_ASSERT(loaded.isAttached());
+    CPPUNIT_ASSERT_EQUAL(original.size(), loaded.size());
+    CPPUNIT_ASSERT_EQUAL(original.rowCount(), loaded.rowCount());
+    CPPUNIT_ASSERT_EQUAL(original.nonZeros(), loaded.nonZeros());
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            CPPUNIT_ASSERT_EQUAL(original.at(i, j), loaded.at(i, j));
+        }
+    }
+}
+
+void TransferCacheTestCase::testWrongKey()
+{
+    TransferMatrix original;
+    buildMatrix(original);
+    std::string path = tempPath();
+    saveTransferCache(path, 42, original);
+
+    TransferMatrix loaded(7);
+    CPPUNIT_ASSERT(!loadTransferCache(path, 43, loaded));
+    unlink(path.c_str());
+    CPPUNIT_ASSERT(!loaded.isAttached());
+    CPPUNIT_ASSERT_EQUAL(7, loaded.size());
+}
+
+void TransferCacheTestCase::testMissing()
+{
+    TransferMatrix loaded;
+    CPPUNIT_ASSERT(!loadTransferCache("/nonexistent/cache.xfer", 42, loaded));
+    CPPUNIT_ASSERT_THROW(saveTransferCache("/nonexistent/cache.xfer", 42, loaded),
+                         std::runtime_error);
+}
+
+// Shards calculated separately merge back into the whole matrix.
+void TransferCacheTestCase::testShards()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 3, 3);
+    }
+    int const n = quads.size();
+    int const shards = 4;
+
+    // Every row is covered exactly once.
+    int covered = 0;
+    for (int s = 0; s < shards; ++s) {
+        int begin, end;
+        transferShardRows(n, s, shards, begin, end);
+        CPPUNIT_ASSERT_EQUAL(covered, begin);
+        covered = end;
+    }
+    CPPUNIT_ASSERT_EQUAL(n, covered);
+
+    char dirTemplate[] = "/tmp/transfer_cache_test.XXXXXX";
+    std::string const dir(mkdtemp(dirTemplate));
+    RayTransferCalculator calc(vertices, quads);
+    TransferMatrix full;
+    calc.calcAllLights(full);
+    for (int s = 0; s < shards; ++s) {
+        int begin, end;
+        transferShardRows(n, s, shards, begin, end);
+        TransferMatrix part;
+        calc.setRows(begin, end);
+        calc.calcAllLights(part);
+        saveTransferShard(dir, 42, s, shards, part);
+    }
+
+    TransferMatrix merged;
+    CPPUNIT_ASSERT(mergeTransferShards(dir, 42, shards, merged));
+    CPPUNIT_ASSERT_EQUAL(n, merged.rowCount());
+    CPPUNIT_ASSERT_EQUAL(full.nonZeros(), merged.nonZeros());
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            CPPUNIT_ASSERT_EQUAL(full.at(i, j), merged.at(i, j));
+        }
+    }
+
+    // Wrong key or split, or a shard missing.
+    TransferMatrix unmerged(5);
+    CPPUNIT_ASSERT(!mergeTransferShards(dir, 43, shards, unmerged));
+    CPPUNIT_ASSERT(!mergeTransferShards(dir, 42, shards - 1, unmerged));
+    CPPUNIT_ASSERT(!loadTransferCache(transferShardPath(dir, 42, 0, shards),
+                                      42, unmerged));
+    unlink(transferShardPath(dir, 42, 1, shards).c_str());
+    CPPUNIT_ASSERT(!mergeTransferShards(dir, 42, shards, unmerged));
+    CPPUNIT_ASSERT_EQUAL(5, unmerged.size());
+
+    for (int s = 0; s < shards; ++s) {
+        unlink(transferShardPath(dir, 42, s, shards).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+// Small blocks, so that the rows come in several, and each pass reads
+// the same.
+void TransferCacheTestCase::testStream()
+{
+    TransferMatrix original;
+    buildMatrix(original);
+    std::string path = tempPath();
+    saveTransferCache(path, 42, original);
+
+    CPPUNIT_ASSERT_THROW(TransferStream(path, 43), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(TransferStream("/nonexistent/cache.xfer", 42),
+                         std::runtime_error);
+
+    // Room for two entries per block, so the row with three gets a
+    // block to itself.
+    TransferStream stream(path, 42, 2 * (sizeof(int) + sizeof(transfer_t)));
+    unlink(path.c_str());
+    CPPUNIT_ASSERT_EQUAL(4, stream.size());
+    CPPUNIT_ASSERT_EQUAL(4, stream.rowCount());
+    CPPUNIT_ASSERT_EQUAL(original.nonZeros(), stream.nonZeros());
+    for (int pass = 0; pass < 2; ++pass) {
+        TransferMatrix block;
+        int first, expectedFirst = 0, blocks = 0;
+        while (stream.next(block, first)) {
+            CPPUNIT_ASSERT_EQUAL(expectedFirst, first);
+            CPPUNIT_ASSERT(block.rowCount() > 0);
+            for (int k = 0; k < block.rowCount(); ++k) {
+                for (int j = 0; j < 4; ++j) {
+                    CPPUNIT_ASSERT_EQUAL(original.at(first + k, j), block.at(k, j));
+                }
+            }
+            expectedFirst += block.rowCount();
+            ++blocks;
+        }
+        CPPUNIT_ASSERT_EQUAL(4, expectedFirst);
+        CPPUNIT_ASSERT_EQUAL(3, blocks);
+        stream.rewind();
+    }
+}
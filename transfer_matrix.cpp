@@ -0,0 +1,272 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_matrix.cpp: Sparse storage of the quad-to-quad light
+// transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <algorithm>
+#include <vector>
+
+#include "transfer_matrix.h"
+
+TransferMatrix::TransferMatrix(int size)
+{
+    reset(size);
+}
+
+TransferMatrix::TransferMatrix(TransferMatrix const &other)
+{
+    *this = other;
+}
+
+TransferMatrix &TransferMatrix::operator=(TransferMatrix const &other)
+{
+    // Attached data is shared, rather than copied.
+    m_size = other.m_size;
+    m_rows = other.m_rows;
+    m_rowStarts = other.m_rowStarts;
+    m_columns = other.m_columns;
+    m_values = other.m_values;
+    m_backing = other.m_backing;
+    if (m_backing) {
+        m_rowStartsPtr = other.m_rowStartsPtr;
+        m_columnsPtr = other.m_columnsPtr;
+        m_valuesPtr = other.m_valuesPtr;
+    } else {
+        sync();
+    }
+    return *this;
+}
+
+void TransferMatrix::reset(int size)
+{
+    m_size = size;
+    m_rows = 0;
+    m_rowStarts.assign(1, 0);
+    m_columns.clear();
+    m_values.clear();
+    m_backing.reset();
+    sync();
+}
+
+void TransferMatrix::addRow(std::vector<double> const &row)
+{
+    addRow(row, rowCount());
+}
+
+void TransferMatrix::addRow(std::vector<double> const &row, int target)
+{
+    detach();
+    for (int j = 0, n = row.size(); j < n; ++j) {
+        if (j != target && row[j] != 0.0) {
+            m_columns.push_back(j);
+            m_values.push_back(row[j]);
+        }
+    }
+    m_rowStarts.push_back(m_columns.size());
+    ++m_rows;
+    sync();
+}
+
+void TransferMatrix::appendRows(TransferMatrix const &other)
+{
+    detach();
+    size_t const offset = m_columns.size();
+    size_t const nnz = other.nonZeros();
+    m_columns.insert(m_columns.end(), other.m_columnsPtr, other.m_columnsPtr + nnz);
+    m_values.insert(m_values.end(), other.m_valuesPtr, other.m_valuesPtr + nnz);
+    for (int i = 0, rows = other.rowCount(); i < rows; ++i) {
+        m_rowStarts.push_back(offset + other.rowEnd(i));
+    }
+    m_rows += other.rowCount();
+    sync();
+}
+
+void TransferMatrix::attach(int size, int rows,
+                            size_t const *rowStarts,
+                            int const *columns,
+                            transfer_t const *values,
+                            std::shared_ptr<void const> const &backing)
+{
+    m_size = size;
+    m_rows = rows;
+    m_rowStarts.clear();
+    m_columns.clear();
+    m_values.clear();
+    m_rowStartsPtr = rowStarts;
+    m_columnsPtr = columns;
+    m_valuesPtr = values;
+    m_backing = backing;
+}
+
+bool TransferMatrix::isAttached() const
+{
+    return bool(m_backing);
+}
+
+void TransferMatrix::sync()
+{
+    m_rowStartsPtr = m_rowStarts.data();
+    m_columnsPtr = m_columns.data();
+    m_valuesPtr = m_values.data();
+}
+
+void TransferMatrix::detach()
+{
+    if (!m_backing) {
+        return;
+    }
+    size_t const nnz = nonZeros();
+    m_rowStarts.assign(m_rowStartsPtr, m_rowStartsPtr + m_rows + 1);
+    m_columns.assign(m_columnsPtr, m_columnsPtr + nnz);
+    m_values.assign(m_valuesPtr, m_valuesPtr + nnz);
+    m_backing.reset();
+    sync();
+}
+
+int TransferMatrix::size() const
+{
+    return m_size;
+}
+
+int TransferMatrix::rowCount() const
+{
+    return m_rows;
+}
+
+size_t TransferMatrix::nonZeros() const
+{
+    return m_rowStartsPtr[m_rows];
+}
+
+size_t TransferMatrix::memoryUsage() const
+{
+    return (m_rows + 1) * sizeof(size_t) +
+           nonZeros() * (sizeof(int) + sizeof(transfer_t));
+}
+
+double TransferMatrix::at(int i, int j) const
+{
+    int const *begin = m_columnsPtr + rowStart(i);
+    int const *end = m_columnsPtr + rowEnd(i);
+    int const *iter = std::lower_bound(begin, end, j);
+    if (iter == end || *iter != j) {
+        return 0.0;
+    }
+    return m_valuesPtr[iter - m_columnsPtr];
+}
+
+void TransferMatrix::transpose(TransferMatrix &out) const
+{
+    int const n = m_size;
+    out.reset(n);
+    out.m_rows = n;
+
+    // Count entries per column, then turn the counts into starts.
+    out.m_rowStarts.assign(n + 1, 0);
+    size_t const nnz = nonZeros();
+    for (size_t k = 0; k < nnz; ++k) {
+        ++out.m_rowStarts[m_columnsPtr[k] + 1];
+    }
+    for (int j = 0; j < n; ++j) {
+        out.m_rowStarts[j + 1] += out.m_rowStarts[j];
+    }
+
+    // Walking the rows in order keeps each output row sorted.
+    std::vector<size_t> next(out.m_rowStarts.begin(), out.m_rowStarts.end() - 1);
+    out.m_columns.resize(nnz);
+    out.m_values.resize(nnz);
+    for (int i = 0, rows = rowCount(); i < rows; ++i) {
+        for (size_t k = rowStart(i), end = rowEnd(i); k != end; ++k) {
+            size_t dst = next[m_columnsPtr[k]]++;
+            out.m_columns[dst] = i;
+            out.m_values[dst] = m_valuesPtr[k];
+        }
+    }
+    out.sync();
+}
+
+////////////////////////////////////////////////////////////////////////
+// SymmetricTransferMatrix
+
+SymmetricTransferMatrix::SymmetricTransferMatrix(int size)
+{
+    reset(std::vector<double>(size, 1.0));
+}
+
+void SymmetricTransferMatrix::reset(std::vector<double> const &areas)
+{
+    m_upper.reset(areas.size());
+    m_areas.assign(areas.begin(), areas.end());
+}
+
+void SymmetricTransferMatrix::addRow(std::vector<double> const &row)
+{
+    // The lower triangle is zeroed, rather than trusted to be.
+    int const i = rowCount();
+    std::vector<double> upper(row);
+    std::fill(upper.begin(), upper.begin() + std::min<int>(i, upper.size()), 0.0);
+    m_upper.addRow(upper);
+}
+
+int SymmetricTransferMatrix::size() const
+{
+    return m_upper.size();
+}
+
+int SymmetricTransferMatrix::rowCount() const
+{
+    return m_upper.rowCount();
+}
+
+size_t SymmetricTransferMatrix::nonZeros() const
+{
+    return m_upper.nonZeros();
+}
+
+size_t SymmetricTransferMatrix::memoryUsage() const
+{
+    return m_upper.memoryUsage() + m_areas.size() * sizeof(transfer_t);
+}
+
+double SymmetricTransferMatrix::area(int i) const
+{
+    return m_areas[i];
+}
+
+double SymmetricTransferMatrix::at(int i, int j) const
+{
+    double const kernel = i < j ? m_upper.at(i, j) : m_upper.at(j, i);
+    return kernel * m_areas[j];
+}
+
+void SymmetricTransferMatrix::expand(TransferMatrix &out) const
+{
+    int const n = size();
+    // Row "i" of the full matrix is column "i" of the upper triangle
+    // (i.e. row "i" of its transpose), followed by row "i" itself.
+    TransferMatrix lower;
+    m_upper.transpose(lower);
+    out.reset(n);
+    std::vector<double> row(n);
+    for (int i = 0; i < n; ++i) {
+        std::fill(row.begin(), row.end(), 0.0);
+        for (size_t k = lower.rowStart(i), end = lower.rowEnd(i); k != end; ++k) {
+            int j = lower.column(k);
+            row[j] = lower.value(k) * m_areas[j];
+        }
+        for (size_t k = m_upper.rowStart(i), end = m_upper.rowEnd(i);
+             k != end; ++k) {
+            int j = m_upper.column(k);
+            row[j] = m_upper.value(k) * m_areas[j];
+        }
+        out.addRow(row);
+    }
+}
+
+TransferMatrix const &SymmetricTransferMatrix::upper() const
+{
+    return m_upper;
+}
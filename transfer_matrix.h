@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_matrix.h: Sparse storage of the quad-to-quad light
+// transfers.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#ifndef RADIOSITY_TRANSFER_MATRIX_H
+#define RADIOSITY_TRANSFER_MATRIX_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "real.h"
+
+// Most of the n*n transfer weights are exactly zero (pairs facing
+// away from each other, or occluded), so we store them in compressed
+// sparse row form. Build with -DRADIOSITY_FLOAT_TRANSFERS (implied
+// by -DRADIOSITY_FLOAT, see real.h) to store the weights in single
+// precision and halve the memory again.
+#ifdef RADIOSITY_FLOAT_TRANSFERS
+typedef float transfer_t;
+#else
+typedef double transfer_t;
+#endif
+
+class TransferMatrix
+{
+public:
+    // An empty matrix of transfers between "size" quads. Rows are
+    // then added in order, one per target quad.
+    explicit TransferMatrix(int size = 0);
+    TransferMatrix(TransferMatrix const &other);
+    TransferMatrix &operator=(TransferMatrix const &other);
+
+    // Forget all rows, and set the number of quads.
+    void reset(int size);
+
+    // Append the next row, dropping zero entries. Self-transfers are
+    // never used, so the diagonal is not stored either. If the
+    // matrix is attached, the entries are copied in first.
+    void addRow(std::vector<double> const &row);
+    // As above, for when the rows don't start from target 0, e.g.
+    // for a range of rows: "target" is the column of the diagonal.
+    void addRow(std::vector<double> const &row, int target);
+
+    // Append all the rows of "other", which must be the same size,
+    // e.g. to join up matrices calculated a range of rows at a time.
+    void appendRows(TransferMatrix const &other);
+
+    // Use entries stored elsewhere (e.g. a memory-mapped file)
+    // instead of our own copy. "rowStarts" has rows + 1 entries.
+    // "backing" is held on to for as long as the data is in use.
+    void attach(int size, int rows,
+                size_t const *rowStarts,
+                int const *columns,
+                transfer_t const *values,
+                std::shared_ptr<void const> const &backing);
+    bool isAttached() const;
+
+    // Number of quads (i.e. columns).
+    int size() const;
+    // Number of rows added so far.
+    int rowCount() const;
+    // Number of non-zero entries stored.
+    size_t nonZeros() const;
+    // Approximate memory used by the entries, in bytes.
+    size_t memoryUsage() const;
+
+    // Look up the transfer to quad "i" from quad "j". Slow-ish, as
+    // it searches the row. Mostly for testing.
+    double at(int i, int j) const;
+
+    // Build the transpose, so that row "j" of "out" lists everything
+    // that quad "j" sends light to. Requires all rows to be present.
+    void transpose(TransferMatrix &out) const;
+
+    // Entries for row "i" are in the range [rowStart(i), rowEnd(i)).
+    size_t rowStart(int i) const { return m_rowStartsPtr[i]; }
+    size_t rowEnd(int i) const { return m_rowStartsPtr[i + 1]; }
+    int column(size_t k) const { return m_columnsPtr[k]; }
+    transfer_t value(size_t k) const { return m_valuesPtr[k]; }
+    // Raw arrays, for vectorised kernels and serialisation.
+    size_t const *rowStarts() const { return m_rowStartsPtr; }
+    int const *columns() const { return m_columnsPtr; }
+    transfer_t const *values() const { return m_valuesPtr; }
+
+private:
+    // Point the accessors at our own vectors.
+    void sync();
+    // Take a private copy of attached data.
+    void detach();
+
+    int m_size;
+    int m_rows;
+
+    // Owned storage, unused when attached.
+    std::vector<size_t> m_rowStarts;
+    std::vector<int> m_columns;
+    std::vector<transfer_t> m_values;
+
+    // What the accessors actually read.
+    size_t const *m_rowStartsPtr;
+    int const *m_columnsPtr;
+    transfer_t const *m_valuesPtr;
+    std::shared_ptr<void const> m_backing;
+};
+
+// Transfers that obey reciprocity, A_i F_ij = A_j F_ji, as the
+// analytic ones do. The kernel G_ij = F_ij / A_j is then symmetric,
+// so only the entries above the diagonal are stored, taking about
+// half the memory of the equivalent TransferMatrix.
+class SymmetricTransferMatrix
+{
+public:
+    // An empty matrix of transfers between "size" quads, all of area
+    // 1. Rows are then added in order.
+    explicit SymmetricTransferMatrix(int size = 0);
+
+    // Forget all rows, and set the quads' areas (and so the size).
+    void reset(std::vector<double> const &areas);
+
+    // Append the next row of the kernel, G_ij. Only the entries with
+    // j > i are read, so the rest may be left as zero.
+    void addRow(std::vector<double> const &row);
+
+    int size() const;
+    int rowCount() const;
+    // Stored entries, which cover both F_ij and F_ji.
+    size_t nonZeros() const;
+    size_t memoryUsage() const;
+
+    double area(int i) const;
+    // The transfer to quad "i" from quad "j", G_ij * A_j, as for
+    // TransferMatrix::at.
+    double at(int i, int j) const;
+
+    // Write out the full matrix, for the solvers that need rows.
+    // Requires all rows to be present.
+    void expand(TransferMatrix &out) const;
+
+    // The stored kernel: row "i" holds G_ij for j > i only.
+    TransferMatrix const &upper() const;
+
+private:
+    TransferMatrix m_upper;
+    std::vector<transfer_t> m_areas;
+};
+
+#endif // RADIOSITY_TRANSFER_MATRIX_H
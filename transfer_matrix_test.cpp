@@ -0,0 +1,209 @@
+////////////////////////////////////////////////////////////////////////
+//
+// transfer_matrix_test.cpp: Tests for transfer_matrix.cpp.
+//
+// Copyright (c) Simon Frankau 2018
+//
+
+#include <cmath>
+#include <memory>
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "transfer_matrix.h"
+
+class TransferMatrixTestCase : public CppUnit::TestCase
+{
+private:
+    CPPUNIT_TEST_SUITE(TransferMatrixTestCase);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testDropsZeros);
+    CPPUNIT_TEST(testDropsDiagonal);
+    CPPUNIT_TEST(testLookup);
+    CPPUNIT_TEST(testReset);
+    CPPUNIT_TEST(testTranspose);
+    CPPUNIT_TEST(testAttach);
+    CPPUNIT_TEST(testAppendRows);
+    CPPUNIT_TEST(testSymmetric);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testEmpty();
+    void testDropsZeros();
+    void testDropsDiagonal();
+    void testLookup();
+    void testReset();
+    void testTranspose();
+    void testAttach();
+    void testAppendRows();
+    void testSymmetric();
+};
+
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TransferMatrixTestCase,
+                                      "TransferMatrixTestCase");
+
+void TransferMatrixTestCase::testEmpty()
+{
+    TransferMatrix m(3);
+    CPPUNIT_ASSERT_EQUAL(3, m.size());
+    CPPUNIT_ASSERT_EQUAL(0, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(0), m.nonZeros());
+}
+
+void TransferMatrixTestCase::testDropsZeros()
+{
+    TransferMatrix m(3);
+    m.addRow({ 0.0, 0.0, 0.5 });
+    m.addRow({ 0.0, 0.0, 0.0 });
+    m.addRow({ 0.25, 0.75, 0.0 });
+    CPPUNIT_ASSERT_EQUAL(3, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(3), m.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(m.rowStart(1), m.rowEnd(1));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), m.rowEnd(2) - m.rowStart(2));
+    CPPUNIT_ASSERT_EQUAL(0, m.column(m.rowStart(2)));
+    CPPUNIT_ASSERT_EQUAL(1, m.column(m.rowStart(2) + 1));
+}
+
+void TransferMatrixTestCase::testDropsDiagonal()
+{
+    // The analytic calculator generates NaNs on the diagonal.
+    TransferMatrix m(2);
+    m.addRow({ NAN, 0.5 });
+    m.addRow({ 0.5, NAN });
+    CPPUNIT_ASSERT_EQUAL(size_t(2), m.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(0.0, m.at(0, 0));
+    CPPUNIT_ASSERT_EQUAL(0.0, m.at(1, 1));
+}
+
+void TransferMatrixTestCase::testLookup()
+{
+    TransferMatrix m(3);
+    m.addRow({ 0.0, 0.125, 0.5 });
+    m.addRow({ 0.0, 0.0, 0.0 });
+    m.addRow({ 0.25, 0.75, 0.0 });
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.125, m.at(0, 1), 1.0e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5,   m.at(0, 2), 1.0e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0,   m.at(1, 0), 1.0e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.25,  m.at(2, 0), 1.0e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.75,  m.at(2, 1), 1.0e-7);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0,   m.at(2, 2), 1.0e-7);
+}
+
+void TransferMatrixTestCase::testReset()
+{
+    TransferMatrix m(2);
+    m.addRow({ 0.0, 0.5 });
+    m.reset(4);
+    CPPUNIT_ASSERT_EQUAL(4, m.size());
+    CPPUNIT_ASSERT_EQUAL(0, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(0), m.nonZeros());
+}
+
+void TransferMatrixTestCase::testTranspose()
+{
+    TransferMatrix m(3);
+    m.addRow({ 0.0, 0.125, 0.5 });
+    m.addRow({ 0.0, 0.0, 0.0 });
+    m.addRow({ 0.25, 0.75, 0.0 });
+    TransferMatrix t;
+    m.transpose(t);
+    CPPUNIT_ASSERT_EQUAL(3, t.size());
+    CPPUNIT_ASSERT_EQUAL(3, t.rowCount());
+    CPPUNIT_ASSERT_EQUAL(m.nonZeros(), t.nonZeros());
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            CPPUNIT_ASSERT_EQUAL(m.at(i, j), t.at(j, i));
+        }
+    }
+}
+
+void TransferMatrixTestCase::testAttach()
+{
+    // Four quads, but only the first three rows: entries (0, 2) and
+    // (2, 1).
+    static size_t const rowStarts[] = { 0, 1, 1, 2 };
+    static int const columns[] = { 2, 1 };
+    static transfer_t const values[] = { 0.5, 0.25 };
+    std::shared_ptr<void const> backing(rowStarts, [](void const *) {});
+
+    TransferMatrix m;
+    m.attach(4, 3, rowStarts, columns, values, backing);
+    CPPUNIT_ASSERT(m.isAttached());
+    CPPUNIT_ASSERT_EQUAL(4, m.size());
+    CPPUNIT_ASSERT_EQUAL(3, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(2), m.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(0.5, m.at(0, 2));
+    CPPUNIT_ASSERT_EQUAL(0.25, m.at(2, 1));
+
+    // Copies share the data.
+    TransferMatrix copy(m);
+    CPPUNIT_ASSERT(copy.isAttached());
+    CPPUNIT_ASSERT_EQUAL(m.values(), copy.values());
+
+    // Adding a row takes a private copy first.
+    copy.addRow({ 0.75, 0.0, 0.0, 0.0 });
+    CPPUNIT_ASSERT(!copy.isAttached());
+    CPPUNIT_ASSERT_EQUAL(4, copy.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(3), copy.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(0.25, copy.at(2, 1));
+    CPPUNIT_ASSERT_EQUAL(0.75, copy.at(3, 0));
+    CPPUNIT_ASSERT(m.isAttached());
+
+    m.reset(2);
+    CPPUNIT_ASSERT(!m.isAttached());
+    CPPUNIT_ASSERT_EQUAL(0, m.rowCount());
+}
+
+void TransferMatrixTestCase::testAppendRows()
+{
+    TransferMatrix a(3);
+    a.addRow({ 0.0, 0.125, 0.5 });
+    // Rows 1 and 2, added as if they were calculated separately.
+    TransferMatrix b(3);
+    b.addRow({ 0.0, 0.0, 0.0 }, 1);
+    b.addRow({ 0.25, 0.75, 0.0 }, 2);
+
+    TransferMatrix m(3);
+    m.appendRows(a);
+    m.appendRows(b);
+    CPPUNIT_ASSERT_EQUAL(3, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(4), m.nonZeros());
+    CPPUNIT_ASSERT_EQUAL(0.125, m.at(0, 1));
+    CPPUNIT_ASSERT_EQUAL(0.5, m.at(0, 2));
+    CPPUNIT_ASSERT_EQUAL(0.0, m.at(1, 0));
+    CPPUNIT_ASSERT_EQUAL(0.25, m.at(2, 0));
+    CPPUNIT_ASSERT_EQUAL(0.75, m.at(2, 1));
+}
+
+void TransferMatrixTestCase::testSymmetric()
+{
+    SymmetricTransferMatrix m;
+    m.reset({ 1.0, 2.0, 4.0 });
+    // The lower triangle and diagonal are ignored.
+    m.addRow({ 9.0, 0.125, 0.25 });
+    m.addRow({ 9.0, 9.0, 0.5 });
+    m.addRow({ 9.0, 9.0, 9.0 });
+    CPPUNIT_ASSERT_EQUAL(3, m.size());
+    CPPUNIT_ASSERT_EQUAL(3, m.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(3), m.nonZeros());
+
+    // A_i F_ij = A_j F_ji.
+    CPPUNIT_ASSERT_EQUAL(0.25, m.at(0, 1));
+    CPPUNIT_ASSERT_EQUAL(0.125, m.at(1, 0));
+    CPPUNIT_ASSERT_EQUAL(1.0, m.at(0, 2));
+    CPPUNIT_ASSERT_EQUAL(0.25, m.at(2, 0));
+    CPPUNIT_ASSERT_EQUAL(2.0, m.at(1, 2));
+    CPPUNIT_ASSERT_EQUAL(1.0, m.at(2, 1));
+    CPPUNIT_ASSERT_EQUAL(0.0, m.at(1, 1));
+
+    TransferMatrix full;
+    m.expand(full);
+    CPPUNIT_ASSERT_EQUAL(3, full.rowCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(6), full.nonZeros());
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            CPPUNIT_ASSERT_EQUAL(m.at(i, j), full.at(i, j));
+        }
+    }
+    CPPUNIT_ASSERT(m.memoryUsage() < full.memoryUsage());
+}
@@ -9,18 +9,25 @@
 // Copyright (c) Simon Frankau 2018
 //
 
+// Needed for framebuffer and pixel buffer objects outside MacOS.
+#define GL_GLEXT_PROTOTYPES
+
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
 #include <GL/glut.h>
 #endif
 
+#include <algorithm>
 #include <cmath>
-#include <iostream>
+#include <stdexcept>
 #include <vector>
 
 #include "geom.h"
 #include "glut_wrap.h"
+#include "profile.h"
+#include "progress.h"
+#include "quad_buffer.h"
 #include "transfers.h"
 #include "weighting.h"
 
@@ -73,50 +80,94 @@ static void viewDown(void)
 RenderTransferCalculator::RenderTransferCalculator(
     std::vector<Vertex> const &vertices,
     std::vector<Quad> const &faces,
-    int resolution)
+    int resolution,
+    TransferReadback readback)
     : m_vertices(vertices),
       m_faces(faces),
       m_resolution(resolution),
-      m_win(gwTransferSetup(resolution))
+      m_win(gwTransferSetup(resolution)),
+      m_readback(readback),
+      m_framebuffer(0),
+      m_atlasTexture(0),
+      m_depthBuffer(0),
+      m_pixelBuffers { 0, 0 },
+      m_reduceProgram(0),
+      m_reduceVertices(0),
+      m_sumsFramebuffer(0),
+      m_sumsTexture(0),
+      m_sumsWidth(0),
+      m_sumsHeight(0),
+      m_minResolution(0),
+      m_tolerance(0.0),
+      m_rowBegin(0),
+      m_rowEnd(faces.size())
 {
+    m_quadBuffer.setIndexQuads(m_faces, m_vertices);
+    if (m_readback != READBACK_WINDOW) {
+        initAtlas();
+    }
+    if (m_readback == READBACK_GPU_REDUCE) {
+        initReduction();
+    }
 }
 
 RenderTransferCalculator::~RenderTransferCalculator()
 {
-    glutDestroyWindow(m_win);
+    if (m_readback == READBACK_GPU_REDUCE) {
+        glDeleteTextures(1, &m_sumsTexture);
+        glDeleteFramebuffers(1, &m_sumsFramebuffer);
+        glDeleteBuffers(1, &m_reduceVertices);
+        glDeleteProgram(m_reduceProgram);
+    }
+    if (m_readback != READBACK_WINDOW) {
+        glDeleteBuffers(2, m_pixelBuffers);
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+        glDeleteTextures(1, &m_atlasTexture);
+        glDeleteFramebuffers(1, &m_framebuffer);
+    }
+    m_quadBuffer.clear();
+    gwTransferTeardown(m_win);
 }
 
 // Extremely simple rendering of the scene.
 void RenderTransferCalculator::render(void)
 {
-    for (int i = 0, n = m_faces.size(); i < n; ++i) {
-        m_faces[i].renderIndex(i + 1, m_vertices);
-    }
+    m_quadBuffer.draw();
 }
 
 static const int NUM_CHANS = 4;
 
-// Sum up value of the pixels, with the given weights.
-void RenderTransferCalculator::sumWeights(std::vector<double> const &weights)
+// Add the weights for each pixel to the sum for the quad it shows.
+void RenderTransferCalculator::accumulate(GLubyte const *pixels,
+                                          std::vector<real_t> const &weights)
 {
-    std::vector<GLubyte> pixels(NUM_CHANS * weights.size());
-    glReadPixels(0, 0, m_resolution, weights.size() / m_resolution,
-                 GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
-
-    for (int i = 0, n = pixels.size(); i < n; i += NUM_CHANS) {
-        // We're not using that many polys, so skip the low bits.
-        int index = (pixels[i] + (pixels[i+1] << 6) + (pixels[i+2] << 12)) >> 2;
+    PROFILE_SCOPE("accumulate");
+    PROFILE_COUNT("pixels decoded", weights.size());
+    for (int i = 0, n = NUM_CHANS * weights.size(); i < n; i += NUM_CHANS) {
+        unsigned index = decodeIndex(pixels + i);
         if (index > 0) {
             m_sums[index - 1] += weights[i/4];
         }
     }
 }
 
+// Sum up value of the pixels, with the given weights.
+void RenderTransferCalculator::sumWeights(std::vector<real_t> const &weights)
+{
+    std::vector<GLubyte> pixels(NUM_CHANS * weights.size());
+    {
+        PROFILE_SCOPE("glReadPixels");
+        glReadPixels(0, 0, m_resolution, weights.size() / m_resolution,
+                     GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    }
+    accumulate(&pixels[0], weights);
+}
+
 // Work out contributions from the given face.
 void RenderTransferCalculator::calcFace(
     Camera const &cam,
     viewFn_t view,
-    std::vector<double> const &weights)
+    std::vector<real_t> const &weights)
 {
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -134,7 +185,7 @@ std::vector<double> RenderTransferCalculator::calcSubtended(Camera const &cam)
     m_sums.clear();
     m_sums.resize(m_faces.size());
 
-    std::vector<double> const &ws = getSubtendWeights();
+    std::vector<real_t> const &ws = getSubtendWeights();
 
     calcFace(cam, viewFront, ws);
     calcFace(cam, viewBack,  ws);
@@ -152,8 +203,15 @@ std::vector<double> RenderTransferCalculator::calcLight(Camera const &cam)
     m_sums.clear();
     m_sums.resize(m_faces.size());
 
-    std::vector<double> const &fws = getForwardLightWeights();
-    std::vector<double> const &sws = getSideLightWeights();
+    if (m_readback != READBACK_WINDOW) {
+        renderAtlas(cam, m_resolution);
+        startReadback(m_pixelBuffers[0], m_resolution);
+        finishReadback(m_pixelBuffers[0], m_resolution);
+        return m_sums;
+    }
+
+    std::vector<real_t> const &fws = getForwardLightWeights();
+    std::vector<real_t> const &sws = getSideLightWeights();
 
     calcFace(cam, viewFront, fws);
     // Avoid rendering things we don't need to. Doesn't seem to
@@ -172,7 +230,7 @@ std::vector<double> RenderTransferCalculator::calcLight(Camera const &cam)
     return m_sums;
 }
 
-std::vector<double> const &RenderTransferCalculator::getSubtendWeights()
+std::vector<real_t> const &RenderTransferCalculator::getSubtendWeights()
 {
     if (m_subtendWeights.empty()) {
         calcSubtendWeights(m_resolution, m_subtendWeights);
@@ -180,7 +238,7 @@ std::vector<double> const &RenderTransferCalculator::getSubtendWeights()
     return m_subtendWeights;
 }
 
-std::vector<double> const &RenderTransferCalculator::getForwardLightWeights()
+std::vector<real_t> const &RenderTransferCalculator::getForwardLightWeights()
 {
     if (m_forwardLightWeights.empty()) {
         calcForwardLightWeights(m_resolution, m_forwardLightWeights);
@@ -188,7 +246,7 @@ std::vector<double> const &RenderTransferCalculator::getForwardLightWeights()
     return m_forwardLightWeights;
 }
 
-std::vector<double> const &RenderTransferCalculator::getSideLightWeights()
+std::vector<real_t> const &RenderTransferCalculator::getSideLightWeights()
 {
     if (m_sideLightWeights.empty()) {
         calcSideLightWeights(m_resolution, m_sideLightWeights);
@@ -196,27 +254,541 @@ std::vector<double> const &RenderTransferCalculator::getSideLightWeights()
     return m_sideLightWeights;
 }
 
+////////////////////////////////////////////////////////////////////////
+// Offscreen atlas rendering.
+//
+// The atlas is m_resolution wide. The forward-facing view takes up
+// the bottom m_resolution rows, and each of the four sideways views
+// is stacked above it, taking m_resolution / 2 rows each. Laid out
+// like this, a single glReadPixels gets the whole hemicube, in the
+// same order as the atlas weights. Lower resolution hemicubes are
+// laid out the same way, in the bottom-left corner.
+
+static int atlasHeight(int resolution)
+{
+    return resolution + 4 * (resolution / 2);
+}
+
+void RenderTransferCalculator::initAtlas(void)
+{
+    int const height = atlasHeight(m_resolution);
+
+    glGenTextures(1, &m_atlasTexture);
+    glBindTexture(GL_TEXTURE_2D, m_atlasTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_resolution, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+                          m_resolution, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, m_atlasTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, m_depthBuffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Transfer atlas framebuffer incomplete");
+    }
+
+    glGenBuffers(2, m_pixelBuffers);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER,
+                     NUM_CHANS * m_resolution * height, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+std::vector<real_t> const &RenderTransferCalculator::getAtlasWeights(
+    int resolution)
+{
+    std::vector<real_t> &weights = m_atlasWeights[resolution];
+    if (weights.empty()) {
+        if (resolution == m_resolution) {
+            weights = getForwardLightWeights();
+        } else {
+            calcForwardLightWeights(resolution, weights);
+        }
+        std::vector<real_t> sideWeights;
+        if (resolution == m_resolution) {
+            sideWeights = getSideLightWeights();
+        } else {
+            calcSideLightWeights(resolution, sideWeights);
+        }
+        for (int i = 0; i < 4; ++i) {
+            weights.insert(weights.end(), sideWeights.begin(), sideWeights.end());
+        }
+    }
+    return weights;
+}
+
+// Render one view into the rows [y, y + height) of the atlas. The
+// viewport is a full face, with the scissor trimming off the half of
+// the sideways views we don't need.
+void RenderTransferCalculator::calcAtlasFace(Camera const &cam,
+                                             viewFn_t view,
+                                             int resolution,
+                                             int y, int height)
+{
+    glViewport(0, y, resolution, resolution);
+    glScissor(0, y, resolution, height);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    view();
+    cam.applyViewTransform();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    render();
+}
+
+void RenderTransferCalculator::renderAtlas(Camera const &cam, int resolution)
+{
+    PROFILE_SCOPE("renderAtlas");
+    int const r = resolution;
+    int const half = r / 2;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glEnable(GL_SCISSOR_TEST);
+    calcAtlasFace(cam, viewFront, r, 0, r);
+    calcAtlasFace(cam, viewRight, r, r,            half);
+    calcAtlasFace(cam, viewLeft,  r, r + half,     half);
+    calcAtlasFace(cam, viewUp,    r, r + half * 2, half);
+    calcAtlasFace(cam, viewDown,  r, r + half * 3, half);
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(0, 0, m_resolution, m_resolution);
+}
+
+// Start an asynchronous copy of the atlas into the pixel buffer.
+void RenderTransferCalculator::readAtlas(GLuint pixelBuffer, int resolution)
+{
+    PROFILE_SCOPE("glReadPixels");
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    glReadPixels(0, 0, resolution, atlasHeight(resolution),
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+}
+
+// Wait for the copy into the pixel buffer, and sum it up into m_sums.
+void RenderTransferCalculator::sumAtlas(GLuint pixelBuffer, int resolution)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    GLubyte const *pixels;
+    {
+        // Waits for the copy to finish.
+        PROFILE_SCOPE("glMapBuffer");
+        pixels = static_cast<GLubyte const *>(
+            glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    }
+    if (pixels == NULL) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw std::runtime_error("Couldn't map transfer pixel buffer");
+    }
+    accumulate(pixels, getAtlasWeights(resolution));
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// The GPU reduction is only set up for the full resolution.
+void RenderTransferCalculator::startReadback(GLuint pixelBuffer,
+                                             int resolution)
+{
+    if (m_readback == READBACK_GPU_REDUCE) {
+        reduceAtlas(pixelBuffer);
+    } else {
+        readAtlas(pixelBuffer, resolution);
+    }
+}
+
+void RenderTransferCalculator::finishReadback(GLuint pixelBuffer,
+                                              int resolution)
+{
+    if (m_readback == READBACK_GPU_REDUCE) {
+        readSums(pixelBuffer);
+    } else {
+        sumAtlas(pixelBuffer, resolution);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// On-GPU reduction of the atlas.
+//
+// We draw one point per atlas pixel. The vertex shader looks up the
+// pixel, decodes the quad index, and moves the point onto that quad's
+// texel in the sums buffer. The fragment shader outputs the pixel's
+// weight, and additive blending does the scatter-add. This only needs
+// GLSL 1.20 and vertex texture fetch, so it works on legacy contexts
+// where compute shaders aren't available.
+
+// Sums buffer width. A power of two, so the division in the shader
+// is exact.
+static int const SUMS_WIDTH = 1024;
+
+static char const *const REDUCE_VERTEX_SHADER =
+    "#version 120\n"
+    "uniform sampler2D atlas;\n"
+    "uniform vec2 sumsSize;\n"
+    "attribute vec2 texel;\n"
+    "attribute float weight;\n"
+    "varying float pixelWeight;\n"
+    "void main() {\n"
+    "    // Undo encodeIndex. Floats are only exact to 24 bits, so\n"
+    "    // alpha is ignored, and initReduction checks it's unused.\n"
+    "    vec3 c = floor(texture2DLod(atlas, texel, 0.0).rgb * 255.0 + 0.5);\n"
+    "    float index = c.r + c.g * 256.0 + c.b * 65536.0;\n"
+    "    float slot = index - 1.0;\n"
+    "    float y = floor(slot / sumsSize.x);\n"
+    "    float x = slot - y * sumsSize.x;\n"
+    "    pixelWeight = weight;\n"
+    "    if (index < 0.5) {\n"
+    "        // Background. Put the point outside the clip volume.\n"
+    "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "    } else {\n"
+    "        gl_Position = vec4((x + 0.5) / sumsSize.x * 2.0 - 1.0,\n"
+    "                           (y + 0.5) / sumsSize.y * 2.0 - 1.0,\n"
+    "                           0.0, 1.0);\n"
+    "    }\n"
+    "}\n";
+
+static char const *const REDUCE_FRAGMENT_SHADER =
+    "#version 120\n"
+    "varying float pixelWeight;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(pixelWeight);\n"
+    "}\n";
+
+void RenderTransferCalculator::initReduction(void)
+{
+    int const height = atlasHeight(m_resolution);
+    int const n = m_faces.size();
+    // The shader decodes indices in floating point.
+    if (n >= (1 << 24)) {
+        throw std::runtime_error("Too many quads for GPU transfer reduction");
+    }
+
+    m_reduceProgram = gwCompileProgram(REDUCE_VERTEX_SHADER,
+                                       REDUCE_FRAGMENT_SHADER,
+                                       { "texel", "weight" });
+
+    // One vertex per atlas pixel: texture coordinates, then weight.
+    // The weight tables are uploaded once, here.
+    std::vector<real_t> const &atlasWeights = getAtlasWeights(m_resolution);
+    std::vector<GLfloat> attribs;
+    attribs.reserve(3 * m_resolution * height);
+    for (int i = 0, size = atlasWeights.size(); i < size; ++i) {
+        int x = i % m_resolution, y = i / m_resolution;
+        attribs.push_back((x + 0.5f) / m_resolution);
+        attribs.push_back((y + 0.5f) / height);
+        attribs.push_back(atlasWeights[i]);
+    }
+    glGenBuffers(1, &m_reduceVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, m_reduceVertices);
+    glBufferData(GL_ARRAY_BUFFER, attribs.size() * sizeof(GLfloat),
+                 &attribs[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Float buffer with a texel per quad.
+    m_sumsWidth = std::min(n, SUMS_WIDTH);
+    m_sumsHeight = (n + SUMS_WIDTH - 1) / SUMS_WIDTH;
+    // Keep the width a power of two if we wrap.
+    if (m_sumsHeight > 1) {
+        m_sumsWidth = SUMS_WIDTH;
+    }
+    glGenTextures(1, &m_sumsTexture);
+    glBindTexture(GL_TEXTURE_2D, m_sumsTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_sumsWidth, m_sumsHeight, 0,
+                 GL_RGBA, GL_FLOAT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &m_sumsFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_sumsFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, m_sumsTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Transfer sums framebuffer incomplete");
+    }
+
+    // Make sure the pixel buffers can hold a row of float sums, as
+    // well as the atlas.
+    int const atlasBytes = NUM_CHANS * m_resolution * height;
+    int const sumsBytes = sizeof(GLfloat) * m_sumsWidth * m_sumsHeight;
+    if (sumsBytes > atlasBytes) {
+        for (int i = 0; i < 2; ++i) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, sumsBytes, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+// Scatter-add the atlas into the sums buffer, and start reading the
+// result back into the pixel buffer.
+void RenderTransferCalculator::reduceAtlas(GLuint pixelBuffer)
+{
+    int const height = atlasHeight(m_resolution);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_sumsFramebuffer);
+    glViewport(0, 0, m_sumsWidth, m_sumsHeight);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glPushAttrib(GL_ENABLE_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glUseProgram(m_reduceProgram);
+    glUniform1i(glGetUniformLocation(m_reduceProgram, "atlas"), 0);
+    glUniform2f(glGetUniformLocation(m_reduceProgram, "sumsSize"),
+                m_sumsWidth, m_sumsHeight);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_atlasTexture);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_reduceVertices);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
+                          reinterpret_cast<GLvoid const *>(0));
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
+                          reinterpret_cast<GLvoid const *>(2 * sizeof(GLfloat)));
+    glDrawArrays(GL_POINTS, 0, m_resolution * height);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glPopAttrib();
+
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    glReadPixels(0, 0, m_sumsWidth, m_sumsHeight, GL_RED, GL_FLOAT, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glViewport(0, 0, m_resolution, m_resolution);
+}
+
+// Wait for the sums to arrive in the pixel buffer, and copy them into
+// m_sums.
+void RenderTransferCalculator::readSums(GLuint pixelBuffer)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    GLfloat const *sums;
+    {
+        PROFILE_SCOPE("glMapBuffer");
+        sums = static_cast<GLfloat const *>(
+            glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    }
+    if (sums == NULL) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw std::runtime_error("Couldn't map transfer pixel buffer");
+    }
+    m_sums.assign(sums, sums + m_faces.size());
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Camera sitting at the centre of a quad, looking out of its face.
+static Camera quadCamera(Quad const &q, std::vector<Vertex> const &vs)
+{
+    Vertex eye(paraCentre(q, vs)); // Gives centre of the quad
+    Vertex dir(paraCross(q, vs)); // Gives normal to the quad
+    Vertex lookAt(eye - dir);
+    Vertex up(dir.perp());
+    return Camera(eye, lookAt, up);
+}
+
+// Calculate the light for each target quad in the row range in turn,
+// passing each row of weights to "addRow".
+void RenderTransferCalculator::calcAllRows(rowFn_t const &addRow)
+{
+    PROFILE_SCOPE("calcAllRows");
+    int const n = m_faces.size();
+    int const begin = m_rowBegin;
+    int const rows = m_rowEnd - m_rowBegin;
+    ProgressTracker tracker(rows, m_progress);
+
+    if (m_readback == READBACK_WINDOW) {
+        // Iterate over targets
+        for (int i = begin; i < m_rowEnd; ++i) {
+            addRow(calcLight(quadCamera(m_faces[i], m_vertices)));
+            tracker.rowDone();
+        }
+        return;
+    }
+
+    if (m_minResolution > 0) {
+        chooseResolutions();
+    } else {
+        m_rowResolutions.assign(rows, m_resolution);
+    }
+
+    // Software-pipelined: render and start reading back row k, then
+    // sum up row k - 1 while that happens.
+    for (int k = 0; k <= rows; ++k) {
+        if (k < rows) {
+            renderAtlas(quadCamera(m_faces[begin + k], m_vertices),
+                        m_rowResolutions[k]);
+            startReadback(m_pixelBuffers[k % 2], m_rowResolutions[k]);
+        }
+        if (k > 0) {
+            m_sums.clear();
+            m_sums.resize(n);
+            finishReadback(m_pixelBuffers[(k - 1) % 2], m_rowResolutions[k - 1]);
+            addRow(m_sums);
+            tracker.rowDone();
+        }
+    }
+}
+
+void RenderTransferCalculator::setRows(int begin, int end)
+{
+    if (begin < 0 || begin > end || end > int(m_faces.size())) {
+        throw std::runtime_error("Transfer rows out of range");
+    }
+    m_rowBegin = begin;
+    m_rowEnd = end;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Adaptive resolution.
+
+void RenderTransferCalculator::setAdaptive(int minResolution, double tolerance)
+{
+    if (m_readback != READBACK_ATLAS) {
+        throw std::runtime_error("Adaptive resolution needs READBACK_ATLAS");
+    }
+    // Halving the full resolution must reach the minimum, and the
+    // coarse pass needs twice the minimum.
+    int r = m_resolution;
+    while (r > minResolution && r % 2 == 0) {
+        r /= 2;
+    }
+    if (minResolution <= 0 || r != minResolution ||
+        2 * minResolution > m_resolution) {
+        throw std::runtime_error("Adaptive resolution must be a power of two "
+                                 "fraction of the resolution");
+    }
+    m_minResolution = minResolution;
+    m_tolerance = tolerance;
+}
+
+std::vector<int> const &RenderTransferCalculator::rowResolutions() const
+{
+    return m_rowResolutions;
+}
+
+// Estimate the error at resolution r0 of the row in "pixels", an
+// atlas at 2 * r0, as the difference between summing all of it, and
+// just every other pixel in each direction, as if rendered at r0.
+// Every part of the atlas is half the size at r0, so the pixel at
+// (x, y) in r0's layout is at (2x, 2y). Returns it relative to the
+// row's total.
+double RenderTransferCalculator::coarseError(GLubyte const *pixels, int r0)
+{
+    std::vector<real_t> const &fineWeights = getAtlasWeights(2 * r0);
+    std::vector<real_t> const &coarseWeights = getAtlasWeights(r0);
+    int const n = m_faces.size();
+    m_sums.assign(n, 0.0);
+    m_coarseSums.assign(n, 0.0);
+    for (int i = 0, size = fineWeights.size(); i < size; ++i) {
+        unsigned index = decodeIndex(pixels + NUM_CHANS * i);
+        if (index > 0) {
+            m_sums[index - 1] += fineWeights[i];
+        }
+    }
+    for (int i = 0, size = coarseWeights.size(); i < size; ++i) {
+        int const x = i % r0, y = i / r0;
+        unsigned index = decodeIndex(pixels + NUM_CHANS * (4 * r0 * y + 2 * x));
+        if (index > 0) {
+            m_coarseSums[index - 1] += coarseWeights[i];
+        }
+    }
+    double diff = 0.0, total = 0.0;
+    for (int j = 0; j < n; ++j) {
+        diff += std::fabs(m_sums[j] - m_coarseSums[j]);
+        total += m_sums[j];
+    }
+    return total > 0.0 ? diff / total : 0.0;
+}
+
+// Fill in m_rowResolutions from a pass at twice the minimum
+// resolution, pipelined like calcAllRows.
+void RenderTransferCalculator::chooseResolutions(void)
+{
+    PROFILE_SCOPE("chooseResolutions");
+    int const rows = m_rowEnd - m_rowBegin;
+    int const r0 = m_minResolution;
+    m_rowResolutions.resize(rows);
+    for (int k = 0; k <= rows; ++k) {
+        if (k < rows) {
+            renderAtlas(quadCamera(m_faces[m_rowBegin + k], m_vertices), 2 * r0);
+            readAtlas(m_pixelBuffers[k % 2], 2 * r0);
+        }
+        if (k > 0) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[(k - 1) % 2]);
+            GLubyte const *pixels = static_cast<GLubyte const *>(
+                glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+            if (pixels == NULL) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                throw std::runtime_error("Couldn't map transfer pixel buffer");
+            }
+            double const error = coarseError(pixels, r0);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            int r = 2 * r0;
+            while (r < m_resolution && error * r0 / r > m_tolerance) {
+                r *= 2;
+            }
+            m_rowResolutions[k - 1] = r;
+            PROFILE_COUNT("adaptive pixels", r * atlasHeight(r));
+        }
+    }
+}
+
+void RenderTransferCalculator::setProgress(transferProgressFn_t const &progress)
+{
+    m_progress = progress;
+}
+
 void RenderTransferCalculator::calcAllLights(std::vector<double> &weights)
 {
     int const n = m_faces.size();
     weights.clear();
-    weights.reserve(n * n);
+    weights.reserve((m_rowEnd - m_rowBegin) * n);
 
-    // Iterate over targets
-    for (int i = 0; i < n; ++i) {
-        Quad currQuad = m_faces[i];
-        Vertex eye(paraCentre(currQuad, m_vertices)); // Gives centre of the quad
-        Vertex dir(paraCross(currQuad, m_vertices)); // Gives normal to the quad
-        Vertex lookAt(eye - dir);
-        Vertex up(dir.perp());
-        Camera cam(eye, lookAt, up);
+    calcAllRows([&weights](std::vector<double> const &row) {
+        weights.insert(weights.end(), row.begin(), row.end());
+    });
+}
 
-        std::vector<double> faceWeights = calcLight(cam);
-        weights.insert(weights.end(), faceWeights.begin(), faceWeights.end());
-        // Somewhat slow, so print progress.
-        std::cerr << ".";
-    }
-    std::cerr << std::endl;
+void RenderTransferCalculator::calcAllLights(TransferMatrix &transfers)
+{
+    transfers.reset(m_faces.size());
+
+    // Compress each row as it's finished.
+    int target = m_rowBegin;
+    calcAllRows([&transfers, &target](std::vector<double> const &row) {
+        transfers.addRow(row, target++);
+    });
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -267,6 +839,7 @@ void AnalyticTransferCalculator::calcAllLights(std::vector<double> &weights)
     weights.clear();
     weights.reserve(n * n);
     Vertex up(0.0, 0.0, 0.0);
+    ProgressTracker tracker(n, m_progress);
 
     // Iterate over targets
     for (int i = 0; i < n; ++i) {
@@ -279,9 +852,62 @@ void AnalyticTransferCalculator::calcAllLights(std::vector<double> &weights)
         for (int j = 0; j < n; ++j) {
             weights.push_back(calcSingleQuadLight(cam, m_faces[j]));
         }
+        tracker.rowDone();
     }
 }
 
+void AnalyticTransferCalculator::calcAllLights(TransferMatrix &transfers)
+{
+    int const n = m_faces.size();
+    transfers.reset(n);
+    Vertex up(0.0, 0.0, 0.0);
+    ProgressTracker tracker(n, m_progress);
+
+    // Iterate over targets
+    for (int i = 0; i < n; ++i) {
+        Quad currQuad = m_faces[i];
+        Vertex eye(paraCentre(currQuad, m_vertices));
+        Vertex lookAt(eye - paraCross(currQuad, m_vertices));
+        transfers.addRow(calcLight(Camera(eye, lookAt, up)));
+        tracker.rowDone();
+    }
+}
+
+void AnalyticTransferCalculator::calcAllLights(
+    SymmetricTransferMatrix &transfers)
+{
+    int const n = m_faces.size();
+    std::vector<double> areas(n);
+    for (int i = 0; i < n; ++i) {
+        areas[i] = paraArea(m_faces[i], m_vertices);
+    }
+    transfers.reset(areas);
+    Vertex up(0.0, 0.0, 0.0);
+    ProgressTracker tracker(n, m_progress);
+
+    // Iterate over targets, and only the sources after them. The
+    // transfer is proportional to the source's area, so dividing it
+    // out leaves the symmetric kernel.
+    std::vector<double> row(n);
+    for (int i = 0; i < n; ++i) {
+        Quad currQuad = m_faces[i];
+        Vertex eye(paraCentre(currQuad, m_vertices));
+        Vertex lookAt(eye - paraCross(currQuad, m_vertices));
+        Camera cam(eye, lookAt, up);
+        for (int j = i + 1; j < n; ++j) {
+            row[j] = areas[j] == 0.0 ? 0.0 :
+                calcSingleQuadLight(cam, m_faces[j]) / areas[j];
+        }
+        transfers.addRow(row);
+        tracker.rowDone();
+    }
+}
+
+void AnalyticTransferCalculator::setProgress(transferProgressFn_t const &progress)
+{
+    m_progress = progress;
+}
+
 std::vector<double> AnalyticTransferCalculator::calcLight(
     Camera const &cam)
 {
@@ -9,6 +9,29 @@
 #ifndef RADIOSITY_TRANSFERS_H
 #define RADIOSITY_TRANSFERS_H
 
+#include "progress.h"
+#include "quad_buffer.h"
+#include "transfer_matrix.h"
+
+#include <functional>
+#include <map>
+#include <vector>
+
+// How rendered hemicubes get from the GPU back to us.
+enum TransferReadback {
+    // Render each face into the window, and read it back straight
+    // away. Simple, but stalls the pipeline five times per quad.
+    READBACK_WINDOW,
+    // Render all five faces of a hemicube into one offscreen atlas,
+    // and read it back through double-buffered pixel buffer objects,
+    // so that the next quad renders while we sum up this one.
+    READBACK_ATLAS,
+    // Like READBACK_ATLAS, but a shader decodes and weights the atlas
+    // pixels, scatter-adding them into a float buffer with one texel
+    // per quad. Only that row of sums is read back.
+    READBACK_GPU_REDUCE
+};
+
 // This class holds all the state that stays the same as we repeatedly
 // render the scene from different views to calculate the light
 // transfers.
@@ -17,7 +40,8 @@ class RenderTransferCalculator
 public:
     RenderTransferCalculator(std::vector<Vertex> const &vertices,
                              std::vector<Quad> const &faces,
-                             int resolution);
+                             int resolution,
+                             TransferReadback readback = READBACK_WINDOW);
 
     virtual ~RenderTransferCalculator();
 
@@ -26,38 +50,122 @@ public:
     std::vector<double> calcSubtended(Camera const &cam);
     std::vector<double> calcLight(Camera const &cam);
     // Calculate the light for all polys, as if we have a camera at
-    // each poly.
+    // each poly. The dense form stores all n*n weights, the sparse
+    // form builds the matrix a row at a time, dropping zeros.
     void calcAllLights(std::vector<double> &weights);
+    void calcAllLights(TransferMatrix &transfers);
+
+    // Called after each row of calcAllLights, which throws
+    // TransferCancelled if it returns false.
+    void setProgress(transferProgressFn_t const &progress);
+
+    // Have calcAllLights pick a hemicube resolution for each row,
+    // from the full resolution halved down to "minResolution". A
+    // quick pass at minResolution and twice that estimates each
+    // row's error, and the row then uses the lowest resolution
+    // predicted to be within "tolerance" of the row's total,
+    // assuming the error falls as 1/resolution. Only for
+    // READBACK_ATLAS; throws std::runtime_error otherwise.
+    void setAdaptive(int minResolution, double tolerance);
+    // The resolution each row of the last calcAllLights used.
+    std::vector<int> const &rowResolutions() const;
+
+    // Only calculate the rows for targets [begin, end), e.g. for one
+    // shard of a distributed run. calcAllLights then produces just
+    // those rows, in order. Throws std::runtime_error if the range
+    // isn't within the quads.
+    void setRows(int begin, int end);
 
 private:
     typedef void (*viewFn_t)();
+    typedef std::function<void(std::vector<double> const &)> rowFn_t;
 
     void render(void);
-    void sumWeights(std::vector<double> const &weights);
+    void accumulate(GLubyte const *pixels, std::vector<real_t> const &weights);
+    void sumWeights(std::vector<real_t> const &weights);
     void calcFace(Camera const &cam,
                   viewFn_t view,
-                  std::vector<double> const &weights);
+                  std::vector<real_t> const &weights);
+    void calcAllRows(rowFn_t const &addRow);
+
+    // Offscreen atlas path.
+    void initAtlas(void);
+    // These work at any resolution up to m_resolution, using the
+    // bottom-left corner of the atlas.
+    void calcAtlasFace(Camera const &cam, viewFn_t view,
+                       int resolution, int y, int height);
+    void renderAtlas(Camera const &cam, int resolution);
+    void readAtlas(GLuint pixelBuffer, int resolution);
+    void sumAtlas(GLuint pixelBuffer, int resolution);
+    std::vector<real_t> const &getAtlasWeights(int resolution);
+    // Start reading back a row of sums into the pixel buffer, and
+    // then wait for it and put it in m_sums. Dispatches on m_readback.
+    void startReadback(GLuint pixelBuffer, int resolution);
+    void finishReadback(GLuint pixelBuffer, int resolution);
+
+    // Adaptive resolution.
+    void chooseResolutions(void);
+    double coarseError(GLubyte const *pixels, int r0);
+
+    // On-GPU reduction path.
+    void initReduction(void);
+    void reduceAtlas(GLuint pixelBuffer);
+    void readSums(GLuint pixelBuffer);
 
     // Caches of weights.
-    std::vector<double> const &getSubtendWeights();
-    std::vector<double> const &getForwardLightWeights();
-    std::vector<double> const &getSideLightWeights();
+    std::vector<real_t> const &getSubtendWeights();
+    std::vector<real_t> const &getForwardLightWeights();
+    std::vector<real_t> const &getSideLightWeights();
 
     // Geometry.
     std::vector<Vertex> const &m_vertices;
     std::vector<Quad> const &m_faces;
     // Rendering resolution.
     int const m_resolution;
-    // Window id.
+    // Context handle, from gwTransferSetup.
     int const m_win;
+    TransferReadback const m_readback;
+    // The scene in index colours, uploaded once.
+    QuadBuffer m_quadBuffer;
+
+    // Atlas framebuffer, and its pixel buffers for readback.
+    GLuint m_framebuffer;
+    GLuint m_atlasTexture;
+    GLuint m_depthBuffer;
+    GLuint m_pixelBuffers[2];
+
+    // Reduction program, the per-pixel attributes it's run over, and
+    // the framebuffer the sums are accumulated into.
+    GLuint m_reduceProgram;
+    GLuint m_reduceVertices;
+    GLuint m_sumsFramebuffer;
+    GLuint m_sumsTexture;
+    int m_sumsWidth;
+    int m_sumsHeight;
 
     // Weighting tables.
-    std::vector<double> m_subtendWeights;
-    std::vector<double> m_forwardLightWeights;
-    std::vector<double> m_sideLightWeights;
+    std::vector<real_t> m_subtendWeights;
+    std::vector<real_t> m_forwardLightWeights;
+    std::vector<real_t> m_sideLightWeights;
+    // Forward weights, followed by four copies of the side weights,
+    // in the order they're laid out in the atlas, by resolution.
+    std::map<int, std::vector<real_t> > m_atlasWeights;
+
+    // Zero unless adaptive.
+    int m_minResolution;
+    double m_tolerance;
+    std::vector<int> m_rowResolutions;
 
-    // Sums being calculated.
+    // Targets calculated by calcAllLights.
+    int m_rowBegin;
+    int m_rowEnd;
+
+    // Sums being calculated, and the subsampled sums used to
+    // estimate the error for adaptive resolution.
     std::vector<double> m_sums;
+    std::vector<double> m_coarseSums;
+
+    transferProgressFn_t m_progress;
 };
 
 // Calculate an analytic approximation. Assume nothing obscuring the
@@ -71,6 +179,13 @@ public:
     std::vector<double> calcSubtended(Camera const &cam);
     std::vector<double> calcLight(Camera const &cam);
     void calcAllLights(std::vector<double> &weights);
+    void calcAllLights(TransferMatrix &transfers);
+    // With no occlusion, the transfers are reciprocal, so this only
+    // works out each pair of quads once.
+    void calcAllLights(SymmetricTransferMatrix &transfers);
+
+    // As for RenderTransferCalculator.
+    void setProgress(transferProgressFn_t const &progress);
 
 private:
     double calcSingleQuadSubtended(Camera const &cam, Quad const &q) const;
@@ -79,6 +194,8 @@ private:
     // Geometry.
     std::vector<Vertex> const &m_vertices;
     std::vector<Quad> const &m_faces;
+
+    transferProgressFn_t m_progress;
 };
 
 #endif // RADIOSITY_TRANSFERS_H
@@ -6,6 +6,8 @@
 //
 
 #include <cmath>
+#include <stdexcept>
+#include <vector>
 
 #include <cppunit/TestCase.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -35,6 +37,17 @@ private:
     CPPUNIT_TEST(baseCameraFacesRightWay);
     CPPUNIT_TEST(backCameraFacesRightWay);
     CPPUNIT_TEST(calcAllLightsWorks);
+    CPPUNIT_TEST(sparseMatchesDense);
+    CPPUNIT_TEST(symmetricMatchesSparse);
+    CPPUNIT_TEST(atlasMatchesWindow);
+    CPPUNIT_TEST(atlasCalcAllLightsMatchesWindow);
+    CPPUNIT_TEST(gpuReduceMatchesWindow);
+    CPPUNIT_TEST(gpuReduceCalcAllLightsMatchesWindow);
+    CPPUNIT_TEST(largeIndicesDecode);
+    CPPUNIT_TEST(adaptiveExtremes);
+    CPPUNIT_TEST(adaptiveWithinTolerance);
+    CPPUNIT_TEST(adaptiveBadSettings);
+    CPPUNIT_TEST(rowRangeMatchesFull);
     CPPUNIT_TEST_SUITE_END();
 
     void renderEachFaceIsAreaOne();
@@ -50,6 +63,17 @@ private:
     void baseCameraFacesRightWay();
     void backCameraFacesRightWay();
     void calcAllLightsWorks();
+    void sparseMatchesDense();
+    void symmetricMatchesSparse();
+    void atlasMatchesWindow();
+    void atlasCalcAllLightsMatchesWindow();
+    void gpuReduceMatchesWindow();
+    void gpuReduceCalcAllLightsMatchesWindow();
+    void largeIndicesDecode();
+    void adaptiveExtremes();
+    void adaptiveWithinTolerance();
+    void adaptiveBadSettings();
+    void rowRangeMatchesFull();
 };
 
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TransfersTestCase, "TransfersTestCase");
@@ -331,3 +355,327 @@ void TransfersTestCase::calcAllLightsWorks()
     CPPUNIT_ASSERT(renderLight[2] >  0.0);
     CPPUNIT_ASSERT(renderLight[3] == 0.0);
 }
+
+void TransfersTestCase::sparseMatchesDense()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+
+    AnalyticTransferCalculator atc(vertices, quads);
+    std::vector<double> analyticDense;
+    atc.calcAllLights(analyticDense);
+    TransferMatrix analyticSparse;
+    atc.calcAllLights(analyticSparse);
+
+    RenderTransferCalculator rtc(vertices, quads, 128);
+    std::vector<double> renderDense;
+    rtc.calcAllLights(renderDense);
+    TransferMatrix renderSparse;
+    rtc.calcAllLights(renderSparse);
+
+    CPPUNIT_ASSERT_EQUAL(n, analyticSparse.rowCount());
+    CPPUNIT_ASSERT_EQUAL(n, renderSparse.rowCount());
+    // Coplanar quads can't see each other, so we should have dropped
+    // at least a sixth of the entries.
+    CPPUNIT_ASSERT(renderSparse.nonZeros() <= size_t(n * n * 5 / 6));
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            if (i == j) {
+                continue;
+            }
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(analyticDense[i * n + j],
+                                         analyticSparse.at(i, j), 1.0e-6);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(renderDense[i * n + j],
+                                         renderSparse.at(i, j), 1.0e-6);
+        }
+    }
+}
+
+// Reciprocity should give the same transfers from half the work and
+// storage.
+void TransfersTestCase::symmetricMatchesSparse()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+
+    AnalyticTransferCalculator atc(vertices, quads);
+    TransferMatrix sparse;
+    atc.calcAllLights(sparse);
+    SymmetricTransferMatrix symmetric;
+    atc.calcAllLights(symmetric);
+
+    CPPUNIT_ASSERT_EQUAL(n, symmetric.rowCount());
+    CPPUNIT_ASSERT_EQUAL(sparse.nonZeros(), 2 * symmetric.nonZeros());
+    CPPUNIT_ASSERT(symmetric.memoryUsage() < sparse.memoryUsage() * 6 / 10);
+    TransferMatrix expanded;
+    symmetric.expand(expanded);
+    CPPUNIT_ASSERT_EQUAL(sparse.nonZeros(), expanded.nonZeros());
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            double expected = sparse.at(i, j);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, symmetric.at(i, j),
+                                         1.0e-5 * expected);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, expanded.at(i, j),
+                                         1.0e-5 * expected);
+        }
+    }
+}
+
+void TransfersTestCase::atlasMatchesWindow()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, SUBDIVISION, SUBDIVISION);
+    }
+
+    Camera cam(Vertex(0.1, -0.1, 0.05),
+               Vertex(1.0, 1.0, 1.0),
+               Vertex(1.0, 0.0, 0.0));
+
+    std::vector<double> windowLight =
+        RenderTransferCalculator(vertices, quads, 256).calcLight(cam);
+    std::vector<double> atlasLight =
+        RenderTransferCalculator(vertices, quads, 256,
+                                 READBACK_ATLAS).calcLight(cam);
+
+    CPPUNIT_ASSERT_EQUAL(windowLight.size(), atlasLight.size());
+    for (int i = 0; i < windowLight.size(); ++i) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(windowLight[i], atlasLight[i], 1.0e-9);
+    }
+}
+
+void TransfersTestCase::atlasCalcAllLightsMatchesWindow()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+
+    TransferMatrix windowTransfers;
+    RenderTransferCalculator(vertices, quads, 128).calcAllLights(windowTransfers);
+    TransferMatrix atlasTransfers;
+    RenderTransferCalculator(vertices, quads, 128,
+                             READBACK_ATLAS).calcAllLights(atlasTransfers);
+
+    CPPUNIT_ASSERT_EQUAL(n, atlasTransfers.rowCount());
+    CPPUNIT_ASSERT_EQUAL(windowTransfers.nonZeros(), atlasTransfers.nonZeros());
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(windowTransfers.at(i, j),
+                                         atlasTransfers.at(i, j), 1.0e-9);
+        }
+    }
+}
+
+void TransfersTestCase::gpuReduceMatchesWindow()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, SUBDIVISION, SUBDIVISION);
+    }
+
+    Camera cam(Vertex(0.1, -0.1, 0.05),
+               Vertex(1.0, 1.0, 1.0),
+               Vertex(1.0, 0.0, 0.0));
+
+    std::vector<double> windowLight =
+        RenderTransferCalculator(vertices, quads, 256).calcLight(cam);
+    std::vector<double> reducedLight =
+        RenderTransferCalculator(vertices, quads, 256,
+                                 READBACK_GPU_REDUCE).calcLight(cam);
+
+    CPPUNIT_ASSERT_EQUAL(windowLight.size(), reducedLight.size());
+    for (int i = 0; i < windowLight.size(); ++i) {
+        // Sums are accumulated in single precision.
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(windowLight[i], reducedLight[i],
+                                     1.0e-6 * windowLight[i] + 1.0e-12);
+    }
+}
+
+void TransfersTestCase::gpuReduceCalcAllLightsMatchesWindow()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+
+    TransferMatrix windowTransfers;
+    RenderTransferCalculator(vertices, quads, 128).calcAllLights(windowTransfers);
+    TransferMatrix reducedTransfers;
+    RenderTransferCalculator(vertices, quads, 128,
+                             READBACK_GPU_REDUCE).calcAllLights(reducedTransfers);
+
+    CPPUNIT_ASSERT_EQUAL(n, reducedTransfers.rowCount());
+    CPPUNIT_ASSERT_EQUAL(windowTransfers.nonZeros(), reducedTransfers.nonZeros());
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            // Sums are accumulated in single precision.
+            double w = windowTransfers.at(i, j);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(w, reducedTransfers.at(i, j),
+                                         1.0e-5 * w + 1.0e-12);
+        }
+    }
+}
+
+// Indices that used to be truncated must come back intact. Pad the
+// quad list with degenerate quads, which draw nothing, so the cube's
+// faces get indices that need more than 18 bits.
+void TransfersTestCase::largeIndicesDecode()
+{
+    int const padding = (1 << 18) + 1000;
+    std::vector<Quad> quads(padding, Quad(0, 0, 0, 0, Colour()));
+    quads.insert(quads.end(), cubeFaces.begin(), cubeFaces.end());
+
+    std::vector<double> expected =
+        RenderTransferCalculator(cubeVertices, cubeFaces, 64,
+                                 READBACK_ATLAS).calcLight(Camera::baseCamera);
+    TransferReadback const readbacks[] = { READBACK_ATLAS, READBACK_GPU_REDUCE };
+    for (int r = 0; r < 2; ++r) {
+        std::vector<double> light =
+            RenderTransferCalculator(cubeVertices, quads, 64,
+                                     readbacks[r]).calcLight(Camera::baseCamera);
+        for (int i = 0; i < padding; ++i) {
+            CPPUNIT_ASSERT_EQUAL(0.0, light[i]);
+        }
+        for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[i], light[padding + i], 1.0e-6);
+        }
+    }
+}
+
+// With no tolerance, every row needs the full resolution, and with
+// any amount, every row gets away with twice the minimum. Either way
+// the rows match a fixed resolution calculation.
+void TransfersTestCase::adaptiveExtremes()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+
+    double const tolerances[] = { 0.0, 1.0e9 };
+    int const resolutions[] = { 128, 32 };
+    for (int k = 0; k < 2; ++k) {
+        std::vector<double> expected;
+        RenderTransferCalculator(vertices, quads, resolutions[k],
+                                 READBACK_ATLAS).calcAllLights(expected);
+        RenderTransferCalculator calc(vertices, quads, 128, READBACK_ATLAS);
+        calc.setAdaptive(16, tolerances[k]);
+        std::vector<double> adaptive;
+        calc.calcAllLights(adaptive);
+
+        CPPUNIT_ASSERT_EQUAL(n, static_cast<int>(calc.rowResolutions().size()));
+        for (int i = 0; i < n; ++i) {
+            CPPUNIT_ASSERT_EQUAL(resolutions[k], calc.rowResolutions()[i]);
+        }
+        CPPUNIT_ASSERT_EQUAL(expected.size(), adaptive.size());
+        for (int i = 0, size = expected.size(); i < size; ++i) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[i], adaptive[i], 1.0e-9);
+        }
+    }
+}
+
+// In between, the rows should be close to the full resolution ones,
+// and some should be cheaper.
+void TransfersTestCase::adaptiveWithinTolerance()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 8, 8);
+    }
+    int const n = quads.size();
+    double const tolerance = 0.05;
+
+    std::vector<double> full;
+    RenderTransferCalculator(vertices, quads, 256,
+                             READBACK_ATLAS).calcAllLights(full);
+    RenderTransferCalculator calc(vertices, quads, 256, READBACK_ATLAS);
+    calc.setAdaptive(32, tolerance);
+    std::vector<double> adaptive;
+    calc.calcAllLights(adaptive);
+
+    int reduced = 0;
+    for (int i = 0; i < n; ++i) {
+        reduced += calc.rowResolutions()[i] < 256;
+        double diff = 0.0, total = 0.0;
+        for (int j = 0; j < n; ++j) {
+            diff += std::fabs(full[i * n + j] - adaptive[i * n + j]);
+            total += full[i * n + j];
+        }
+        // The error estimate isn't exact.
+        CPPUNIT_ASSERT(diff < 2.0 * tolerance * total);
+    }
+    CPPUNIT_ASSERT(reduced > 0);
+}
+
+void TransfersTestCase::adaptiveBadSettings()
+{
+    RenderTransferCalculator window(cubeVertices, cubeFaces, 128);
+    CPPUNIT_ASSERT_THROW(window.setAdaptive(32, 0.01), std::runtime_error);
+
+    RenderTransferCalculator atlas(cubeVertices, cubeFaces, 128, READBACK_ATLAS);
+    // Not a power of two fraction.
+    CPPUNIT_ASSERT_THROW(atlas.setAdaptive(48, 0.01), std::runtime_error);
+    // No room for the coarse pass.
+    CPPUNIT_ASSERT_THROW(atlas.setAdaptive(128, 0.01), std::runtime_error);
+    atlas.setAdaptive(64, 0.01);
+}
+
+// A shard's rows are the same as those rows of the whole matrix,
+// including the adaptive resolutions chosen for them.
+void TransfersTestCase::rowRangeMatchesFull()
+{
+    std::vector<Vertex> vertices(cubeVertices);
+    std::vector<Quad> quads;
+    for (int i = 0, n = cubeFaces.size(); i < n; ++i) {
+        subdivide(cubeFaces[i], vertices, quads, 4, 4);
+    }
+    int const n = quads.size();
+    int const begin = 17, end = 53;
+
+    RenderTransferCalculator full(vertices, quads, 128, READBACK_ATLAS);
+    full.setAdaptive(32, 0.02);
+    TransferMatrix fullTransfers;
+    full.calcAllLights(fullTransfers);
+
+    RenderTransferCalculator part(vertices, quads, 128, READBACK_ATLAS);
+    part.setAdaptive(32, 0.02);
+    part.setRows(begin, end);
+    TransferMatrix partTransfers;
+    part.calcAllLights(partTransfers);
+
+    CPPUNIT_ASSERT_EQUAL(n, partTransfers.size());
+    CPPUNIT_ASSERT_EQUAL(end - begin, partTransfers.rowCount());
+    CPPUNIT_ASSERT_EQUAL(end - begin, int(part.rowResolutions().size()));
+    for (int i = begin; i < end; ++i) {
+        CPPUNIT_ASSERT_EQUAL(full.rowResolutions()[i],
+                             part.rowResolutions()[i - begin]);
+        CPPUNIT_ASSERT_EQUAL(0.0, partTransfers.at(i - begin, i));
+        for (int j = 0; j < n; ++j) {
+            if (j != i) {
+                CPPUNIT_ASSERT_EQUAL(fullTransfers.at(i, j),
+                                     partTransfers.at(i - begin, j));
+            }
+        }
+    }
+
+    CPPUNIT_ASSERT_THROW(part.setRows(10, 5), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(part.setRows(0, n + 1), std::runtime_error);
+}
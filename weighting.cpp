@@ -11,9 +11,13 @@
 #include "geom.h"
 #include "weighting.h"
 
+// The weights are always calculated in double, and then rounded to
+// the table's precision.
+
 // Generate a weightings array based on projecting rectangles onto a
 // sphere. Assumes 90 degree field of view.
-void projSubtendWeights(int resolution, std::vector<double> &weights)
+template<typename T>
+void projSubtendWeights(int resolution, std::vector<T> &weights)
 {
     // From -1 to +1.
     double conv = 2.0 / resolution;
@@ -22,9 +26,9 @@ void projSubtendWeights(int resolution, std::vector<double> &weights)
 
     for (int y = 0; y < resolution; ++y) {
         for (int x = 0; x < resolution; ++x) {
-            Vertex v1 = Vertex(x       * conv - 1, y       * conv - 1, 1);
-            Vertex v2 = Vertex((x + 1) * conv - 1, y       * conv - 1, 1);
-            Vertex v3 = Vertex(x       * conv - 1, (y + 1) * conv - 1, 1);
+            BasicVertex<double> v1(x       * conv - 1, y       * conv - 1, 1);
+            BasicVertex<double> v2((x + 1) * conv - 1, y       * conv - 1, 1);
+            BasicVertex<double> v3(x       * conv - 1, (y + 1) * conv - 1, 1);
             v1 = v1.norm(); v2 = v2.norm(); v3 = v3.norm();
             weights.push_back(weight * cross(v3 - v1, v2 - v1).len());
         }
@@ -33,7 +37,8 @@ void projSubtendWeights(int resolution, std::vector<double> &weights)
 
 // Like projSubtendWeights, but generated analytically rather than through
 // finite differences.
-void calcSubtendWeights(int resolution, std::vector<double> &weights)
+template<typename T>
+void calcSubtendWeights(int resolution, std::vector<T> &weights)
 {
     // From -1 to +1.
     double conv = 2.0 / resolution;
@@ -67,7 +72,8 @@ void calcSubtendWeights(int resolution, std::vector<double> &weights)
 
 // Calculate forward-facing weights. Like calcSubtendWeights, but with an extra
 // cos(theta) factor for the angle from facing direction.
-void calcForwardLightWeights(int resolution, std::vector<double> &weights)
+template<typename T>
+void calcForwardLightWeights(int resolution, std::vector<T> &weights)
 {
     double conv = 2.0 / resolution;
     double weight = 1.0 / M_PI;
@@ -88,7 +94,8 @@ void calcForwardLightWeights(int resolution, std::vector<double> &weights)
 
 // Calculate sideways-facing weights. Like calcForwardLightWeights,
 // but for the sideways-facing cube maps.
-void calcSideLightWeights(int resolution, std::vector<double> &weights)
+template<typename T>
+void calcSideLightWeights(int resolution, std::vector<T> &weights)
 {
     double conv = 2.0 / resolution;
     double weight = 1.0 / M_PI;
@@ -105,3 +112,14 @@ void calcSideLightWeights(int resolution, std::vector<double> &weights)
         }
     }
 }
+
+#define INSTANTIATE_WEIGHTS(T)                                                      \
+    template void projSubtendWeights(int resolution, std::vector<T> &weights);      \
+    template void calcSubtendWeights(int resolution, std::vector<T> &weights);      \
+    template void calcForwardLightWeights(int resolution, std::vector<T> &weights); \
+    template void calcSideLightWeights(int resolution, std::vector<T> &weights);
+
+INSTANTIATE_WEIGHTS(float)
+INSTANTIATE_WEIGHTS(double)
+
+#undef INSTANTIATE_WEIGHTS
@@ -11,20 +11,26 @@
 
 #include <vector>
 
+// Each can fill in a table of floats or doubles, see real.h.
+
 // Generate a weightings array based on projecting rectangles onto a
 // sphere. Assumes 90 degree field of view.
-void projSubtendWeights(int resolution, std::vector<double> &weights);
+template<typename T>
+void projSubtendWeights(int resolution, std::vector<T> &weights);
 
 // Like calcWeights, but generated analytically rather than through
 // finite differences.
-void calcSubtendWeights(int resolution, std::vector<double> &weights);
+template<typename T>
+void calcSubtendWeights(int resolution, std::vector<T> &weights);
 
 // Calculate forward-facing weights. Like calcSubtendWeights, but with an extra
 // cos(theta) factor for the angle from facing direction.
-void calcForwardLightWeights(int resolution, std::vector<double> &weights);
+template<typename T>
+void calcForwardLightWeights(int resolution, std::vector<T> &weights);
 
 // Calculate sideways-facing weights. Like calcForwardLightWeights,
 // but for the sideways-facing cube maps.
-void calcSideLightWeights(int resolution, std::vector<double> &weights);
+template<typename T>
+void calcSideLightWeights(int resolution, std::vector<T> &weights);
 
 #endif // RADIOSITY_WEIGHTING_H
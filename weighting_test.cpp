@@ -6,6 +6,7 @@
 //
 
 #include <cmath>
+#include <vector>
 
 #include <cppunit/TestCase.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -22,12 +23,14 @@ private:
     CPPUNIT_TEST(testCalcSubtendWeightsSumToOne);
     CPPUNIT_TEST(testWeightsMatch);
     CPPUNIT_TEST(testCalcLightWeightsSumToOne);
+    CPPUNIT_TEST(testFloatWeights);
     CPPUNIT_TEST_SUITE_END();
 
     void testProjSubtendWeightsSumToOne();
     void testCalcSubtendWeightsSumToOne();
     void testWeightsMatch();
     void testCalcLightWeightsSumToOne();
+    void testFloatWeights();
 };
 
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(WeightingTestCase, "WeightingTestCase");
@@ -84,3 +87,16 @@ void WeightingTestCase::testCalcLightWeightsSumToOne()
     double totalWeight = totalFrontWeight + 4 * totalSideWeight;
     CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, totalWeight, 1e-5);
 }
+
+// Single precision tables are the double ones, rounded.
+void WeightingTestCase::testFloatWeights()
+{
+    std::vector<double> ws;
+    std::vector<float> fws;
+    calcSideLightWeights(RESOLUTION, ws);
+    calcSideLightWeights(RESOLUTION, fws);
+    CPPUNIT_ASSERT_EQUAL(ws.size(), fws.size());
+    for (int i = 0, n = ws.size(); i < n; ++i) {
+        CPPUNIT_ASSERT_EQUAL(float(ws[i]), fws[i]);
+    }
+}